@@ -23,14 +23,10 @@ if [ -d "$CONFDIR" ]; then
     ln -sf "$CONFDIR/config.js" /var/www/aqualinkd/config.js
   fi
 
-  # If don't have a cron file, create one
-  if [ ! -f "$CONFDIR/aqualinkd.schedule" ]; then
-    echo "#***** AUTO GENERATED DO NOT EDIT *****" > "$CONFDIR/aqualinkd.schedule"
+  # AqualinkD runs schedules itself from $CONFDIR/aqualinkd.schedule, make sure cron doesn't as well.
+  if [ -L /etc/cron.d/aqualinkd ]; then
+    rm -f /etc/cron.d/aqualinkd
   fi
-
-  # link mounted cron file to local filesystem.
-  ln -sf "$CONFDIR/aqualinkd.schedule" /etc/cron.d/aqualinkd
-  chmod 644 "$CONFDIR/aqualinkd.schedule"
 else
   # No conig dir, show warning 
   echo "WARNING no config directory, AqualinkD starting with default config, no changes will be saved"
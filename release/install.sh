@@ -201,6 +201,9 @@ if [ "$1" == "clean" ]; then
   if [ -f /etc/cron.d/aqualinkd ]; then
     rm -f /etc/cron.d/aqualinkd
   fi
+  if [ -f /etc/aqualinkd.schedule ]; then
+    rm -f /etc/aqualinkd.schedule
+  fi
   if [ -d $WEBLocation ]; then
     rm -rf $WEBLocation
   fi
@@ -209,15 +212,6 @@ if [ "$1" == "clean" ]; then
 fi
 
 
-# Check cron.d options
-if systemctl is-active --quiet cron.service; then
-  if [ ! -d "/etc/cron.d" ]; then
-    log "The version of cron installed may not support chron.d, if so AqualinkD Scheduler will not work"
-  fi
-else
- log "Please install cron, if not the AqualinkD Scheduler will not work"
-fi
-
 # V2.3.9 & V2.6.0 has kind-a breaking change for config.js, so check existing and rename if needed
 #        we added Aux_V? to the button list
 if [ -f "$WEBLocation/config.js" ]; then
@@ -10,6 +10,7 @@
 #include "allbutton_aq_programmer.h"
 #include "color_lights.h"
 #include "aq_scheduler.h"
+#include "uri_routes.h"
 
 /* Below can also be called from serialadapter.c */
 void processLEDstate(struct aqualinkdata *aqdata, unsigned char *packet, logmask_t from)
@@ -75,7 +76,6 @@ void processLEDstate(struct aqualinkdata *aqdata, unsigned char *packet, logmask
 #ifdef CLIGHT_PANEL_FIX // Use state from RSSD protocol for color light if it's on.
   for (int i=0; i < aqdata->num_lights; i++) {
     if ( aqdata->lights[i].RSSDstate == ON && aqdata->lights[i].button->led->state != ON ) {
-      aqdata->lights[i].button->led->state = aqdata->lights[i].RSSDstate;
       SET_IF_CHANGED(aqdata->lights[i].button->led->state, aqdata->lights[i].RSSDstate, aqdata->is_dirty);
       //LOG(from,LOG_WARNING,"Fix Jandy bug, color light '%s' is on, setting status to match!\n", aqdata->lights[i].button->label);
     }
@@ -234,7 +234,7 @@ void _processMessage(char *message, struct aqualinkdata *aqdata, bool reset)
     strcpy(aqdata->last_message, msg);
     LOG(ALLB_LOG,LOG_INFO, "RS Message :- '%s'\n", msg);
     // Just set this to off, it will re-set since it'll be the only message we get if on
-    aqdata->service_mode_state = OFF;
+    SET_IF_CHANGED(aqdata->service_mode_state, OFF, aqdata->is_dirty);
   } else {
     //aqdata->display_message = NULL;
     //aqdata->last_display_message[0] = ' ';
@@ -253,7 +253,7 @@ void _processMessage(char *message, struct aqualinkdata *aqdata, bool reset)
 
     if ((msg_loop & MSG_SERVICE) != MSG_SERVICE &&
         (msg_loop & MSG_TIMEOUT) != MSG_TIMEOUT ) {
-      aqdata->service_mode_state = OFF; // IF we get this message then Service / Timeout is off
+      SET_IF_CHANGED(aqdata->service_mode_state, OFF, aqdata->is_dirty); // IF we get this message then Service / Timeout is off
     }
 
     if ( ((msg_loop & MSG_SWG_DEVICE) != MSG_SWG_DEVICE) && aqdata->swg_led_state != LED_S_UNKNOWN) {
@@ -599,6 +599,7 @@ void _processMessage(char *message, struct aqualinkdata *aqdata, bool reset)
       // Aux1: on panel = Button 3 in aqualinkd  (button 2 in array)
       if (strncasecmp(msg+ni+3, "No Label", 8) != 0) {
         aqdata->aqbuttons[labelid].label = prittyString(cleanalloc(msg+ni+2));
+        invalidate_uri_button_index();
         LOG(ALLB_LOG,LOG_NOTICE, "AUX ID %s label set to '%s'\n", aqdata->aqbuttons[labelid].name, aqdata->aqbuttons[labelid].label);
       } else {
         LOG(ALLB_LOG,LOG_NOTICE, "AUX ID %s has no control panel label using '%s'\n", aqdata->aqbuttons[labelid].name, aqdata->aqbuttons[labelid].label);
@@ -616,7 +617,7 @@ void _processMessage(char *message, struct aqualinkdata *aqdata, bool reset)
       }
 
       snprintf(aqdata->boost_msg, 6, "%s", &msg[11]);
-      aqdata->boost_duration = rsm_HHMM2min(aqdata->boost_msg);
+      SET_IF_CHANGED(aqdata->boost_duration, rsm_HHMM2min(aqdata->boost_msg), aqdata->is_dirty);
       SET_IF_CHANGED(aqdata->boost, true, aqdata->is_dirty);
       msg_loop |= MSG_BOOST;
       msg_loop |= MSG_SWG;
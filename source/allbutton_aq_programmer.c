@@ -12,11 +12,13 @@
 #include "aq_serial.h"
 #include "color_lights.h"
 #include "devices_jandy.h"
+#include "cmd_queue.h"
 
 
 
 bool waitForButtonState(struct aqualinkdata *aqdata, aqkey* button, aqledstate state, int numMessageReceived);
 bool waitForMessage(struct aqualinkdata *aqdata, char* message, int numMessageReceived);
+bool waitForMessageGone(struct aqualinkdata *aqdata, char* message);
 bool waitForEitherMessage(struct aqualinkdata *aqdata, char* message1, char* message2, int numMessageReceived);
 
 bool select_sub_menu_item(struct aqualinkdata *aqdata, char* item_string);
@@ -31,9 +33,7 @@ void longwaitfor_queue2empty();
 int _expectNextMessage = 0;
 unsigned char _allb_last_sent_command = NUL;
 
-#define MAX_STACK 20
-int _allb_stack_place = 0;
-unsigned char _allb_commands[MAX_STACK];
+static cmd_queue _allb_queue = CMD_QUEUE_INIT("allbutton", ALLB_LOG, 20);
 //unsigned char pgm_allb_commands[MAX_STACK];
 unsigned char _allb_pgm_command = NUL;
 //unsigned char _ot_allb_pgm_command = NUL;
@@ -52,20 +52,13 @@ bool push_allb_cmd(unsigned char cmd) {
   
   //LOG(ALLB_LOG, LOG_NOTICE, "push_aq_cmd '0x%02hhx'\n", cmd);
 
-  if (_allb_stack_place < MAX_STACK) {
-    _allb_commands[_allb_stack_place] = cmd;
-    _allb_stack_place++;
-  } else {
-    LOG(ALLB_LOG, LOG_ERR, "Command queue overflow, too many unsent commands to RS control panel\n");
-    return false;
-  }
-
-  return true;
+  // Key presses toggle, so never coalesce them.
+  return cmdq_push(&_allb_queue, CMDQ_USER, 0, &cmd, 1);
 }
 
 int get_allb_queue_length()
 {
-  return _allb_stack_place;
+  return cmdq_length(&_allb_queue);
 }
 
 
@@ -95,18 +88,16 @@ unsigned char pop_allb_cmd(struct aqualinkdata *aqdata)
     if ( _allb_pgm_command != NUL && aqdata->last_packet_type == CMD_STATUS) {
       cmd = _allb_pgm_command;
       _allb_pgm_command = NUL;
+      signal_prog_event(ALLBUTTON);
       LOG(ALLB_LOG, LOG_DEBUG_SERIAL, "RS SEND cmd '0x%02hhx' (programming)\n", cmd);
     } else if (_allb_pgm_command != NUL) {
       LOG(ALLB_LOG, LOG_DEBUG_SERIAL, "RS Waiting to send cmd '0x%02hhx' (programming)\n", _allb_pgm_command);
     } else {
       LOG(ALLB_LOG, LOG_DEBUG_SERIAL, "RS SEND cmd '0x%02hhx' empty queue (programming)\n", cmd);
     }
-  } else if (_allb_stack_place > 0 && aqdata->last_packet_type == CMD_STATUS ) {
-    cmd = _allb_commands[0];
-    _allb_stack_place--;
+  } else if (aqdata->last_packet_type == CMD_STATUS && (cmd = cmdq_pop_byte(&_allb_queue)) != NUL) {
     LOG(ALLB_LOG, LOG_DEBUG_SERIAL, "RS SEND cmd '0x%02hhx'\n", cmd);
     //LOG(ALLB_LOG, LOG_NOTICE, "pop_cmd '0x%02hhx'\n", cmd);
-    memmove(&_allb_commands[0], &_allb_commands[1], sizeof(unsigned char) * _allb_stack_place ) ;
   } else {
     LOG(ALLB_LOG, LOG_DEBUG_SERIAL, "RS SEND cmd '0x%02hhx'\n", cmd);
   }
@@ -335,7 +326,7 @@ STOP BOOST POOL
 
   cleanAndTerminateThread(threadCtrl);
 
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -413,7 +404,7 @@ void *set_allbutton_SWG( void *ptr )
 
   cleanAndTerminateThread(threadCtrl);
 
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -447,7 +438,7 @@ void *get_allbutton_aux_labels( void *ptr )
 
   cleanAndTerminateThread(threadCtrl);
   
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -572,7 +563,7 @@ void *set_allbutton_light_colormode( void *ptr )
 
   cleanAndTerminateThread(threadCtrl);
   
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -718,7 +709,7 @@ void *set_allbutton_light_programmode( void *ptr )
 
   cleanAndTerminateThread(threadCtrl);
   
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -859,7 +850,7 @@ void *set_allbutton_light_dimmer( void *ptr )
 
   cleanAndTerminateThread(threadCtrl);
   
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -927,9 +918,7 @@ void *set_allbutton_pool_heater_temps( void *ptr )
     // Before going to numeric field.
     waitForMessage(threadCtrl->aqdata, "MUST BE SET", 5);
     send_cmd(KEY_LEFT);
-    while (stristr(aqdata->last_message, "MUST BE SET") != NULL) { 
-      delay(500);
-    }
+    waitForMessageGone(aqdata, "MUST BE SET");
   } 
 
   //setAqualinkNumericField(aqdata, "POOL", val);
@@ -939,7 +928,7 @@ void *set_allbutton_pool_heater_temps( void *ptr )
   waitForMessage(threadCtrl->aqdata, "POOL TEMP IS SET TO", 1); 
   cleanAndTerminateThread(threadCtrl);
   
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 void *set_allbutton_spa_heater_temps( void *ptr )
@@ -1003,9 +992,7 @@ void *set_allbutton_spa_heater_temps( void *ptr )
     // Before going to numeric field.
     waitForMessage(threadCtrl->aqdata, "MUST BE SET", 5);
     send_cmd(KEY_LEFT);
-    while (stristr(aqdata->last_message, "MUST BE SET") != NULL) { 
-      delay(500);
-    }
+    waitForMessageGone(aqdata, "MUST BE SET");
   } 
   
   //setAqualinkNumericField(aqdata, "SPA", val);
@@ -1015,7 +1002,7 @@ void *set_allbutton_spa_heater_temps( void *ptr )
   waitForMessage(threadCtrl->aqdata, "SPA TEMP IS SET TO", 1);
   cleanAndTerminateThread(threadCtrl);
   
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -1074,7 +1061,7 @@ void *set_allbutton_freeze_heater_temps( void *ptr )
   waitForMessage(threadCtrl->aqdata, "FREEZE PROTECTION IS SET TO", 3);
   cleanAndTerminateThread(threadCtrl);
   
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -1128,7 +1115,7 @@ void *set_allbutton_time( void *ptr )
 
   cleanAndTerminateThread(threadCtrl);
   
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -1160,7 +1147,7 @@ void *get_allbutton_diag_model( void *ptr )
   //8157 REV MMM | BATTERY OK | Cal:  -27  0  6 | CONTROL PANEL #1 | CONTROL PANEL #3 | WATER SENSOR OK | AIR SENSOR OK | SOLAR SENSOR OPENED
   cleanAndTerminateThread(threadCtrl);
   
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -1197,7 +1184,7 @@ void *get_allbutton_pool_spa_heater_temps( void *ptr )
   //cancel_menu(threadCtrl->aqdata);
   cleanAndTerminateThread(threadCtrl);
   
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -1230,7 +1217,7 @@ void *get_allbutton_freeze_protect_temp( void *ptr )
   //cancel_menu(aqdata); 
   cleanAndTerminateThread(threadCtrl);
   
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -1294,7 +1281,7 @@ void *get_allbutton_programs( void *ptr )
   //cancel_menu(aqdata); 
   cleanAndTerminateThread(threadCtrl);
   
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -1310,8 +1297,6 @@ void send_cmd(unsigned char cmd, struct aqualinkdata *aqdata)
 
 void _waitfor_queue2empty(bool longwait)
 {
-  int i=0;
-
   if (_allb_pgm_command != NUL) {
     LOG(ALLB_LOG, LOG_DEBUG, "Waiting for queue to empty\n");
   } else {
@@ -1319,11 +1304,7 @@ void _waitfor_queue2empty(bool longwait)
     return;
   }
 
-  while ( (_allb_pgm_command != NUL) && ( i++ < (PROGRAMMING_POLL_COUNTER*(longwait?2:1) ) ) ) {
-    delay(PROGRAMMING_POLL_DELAY_TIME);
-  }
-
-  if (_allb_pgm_command != NUL) {
+  if ( ! wait_for_prog_cmd_sent(ALLBUTTON, &_allb_pgm_command, PROGRAMMING_POLL_COUNTER * PROGRAMMING_POLL_DELAY_TIME * (longwait?2:1)) ) {
     LOG(ALLB_LOG, LOG_WARNING, "Send command Queue did not empty, timeout\n");
   } else {
     LOG(ALLB_LOG, LOG_DEBUG, "Queue now empty!\n");
@@ -1340,6 +1321,11 @@ void longwaitfor_queue2empty()
   _waitfor_queue2empty(true);
 }
 
+bool allb_cmd_pending()
+{
+  return (_allb_pgm_command != NUL);
+}
+
 void send_cmd(unsigned char cmd)
 {
   waitfor_queue2empty();
@@ -1418,7 +1404,7 @@ bool waitForEitherMessage(struct aqualinkdata *aqdata, char* message1, char* mes
     }
     
     //LOG(ALLB_LOG, LOG_DEBUG, "looking for '%s' received message1 '%s'\n",message1,aqdata->last_message);
-    pthread_cond_wait(&aqdata->active_thread.thread_cond, &aqdata->active_thread.thread_mutex);
+    wait_for_prog_kick(aqdata);
     //LOG(ALLB_LOG, LOG_DEBUG, "loop %d of %d looking for '%s' received message1 '%s'\n",i,numMessageReceived,message1,aqdata->last_message);
   }
   
@@ -1474,7 +1460,7 @@ bool waitForMessage(struct aqualinkdata *aqdata, char* message, int numMessageRe
     
     //LOG(ALLB_LOG, LOG_DEBUG, "looking for '%s' received message '%s'\n",message,aqdata->last_message);
     //LOG(ALLB_LOG, LOG_DEBUG, "*** pthread_cond_wait() sleep\n");
-    pthread_cond_wait(&aqdata->active_thread.thread_cond, &aqdata->active_thread.thread_mutex);
+    wait_for_prog_kick(aqdata);
     //LOG(ALLB_LOG, LOG_DEBUG, "*** pthread_cond_wait() wake\n");
     //LOG(ALLB_LOG, LOG_DEBUG, "loop %d of %d looking for '%s' received message '%s'\n",i,numMessageReceived,message,aqdata->last_message);
   }
@@ -1493,6 +1479,29 @@ bool waitForMessage(struct aqualinkdata *aqdata, char* message, int numMessageRe
   return true;
 }
 
+struct message_wait {
+  struct aqualinkdata *aqdata;
+  char *message;
+};
+
+static bool message_gone(void *arg)
+{
+  struct message_wait *mw = (struct message_wait *)arg;
+  return (stristr(mw->aqdata->last_message, mw->message) == NULL);
+}
+
+// Wait for panel to move past message.
+bool waitForMessageGone(struct aqualinkdata *aqdata, char* message)
+{
+  struct message_wait mw = {aqdata, message};
+
+  if ( ! wait_for_prog_event(ALLBUTTON, message_gone, &mw, PROGRAMMING_KICK_TIMEOUT * 1000 * 2) ) {
+    LOG(ALLB_LOG, LOG_WARNING, "Message '%s' still displayed, timeout\n", message);
+    return false;
+  }
+  return true;
+}
+
 bool select_menu_item(struct aqualinkdata *aqdata, char* item_string)
 {
   char* expectedMsg = "PRESS ENTER* TO SELECT";
@@ -1598,7 +1607,7 @@ bool waitForButtonState(struct aqualinkdata *aqdata, aqkey* button, aqledstate s
     }
 
     //LOG(ALLB_LOG, LOG_DEBUG, "looking for '%s' received message '%s'\n",message,aqdata->last_message);
-    pthread_cond_wait(&aqdata->active_thread.thread_cond, &aqdata->active_thread.thread_mutex);
+    wait_for_prog_kick(aqdata);
     //LOG(ALLB_LOG, LOG_DEBUG, "loop %d of %d looking for '%s' received message '%s'\n",i,numMessageReceived,message,aqdata->last_message);
   }
 
@@ -19,6 +19,7 @@ void *set_allbutton_SWG( void *ptr );
 void *set_allbutton_boost( void *ptr );
 
 unsigned char pop_allb_cmd(struct aqualinkdata *aq_data);
+bool allb_cmd_pending();
 
 
 
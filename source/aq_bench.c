@@ -0,0 +1,736 @@
+/*
+ * Copyright (c) 2017 Shaun Feakes - All rights reserved
+ *
+ * You may use redistribute and/or modify this code under the terms of
+ * the GNU General Public License version 2 as published by the
+ * Free Software Foundation. For the terms of this license,
+ * see <http://www.gnu.org/licenses/>.
+ *
+ * You are free to use this software under the terms of the GNU General
+ * Public License, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ *  https://github.com/sfeakes/aqualinkd
+ */
+
+/*
+  Micro benchmarks for the RS485 & JSON hot paths, linked against the same objects as aqualinkd
+  (built with AQ_BENCH).  Each benchmark is sized to run for about -t ms, then run -n times,
+  and the median ns/op is reported with the min and interquartile spread, so runs can be compared
+  without one preempted sample skewing them.
+
+  make bench
+  ./release/aqbench [-c aqualinkd.conf] [-f filter] [-t ms] [-n samples] [-cpu n]
+*/
+
+#define _GNU_SOURCE 1 // for memfd_create & sched_setaffinity
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "aqualink.h"
+#include "aq_serial.h"
+#include "aq_panel.h"
+#include "aq_snapshot.h"
+#include "config.h"
+#include "json_messages.h"
+#include "net_services.h"
+#include "packetLogger.h"
+#include "rs_msg_utils.h"
+#include "utils.h"
+
+#define DEFAULT_CFG        "./release/aqualinkd.conf"
+#define DEFAULT_SAMPLE_MS  50
+#define DEFAULT_SAMPLES    9
+#define MAX_SAMPLES        101
+
+typedef struct bench {
+  const char *name;
+  void (*setup)();
+  void (*run)(long ops);
+} bench;
+
+static struct aqualinkdata _aqdata;
+static volatile long _sink = 0;
+
+// Only aqualinkd.c isn't linked in, these are what the rest expect from it.
+bool isAqualinkDStopping() {
+  return false;
+}
+
+void intHandler(int dummy) {}
+
+bool checkAqualinkTime() {
+  return true;
+}
+
+bool isVirtualButtonEnabled() {
+  return false;
+}
+
+/*
+ * Frames as they come off the bus, a busy RS-8 with an iAqualinkTouch, SWG and Pentair pump.
+ */
+static int _packet_fd = -1;
+static int _packets_in_stream = 0;
+
+static int add_jandy_frame(unsigned char *stream, const unsigned char *data, int length)
+{
+  unsigned char packet[AQ_MAXPKTLEN];
+  int i, n = 0;
+
+  packet[0] = DLE;
+  packet[1] = STX;
+  memcpy(&packet[2], data, length);
+  packet[length+3] = DLE;
+  packet[length+4] = ETX;
+  packet[length+2] = generate_checksum(packet, length+5);
+
+  stream[n++] = DLE;
+  stream[n++] = STX;
+  for (i=2; i < length+3; i++) {
+    stream[n++] = packet[i];
+    if (packet[i] == DLE)
+      stream[n++] = NUL;
+  }
+  stream[n++] = DLE;
+  stream[n++] = ETX;
+
+  return n;
+}
+
+static int add_pentair_frame(unsigned char *stream, const unsigned char *data, int length)
+{
+  int i, sum = 0, n = 0;
+
+  stream[n++] = 0xFF;
+  stream[n++] = 0x00;
+  stream[n++] = 0xFF;
+  for (i=0; i < length; i++) {
+    stream[n++] = data[i];
+    sum += data[i];
+  }
+  stream[n++] = (sum >> 8) & 0xFF;
+  stream[n++] = sum & 0xFF;
+
+  return n;
+}
+
+static void setup_packet_stream()
+{
+  const unsigned char probe[] = {0x09, CMD_PROBE};
+  const unsigned char ack[] = {DEV_MASTER, CMD_ACK, ACK_NORMAL, NUL};
+  const unsigned char status[] = {0x0a, CMD_STATUS, 0x00, 0x10, 0x00, 0x00, 0x00};
+  const unsigned char msg[] = {0x0a, CMD_MSG, 0x00, 'A','I','R',' ','T','E','M','P',' ','7','5','`','F',' ',' ',' '};
+  const unsigned char poll[] = {0x33, CMD_IAQ_POLL};
+  const unsigned char swg[] = {0x50, CMD_PERCENT, 0x10}; // 16% has a DLE to escape
+  const unsigned char swg_reply[] = {DEV_MASTER, CMD_PPM, 0x1f, 0x00, 0x00, 0x00};
+  const unsigned char pump[] = {0xA5, 0x00, 0x10, 0x60, 0x07, 0x0F, 0x0A, 0x02, 0x02, 0x00, 0xE7, 0x06, 0xD6,
+                                0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03};
+  unsigned char stream[8192];
+  unsigned char packet[AQ_MAXPKTLEN];
+  int n = 0, i, rtn;
+
+  for (i=0; i < 32; i++) {
+    n += add_jandy_frame(&stream[n], probe, sizeof(probe));
+    n += add_jandy_frame(&stream[n], status, sizeof(status));
+    n += add_jandy_frame(&stream[n], ack, sizeof(ack));
+    n += add_jandy_frame(&stream[n], msg, sizeof(msg));
+    n += add_jandy_frame(&stream[n], ack, sizeof(ack));
+    n += add_jandy_frame(&stream[n], poll, sizeof(poll));
+    n += add_jandy_frame(&stream[n], ack, sizeof(ack));
+    n += add_jandy_frame(&stream[n], swg, sizeof(swg));
+    n += add_jandy_frame(&stream[n], swg_reply, sizeof(swg_reply));
+    n += add_pentair_frame(&stream[n], pump, sizeof(pump));
+  }
+
+  if ((_packet_fd = memfd_create("aqbench", 0)) < 0 || write(_packet_fd, stream, n) != n) {
+    fprintf(stderr, "Unable to create in memory fd\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Make sure get_packet() frames all of it, or we'd be timing error paths.
+  lseek(_packet_fd, 0, SEEK_SET);
+  while ((rtn = get_packet(_packet_fd, packet)) > 0) {
+    if (packet[0] == DLE ? !check_jandy_checksum(packet, rtn) : !check_pentair_checksum(packet, rtn)) {
+      fprintf(stderr, "get_packet() returned a bad frame from the test stream\n");
+      exit(EXIT_FAILURE);
+    }
+    _packets_in_stream++;
+  }
+  if (_packets_in_stream != i * 10) {
+    fprintf(stderr, "get_packet() framed %d of %d packets from the test stream\n", _packets_in_stream, i * 10);
+    exit(EXIT_FAILURE);
+  }
+}
+
+// One op is one packet, rewind at the end of the stream same as a new read() from the tty.
+static void run_get_packet(long ops)
+{
+  unsigned char packet[AQ_MAXPKTLEN];
+  long sum = 0;
+  int rtn;
+
+  while (ops > 0) {
+    if ((rtn = get_packet(_packet_fd, packet)) <= 0) {
+      lseek(_packet_fd, 0, SEEK_SET);
+      continue;
+    }
+    sum += rtn;
+    ops--;
+  }
+  _sink += sum;
+}
+
+static unsigned char _jandy_status[] = {DLE, STX, 0x0a, CMD_STATUS, 0x00, 0x10, 0x00, 0x00, 0x00, 0x2c, DLE, ETX};
+static unsigned char _jandy_msg[AQ_MAXPKTLEN];
+static int _jandy_msg_len;
+static unsigned char _pentair_status[] = {0xFF, 0x00, 0xFF, 0xA5, 0x00, 0x10, 0x60, 0x07, 0x0F, 0x0A, 0x02, 0x02, 0x00, 0xE7,
+                                          0x06, 0xD6, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03, 0x00, 0x00};
+
+static void setup_checksums()
+{
+  const unsigned char msg[] = {0x0a, CMD_MSG, 0x00, 'P','O','O','L',' ','T','E','M','P',' ','8','0','`','F',' ',' '};
+  int i, sum = 0;
+
+  _jandy_status[9] = generate_checksum(_jandy_status, sizeof(_jandy_status));
+
+  _jandy_msg[0] = DLE;
+  _jandy_msg[1] = STX;
+  memcpy(&_jandy_msg[2], msg, sizeof(msg));
+  _jandy_msg_len = sizeof(msg) + 5;
+  _jandy_msg[_jandy_msg_len-2] = DLE;
+  _jandy_msg[_jandy_msg_len-1] = ETX;
+  _jandy_msg[_jandy_msg_len-3] = generate_checksum(_jandy_msg, _jandy_msg_len);
+
+  for (i=3; i < sizeof(_pentair_status)-2; i++)
+    sum += _pentair_status[i];
+  _pentair_status[sizeof(_pentair_status)-2] = (sum >> 8) & 0xFF;
+  _pentair_status[sizeof(_pentair_status)-1] = sum & 0xFF;
+
+  if (!check_jandy_checksum(_jandy_status, sizeof(_jandy_status)) || !check_jandy_checksum(_jandy_msg, _jandy_msg_len) ||
+      !check_pentair_checksum(_pentair_status, sizeof(_pentair_status))) {
+    fprintf(stderr, "Bad checksum in benchmark packets\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void run_jandy_checksum(long ops)
+{
+  long sum = 0;
+
+  for (long i=0; i < ops; i++) {
+    if (i & 1)
+      sum += check_jandy_checksum(_jandy_msg, _jandy_msg_len);
+    else
+      sum += check_jandy_checksum(_jandy_status, sizeof(_jandy_status));
+  }
+  _sink += sum;
+}
+
+static void run_pentair_checksum(long ops)
+{
+  long sum = 0;
+
+  for (long i=0; i < ops; i++)
+    sum += check_pentair_checksum(_pentair_status, sizeof(_pentair_status));
+  _sink += sum;
+}
+
+static void run_beautify_jandy(long ops)
+{
+  char buff[1024];
+  long sum = 0;
+
+  for (long i=0; i < ops; i++)
+    sum += beautifyPacket(buff, sizeof(buff), _jandy_msg, _jandy_msg_len, true);
+  _sink += sum;
+}
+
+static void run_beautify_pentair(long ops)
+{
+  char buff[1024];
+  long sum = 0;
+
+  for (long i=0; i < ops; i++)
+    sum += beautifyPacket(buff, sizeof(buff), _pentair_status, sizeof(_pentair_status), true);
+  _sink += sum;
+}
+
+/*
+ * rs_msg_utils, on the sort of 16 char lines the allbutton / PDA / onetouch menus parse.
+ */
+static const char *_lines[] = {
+  "AIR TEMP 75`F   ", "POOL TEMP 80`F  ", "SPA HEAT 102`F  ", "  FILTER PUMP   ",
+  "8157 REV T.2    ", "B0029221 REV T.2", "Set Temp        ", "   11:45 AM     ",
+};
+#define NUM_LINES (sizeof(_lines) / sizeof(_lines[0]))
+
+static void run_rsm_strstr(long ops)
+{
+  long sum = 0;
+
+  for (long i=0; i < ops; i++)
+    sum += (rsm_strstr(_lines[i % NUM_LINES], "TEMP") != NULL);
+  _sink += sum;
+}
+
+static void run_rsm_strncasestr(long ops)
+{
+  long sum = 0;
+
+  for (long i=0; i < ops; i++)
+    sum += (rsm_strncasestr(_lines[i % NUM_LINES], "rev", AQ_MSGLEN) != NULL);
+  _sink += sum;
+}
+
+static void run_rsm_strcmp(long ops)
+{
+  long sum = 0;
+
+  for (long i=0; i < ops; i++)
+    sum += rsm_strcmp(_lines[i % NUM_LINES], "FILTER PUMP");
+  _sink += sum;
+}
+
+static void run_rsm_strmatch(long ops)
+{
+  long sum = 0;
+
+  for (long i=0; i < ops; i++)
+    sum += rsm_strmatch(_lines[i % NUM_LINES], "FILTER PUMP");
+  _sink += sum;
+}
+
+static void run_rsm_strncpy(long ops)
+{
+  char dest[AQ_MSGLEN * 2];
+  long sum = 0;
+
+  for (long i=0; i < ops; i++)
+    sum += rsm_strncpy(dest, (const unsigned char *)_lines[i % NUM_LINES], sizeof(dest), AQ_MSGLEN);
+  _sink += sum;
+}
+
+static void run_rsm_atoi(long ops)
+{
+  long sum = 0;
+
+  for (long i=0; i < ops; i++)
+    sum += rsm_atoi(&_lines[i % 3][9]); // "75`F", "80`F", "102`F"
+  _sink += sum;
+}
+
+static void run_rsm_get_revision(long ops)
+{
+  char dest[AQ_MSGLEN + 1];
+  long sum = 0;
+
+  for (long i=0; i < ops; i++)
+    sum += rsm_get_revision_new(dest, sizeof(dest), _lines[4 + (i & 1)], AQ_MSGLEN);
+  _sink += sum;
+}
+
+static void run_rsm_HHMM2min(long ops)
+{
+  char line[AQ_MSGLEN + 1];
+  long sum = 0;
+
+  for (long i=0; i < ops; i++) {
+    memcpy(line, "11:45", 6);
+    sum += rsm_HHMM2min(line);
+  }
+  _sink += sum;
+}
+
+/*
+ * JSON, on the panel from the config file with some equipment on.
+ */
+static void setup_aqdata()
+{
+  static bool done = false;
+  int i;
+
+  if (done)
+    return;
+  done = true;
+
+  _aqdata.air_temp = 75;
+  _aqdata.pool_temp = 80;
+  _aqdata.spa_temp = 102;
+  _aqdata.pool_htr_set_point = 82;
+  _aqdata.spa_htr_set_point = 102;
+  _aqdata.frz_protect_set_point = 38;
+  _aqdata.chiller_set_point = TEMP_UNKNOWN;
+  _aqdata.swg_percent = 50;
+  _aqdata.swg_ppm = 3100;
+  _aqdata.ar_swg_device_status = SWG_STATUS_ON;
+  _aqdata.swg_led_state = ON;
+  _aqdata.swg_delayed_percent = TEMP_UNKNOWN;
+  _aqdata.temp_units = FAHRENHEIT;
+  _aqdata.service_mode_state = OFF;
+  _aqdata.frz_protect_state = OFF;
+  _aqdata.battery = OK;
+  _aqdata.ph = TEMP_UNKNOWN;
+  _aqdata.orp = TEMP_UNKNOWN;
+  _aqdata.unactioned.type = NO_ACTION;
+  sprintf(_aqdata.last_display_message, "%s", "");
+
+  for (i=0; i < _aqdata.num_pumps; i++) {
+    _aqdata.pumps[i].rpm = 2750;
+    _aqdata.pumps[i].gpm = TEMP_UNKNOWN;
+    _aqdata.pumps[i].watts = 1100;
+    _aqdata.pumps[i].mode = TEMP_UNKNOWN;
+    _aqdata.pumps[i].status = TEMP_UNKNOWN;
+    _aqdata.pumps[i].pressureCurve = TEMP_UNKNOWN;
+  }
+
+  // Filter pump & first aux on, every other button off.
+  for (i=0; i < _aqdata.total_buttons; i++) {
+    if (_aqdata.aqbuttons[i].led != NULL)
+      _aqdata.aqbuttons[i].led->state = (i == 0 || i == 2) ? ON : OFF;
+  }
+
+  _aqdata.status_mask = CONNECTED;
+
+  set_net_services_aqdata(&_aqdata);
+}
+
+/*
+  Not a benchmark, the device / MQTT caches only rebuild a device when its aqdata->versions counter moves,
+  so make sure a request that pre-sets the LED (device_pre_state) moves it.  Otherwise the panel's
+  confirmation is a no-op through SET_IF_CHANGED() and the caches serve the old state until something
+  else changes.  Run before the benchmarks, fails the run if it doesn't hold.
+*/
+static bool check_request_bumps_version()
+{
+  bool ok = true;
+  int i;
+
+  setup_aqdata();
+  aqdata_track_changes(&_aqdata);
+
+  for (i=1; i < _aqdata.total_buttons; i++) {
+    aqkey *button = &_aqdata.aqbuttons[i];
+    uint32_t before;
+
+    if (button->led == NULL || button->led->state != OFF || isVBUTTON(button->special_mask) ||
+        isPLIGHT(button->special_mask) || isVS_PUMP(button->special_mask) ||
+        button->led < _aqdata.aqualinkleds || button->led >= _aqdata.aqualinkleds + TOTAL_LEDS)
+      continue;
+
+    before = _aqdata.versions.led[button->led - _aqdata.aqualinkleds];
+    panel_device_request(&_aqdata, ON_OFF, i, 1, NET_API);
+
+    if (button->led->state != OFF && _aqdata.versions.led[button->led - _aqdata.aqualinkleds] == before) {
+      fprintf(stderr, "FAIL, turning on '%s' changed its LED without moving its version\n", button->label);
+      ok = false;
+    }
+
+    panel_device_request(&_aqdata, ON_OFF, i, 0, NET_API);
+    break;
+  }
+
+  if (i >= _aqdata.total_buttons)
+    fprintf(stderr, "No plain button that's off to check version tracking on\n");
+
+  aqdata_track_changes(NULL);
+  return ok;
+}
+
+static void run_status_JSON(long ops)
+{
+  char buffer[JSON_STATUS_SIZE];
+  long sum = 0;
+
+  for (long i=0; i < ops; i++)
+    sum += build_aqualink_status_JSON(&_aqdata, buffer, sizeof(buffer));
+  _sink += sum;
+}
+
+static void run_device_JSON(long ops)
+{
+  char buffer[JSON_BUFFER_SIZE];
+  long sum = 0;
+
+  for (long i=0; i < ops; i++)
+    sum += build_device_JSON(&_aqdata, buffer, sizeof(buffer), false);
+  _sink += sum;
+}
+
+static void run_device_JSON_homekit(long ops)
+{
+  char buffer[JSON_BUFFER_SIZE];
+  long sum = 0;
+
+  for (long i=0; i < ops; i++)
+    sum += build_device_JSON(&_aqdata, buffer, sizeof(buffer), true);
+  _sink += sum;
+}
+
+/*
+  The two above serve every device from the fragment cache after the first call.  Real polls
+  mostly follow a change, so these mark one device changed per op (the next button round robin,
+  like a panel LED update) or everything (SET_DIRTY) so that share of the list gets rebuilt.
+*/
+static void run_device_JSON_one_changed(long ops)
+{
+  char buffer[JSON_BUFFER_SIZE];
+  long sum = 0;
+
+  aqdata_track_changes(&_aqdata);
+  for (long i=0; i < ops; i++) {
+    aqdata_changed(&_aqdata.aqbuttons[i % _aqdata.total_buttons]);
+    sum += build_device_JSON(&_aqdata, buffer, sizeof(buffer), false);
+  }
+  aqdata_track_changes(NULL);
+  _sink += sum;
+}
+
+static void run_device_JSON_all_changed(long ops)
+{
+  char buffer[JSON_BUFFER_SIZE];
+  long sum = 0;
+
+  aqdata_track_changes(&_aqdata);
+  for (long i=0; i < ops; i++) {
+    aqdata_changed(NULL);
+    sum += build_device_JSON(&_aqdata, buffer, sizeof(buffer), false);
+  }
+  aqdata_track_changes(NULL);
+  _sink += sum;
+}
+
+// The pre json_writer builders, aq_bench_sprintf.c
+int sprintf_build_device_JSON(struct aqualinkdata *aqdata, char* buffer, int size, bool homekit);
+int sprintf_build_aqualink_status_JSON(struct aqualinkdata *aqdata, char* buffer, int size);
+
+static void run_status_JSON_sprintf(long ops)
+{
+  char buffer[JSON_STATUS_SIZE];
+  long sum = 0;
+
+  for (long i=0; i < ops; i++)
+    sum += sprintf_build_aqualink_status_JSON(&_aqdata, buffer, sizeof(buffer));
+  _sink += sum;
+}
+
+static void run_device_JSON_sprintf(long ops)
+{
+  char buffer[JSON_BUFFER_SIZE];
+  long sum = 0;
+
+  for (long i=0; i < ops; i++)
+    sum += sprintf_build_device_JSON(&_aqdata, buffer, sizeof(buffer), false);
+  _sink += sum;
+}
+
+// Routes that don't queue anything, off for a button that's already off is the common MQTT repeat.
+static const char *_uris[] = {
+  "status", "devices", "homebridge", "Aux_2/set", "Aux_3/set", "CHEM/ORP/set", "Nothing/set",
+};
+#define NUM_URIS (sizeof(_uris) / sizeof(_uris[0]))
+
+static void run_action_URI(long ops)
+{
+  long sum = 0;
+
+  for (long i=0; i < ops; i++)
+    sum += action_scheduled_URI(_uris[i % NUM_URIS], 0);
+  _sink += sum;
+}
+
+static void run_parseJSONrequest(long ops)
+{
+  const char *requests[] = {
+    "{\"uri\":\"Filter_Pump/set\",\"value\":\"1\"}",
+    "{\"command\":\"GET_AUX_LABELS\"}",
+    "{\"uri\":\"Pool_Heater/setpoint/set\",\"value\":\"82\"}",
+  };
+  struct JSONkvptr jsonkv;
+  char buffer[128];
+  int lengths[3];
+  long sum = 0;
+
+  for (int r=0; r < 3; r++)
+    lengths[r] = strlen(requests[r]) + 1;
+
+  // Parse is in place, the copy is part of what the WS handler does too.
+  for (long i=0; i < ops; i++) {
+    memcpy(buffer, requests[i % 3], lengths[i % 3]);
+    parseJSONrequest(buffer, &jsonkv);
+    sum += (jsonkv.kv[0].value != NULL);
+  }
+  _sink += sum;
+}
+
+static const bench _benches[] = {
+  {"get_packet",               setup_packet_stream, run_get_packet},
+  {"check_jandy_checksum",     setup_checksums,     run_jandy_checksum},
+  {"check_pentair_checksum",   setup_checksums,     run_pentair_checksum},
+  {"beautifyPacket/jandy",     setup_checksums,     run_beautify_jandy},
+  {"beautifyPacket/pentair",   setup_checksums,     run_beautify_pentair},
+  {"rsm_strstr",               NULL,                run_rsm_strstr},
+  {"rsm_strncasestr",          NULL,                run_rsm_strncasestr},
+  {"rsm_strcmp",               NULL,                run_rsm_strcmp},
+  {"rsm_strmatch",             NULL,                run_rsm_strmatch},
+  {"rsm_strncpy",              NULL,                run_rsm_strncpy},
+  {"rsm_atoi",                 NULL,                run_rsm_atoi},
+  {"rsm_get_revision_new",     NULL,                run_rsm_get_revision},
+  {"rsm_HHMM2min",             NULL,                run_rsm_HHMM2min},
+  {"build_aqualink_status_JSON", setup_aqdata,      run_status_JSON},
+  {"build_aqualink_status_JSON/sprintf", setup_aqdata, run_status_JSON_sprintf},
+  {"build_device_JSON",        setup_aqdata,        run_device_JSON},
+  {"build_device_JSON/sprintf", setup_aqdata,       run_device_JSON_sprintf},
+  {"build_device_JSON/homekit", setup_aqdata,       run_device_JSON_homekit},
+  {"build_device_JSON/1 changed", setup_aqdata,     run_device_JSON_one_changed},
+  {"build_device_JSON/all changed", setup_aqdata,   run_device_JSON_all_changed},
+  {"action_URI",               setup_aqdata,        run_action_URI},
+  {"parseJSONrequest",         NULL,                run_parseJSONrequest},
+};
+
+static double elapsed_ns(struct timespec *start, struct timespec *end)
+{
+  return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+static double time_run(const bench *b, long ops)
+{
+  struct timespec start, end;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  b->run(ops);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  return elapsed_ns(&start, &end);
+}
+
+static int compare_double(const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Double ops until a run takes a tenth of the sample, then scale to the sample time.
+static long calibrate(const bench *b, double sample_ns)
+{
+  long ops = 1;
+  double ns;
+
+  while ((ns = time_run(b, ops)) < sample_ns / 10 && ops < (1L << 40))
+    ops *= 2;
+
+  ops = (long)(ops * (sample_ns / (ns > 0 ? ns : 1)));
+  return ops > 0 ? ops : 1;
+}
+
+static void run_bench(const bench *b, int samples, double sample_ns)
+{
+  double ns_op[MAX_SAMPLES];
+  double median;
+  long ops;
+  int i;
+
+  if (b->setup != NULL)
+    b->setup();
+
+  ops = calibrate(b, sample_ns);
+  b->run(ops); // Warm up at full size
+
+  for (i=0; i < samples; i++)
+    ns_op[i] = time_run(b, ops) / ops;
+
+  qsort(ns_op, samples, sizeof(double), compare_double);
+  median = ns_op[samples / 2];
+
+  printf("%-36s %10.1f ns/op   min %10.1f   iqr %5.1f%%   (%ld ops x %d)\n",
+         b->name, median, ns_op[0], median > 0 ? 100.0 * (ns_op[samples*3/4] - ns_op[samples/4]) / median : 0.0, ops, samples);
+}
+
+void printHelp(const char *name)
+{
+  printf("%s\n", name);
+  printf("\t-h             (this message)\n");
+  printf("\t-c <file>      (Config file for panel / buttons, default %s)\n", DEFAULT_CFG);
+  printf("\t-f <filter>    (Only run benchmarks with this in the name)\n");
+  printf("\t-t <ms>        (Time per sample, default %d)\n", DEFAULT_SAMPLE_MS);
+  printf("\t-n <samples>   (Samples per benchmark, default %d)\n", DEFAULT_SAMPLES);
+  printf("\t-cpu <n>       (Pin to cpu n)\n");
+  printf("\t-l             (List benchmarks)\n");
+}
+
+int main(int argc, char *argv[])
+{
+  char *cfgFile = DEFAULT_CFG;
+  const char *filter = NULL;
+  int sample_ms = DEFAULT_SAMPLE_MS;
+  int samples = DEFAULT_SAMPLES;
+  int cpu = -1;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0) {
+      printHelp(argv[0]);
+      return EXIT_SUCCESS;
+    } else if (strcmp(argv[i], "-l") == 0) {
+      for (int b=0; b < sizeof(_benches) / sizeof(_benches[0]); b++)
+        printf("%s\n", _benches[b].name);
+      return EXIT_SUCCESS;
+    } else if (strcmp(argv[i], "-c") == 0 && i+1 < argc) {
+      cfgFile = argv[++i];
+    } else if (strcmp(argv[i], "-f") == 0 && i+1 < argc) {
+      filter = argv[++i];
+    } else if (strcmp(argv[i], "-t") == 0 && i+1 < argc) {
+      sample_ms = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-n") == 0 && i+1 < argc) {
+      samples = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-cpu") == 0 && i+1 < argc) {
+      cpu = atoi(argv[++i]);
+    }
+  }
+
+  if (samples < 1 || samples > MAX_SAMPLES || sample_ms < 1) {
+    fprintf(stderr, "ERROR, samples must be 1-%d and sample time at least 1ms\n", MAX_SAMPLES);
+    return EXIT_FAILURE;
+  }
+
+  if (cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0)
+      fprintf(stderr, "Unable to pin to cpu %d\n", cpu);
+  }
+
+  init_config();
+  setSystemLogLevel(LOG_ERR);
+  read_config(&_aqdata, cfgFile);
+  // Config may have asked for more, benchmarks mustn't spend their time logging.
+  _aqconfig_.log_level = LOG_ERR;
+  _aqconfig_.log_protocol_packets = false;
+  _aqconfig_.log_raw_bytes = false;
+#ifdef AQ_MANAGER
+  setLoggingPrms(LOG_ERR, false, NULL);
+#else
+  setLoggingPrms(LOG_ERR, false, NULL, NULL);
+#endif
+
+  printf("%s, %d buttons, %d samples of %dms per benchmark\n", cfgFile, _aqdata.total_buttons, samples, sample_ms);
+
+  if (!check_request_bumps_version())
+    return EXIT_FAILURE;
+
+  for (i=0; i < sizeof(_benches) / sizeof(_benches[0]); i++) {
+    if (filter == NULL || strstr(_benches[i].name, filter) != NULL)
+      run_bench(&_benches[i], samples, sample_ms * 1e6);
+  }
+
+  return EXIT_SUCCESS;
+}
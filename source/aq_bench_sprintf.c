@@ -0,0 +1,610 @@
+/*
+ * Copyright (c) 2017 Shaun Feakes - All rights reserved
+ *
+ * You may use redistribute and/or modify this code under the terms of
+ * the GNU General Public License version 2 as published by the
+ * Free Software Foundation. For the terms of this license,
+ * see <http://www.gnu.org/licenses/>.
+ *
+ * You are free to use this software under the terms of the GNU General
+ * Public License, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ *  https://github.com/sfeakes/aqualinkd
+ */
+
+/*
+  The sprintf() device & status JSON builders as they were before json_writer, only built into aqbench
+  so the old and new builders can be compared on the same aqdata.  Kept as close to the original as
+  possible (only renamed, and get_timer_left() now takes the button index), don't fix things in here.
+*/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "aqualink.h"
+#include "config.h"
+#include "utils.h"
+#include "json_messages.h"
+#include "aq_mqtt.h"
+#include "devices_jandy.h"
+#include "version.h"
+#include "aq_timer.h"
+#include "aq_programmer.h"
+#include "rs_msg_utils.h"
+#include "color_lights.h"
+#include "iaqualink.h"
+#include "aq_panel.h"
+
+#define AUX_BUFFER_SIZE 200
+
+// Not in json_messages.h, only used in there.
+int LED2int(aqledstate state);
+const char* getStatus(struct aqualinkdata *aqdata);
+
+static char *sprintf_get_aux_information(aqkey *button, struct aqualinkdata *aqdata, char *buffer)
+{
+  int i;
+  int length = 0;
+  buffer[0] = '\0';
+
+  //if ((button->special_mask & VS_PUMP) == VS_PUMP)
+  if (isVS_PUMP(button->special_mask))
+  {
+//printf("Button %s is VSP\n", button->name);
+    for (i=0; i < aqdata->num_pumps; i++) {
+      if (button == aqdata->pumps[i].button) {       
+          length += sprintf(buffer, ",\"type_ext\":\"switch_vsp\",\"Pump_RPM\":\"%d\",\"Pump_GPM\":\"%d\",\"Pump_Watts\":\"%d\",\"Pump_Type\":\"%s\",\"Pump_Status\":\"%d\",\"Pump_Speed\":\"%d\"", 
+                  aqdata->pumps[i].rpm,
+                  aqdata->pumps[i].gpm,
+                  aqdata->pumps[i].watts,
+                  (aqdata->pumps[i].pumpType==VFPUMP?"vfPump":(aqdata->pumps[i].pumpType==VSPUMP?"vsPump":"ePump")),
+                  getPumpStatus(i, aqdata),
+                  getPumpSpeedAsPercent(&aqdata->pumps[i]));
+
+          return buffer;
+      }
+    }
+  } 
+  //else if ((button->special_mask & PROGRAM_LIGHT) == PROGRAM_LIGHT)
+  else if (isPLIGHT(button->special_mask))
+  {
+//printf("Button %s is ProgramableLight\n", button->name);
+    for (i=0; i < aqdata->num_lights; i++) {
+      if (button == aqdata->lights[i].button) {
+        if (aqdata->lights[i].lightType == LC_DIMMER2) {
+          length += sprintf(buffer, ",\"type_ext\": \"light_dimmer\", \"Light_Type\":\"%d\", \"Light_Program\":\"%d\", \"Program_Name\":\"%d%%\" ",
+                                  aqdata->lights[i].lightType,
+                                  aqdata->lights[i].currentValue,
+                                  aqdata->lights[i].currentValue);
+        } else {
+          length += sprintf(buffer, ",\"type_ext\": \"switch_program\", \"Light_Type\":\"%d\", \"Light_Program\":\"%d\", \"Program_Name\":\"%s\" ",
+                                  aqdata->lights[i].lightType,
+                                  aqdata->lights[i].currentValue,
+                                  get_currentlight_mode_name(aqdata->lights[i], ALLBUTTON));
+                                  //light_mode_name(aqdata->lights[i].lightType, aqdata->lights[i].currentValue, ALLBUTTON));
+        }
+        return buffer;
+      }
+    }
+  }
+  if (isVBUTTON_ALTLABEL(button->special_mask))
+  {
+    length += sprintf(buffer, ",\"alt_label\":\"%s\", \"in_alt_mode\": \"%s\" ",((altlabel_detail *)button->special_mask_ptr)->altlabel, ((altlabel_detail *)button->special_mask_ptr)->in_alt_mode?JSON_ON:JSON_OFF );
+    //return buffer;
+  }
+
+//printf("Button %s is Switch\n", button->name);
+  length += sprintf(buffer+length, ",\"type_ext\": \"switch_timer\", \"timer_active\":\"%s\"", (((button->special_mask & TIMER_ACTIVE) == TIMER_ACTIVE)?JSON_ON:JSON_OFF) );
+  if ((button->special_mask & TIMER_ACTIVE) == TIMER_ACTIVE) {
+    length += sprintf(buffer+length,",\"timer_duration\":\"%d\"", get_timer_left(button - aqdata->aqbuttons));
+  }
+  return buffer;
+}
+
+//int build_device_JSON(struct aqualinkdata *aqdata, int programable_switch1, int programable_switch2, char* buffer, int size, bool homekit)
+int sprintf_build_device_JSON(struct aqualinkdata *aqdata, char* buffer, int size, bool homekit)
+{
+  char aux_info[AUX_BUFFER_SIZE];
+  memset(&buffer[0], 0, size);
+  int length = 0;
+  int i;
+
+  // IF temp units are F assume homekit is using F
+  bool homekit_f = (homekit && ( aqdata->temp_units==FAHRENHEIT || aqdata->temp_units == UNKNOWN) );
+
+  length += sprintf(buffer+length, "{\"type\": \"devices\"");
+  length += sprintf(buffer+length, ",\"aqualinkd_version\":\"%s\"",AQUALINKD_VERSION);//"09/01/16 THU",
+  length += sprintf(buffer+length, ",\"date\":\"%s\"",aqdata->date );//"09/01/16 THU",
+  length += sprintf(buffer+length, ",\"time\":\"%s\"",aqdata->time );//"1:16 PM",
+  if ( aqdata->temp_units == FAHRENHEIT )
+    length += sprintf(buffer+length, ",\"temp_units\":\"%s\"",JSON_FAHRENHEIT );
+  else if ( aqdata->temp_units == CELSIUS )
+    length += sprintf(buffer+length, ",\"temp_units\":\"%s\"", JSON_CELSIUS);
+  else
+    length += sprintf(buffer+length, ",\"temp_units\":\"%s\"",JSON_UNKNOWN );
+
+  length += sprintf(buffer+length,  ", \"devices\": [");
+  
+  for (i=0; i < aqdata->total_buttons; i++) 
+  {
+    if ( strcmp(BTN_POOL_HTR,aqdata->aqbuttons[i].name) == 0 && (ENABLE_HEATERS || aqdata->pool_htr_set_point != TEMP_UNKNOWN)) {
+      length += sprintf(buffer+length, "{\"type\": \"setpoint_thermo\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"status\": \"%s\", \"spvalue\": \"%.*f\", \"value\": \"%.*f\", \"int_status\": \"%d\", \"timer_active\":\"%s\" },",
+                                     aqdata->aqbuttons[i].name, 
+                                     aqdata->aqbuttons[i].label,
+                                     aqdata->aqbuttons[i].led->state==ON?JSON_ON:JSON_OFF,
+                                     LED2text(aqdata->aqbuttons[i].led->state),
+                                     ((homekit)?2:0),
+                                     ((homekit_f)?degFtoC(aqdata->pool_htr_set_point):aqdata->pool_htr_set_point),
+                                     ((homekit)?2:0),
+                                     ((homekit_f)?degFtoC(aqdata->pool_temp):aqdata->pool_temp),
+                                     LED2int(aqdata->aqbuttons[i].led->state),
+                                     ((aqdata->aqbuttons[i].special_mask & TIMER_ACTIVE) == TIMER_ACTIVE?JSON_ON:JSON_OFF) );
+
+    } else if ( strcmp(BTN_SPA_HTR,aqdata->aqbuttons[i].name)==0 && (ENABLE_HEATERS || aqdata->spa_htr_set_point != TEMP_UNKNOWN)) {
+      length += sprintf(buffer+length, "{\"type\": \"setpoint_thermo\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"status\": \"%s\", \"spvalue\": \"%.*f\", \"value\": \"%.*f\", \"int_status\": \"%d\", \"timer_active\":\"%s\" },",
+                                     aqdata->aqbuttons[i].name, 
+                                     aqdata->aqbuttons[i].label,
+                                     aqdata->aqbuttons[i].led->state==ON?JSON_ON:JSON_OFF,
+                                     LED2text(aqdata->aqbuttons[i].led->state),
+                                     ((homekit)?2:0),
+                                     ((homekit_f)?degFtoC(aqdata->spa_htr_set_point):aqdata->spa_htr_set_point),
+                                     ((homekit)?2:0),
+                                     ((homekit_f)?degFtoC(aqdata->spa_temp):aqdata->spa_temp),
+                                     LED2int(aqdata->aqbuttons[i].led->state),
+                                     ((aqdata->aqbuttons[i].special_mask & TIMER_ACTIVE) == TIMER_ACTIVE?JSON_ON:JSON_OFF));
+
+    } else {
+      if (!homekit && ENABLE_CHILLER && isVBUTTON_CHILLER(aqdata->aqbuttons[i].special_mask) ) {
+        // We will add this VButton as a thermostat
+        continue;
+      }
+      sprintf_get_aux_information(&aqdata->aqbuttons[i], aqdata, aux_info);
+      //length += sprintf(buffer+length, "{\"type\": \"switch\", \"type_ext\": \"switch_vsp\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"status\": \"%s\", \"int_status\": \"%d\" %s},", 
+      length += sprintf(buffer+length, "{\"type\": \"switch\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"status\": \"%s\", \"int_status\": \"%d\" %s},", 
+                                     aqdata->aqbuttons[i].name, 
+                                     aqdata->aqbuttons[i].label,
+                                     aqdata->aqbuttons[i].led->state==ON?JSON_ON:JSON_OFF,
+                                     LED2text(aqdata->aqbuttons[i].led->state),
+                                     LED2int(aqdata->aqbuttons[i].led->state),
+                                     aux_info);
+    }
+    /*    
+    } else if ( (programable_switch1 > 0 && programable_switch1 == i) || 
+                (programable_switch2 > 0 && programable_switch2 == i)) {
+        length += sprintf(buffer+length, "{\"type\": \"switch\", \"type_ext\": \"switch_program\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"status\": \"%s\", \"int_status\": \"%d\"},", 
+                                     aqdata->aqbuttons[i].name, 
+                                     aqdata->aqbuttons[i].label,
+                                     aqdata->aqbuttons[i].led->state==ON?JSON_ON:JSON_OFF,
+                                     LED2text(aqdata->aqbuttons[i].led->state),
+                                     LED2int(aqdata->aqbuttons[i].led->state));
+    } else {
+      if ( sprintf_get_aux_information(&aqdata->aqbuttons[i], aqdata, aux_info)[0] == '\0' ) {
+        length += sprintf(buffer+length, "{\"type\": \"switch\", \"type_ext\": \"switch\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"status\": \"%s\", \"int_status\": \"%d\"},", 
+                                     aqdata->aqbuttons[i].name, 
+                                     aqdata->aqbuttons[i].label,
+                                     aqdata->aqbuttons[i].led->state==ON?JSON_ON:JSON_OFF,
+                                     LED2text(aqdata->aqbuttons[i].led->state),
+                                     LED2int(aqdata->aqbuttons[i].led->state));
+      } else {
+        length += sprintf(buffer+length, "{\"type\": \"switch\", \"type_ext\": \"switch_vsp\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"status\": \"%s\", \"int_status\": \"%d\" %s},", 
+                                     aqdata->aqbuttons[i].name, 
+                                     aqdata->aqbuttons[i].label,
+                                     aqdata->aqbuttons[i].led->state==ON?JSON_ON:JSON_OFF,
+                                     LED2text(aqdata->aqbuttons[i].led->state),
+                                     LED2int(aqdata->aqbuttons[i].led->state),
+                                     aux_info);
+                                     //sprintf_get_aux_information(&aqdata->aqbuttons[i], aqdata, aux_info));
+      }
+    }*/
+  }
+
+  if ( ENABLE_FREEZEPROTECT || (aqdata->frz_protect_set_point != TEMP_UNKNOWN && aqdata->air_temp != TEMP_UNKNOWN) ) {
+    length += sprintf(buffer+length, "{\"type\": \"setpoint_freeze\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"status\": \"%s\", \"spvalue\": \"%.*f\", \"value\": \"%.*f\", \"int_status\": \"%d\" },",
+                                     FREEZE_PROTECT,
+                                    "Freeze Protection",
+                                    aqdata->frz_protect_state==ON?JSON_ON:JSON_OFF,
+                                    aqdata->frz_protect_state==ON?LED2text(ON):LED2text(ENABLE),
+                                    ((homekit)?2:0),
+                                    ((homekit_f)?degFtoC(aqdata->frz_protect_set_point):aqdata->frz_protect_set_point),
+                                    ((homekit)?2:0),
+                                    ((homekit_f)?degFtoC(aqdata->air_temp):aqdata->air_temp),
+                                    aqdata->frz_protect_state==ON?1:0);
+  }
+
+  if ( (ENABLE_CHILLER || (aqdata->chiller_set_point != TEMP_UNKNOWN && getWaterTemp(aqdata) != TEMP_UNKNOWN)) && (aqdata->chiller_button != NULL) ) {
+    length += sprintf(buffer+length, "{\"type\": \"setpoint_chiller\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"status\": \"%s\", \"spvalue\": \"%.*f\", \"value\": \"%.*f\", \"int_status\": \"%d\" },",
+      CHILLER,
+     "Heat Pump Chiller",
+     aqdata->chiller_button->led->state==ON?JSON_ON:JSON_OFF,
+     //((vbutton_detail *)aqdata->chiller_button->special_mask_ptr)->in_alt_mode?JSON_ON:JSON_OFF,
+     aqdata->chiller_button->led->state==ON?LED2text(ON):LED2text(ENABLE),
+     //((vbutton_detail *)aqdata->chiller_button->special_mask_ptr)->in_alt_mode?(aqdata->chiller_button->led->state==ON?LED2text(ON):LED2text(ENABLE)):JSON_OFF,
+     ((homekit)?2:0),
+     ((homekit_f)?degFtoC(aqdata->chiller_set_point):aqdata->chiller_set_point),
+     ((homekit)?2:0),
+     ((homekit_f)?degFtoC(getWaterTemp(aqdata)):getWaterTemp(aqdata)),
+     aqdata->chiller_button->led->state==ON?1:0);
+  }
+
+  if (aqdata->swg_led_state != LED_S_UNKNOWN) {
+    if ( aqdata->swg_percent != TEMP_UNKNOWN ) {
+      length += sprintf(buffer+length, "{\"type\": \"setpoint_swg\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"status\": \"%s\", \"spvalue\": \"%.*f\", \"value\": \"%.*f\", \"int_status\": \"%d\" },",
+                                     SWG_TOPIC,
+                                    "Salt Water Generator",
+                                    //aqdata->ar_swg_status == SWG_STATUS_OFF?JSON_OFF:JSON_ON,
+                                    aqdata->swg_led_state == OFF?JSON_OFF:JSON_ON,
+                                    //LED2text(get_swg_led_state(aqdata)),
+                                    LED2text(aqdata->swg_led_state),
+                                    ((homekit)?2:0),
+                                    ((homekit_f)?degFtoC(aqdata->swg_percent):aqdata->swg_percent),
+                                    ((homekit)?2:0),
+                                    ((homekit_f)?degFtoC(aqdata->swg_percent):aqdata->swg_percent),
+                                    LED2int(aqdata->swg_led_state) );
+                                    //aqdata->ar_swg_status == SWG_STATUS_OFF?LED2int(OFF):LED2int(ON));
+
+    //length += sprintf(buffer+length, "{\"type\": \"value\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"value\": \"%d\" },",
+      length += sprintf(buffer+length, "{\"type\": \"value\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"value\": \"%.*f\" },",
+                                   ((homekit_f)?SWG_PERCENT_F_TOPIC:SWG_PERCENT_TOPIC),
+                                   "Salt Water Generator Percent",
+                                   "on",
+                                   ((homekit_f)?2:0),
+                                   ((homekit_f)?degFtoC(aqdata->swg_percent):aqdata->swg_percent));
+      //if (!homekit) { // For the moment keep boost off homekit   
+
+        length += sprintf(buffer+length, "{\"type\": \"switch\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"status\": \"%s\", \"int_status\": \"%d\"},", 
+                                     SWG_BOOST_TOPIC, 
+                                     "SWG Boost",
+                                     aqdata->boost?JSON_ON:JSON_OFF,
+                                     aqdata->boost?JSON_ON:JSON_OFF,
+                                     aqdata->boost?LED2int(ON):LED2int(OFF));
+      //}
+    }
+
+    if ( aqdata->swg_ppm != TEMP_UNKNOWN ) {
+
+      length += sprintf(buffer+length, "{\"type\": \"value\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"value\": \"%.*f\" },",
+                                     ((homekit_f)?SWG_PPM_F_TOPIC:SWG_PPM_TOPIC),
+                                     "Salt Level PPM",
+                                     "on",
+                                     ((homekit)?2:0),
+                                     ((homekit_f)?roundf(degFtoC(aqdata->swg_ppm)):aqdata->swg_ppm)); 
+                                   
+     /*         
+   length += sprintf(buffer+length, "{\"type\": \"value\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"value\": \"%d\" },",
+                                   SWG_PPM_TOPIC,
+                                   "Salt Level PPM",
+                                   "on",
+                                   aqdata->swg_ppm);
+   */
+                                   
+    }
+  }
+
+  if ( aqdata->ph != TEMP_UNKNOWN ) {
+    length += sprintf(buffer+length, "{\"type\": \"value\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"value\": \"%.*f\" },",
+                                   ((homekit_f)?CHRM_PH_F_TOPIC:CHEM_PH_TOPIC),
+                                   "Water Chemistry pH",
+                                   "on",
+                                   ((homekit)?2:1),
+                                   ((homekit_f)?(degFtoC(aqdata->ph)):aqdata->ph)); 
+  }
+  if ( aqdata->orp != TEMP_UNKNOWN ) {
+    length += sprintf(buffer+length, "{\"type\": \"value\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"value\": \"%.*f\" },",
+                                   ((homekit_f)?CHRM_ORP_F_TOPIC:CHEM_ORP_TOPIC),
+                                   "Water Chemistry ORP",
+                                   "on",
+                                   ((homekit)?2:0),
+                                   ((homekit_f)?(degFtoC(aqdata->orp)):aqdata->orp)); 
+  }
+
+  length += sprintf(buffer+length, "{\"type\": \"temperature\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"value\": \"%.*f\" },",
+                                   AIR_TEMP_TOPIC,
+                                   /*AIR_TEMPERATURE,*/
+                                   "Pool Air Temperature",
+                                   "on",
+                                   ((homekit)?2:0),
+                                   ((homekit_f)?degFtoC(aqdata->air_temp):aqdata->air_temp));
+  length += sprintf(buffer+length, "{\"type\": \"temperature\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"value\": \"%.*f\" },",
+                                   POOL_TEMP_TOPIC,
+                                   /*POOL_TEMPERATURE,*/
+                                   "Pool Water Temperature",
+                                   "on",
+                                   ((homekit)?2:0),
+                                   ((homekit_f)?degFtoC(aqdata->pool_temp):aqdata->pool_temp));
+  length += sprintf(buffer+length, "{\"type\": \"temperature\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"value\": \"%.*f\" },",
+                                   SPA_TEMP_TOPIC,
+                                   /*SPA_TEMPERATURE,*/
+                                   "Spa Water Temperature",
+                                   "on",
+                                   ((homekit)?2:0),
+                                   ((homekit_f)?degFtoC(aqdata->spa_temp):aqdata->spa_temp));
+
+  for (i=0; i < aqdata->num_sensors; i++) 
+  {
+    if (aqdata->sensors[i].value != TEMP_UNKNOWN) {
+       //length += sprintf(buffer+length, "\"%s\": \"%.2f\",", aqdata->sensors[i].label, aqdata->sensors[i].value );
+       /*
+      length += sprintf(buffer+length, "{\"type\": \"temperature\", \"id\": \"%s/%s\", \"name\": \"%s\", \"state\": \"%s\", \"value\": \"%.*f\" },",
+        SENSOR_TOPIC,aqdata->sensors[i].label,
+        aqdata->sensors[i].label,
+        "on",
+        ((homekit)?2:0),
+        ((homekit_f)?aqdata->sensors[i].value:aqdata->sensors[i].value));*/
+
+      temperatureUOM t_uom = getTemperatureUOM(aqdata->sensors[i].uom);
+
+      if (aqdata->sensors[i].uom == NULL) {
+        length += sprintf(buffer+length, "{\"type\": \"value\", \"id\": \"%s%s\", \"name\": \"%s\", \"state\": \"on\", \"value\": \"%.*f\", \"uom\": \"\" },",
+        FULL_SENSOR_TOPIC,
+        aqdata->sensors[i].ID,
+        aqdata->sensors[i].label,
+        2,
+        aqdata->sensors[i].value);
+      } else if (t_uom == UNKNOWN) {
+        length += sprintf(buffer+length, "{\"type\": \"value\", \"id\": \"%s%s\", \"name\": \"%s\", \"state\": \"on\", \"value\": \"%.*f\", \"uom\": \"%s\" },",
+        FULL_SENSOR_TOPIC,
+        aqdata->sensors[i].ID,
+        aqdata->sensors[i].label,
+        2,
+        aqdata->sensors[i].value,
+        aqdata->sensors[i].uom);
+      } else if ( !homekit && (aqdata->temp_units == FAHRENHEIT && t_uom == CELSIUS) ) {
+        length += sprintf(buffer+length, "{\"type\": \"temperature\", \"id\": \"%s%s\", \"name\": \"%s\", \"state\": \"on\", \"value\": \"%.*f\" },",
+        FULL_SENSOR_TOPIC,
+        aqdata->sensors[i].ID,
+        aqdata->sensors[i].label,
+        2,
+        degCtoF(aqdata->sensors[i].value));
+      } else {
+        length += sprintf(buffer+length, "{\"type\": \"temperature\", \"id\": \"%s%s\", \"name\": \"%s\", \"state\": \"%s\", \"value\": \"%.*f\" },",
+        FULL_SENSOR_TOPIC,
+        aqdata->sensors[i].ID,
+        aqdata->sensors[i].label,
+        "on",
+        ((homekit)?2:0),
+        ((homekit_f)?aqdata->sensors[i].value:aqdata->sensors[i].value));
+      }
+    }
+  }
+/*
+  length += sprintf(buffer+length,  "], \"aux_device_detail\": [");
+  for (i=0; i < MAX_PUMPS; i++) {
+  }
+*/
+  if (buffer[length-1] == ',')
+    length--;
+
+  length += sprintf(buffer+length, "]}");
+
+  // Really crap test
+  if (length >= size) {
+    LOG(NET_LOG,LOG_ERR, "JSON: %s went over buffer size %d of %d\n", homekit?"homebridge":"web", length, size);
+    buffer[size - 1] = '\0';
+  }
+
+  LOG(NET_LOG,LOG_DEBUG, "JSON: %s used %d of %d\n", homekit?"homebridge":"web", length, size);
+
+  buffer[length] = '\0';
+
+//printf("%s\n",buffer);
+
+  return strlen(buffer);
+  
+  //return length;
+}
+
+int sprintf_build_aqualink_status_JSON(struct aqualinkdata *aqdata, char* buffer, int size)
+{
+  //strncpy(buffer, test_message, strlen(test_message)+1);
+  //return strlen(test_message);
+  //char buffer2[600];
+  
+  memset(&buffer[0], 0, size);
+  int length = 0;
+  int i;
+
+  length += sprintf(buffer+length, "{\"type\": \"status\"");
+  length += sprintf(buffer+length, ",\"status\":\"%s\"",getStatus(aqdata) );
+  length += sprintf(buffer+length, ",\"panel_message\":\"%s\"",aqdata->last_message );
+  length += sprintf(buffer+length, ",\"panel_type_full\":\"%s\"",getPanelString());
+  length += sprintf(buffer+length, ",\"panel_type\":\"%s\"",getShortPanelString());
+  //length += sprintf(buffer+length, ",\"message\":\"%s\"",aqdata->message );
+  //length += sprintf(buffer+length, ",\"version\":\"%s\"",aqdata->version );//8157 REV MMM",
+  length += sprintf(buffer+length, ",\"version\":\"%s %s\"",aqdata->panel_cpu, aqdata->panel_rev );//8157 REV MMM",
+  length += sprintf(buffer+length, ",\"aqualinkd_version\":\"%s\"", AQUALINKD_VERSION ); //1.0b,
+  length += sprintf(buffer+length, ",\"date\":\"%s\"",aqdata->date );//"09/01/16 THU",
+  length += sprintf(buffer+length, ",\"time\":\"%s\"",aqdata->time );//"1:16 PM",
+  //length += sprintf(buffer+length, ",\"air_temp\":\"%d\"",aqdata->air_temp );//"96",
+  //length += sprintf(buffer+length, ",\"pool_temp\":\"%d\"",aqdata->pool_temp );//"86",
+  //length += sprintf(buffer+length, ",\"spa_temp\":\"%d\"",aqdata->spa_temp );//" ",
+  
+  length += sprintf(buffer+length, ",\"pool_htr_set_pnt\":\"%d\"",aqdata->pool_htr_set_point );//"85",
+  length += sprintf(buffer+length, ",\"spa_htr_set_pnt\":\"%d\"",aqdata->spa_htr_set_point );//"99",
+  //length += sprintf(buffer+length, ",\"freeze_protection":\"%s\"",aqdata->frz_protect_set_point );//"off",
+  length += sprintf(buffer+length, ",\"frz_protect_set_pnt\":\"%d\"",aqdata->frz_protect_set_point );//"0",
+  if ( (ENABLE_CHILLER || aqdata->chiller_set_point != TEMP_UNKNOWN) && aqdata->chiller_button != NULL) {
+    length += sprintf(buffer+length, ",\"chiller_set_pnt\":\"%d\"",aqdata->chiller_set_point );//"0",
+    if (isVBUTTON_CHILLER(aqdata->chiller_button->special_mask))
+      length += sprintf(buffer+length, ",\"chiller_mode\":\"%s\"",((altlabel_detail *)aqdata->chiller_button->special_mask_ptr)->in_alt_mode?"cool":"heat");
+  }
+  
+  if ( aqdata->air_temp == TEMP_UNKNOWN )
+    length += sprintf(buffer+length, ",\"air_temp\":\" \"");
+  else
+    length += sprintf(buffer+length, ",\"air_temp\":\"%d\"",aqdata->air_temp );
+  
+  if ( aqdata->pool_temp == TEMP_UNKNOWN )
+    length += sprintf(buffer+length, ",\"pool_temp\":\" \"");
+  else
+    length += sprintf(buffer+length, ",\"pool_temp\":\"%d\"",aqdata->pool_temp );
+    
+  if ( aqdata->spa_temp == TEMP_UNKNOWN )
+    length += sprintf(buffer+length, ",\"spa_temp\":\" \"");
+  else
+    length += sprintf(buffer+length, ",\"spa_temp\":\"%d\"",aqdata->spa_temp );
+
+  if (aqdata->swg_led_state != LED_S_UNKNOWN) {
+    if ( aqdata->swg_percent != TEMP_UNKNOWN )
+      length += sprintf(buffer+length, ",\"swg_percent\":\"%d\"",aqdata->swg_percent );
+  
+    if ( aqdata->swg_ppm != TEMP_UNKNOWN )
+      length += sprintf(buffer+length, ",\"swg_ppm\":\"%d\"",aqdata->swg_ppm );
+  }
+
+  if ( aqdata->temp_units == FAHRENHEIT )
+    length += sprintf(buffer+length, ",\"temp_units\":\"%s\"",JSON_FAHRENHEIT );
+  else if ( aqdata->temp_units == CELSIUS )
+    length += sprintf(buffer+length, ",\"temp_units\":\"%s\"", JSON_CELSIUS);
+  else
+    length += sprintf(buffer+length, ",\"temp_units\":\"%s\"",JSON_UNKNOWN );
+  
+  if (aqdata->battery == OK)
+    length += sprintf(buffer+length, ",\"battery\":\"%s\"",JSON_OK );//"ok",
+  else
+    length += sprintf(buffer+length, ",\"battery\":\"%s\"",JSON_LOW );//"ok",
+
+  if ( aqdata->swg_percent == 101 )
+    length += sprintf(buffer+length, ",\"swg_boost_msg\":\"%s\"",aqdata->boost_msg );
+  
+  if ( aqdata->ph != TEMP_UNKNOWN )
+    length += sprintf(buffer+length, ",\"chem_ph\":\"%.1f\"",aqdata->ph );
+    
+  if ( aqdata->orp != TEMP_UNKNOWN )
+    length += sprintf(buffer+length, ",\"chem_orp\":\"%d\"",aqdata->orp );
+
+  //if ( READ_RSDEV_SWG )
+    length += sprintf(buffer+length, ",\"swg_fullstatus\": \"%d\"", aqdata->ar_swg_device_status);
+
+  length += sprintf(buffer+length, ",\"leds\":{" );
+  for (i=0; i < aqdata->total_buttons; i++) 
+  {
+    char *state = LED2text(aqdata->aqbuttons[i].led->state);
+    length += sprintf(buffer+length, "\"%s\": \"%s\"", aqdata->aqbuttons[i].name, state);
+
+    if (i+1 < aqdata->total_buttons)
+      length += sprintf(buffer+length, "," );
+  }
+
+  if ( aqdata->swg_percent != TEMP_UNKNOWN && aqdata->swg_led_state != LED_S_UNKNOWN ) {
+    //length += sprintf(buffer+length, ", \"%s\": \"%s\"", SWG_TOPIC, LED2text(get_swg_led_state(aqdata)));
+    length += sprintf(buffer+length, ", \"%s\": \"%s\"", SWG_TOPIC, LED2text(aqdata->swg_led_state));
+    //length += sprintf(buffer+length, ", \"%s\": \"%s\"", SWG_TOPIC, aqdata->ar_swg_status == SWG_STATUS_OFF?JSON_OFF:JSON_ON);
+    length += sprintf(buffer+length, ", \"%s\": \"%s\"", SWG_BOOST_TOPIC, aqdata->boost?JSON_ON:JSON_OFF);
+  }
+  //NSF Need to come back and read what the display states when Freeze protection is on
+  if ( aqdata->frz_protect_set_point != TEMP_UNKNOWN || ENABLE_FREEZEPROTECT ) {
+    //length += sprintf(buffer+length, ", \"%s\": \"%s\"", FREEZE_PROTECT, aqdata->frz_protect_state==ON?JSON_ON:JSON_ENABLED);
+    length += sprintf(buffer+length, ", \"%s\": \"%s\"", FREEZE_PROTECT, LED2text(aqdata->frz_protect_state) );
+  }
+  // Add Chiller if exists
+  if (aqdata->chiller_button != NULL) {
+    length += sprintf(buffer+length, ", \"%s\": \"%s\"", CHILLER, LED2text(aqdata->chiller_button->led->state) );
+  }
+  //length += sprintf(buffer+length, "}, \"extra\":{" );
+  length += sprintf(buffer+length, "},");
+
+  // NSF Check below needs to be for VSP Pump (any state), not just known state
+  for (i=0; i < aqdata->num_pumps; i++) {
+    /*  NSF There is a problem here that needs to be fixed.
+printf("Loop %d Message '%s'\n",i,buffer);
+printf("Pump Label %s\n",aqdata->pumps[i].button->label);
+printf("Pump Name %s\n",aqdata->pumps[i].button->name);
+printf("Pump RPM %d\n",aqdata->pumps[i].rpm);
+printf("Pump GPM %d\n",aqdata->pumps[i].gpm);
+printf("Pump GPM %d\n",aqdata->pumps[i].watts);
+printf("Pump Type %d\n",aqdata->pumps[i].pumpType);
+    */
+    //if (aqdata->pumps[i].pumpType != PT_UNKNOWN && (aqdata->pumps[i].rpm != TEMP_UNKNOWN || aqdata->pumps[i].gpm != TEMP_UNKNOWN || aqdata->pumps[i].watts != TEMP_UNKNOWN)) {
+    if (aqdata->pumps[i].pumpType != PT_UNKNOWN ) {
+      length += sprintf(buffer+length, "\"Pump_%d\":{\"name\":\"%s\",\"id\":\"%s\",\"RPM\":\"%d\",\"GPM\":\"%d\",\"Watts\":\"%d\",\"Pump_Type\":\"%s\",\"Status\":\"%d\"},",
+                        i+1,aqdata->pumps[i].button->label,aqdata->pumps[i].button->name,aqdata->pumps[i].rpm,aqdata->pumps[i].gpm,aqdata->pumps[i].watts,
+                        (aqdata->pumps[i].pumpType==VFPUMP?"vfPump":(aqdata->pumps[i].pumpType==VSPUMP?"vsPump":"ePump")),
+                        getPumpStatus(i, aqdata));
+    }
+  }
+  if (buffer[length-1] == ',')
+    length--;
+
+  length += sprintf(buffer+length, ",\"timers\":{" );
+  for (i=0; i < aqdata->total_buttons; i++) 
+  {
+    if ((aqdata->aqbuttons[i].special_mask & TIMER_ACTIVE) == TIMER_ACTIVE) {
+      length += sprintf(buffer+length, "\"%s\": \"on\",", aqdata->aqbuttons[i].name);
+      //length += sprintf(buffer+length, "\"%s_duration\": \"%d\",", aqdata->aqbuttons[i].name, get_timer_left(&aqdata->aqbuttons[i]) );
+    }
+  }
+  if (buffer[length-1] == ',')
+    length--;
+  length += sprintf(buffer+length, "}");
+
+  length += sprintf(buffer+length, ",\"timer_durations\":{" );
+  for (i=0; i < aqdata->total_buttons; i++) 
+  {
+    if ((aqdata->aqbuttons[i].special_mask & TIMER_ACTIVE) == TIMER_ACTIVE) {
+      length += sprintf(buffer+length, "\"%s\": \"%d\",", aqdata->aqbuttons[i].name, get_timer_left(i) );
+    }
+  }
+  if (buffer[length-1] == ',')
+    length--;
+  length += sprintf(buffer+length, "}");
+
+  length += sprintf(buffer+length, ",\"light_program_names\":{" );
+  for (i=0; i < aqdata->num_lights; i++) 
+  {
+    if (aqdata->lights[i].lightType == LC_DIMMER2) {
+      length += sprintf(buffer+length, "\"%s\": \"%d%%\",", aqdata->lights[i].button->name, aqdata->lights[i].currentValue );
+    } else {
+      //length += sprintf(buffer+length, "\"%s\": \"%s\",", aqdata->lights[i].button->name, light_mode_name(aqdata->lights[i].lightType, aqdata->lights[i].currentValue, RSSADAPTER) );
+      length += sprintf(buffer+length, "\"%s\": \"%s\",", aqdata->lights[i].button->name, get_currentlight_mode_name(aqdata->lights[i], RSSADAPTER) );
+    }
+  }
+  if (buffer[length-1] == ',')
+    length--;
+  length += sprintf(buffer+length, "}");
+
+
+  length += sprintf(buffer+length, ",\"alternate_modes\":{" );
+  if (aqdata->virtual_button_start > 0) {
+    for (i=aqdata->virtual_button_start; i < aqdata->total_buttons; i++) 
+    {
+      if (isVBUTTON_ALTLABEL(aqdata->aqbuttons[i].special_mask)) {
+        length += sprintf(buffer+length, "\"%s\": \"%s\",",aqdata->aqbuttons[i].name, ((altlabel_detail *)aqdata->aqbuttons[i].special_mask_ptr)->in_alt_mode?JSON_ON:JSON_OFF );
+      }
+    }
+    if (buffer[length-1] == ',')
+      length--;
+  }
+  length += sprintf(buffer+length, "}");
+
+
+  length += sprintf(buffer+length, ",\"sensors\":{" );
+  for (i=0; i < aqdata->num_sensors; i++) 
+  {
+    //printf("Sensor value %f %.2f\n",aqdata->sensors[i].value,aqdata->sensors[i].value);
+    
+    if (aqdata->sensors[i].value != TEMP_UNKNOWN) {
+      //length += sprintf(buffer+length, "\"%s\": \"%.2f\",", aqdata->sensors[i].label, aqdata->sensors[i].value );
+      if ( aqdata->temp_units == FAHRENHEIT && getTemperatureUOM(aqdata->sensors[i].uom) == CELSIUS ) {
+        length += sprintf(buffer+length, "\"%s\": \"%.1f\",", aqdata->sensors[i].ID, degCtoF(aqdata->sensors[i].value) );
+      } else {
+        length += sprintf(buffer+length, "\"%s\": \"%.1f\",", aqdata->sensors[i].ID, aqdata->sensors[i].value );
+      }
+    }
+  }
+  if (buffer[length-1] == ',')
+    length--;
+  length += sprintf(buffer+length, "}");
+
+
+  length += sprintf(buffer+length, "}" );
+  
+  buffer[length] = '\0';
+  
+  return strlen(buffer);
+}
+
@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2017 Shaun Feakes - All rights reserved
+ *
+ * You may use redistribute and/or modify this code under the terms of
+ * the GNU General Public License version 2 as published by the
+ * Free Software Foundation. For the terms of this license,
+ * see <http://www.gnu.org/licenses/>.
+ *
+ * You are free to use this software under the terms of the GNU General
+ * Public License, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ *  https://github.com/sfeakes/aqualinkd
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "aqualink.h"
+#include "aq_serial.h"
+#include "aq_programmer.h"
+#include "mongoose.h"
+#include "aq_metrics.h"
+#include "cmd_queue.h"
+#include "rs_packet_queue.h"
+#include "utils.h"
+#include "version.h"
+
+#define METRIC_PROG_TYPES (AQ_ADD_RSSADAPTER_SPA_HEATER_TEMP + 1)
+#define METRIC_SERR_TYPES 5 // AQSERR_READ (-1) to AQSERR_2SMALL (-5)
+
+typedef struct metric_histogram {
+  atomic_uint_fast64_t buckets[METRIC_PROG_BUCKETS > METRIC_BROADCAST_BUCKETS ? METRIC_PROG_BUCKETS : METRIC_BROADCAST_BUCKETS];
+  atomic_uint_fast64_t count;
+  atomic_uint_fast64_t sum;  // In the unit it was recorded in (ms or us)
+} metric_histogram;
+
+// Upper bounds of all but the last (+Inf) bucket
+static const long _prog_bounds_ms[METRIC_PROG_BUCKETS-1] = {250, 500, 1000, 2000, 5000, 10000, 30000, 60000, 120000};
+static const long _broadcast_bounds_us[METRIC_BROADCAST_BUCKETS-1] = {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000};
+
+static atomic_uint_fast64_t _rs_packets[P_UNKNOWN+1][256];
+static atomic_uint_fast64_t _rs_errors[METRIC_SERR_TYPES];
+static metric_histogram _prog_run[METRIC_PROG_TYPES];
+static atomic_uint_fast64_t _prog_wait_ms;
+static metric_histogram _broadcast;
+
+static const char *_serr_names[METRIC_SERR_TYPES] = {"read", "timeout", "checksum", "toolarge", "toosmall"};
+static const char *_protocol_names[P_UNKNOWN+1] = {"jandy", "pentair", "unknown"};
+
+
+static void histogram_add(metric_histogram *h, const long *bounds, int buckets, long value)
+{
+  int i;
+
+  for (i=0; i < buckets-1; i++) {
+    if (value <= bounds[i])
+      break;
+  }
+
+  atomic_fetch_add_explicit(&h->buckets[i], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&h->sum, value < 0 ? 0 : value, memory_order_relaxed);
+}
+
+void metric_rs_packet(const unsigned char *packet, int length)
+{
+  protocolType protocol = getProtocolType(packet);
+  unsigned char dest;
+
+  if (protocol == PENTAIR)
+    dest = (length > PEN_PKT_DEST) ? packet[PEN_PKT_DEST] : 0;
+  else
+    dest = (length > PKT_DEST) ? packet[PKT_DEST] : 0;
+
+  atomic_fetch_add_explicit(&_rs_packets[protocol][dest], 1, memory_order_relaxed);
+}
+
+void metric_rs_error(int aqserr)
+{
+  if (aqserr <= AQSERR_READ && aqserr >= AQSERR_2SMALL)
+    atomic_fetch_add_explicit(&_rs_errors[AQSERR_READ - aqserr], 1, memory_order_relaxed);
+}
+
+void metric_prog_job(program_type type, long wait_ms, long run_ms)
+{
+  if (type < 0 || type >= METRIC_PROG_TYPES)
+    return;
+
+  histogram_add(&_prog_run[type], _prog_bounds_ms, METRIC_PROG_BUCKETS, run_ms);
+  atomic_fetch_add_explicit(&_prog_wait_ms, wait_ms < 0 ? 0 : wait_ms, memory_order_relaxed);
+}
+
+void metric_broadcast(long us)
+{
+  histogram_add(&_broadcast, _broadcast_bounds_us, METRIC_BROADCAST_BUCKETS, us);
+}
+
+
+/*
+  Text exposition format, ie
+  # HELP aqualinkd_rs485_packets_total ...
+  # TYPE aqualinkd_rs485_packets_total counter
+  aqualinkd_rs485_packets_total{protocol="jandy",dest="0x10"} 1234
+*/
+static void mprintf(struct mg_iobuf *io, const char *format, ...) __attribute__ ((format (printf, 2, 3)));
+static void mprintf(struct mg_iobuf *io, const char *format, ...)
+{
+  char line[256];
+  va_list args;
+  int n;
+
+  va_start(args, format);
+  n = vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+
+  if (n > 0)
+    mg_iobuf_add(io, io->len, line, (n < (int)sizeof(line)) ? n : (int)sizeof(line) - 1);
+}
+
+static void metric_header(struct mg_iobuf *io, const char *name, const char *type, const char *help)
+{
+  mprintf(io, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// Label values can't have " or \ in them, ptypeName() etc shouldn't but make sure.
+static const char *label_value(const char *value, char *buf, int size)
+{
+  int i;
+
+  for (i=0; value != NULL && value[i] != '\0' && i < size-1; i++)
+    buf[i] = (value[i] == '"' || value[i] == '\\') ? '\'' : value[i];
+  buf[i] = '\0';
+
+  return buf;
+}
+
+// Histogram recorded in units of 1/scale seconds (1000 for ms, 1000000 for us)
+static void write_histogram(struct mg_iobuf *io, const char *name, const char *labels, const metric_histogram *h,
+                            const long *bounds, int buckets, double scale)
+{
+  uint64_t cumulative = 0;
+  const char *sep = (labels[0] == '\0') ? "" : ",";
+  int i;
+
+  for (i=0; i < buckets-1; i++) {
+    cumulative += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+    mprintf(io, "%s_bucket{%s%sle=\"%g\"} %llu\n", name, labels, sep, bounds[i] / scale, (unsigned long long)cumulative);
+  }
+  cumulative += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+  mprintf(io, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep, (unsigned long long)cumulative);
+  mprintf(io, "%s_sum%s%s%s %g\n", name, (labels[0]=='\0'?"":"{"), labels, (labels[0]=='\0'?"":"}"),
+                                   atomic_load_explicit(&h->sum, memory_order_relaxed) / scale);
+  mprintf(io, "%s_count%s%s%s %llu\n", name, (labels[0]=='\0'?"":"{"), labels, (labels[0]=='\0'?"":"}"),
+                                       (unsigned long long)atomic_load_explicit(&h->count, memory_order_relaxed));
+}
+
+static void write_rs485_metrics(struct mg_iobuf *io)
+{
+  uint64_t count;
+  int p, d;
+
+  metric_header(io, "aqualinkd_rs485_packets_total", "counter", "RS485 packets read, by protocol and destination ID.");
+  for (p=0; p <= P_UNKNOWN; p++) {
+    for (d=0; d < 256; d++) {
+      if ( (count = atomic_load_explicit(&_rs_packets[p][d], memory_order_relaxed)) > 0 )
+        mprintf(io, "aqualinkd_rs485_packets_total{protocol=\"%s\",dest=\"0x%02x\"} %llu\n", _protocol_names[p], d, (unsigned long long)count);
+    }
+  }
+
+  metric_header(io, "aqualinkd_rs485_errors_total", "counter", "get_packet() errors, by AQSERR type.");
+  for (p=0; p < METRIC_SERR_TYPES; p++) {
+    mprintf(io, "aqualinkd_rs485_errors_total{type=\"%s\"} %llu\n", _serr_names[p],
+                (unsigned long long)atomic_load_explicit(&_rs_errors[p], memory_order_relaxed));
+  }
+}
+
+static void write_ack_latency_metrics(struct mg_iobuf *io)
+{
+  emulation_type emulations[] = {ALLBUTTON, RSSADAPTER, ONETOUCH, IAQTOUCH, AQUAPDA, IAQUALNK, SIMULATOR};
+  ack_latency_stats stats;
+  uint64_t cumulative;
+  const char *name;
+  int i, b;
+
+  metric_header(io, "aqualinkd_ack_latency_seconds", "histogram", "Time from end of a frame addressed to us to our reply, by emulation.");
+
+  for (i=0; i < sizeof(emulations)/sizeof(emulations[0]); i++) {
+    if ( !get_ack_latency(emulations[i], &stats) || stats.count == 0)
+      continue;
+
+    name = (emulations[i]==SIMULATOR?"Simulator":getJandyDeviceName(emulations[i]));
+    cumulative = 0;
+    for (b=0; b < ACK_LATENCY_BUCKETS-1; b++) {
+      cumulative += stats.buckets[b];
+      mprintf(io, "aqualinkd_ack_latency_seconds_bucket{emulation=\"%s\",le=\"%g\"} %llu\n", name, get_ack_latency_bucket_us(b) / 1000000.0, (unsigned long long)cumulative);
+    }
+    cumulative += stats.buckets[b];
+    mprintf(io, "aqualinkd_ack_latency_seconds_bucket{emulation=\"%s\",le=\"+Inf\"} %llu\n", name, (unsigned long long)cumulative);
+    mprintf(io, "aqualinkd_ack_latency_seconds_sum{emulation=\"%s\"} %g\n", name, stats.total_us / 1000000.0);
+    mprintf(io, "aqualinkd_ack_latency_seconds_count{emulation=\"%s\"} %u\n", name, stats.count);
+  }
+}
+
+static void write_programmer_metrics(struct mg_iobuf *io)
+{
+  aq_programmer_stats stats;
+  char labels[96];
+  char value[64];
+  int t;
+
+  get_aq_programmer_stats(&stats);
+
+  metric_header(io, "aqualinkd_programmer_queue_depth", "gauge", "Programming jobs waiting to run.");
+  mprintf(io, "aqualinkd_programmer_queue_depth %u\n", stats.depth);
+  metric_header(io, "aqualinkd_programmer_jobs_total", "counter", "Programming jobs, by what happened to them.");
+  mprintf(io, "aqualinkd_programmer_jobs_total{result=\"queued\"} %llu\n", (unsigned long long)stats.queued);
+  mprintf(io, "aqualinkd_programmer_jobs_total{result=\"completed\"} %llu\n", (unsigned long long)stats.completed);
+  mprintf(io, "aqualinkd_programmer_jobs_total{result=\"rejected\"} %llu\n", (unsigned long long)stats.rejected);
+  mprintf(io, "aqualinkd_programmer_jobs_total{result=\"cancelled\"} %llu\n", (unsigned long long)stats.cancelled);
+  mprintf(io, "aqualinkd_programmer_jobs_total{result=\"timed_out\"} %llu\n", (unsigned long long)stats.timed_out);
+  metric_header(io, "aqualinkd_programmer_wait_seconds_total", "counter", "Time completed jobs spent queued.");
+  mprintf(io, "aqualinkd_programmer_wait_seconds_total %g\n", atomic_load_explicit(&_prog_wait_ms, memory_order_relaxed) / 1000.0);
+
+  metric_header(io, "aqualinkd_programmer_job_seconds", "histogram", "Programming job run time, by program type.");
+  for (t=0; t < METRIC_PROG_TYPES; t++) {
+    if (atomic_load_explicit(&_prog_run[t].count, memory_order_relaxed) == 0)
+      continue;
+    snprintf(labels, sizeof(labels), "type=\"%s\"", label_value(ptypeName(t), value, sizeof(value)));
+    write_histogram(io, "aqualinkd_programmer_job_seconds", labels, &_prog_run[t], _prog_bounds_ms, METRIC_PROG_BUCKETS, 1000.0);
+  }
+}
+
+static void write_queue_metrics(struct mg_iobuf *io)
+{
+  cmdq_info cmdq[16];
+  rs_packet_queue_stats rsq;
+  unsigned long log_queued, log_dropped;
+  int i, n;
+
+  n = get_cmd_queue_stats(cmdq, sizeof(cmdq)/sizeof(cmdq[0]));
+  metric_header(io, "aqualinkd_cmd_queue_depth", "gauge", "Commands waiting to be sent to the panel, by emulation.");
+  for (i=0; i < n; i++)
+    mprintf(io, "aqualinkd_cmd_queue_depth{queue=\"%s\"} %u\n", cmdq[i].name, cmdq[i].stats.depth);
+  metric_header(io, "aqualinkd_cmd_queue_max_depth", "gauge", "High water mark of the command queue.");
+  for (i=0; i < n; i++)
+    mprintf(io, "aqualinkd_cmd_queue_max_depth{queue=\"%s\"} %u\n", cmdq[i].name, cmdq[i].stats.max_depth);
+  metric_header(io, "aqualinkd_cmd_queue_commands_total", "counter", "Commands through the queue, by what happened to them.");
+  for (i=0; i < n; i++) {
+    mprintf(io, "aqualinkd_cmd_queue_commands_total{queue=\"%s\",result=\"pushed\"} %llu\n", cmdq[i].name, (unsigned long long)cmdq[i].stats.pushed);
+    mprintf(io, "aqualinkd_cmd_queue_commands_total{queue=\"%s\",result=\"sent\"} %llu\n", cmdq[i].name, (unsigned long long)cmdq[i].stats.popped);
+    mprintf(io, "aqualinkd_cmd_queue_commands_total{queue=\"%s\",result=\"coalesced\"} %llu\n", cmdq[i].name, (unsigned long long)cmdq[i].stats.coalesced);
+    mprintf(io, "aqualinkd_cmd_queue_commands_total{queue=\"%s\",result=\"dropped\"} %llu\n", cmdq[i].name, (unsigned long long)cmdq[i].stats.dropped);
+  }
+
+  get_rs_packet_queue_stats(&rsq);
+  metric_header(io, "aqualinkd_rs_device_queue_depth", "gauge", "Readonly device packets waiting to be decoded.");
+  mprintf(io, "aqualinkd_rs_device_queue_depth %u\n", rsq.depth);
+  metric_header(io, "aqualinkd_rs_device_queue_max_depth", "gauge", "High water mark of the readonly device queue.");
+  mprintf(io, "aqualinkd_rs_device_queue_max_depth %u\n", rsq.max_depth);
+  metric_header(io, "aqualinkd_rs_device_queue_packets_total", "counter", "Readonly device packets queued, and dropped because the queue was full.");
+  mprintf(io, "aqualinkd_rs_device_queue_packets_total{result=\"queued\"} %llu\n", (unsigned long long)rsq.queued);
+  mprintf(io, "aqualinkd_rs_device_queue_packets_total{result=\"dropped\"} %llu\n", (unsigned long long)rsq.overflows);
+
+  get_log_stats(&log_queued, &log_dropped);
+  metric_header(io, "aqualinkd_log_messages_total", "counter", "Messages through the log writer, and dropped because it was full.");
+  mprintf(io, "aqualinkd_log_messages_total{result=\"queued\"} %lu\n", log_queued);
+  mprintf(io, "aqualinkd_log_messages_total{result=\"dropped\"} %lu\n", log_dropped);
+  metric_header(io, "aqualinkd_log_level_messages_total", "counter", "Messages logged, by level.");
+  for (i=LOG_ERR; i <= LOG_DEBUG_SERIAL; i++)
+    mprintf(io, "aqualinkd_log_level_messages_total{level=\"%s\"} %lu\n", loglevel2cgn_name(i), get_log_level_count(i));
+}
+
+void write_metrics(struct mg_iobuf *io, const net_metrics *net)
+{
+  metric_header(io, "aqualinkd_build_info", "gauge", "Version of AqualinkD running.");
+  mprintf(io, "aqualinkd_build_info{version=\"%s\"} 1\n", AQUALINKD_VERSION);
+
+  write_rs485_metrics(io);
+  write_ack_latency_metrics(io);
+  write_programmer_metrics(io);
+  write_queue_metrics(io);
+
+  metric_header(io, "aqualinkd_broadcast_seconds", "histogram", "Time to build and send a status broadcast to websockets and MQTT.");
+  write_histogram(io, "aqualinkd_broadcast_seconds", "", &_broadcast, _broadcast_bounds_us, METRIC_BROADCAST_BUCKETS, 1000000.0);
+
+  if (net != NULL) {
+    metric_header(io, "aqualinkd_clients", "gauge", "Open connections, by type.");
+    mprintf(io, "aqualinkd_clients{type=\"websocket\"} %d\n", net->websockets);
+    mprintf(io, "aqualinkd_clients{type=\"websocket_delta\"} %d\n", net->websockets_delta);
+    mprintf(io, "aqualinkd_clients{type=\"mqtt\"} %d\n", net->mqtt);
+    mprintf(io, "aqualinkd_clients{type=\"http\"} %d\n", net->http);
+  }
+}
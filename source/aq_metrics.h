@@ -0,0 +1,37 @@
+#ifndef AQ_METRICS_H_
+#define AQ_METRICS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "aq_programmer.h"
+
+struct mg_iobuf;
+
+/*
+  Always on counters & histograms for /api/metrics (Prometheus text format).
+  Recording is a relaxed atomic add, so it's safe from any thread and cheap enough
+  for the serial read loop.  Everything else (queues, ack latency, log ring) is read
+  from the module that owns it when the metrics are written.
+*/
+
+// Upper bounds, last bucket of each histogram is +Inf
+#define METRIC_PROG_BUCKETS      10
+#define METRIC_BROADCAST_BUCKETS 10
+
+// Connection counts are only known by the net thread, so it passes them in.
+typedef struct net_metrics {
+  int websockets;
+  int websockets_delta;
+  int mqtt;
+  int http;
+} net_metrics;
+
+void metric_rs_packet(const unsigned char *packet, int length);
+void metric_rs_error(int aqserr);
+void metric_prog_job(program_type type, long wait_ms, long run_ms);
+void metric_broadcast(long us);
+
+void write_metrics(struct mg_iobuf *io, const net_metrics *net);
+
+#endif // AQ_METRICS_H_
@@ -28,6 +28,8 @@
 #include "allbutton_aq_programmer.h"
 #include "rs_msg_utils.h"
 #include "iaqualink.h"
+#include "rs_dispatch.h"
+#include "uri_routes.h"
 
 void initPanelButtons(struct aqualinkdata *aqdata, bool rspda, int size, bool combo, bool dual);
 void programDeviceLightMode(struct aqualinkdata *aqdata, int value, int button);
@@ -173,6 +175,9 @@ void checkPanelConfig(struct aqualinkdata *aqdata) {
     }
   }
 
+  // ID's may have been removed above
+  build_rs_dispatch_table();
+
   // At present only need to set extended_device_id for certain things, no need to print warning as it only add to panel load
   // VSP / Chiller / VButtons etc
 /* 
@@ -347,7 +352,7 @@ uint8_t setPanelInformationFromPanelMsg(struct aqualinkdata *aqdata, const char
       }
     }
 
-    aqdata->is_dirty = true;
+    SET_DIRTY(aqdata->is_dirty);
     return rtn;
 }
 
@@ -739,6 +744,9 @@ void setPanel(struct aqualinkdata *aqdata, bool rs, int size, bool combo, bool d
   initPanelButtons(aqdata, rs, nsize, combo, dual);
   
   setPanelString();
+
+  // Every button may have moved, so nothing cached about them is valid.
+  SET_DIRTY(aqdata->is_dirty);
 }
 
 uint16_t getPanelBitmaskFromName(const char *str)
@@ -925,7 +933,7 @@ aqkey *addVirtualButton(struct aqualinkdata *aqdata, char *label, int vindex) {
   button->code = NUL;
   setButtonSpecialMask(button, VIRTUAL_BUTTON);
   //button->special_mask |= VIRTUAL_BUTTON; // Could change to special mask vbutton
-  button->led->state = OFF;
+  SET_IF_CHANGED(button->led->state, OFF, aqdata->is_dirty);
 
   return button;  
 }
@@ -933,6 +941,7 @@ aqkey *addVirtualButton(struct aqualinkdata *aqdata, char *label, int vindex) {
 bool setVirtualButtonLabel(aqkey *button, const char *label) {
 
   button->label = (char *)label;
+  invalidate_uri_button_index();
   
   // These 3 vbuttons have a button code on iaqualink protocol, so use that for rssd_code.
   if (strncasecmp (button->label, "ALL OFF", 7) == 0) {
@@ -963,6 +972,7 @@ bool setVirtualButtonAltLabel(aqkey *button, char *label) {
 
   ((altlabel_detail *)button->special_mask_ptr)->altlabel = (char *)label;
   ((altlabel_detail *)button->special_mask_ptr)->in_alt_mode = false;
+  invalidate_uri_button_index();
   
   //setButtonSpecialMask(button, VIRTUAL_BUTTON_ALT_LABEL);
   //button->special_mask |= VIRTUAL_BUTTON_ALT_LABEL;
@@ -1244,6 +1254,7 @@ void initPanelButtons(struct aqualinkdata *aqdata, bool rs, int size, bool combo
   // Set the sizes for button index
   aqdata->total_buttons = index;
   aqdata->virtual_button_start = 0;
+  invalidate_uri_button_index();
 
   aqdata->rs16_vbutton_start = 13 - (combo?0:1);
   aqdata->rs16_vbutton_end = 16 - (combo?0:1);
@@ -1373,7 +1384,7 @@ bool setDeviceState(struct aqualinkdata *aqdata, int deviceIndex, bool isON, req
   if ( isVS_PUMP(button->special_mask) && isVBUTTON(button->special_mask)) {
     // Virtual Button with VSP is always on.
     LOG(PANL_LOG, LOG_INFO, "received '%s' for '%s', virtual pump is always on, ignoring", (isON == false ? "OFF" : "ON"), button->name);
-    button->led->state = ON;
+    SET_IF_CHANGED(button->led->state, ON, aqdata->is_dirty);
     return false;
   }
 
@@ -1494,11 +1505,11 @@ bool setDeviceState(struct aqualinkdata *aqdata, int deviceIndex, bool isON, req
         if ((button->code == KEY_POOL_HTR || button->code == KEY_SPA_HTR ||
              button->code == KEY_EXT_AUX) &&
             isON > 0) {
-          button->led->state = ENABLE; // if heater and set to on, set pre-status to enable.
+          SET_IF_CHANGED(button->led->state, ENABLE, aqdata->is_dirty); // if heater and set to on, set pre-status to enable.
           LOG(PANL_LOG, LOG_INFO, "Pre-set state of %s to enable\n",button->label);
         //_aqualink_data->updated = true;
         } else if (isRSSA_ENABLED || ((button->special_mask & PROGRAM_LIGHT) != PROGRAM_LIGHT)) {
-          button->led->state = (isON == false ? OFF : ON); // as long as it's not programmable light , pre-set to on/off
+          SET_IF_CHANGED(button->led->state, (isON == false ? OFF : ON), aqdata->is_dirty); // as long as it's not programmable light , pre-set to on/off
           LOG(PANL_LOG, LOG_INFO, "Pre-set state of %s to %s\n",button->label,(isON == false ? "Off" : "On"));
         //_aqualink_data->updated = true;
         }
@@ -1554,7 +1565,7 @@ bool programDeviceValue(struct aqualinkdata *aqdata, action_type type, int value
   
   // Should probably limit this to setpoint and no aq_serial protocol.
   if (expectMultiple) // We can get multiple MQTT requests from some, so this will wait for last one to come in.
-    time(&aqdata->unactioned.requested);
+    aq_time(&aqdata->unactioned.requested);
   else
     aqdata->unactioned.requested = 0;
 
@@ -1594,7 +1605,7 @@ void programDeviceLightBrightness(struct aqualinkdata *aqdata, int value, int de
        if (value != 25 && value !=50 && value !=75 && value != 100) {
         // Setup the rssd to set the light to the right value. 
         //printf("Second programming for %%%d\n",value);
-        time(&aqdata->unactioned.requested);
+        aq_time(&aqdata->unactioned.requested);
         aqdata->unactioned.requested += 5;
         aqdata->unactioned.value = value;
         aqdata->unactioned.type = LIGHT_MODE;
@@ -1616,7 +1627,7 @@ void programDeviceLightBrightness(struct aqualinkdata *aqdata, int value, int de
     /*
     if (value != 25 && value !=50 && value !=75 && value != 100) {
       printf("Second programming for %%%d\n",value);
-      time(&aqdata->unactioned.requested);
+      aq_time(&aqdata->unactioned.requested);
       aqdata->unactioned.requested += 5;
       aqdata->unactioned.value = value;
       aqdata->unactioned.type = LIGHT_MODE;
@@ -1656,7 +1667,7 @@ void programDeviceLightBrightness(struct aqualinkdata *aqdata, int value, int de
     return;
   }
 
-  time(&aqdata->unactioned.requested);
+  aq_time(&aqdata->unactioned.requested);
   aqdata->unactioned.value = value;
   aqdata->unactioned.type = LIGHT_MODE;
   aqdata->unactioned.id = deviceIndex;
@@ -1874,7 +1885,7 @@ bool panel_device_request(struct aqualinkdata *aqdata, action_type type, int dev
 // Programmable light has been updated, so update the status in AqualinkD
 void updateLightProgram(struct aqualinkdata *aqdata, int value, clight_detail *light)
 {
-  light->currentValue = value;
+  SET_IF_CHANGED(light->currentValue, value, aqdata->is_dirty);
   if (value > 0 && light->lastValue != value) {
     light->lastValue = value;
     if (_aqconfig_.save_light_programming_value && light->lightType == LC_PROGRAMABLE ) {
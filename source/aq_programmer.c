@@ -20,6 +20,10 @@
 #include <pthread.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <limits.h>
 
 
 #include "aqualink.h"
@@ -42,6 +46,8 @@
 #include "config.h"
 #include "devices_jandy.h"
 #include "iaqualink.h"
+#include "aq_metrics.h"
+#include "flight_recorder.h"
 
 #ifdef AQ_DEBUG
   #include <time.h>
@@ -435,6 +441,8 @@ const char *get_current_programming_mode_name(struct aqualinkdata *aqdata)
 
 void kick_aq_program_thread(struct aqualinkdata *aqdata, emulation_type source_type)
 {
+  signal_prog_event(source_type);
+
   if ( aqdata->active_thread.thread_id != 0 ) {
     if ( (source_type == ONETOUCH) && in_ot_programming_mode(aqdata))
     {
@@ -461,6 +469,379 @@ void kick_aq_program_thread(struct aqualinkdata *aqdata, emulation_type source_t
 
 
 
+/*
+  Event channel per emulation.
+  The RS side signals whenever it's done something a programmer could be waiting on (processed a
+  packet, sent a programming command), programmers block until their condition is true or the
+  deadline passes, rather than sleeping & polling.
+*/
+#define PROG_EVENT_CHANNELS (SIMULATOR + 1)
+
+static struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  atomic_int waiters;
+} _prog_events[PROG_EVENT_CHANNELS];
+
+static pthread_once_t _prog_events_once = PTHREAD_ONCE_INIT;
+
+static long prog_job_ms_left();
+
+static void init_prog_events()
+{
+  pthread_condattr_t attr;
+  int i;
+
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  for (i=0; i < PROG_EVENT_CHANNELS; i++) {
+    pthread_mutex_init(&_prog_events[i].mutex, NULL);
+    pthread_cond_init(&_prog_events[i].cond, &attr);
+  }
+  pthread_condattr_destroy(&attr);
+}
+
+// Cheap if nobody is waiting, so fine to call on every packet.
+void signal_prog_event(emulation_type source)
+{
+  if (source < 0 || source >= PROG_EVENT_CHANNELS)
+    return;
+  // Whatever the caller just stored (cmd sent, new message) must be visible before we read waiters,
+  // pairs with the waiter's fetch_add before it checks done(). Without it we could both miss each other.
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load(&_prog_events[source].waiters) == 0)
+    return;
+
+  pthread_mutex_lock(&_prog_events[source].mutex);
+  pthread_cond_broadcast(&_prog_events[source].cond);
+  pthread_mutex_unlock(&_prog_events[source].mutex);
+}
+
+// Returns done(arg), ie false if we hit timeout first.
+bool wait_for_prog_event(emulation_type source, bool (*done)(void *arg), void *arg, int timeout_ms)
+{
+  struct timespec deadline;
+  long left_ms;
+  bool rtn;
+
+  if (done(arg))
+    return true;
+  if (source < 0 || source >= PROG_EVENT_CHANNELS)
+    return false;
+  if ((left_ms = prog_job_ms_left()) <= 0)
+    return false;
+  if (timeout_ms > left_ms)
+    timeout_ms = left_ms;
+
+  pthread_once(&_prog_events_once, init_prog_events);
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += timeout_ms / 1000;
+  deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  pthread_mutex_lock(&_prog_events[source].mutex);
+  atomic_fetch_add(&_prog_events[source].waiters, 1);
+
+  while ( !(rtn = done(arg)) &&
+          pthread_cond_timedwait(&_prog_events[source].cond, &_prog_events[source].mutex, &deadline) != ETIMEDOUT) {}
+  if (!rtn)
+    rtn = done(arg);
+
+  atomic_fetch_sub(&_prog_events[source].waiters, 1);
+  pthread_mutex_unlock(&_prog_events[source].mutex);
+
+  return rtn;
+}
+
+/*
+ * Caller holds aqdata->active_thread.thread_mutex.  Wait for the next packet for the emulation we are
+ * programming with (kick_aq_program_thread()), but don't wait forever if the panel goes quiet.
+ */
+bool wait_for_prog_kick(struct aqualinkdata *aqdata)
+{
+  struct timespec deadline;
+  long timeout_ms = PROGRAMMING_KICK_TIMEOUT * 1000;
+  long left_ms;
+
+  if ((left_ms = prog_job_ms_left()) <= 0)
+    return false;
+  if (timeout_ms > left_ms)
+    timeout_ms = left_ms;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeout_ms / 1000;
+  deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  if (pthread_cond_timedwait(&aqdata->active_thread.thread_cond, &aqdata->active_thread.thread_mutex, &deadline) == 0)
+    return true;
+
+  flight_recorder_anomaly("programmer timeout");
+  return false;
+}
+
+static bool prog_cmd_empty(void *cmd)
+{
+  return *(volatile unsigned char *)cmd == NUL;
+}
+
+// Wait for the RS thread to take cmd (programming command byte) off the queue.
+bool wait_for_prog_cmd_sent(emulation_type source, unsigned char *cmd, int timeout_ms)
+{
+  return wait_for_prog_event(source, prog_cmd_empty, cmd, timeout_ms);
+}
+
+static bool prog_cmds_sent(void *arg)
+{
+  switch (*(emulation_type *)arg) {
+    case ALLBUTTON:
+      return !allb_cmd_pending();
+    case ONETOUCH:
+      return !ot_cmd_pending();
+    case IAQTOUCH:
+      return !iaqt_cmd_pending();
+#ifdef AQ_PDA
+    case AQUAPDA:
+      return !pda_cmd_pending();
+#endif
+    default:
+      return true;
+  }
+}
+
+/*
+  Programming jobs.
+  Every programming function used to get it's own thread that then sat waiting for any other one
+  to finish, so bursts of requests piled up threads & ran in whatever order they woke up.
+  Now requests go into a bounded FIFO and one worker thread runs them in order.
+
+  The old 120 second waitForSingleThreadOrTerminate() limit is now a per job watchdog, every programming
+  wait (wait_for_prog_event() / wait_for_prog_kick()) is cut short at the job's deadline and fails once
+  it has passed, so a job stuck on a panel that never answers gives up rather than blocking the queue.
+*/
+typedef struct aq_programmer_job {
+  unsigned int id;
+  program_type type;
+  struct timespec queued_at;   // CLOCK_MONOTONIC
+  struct programmingThreadCtrl ctrl;
+} aq_programmer_job;
+
+static struct {
+  aq_programmer_job jobs[AQ_PROGRAMMER_QUEUE_SIZE];
+  int head;
+  int count;
+  aq_programmer_job running;   // Copy of the job being run, running.id is 0 when idle
+  unsigned int next_id;
+  unsigned int last_done_id;
+  aq_programmer_stats stats;
+  pthread_mutex_t mutex;
+  pthread_cond_t ready;
+  bool started;
+  // Watchdog, programming functions only run on the worker so these are only used from it.
+  struct timespec deadline;    // CLOCK_MONOTONIC
+  bool overdue;
+} _pq = {.next_id = 1, .mutex = PTHREAD_MUTEX_INITIALIZER, .ready = PTHREAD_COND_INITIALIZER};
+
+static long elapsed_ms(const struct timespec *from, const struct timespec *to)
+{
+  return (to->tv_sec - from->tv_sec) * 1000L + (to->tv_nsec - from->tv_nsec) / 1000000L;
+}
+
+// Time the running job has left before the watchdog stops it, LONG_MAX if no job is running.
+static long prog_job_ms_left()
+{
+  struct timespec now;
+  long left;
+
+  if (_pq.running.id == 0)
+    return LONG_MAX;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  left = elapsed_ms(&now, &_pq.deadline);
+
+  if (left <= 0 && !_pq.overdue) {
+    _pq.overdue = true;
+    LOG(PROG_LOG, LOG_ERR, "Programming job %u '%s' still running after %d seconds, stopping it\n",
+                           _pq.running.id, ptypeName(_pq.running.type), AQ_PROGRAMMER_JOB_TIMEOUT);
+    flight_recorder_anomaly("programmer job timeout");
+  }
+
+  return left;
+}
+
+// For programming loops that don't end on a wait timing out.
+bool aq_programmer_job_overdue()
+{
+  return prog_job_ms_left() <= 0;
+}
+
+void *aq_programmer_worker(void *ptr)
+{
+  struct timespec started, finished;
+  aq_programmer_job *job = &_pq.running;
+  long wait_ms, run_ms;
+
+  pthread_mutex_lock(&_pq.mutex);
+
+  while (true) {
+    while (_pq.count == 0)
+      pthread_cond_wait(&_pq.ready, &_pq.mutex);
+
+    *job = _pq.jobs[_pq.head];
+    _pq.head = (_pq.head + 1) % AQ_PROGRAMMER_QUEUE_SIZE;
+    _pq.count--;
+    pthread_mutex_unlock(&_pq.mutex);
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    wait_ms = elapsed_ms(&job->queued_at, &started);
+    job->ctrl.thread_id = pthread_self();
+    _pq.deadline = started;
+    _pq.deadline.tv_sec += AQ_PROGRAMMER_JOB_TIMEOUT;
+    _pq.overdue = false;
+
+    LOG(PROG_LOG, LOG_DEBUG, "Starting programming job %u '%s', queued for %ld ms\n",job->id,ptypeName(job->type),wait_ms);
+
+    // Should check that _prog_functions[type] is valid.
+    _prog_functions[job->type]((void*)&job->ctrl);
+
+    // Function didn't clean up after itself.
+    if (job->ctrl.aqdata->active_thread.thread_id == &job->ctrl.thread_id) {
+      job->ctrl.aqdata->active_thread.thread_id = 0;
+      job->ctrl.aqdata->active_thread.ptype = AQP_NULL;
+      SET_DIRTY(job->ctrl.aqdata->is_dirty);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    run_ms = elapsed_ms(&started, &finished);
+
+    LOG(PROG_LOG, LOG_INFO, "Programming job %u '%s' finished, queued %ld ms, ran %ld ms\n",job->id,ptypeName(job->type),wait_ms,run_ms);
+    metric_prog_job(job->type, wait_ms, run_ms);
+
+    pthread_mutex_lock(&_pq.mutex);
+    _pq.stats.completed++;
+    _pq.stats.total_wait_ms += wait_ms;
+    _pq.stats.total_run_ms += run_ms;
+    _pq.stats.max_wait_ms = AQ_MAX(_pq.stats.max_wait_ms, wait_ms);
+    _pq.stats.max_run_ms = AQ_MAX(_pq.stats.max_run_ms, run_ms);
+    if (_pq.overdue)
+      _pq.stats.timed_out++;
+    _pq.stats.last_type = job->type;
+    _pq.stats.last_wait_ms = wait_ms;
+    _pq.stats.last_run_ms = run_ms;
+    _pq.last_done_id = job->id;
+    job->id = 0;
+  }
+
+  pthread_mutex_unlock(&_pq.mutex);
+  return ptr;
+}
+
+// Returns job id, or 0 if it couldn't be queued.
+static unsigned int queue_aq_programmer_job(program_type type, struct programmingThreadCtrl *ctrl)
+{
+  aq_programmer_job *job;
+  unsigned int id = 0;
+  pthread_t thread_id;
+
+  pthread_mutex_lock(&_pq.mutex);
+
+  if (!_pq.started) {
+    if( pthread_create( &thread_id , NULL ,  aq_programmer_worker, NULL) != 0) {
+      LOG(PROG_LOG, LOG_ERR, "could not create programming thread\n");
+      pthread_mutex_unlock(&_pq.mutex);
+      return 0;
+    }
+    pthread_detach(thread_id);
+    _pq.started = true;
+  }
+
+  if (_pq.count >= AQ_PROGRAMMER_QUEUE_SIZE) {
+    _pq.stats.rejected++;
+    LOG(PROG_LOG, LOG_ERR, "Programming queue full, ignoring '%s'\n",ptypeName(type));
+  } else {
+    job = &_pq.jobs[(_pq.head + _pq.count) % AQ_PROGRAMMER_QUEUE_SIZE];
+    job->id = id = _pq.next_id++;
+    if (_pq.next_id == 0) // 0 means none
+      _pq.next_id = 1;
+    job->type = type;
+    job->ctrl = *ctrl;
+    clock_gettime(CLOCK_MONOTONIC, &job->queued_at);
+
+    _pq.count++;
+    _pq.stats.queued++;
+    _pq.stats.max_depth = AQ_MAX(_pq.stats.max_depth, _pq.count);
+    pthread_cond_signal(&_pq.ready);
+  }
+
+  pthread_mutex_unlock(&_pq.mutex);
+
+  return id;
+}
+
+// Only jobs that haven't started can be cancelled.
+bool cancel_aq_programmer_job(unsigned int id)
+{
+  int i, j;
+  bool found = false;
+
+  pthread_mutex_lock(&_pq.mutex);
+  for (i=0; i < _pq.count; i++) {
+    if (_pq.jobs[(_pq.head + i) % AQ_PROGRAMMER_QUEUE_SIZE].id == id) {
+      LOG(PROG_LOG, LOG_NOTICE, "Cancelled programming job %u '%s'\n",id,ptypeName(_pq.jobs[(_pq.head + i) % AQ_PROGRAMMER_QUEUE_SIZE].type));
+      for (j=i; j < _pq.count-1; j++)
+        _pq.jobs[(_pq.head + j) % AQ_PROGRAMMER_QUEUE_SIZE] = _pq.jobs[(_pq.head + j + 1) % AQ_PROGRAMMER_QUEUE_SIZE];
+      _pq.count--;
+      _pq.stats.cancelled++;
+      found = true;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&_pq.mutex);
+
+  return found;
+}
+
+// Running job (if any) first, then queued in the order they will run.
+int get_aq_programmer_jobs(aq_programmer_job_info *jobs, int max)
+{
+  struct timespec now;
+  aq_programmer_job *job;
+  int i, n = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  pthread_mutex_lock(&_pq.mutex);
+  for (i=-1; i < _pq.count && n < max; i++) {
+    job = (i < 0) ? &_pq.running : &_pq.jobs[(_pq.head + i) % AQ_PROGRAMMER_QUEUE_SIZE];
+    if (job->id == 0)
+      continue;
+    jobs[n].id = job->id;
+    jobs[n].type = job->type;
+    jobs[n].running = (i < 0);
+    jobs[n].age_ms = elapsed_ms(&job->queued_at, &now);
+    n++;
+  }
+  pthread_mutex_unlock(&_pq.mutex);
+
+  return n;
+}
+
+void get_aq_programmer_stats(aq_programmer_stats *stats)
+{
+  pthread_mutex_lock(&_pq.mutex);
+  *stats = _pq.stats;
+  stats->depth = _pq.count;
+  pthread_mutex_unlock(&_pq.mutex);
+}
+
+
 #ifdef NEW_AQ_PROGRAMMER
 void _aq_programmer_(program_type r_type, aqkey *button, int value, int alt_value, struct aqualinkdata *aqdata, bool allowOveride);
 
@@ -494,10 +875,13 @@ void _aq_programmer_(program_type r_type, aqkey *button, int value, int alt_valu
 void _aq_programmer_(program_type r_type, char *args, aqkey *button, int value, int alt_value, struct aqualinkdata *aqdata, bool allowOveride)
 #endif
 {
-  struct programmingThreadCtrl *programmingthread = malloc(sizeof(struct programmingThreadCtrl));
+  struct programmingThreadCtrl ctrl;
+  struct programmingThreadCtrl *programmingthread = &ctrl;
 
   program_type type = r_type;
 
+  memset(&ctrl, 0, sizeof(ctrl));
+
   // RS SerialAdapter is quickest for changing thermostat temps, so use that if enabeled.
   // VSP RPM can only be changed with oneTouch or iAquatouch so check / use those
   // VSP Program is only available with iAquatouch, so check / use that.
@@ -679,7 +1063,7 @@ void _aq_programmer_(program_type r_type, char *args, aqkey *button, int value,
   }
 
 
-  LOG(PROG_LOG, LOG_NOTICE, "Starting programming thread '%s'\n",ptypeName(type));
+  LOG(PROG_LOG, LOG_NOTICE, "Queueing programming job '%s'\n",ptypeName(type));
 
   programmingthread->aqdata = aqdata;
   programmingthread->thread_id = 0;
@@ -729,11 +1113,7 @@ void _aq_programmer_(program_type r_type, char *args, aqkey *button, int value,
       return; // No need to create this as thread.
       break;
     default:
-      // Should check that _prog_functions[type] is valid.
-      if( pthread_create( &programmingthread->thread_id , NULL ,  _prog_functions[type], (void*)programmingthread) < 0) {
-        LOG(PROG_LOG, LOG_ERR, "could not create thread\n");
-        return;
-      }
+      queue_aq_programmer_job(type, programmingthread);
     break;
   }
 #else
@@ -771,60 +1151,22 @@ void _aq_programmer_(program_type r_type, char *args, aqkey *button, int value,
       return; // No need to create this as thread.
       break;
     default:
-      // Should check that _prog_functions[type] is valid.
-      if( pthread_create( &programmingthread->thread_id , NULL ,  _prog_functions[type], (void*)programmingthread) < 0) {
-        LOG(PROG_LOG, LOG_ERR, "could not create thread\n");
-        return;
-      }
+      queue_aq_programmer_job(type, programmingthread);
     break;
   }
 #endif
-  
-  if ( programmingthread->thread_id != 0 ) {
-    //LOG(PROG_LOG, LOG_DEBUG, "********* DID pthread_detach %d\n",programmingthread->thread_id);
-    pthread_detach(programmingthread->thread_id);
-  } else {
-    //LOG(PROG_LOG, LOG_DEBUG, "********* DID NOT pthread_detach\n");
-  }
 }
 
 
+// Jobs are run one at a time by the programmer worker, so there is nothing to wait for anymore, just mark us active.
 void waitForSingleThreadOrTerminate(struct programmingThreadCtrl *threadCtrl, program_type type)
 {
-  //static int tries = 120;
-  int tries = 120;
-  static int waitTime = 1;
-  int i=0;
-
   // Make sure to update UI
   SET_DIRTY(threadCtrl->aqdata->is_dirty);
-/*
-  i = 0;
-  while (get_aq_cmd_length() > 0 && ( i++ <= tries) ) {
-    LOG(PROG_LOG, LOG_DEBUG, "Thread %p (%s) sleeping, waiting command queue to empty\n", &threadCtrl->thread_id, ptypeName(type));
-    sleep(waitTime);
-  }
-  if (i >= tries) {
-    LOG(PROG_LOG, LOG_ERR, "Thread %p (%s) timeout waiting, ending\n",&threadCtrl->thread_id,ptypeName(type));
-    free(threadCtrl);
-    pthread_exit(0);
-  }
-*/
-  while ( (threadCtrl->aqdata->active_thread.thread_id != 0) && ( i++ <= tries) ) {
-    //LOG(PROG_LOG, LOG_DEBUG, "Thread %d sleeping, waiting for thread %d to finish\n", threadCtrl->thread_id, threadCtrl->aqdata->active_thread.thread_id);
-    LOG(PROG_LOG, LOG_DEBUG, "Thread %p (%s) sleeping, waiting for thread %p (%s) to finish\n",
-                &threadCtrl->thread_id, ptypeName(type),
-                threadCtrl->aqdata->active_thread.thread_id, ptypeName(threadCtrl->aqdata->active_thread.ptype));
-    sleep(waitTime);
-  }
-  
-  if (i >= tries) {
-    //LOG(PROG_LOG, LOG_ERR, "Thread %d timeout waiting, ending\n",threadCtrl->thread_id);
-    LOG(PROG_LOG, LOG_ERR, "Thread (%s) %p timeout waiting for thread (%s) %p to finish\n",
-                ptypeName(type), &threadCtrl->thread_id, ptypeName(threadCtrl->aqdata->active_thread.ptype),
-                threadCtrl->aqdata->active_thread.thread_id);
-    free(threadCtrl);
-    pthread_exit(0);
+
+  if (threadCtrl->aqdata->active_thread.thread_id != 0 && threadCtrl->aqdata->active_thread.thread_id != &threadCtrl->thread_id) {
+    LOG(PROG_LOG, LOG_ERR, "Programming (%s) started while (%s) still active\n",
+                ptypeName(type), ptypeName(threadCtrl->aqdata->active_thread.ptype));
   }
  
   // Clear out any messages to the UI.
@@ -863,16 +1205,18 @@ void cleanAndTerminateThread(struct programmingThreadCtrl *threadCtrl)
              elapsed.tv_sec, elapsed.tv_nsec / 1000000L);
   #endif
 
-  // Quick delay to allow for last message to be sent.
-  delay(500);
+  // Allow for last message to be sent.
+  {
+    emulation_type mode = get_programming_mode(threadCtrl->aqdata->active_thread.ptype);
+    wait_for_prog_event(mode, prog_cmds_sent, &mode, 500);
+  }
   threadCtrl->aqdata->active_thread.thread_id = 0;
   threadCtrl->aqdata->active_thread.ptype = AQP_NULL;
   threadCtrl->thread_id = 0;
   // Force update, change display message
   //threadCtrl->aqdata->is_dirty = true;
   SET_DIRTY(threadCtrl->aqdata->is_dirty);
-  free(threadCtrl);
-  pthread_exit(0);
+  // Programming function returns to the worker after this.
 }
 
 
@@ -3,6 +3,8 @@
 #define AQ_PROGRAMMER_H_
 
 #include <pthread.h>
+#include <stdint.h>
+#include <stdbool.h>
 //#include "aqualink.h"
 
 #define NEW_AQ_PROGRAMMER
@@ -11,6 +13,7 @@
 //#define PROGRAMMING_POLL_DELAY_TIME 2
 //#define PROGRAMMING_POLL_DELAY_TIME 5
 #define PROGRAMMING_POLL_COUNTER 200
+#define PROGRAMMING_KICK_TIMEOUT 5 // seconds to wait for next packet before giving up on it
 
 // need to get the C values from aqualink manual and add those just incase
 // someone has the controller set to C.
@@ -214,9 +217,48 @@ void queueGetProgramData(emulation_type source_type, struct aqualinkdata *aq_dat
 //void queueGetExtendedProgramData(emulation_type source_type, struct aqualinkdata *aq_data, bool labels);
 //unsigned char pop_aq_cmd(struct aqualinkdata *aq_data);
 
+// Per emulation event channel, see aq_programmer.c
+void signal_prog_event(emulation_type source);
+bool wait_for_prog_event(emulation_type source, bool (*done)(void *arg), void *arg, int timeout_ms);
+bool wait_for_prog_cmd_sent(emulation_type source, unsigned char *cmd, int timeout_ms);
+bool wait_for_prog_kick(struct aqualinkdata *aqdata);
+
 void waitForSingleThreadOrTerminate(struct programmingThreadCtrl *threadCtrl, program_type type);
 void cleanAndTerminateThread(struct programmingThreadCtrl *threadCtrl);
 
+// Programming jobs are queued and run in order by a single worker thread.
+#define AQ_PROGRAMMER_QUEUE_SIZE 16
+#define AQ_PROGRAMMER_JOB_TIMEOUT 120 // seconds a job can run before it's programming waits start failing
+
+typedef struct aq_programmer_job_info {
+  unsigned int id;
+  program_type type;
+  bool running;
+  long age_ms;            // Since it was queued
+} aq_programmer_job_info;
+
+typedef struct aq_programmer_stats {
+  uint32_t depth;         // Jobs waiting right now
+  uint32_t max_depth;
+  uint64_t queued;
+  uint64_t completed;
+  uint64_t rejected;      // Queue was full
+  uint64_t cancelled;
+  uint64_t timed_out;     // Stopped by the job watchdog (also counted in completed)
+  uint64_t total_wait_ms; // Time completed jobs spent in the queue
+  uint64_t total_run_ms;
+  long max_wait_ms;
+  long max_run_ms;
+  program_type last_type;
+  long last_wait_ms;
+  long last_run_ms;
+} aq_programmer_stats;
+
+bool cancel_aq_programmer_job(unsigned int id);
+bool aq_programmer_job_overdue();
+int  get_aq_programmer_jobs(aq_programmer_job_info *jobs, int max);
+void get_aq_programmer_stats(aq_programmer_stats *stats);
+
 void force_queue_delete(); // NSF This needs to be deleted  (come back and fix)
 
 
@@ -20,7 +20,9 @@
 #include <ctype.h>
 #include <sys/mount.h>
 #include <sys/statvfs.h>
-#include <regex.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 
 #include "mongoose.h"
@@ -31,12 +33,14 @@
 //#include "utils.h"
 #include "aq_systemutils.h"
 #include "net_interface.h"
+#include "net_services.h"
+#include "json_writer.h"
 
 
 /*
-Example /etc/cron.d/aqualinkd
+Example aqualinkd.schedule (was /etc/cron.d/aqualinkd)
 
-01 10 1 * * curl localhost:80/api/Filter_Pump/set -d value=2 -X PUT
+01 10 1 * * root curl localhost:80/api/Filter_Pump/set -d value=2 -X PUT
 */
 
 
@@ -114,210 +118,713 @@ bool passJson_scObj(const char* line, int length, aqs_cron *values)
 
 
 
-int save_schedules_js(const char* inBuf, int inSize, char* outBuf, int outSize)
+/*
+  Schedules used to be run by cron, curl'ing our own API for every action.  Now they are kept
+  in memory with the next time each one is due, a min-heap orders them and one thread sleeps
+  until the first is due and calls the action directly.
+  They are still saved in cron format (SCHEDULE_FILE, next to the config file) so nothing
+  changes for the UI, and an existing CRON_FILE is imported once.
+*/
+
+#define MAX_SCHEDULES 64
+#define SCHEDULE_MISSED_LIMIT 120 // seconds, later than this and clock has jumped (NTP at boot), so don't fire
+#define SCHEDULE_SEARCH_LIMIT 5000
+
+typedef struct aqs_schedule {
+  aqs_cron cron;
+  uint64_t minutes;
+  uint32_t hours;
+  uint32_t daym;    // bit 1-31
+  uint16_t months;  // bit 1-12
+  uint8_t dayw;     // bit 0-6, Sunday 0
+  bool daym_any;
+  bool dayw_any;
+  time_t next;
+} aqs_schedule;
+
+static struct {
+  aqs_schedule schedules[MAX_SCHEDULES];
+  int num_schedules;
+  aqs_schedule *heap[MAX_SCHEDULES];
+  int heap_size;
+  bool loaded;
+  bool running;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} _aqs = {.mutex = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER};
+
+static const char *schedule_file()
 {
-  FILE *fp;
+  static char path[PATH_MAX];
+  const char *slash;
+
+  if (path[0] == '\0') {
+    if (_aqconfig_.config_file != NULL && (slash = strrchr(_aqconfig_.config_file, '/')) != NULL)
+      snprintf(path, sizeof(path), "%.*s/%s", (int)(slash - _aqconfig_.config_file), _aqconfig_.config_file, SCHEDULE_FILE);
+    else
+      snprintf(path, sizeof(path), "/etc/%s", SCHEDULE_FILE);
+  }
+  return path;
+}
+
+static const char *const _cron_months[] = {"jan","feb","mar","apr","may","jun","jul","aug","sep","oct","nov","dec",NULL};
+static const char *const _cron_days[] = {"sun","mon","tue","wed","thu","fri","sat",NULL};
+
+// A number, or one of cron's three letter names (case insensitive) where names[0] is min.
+static long parse_cron_value(const char *ptr, const char **end, const char *const *names, int min)
+{
+  char *nend;
+  long value;
   int i;
-  bool inarray = false;
+
+  value = strtol(ptr, &nend, 10);
+  *end = nend;
+  if (nend != ptr || names == NULL)
+    return value;
+
+  for (i=0; names[i] != NULL; i++) {
+    if (strncasecmp(ptr, names[i], 3) == 0 && !isalpha((unsigned char)ptr[3])) {
+      *end = ptr + 3;
+      return min + i;
+    }
+  }
+  return 0;
+}
+
+// One cron field ie "*", "5", "1-5", "*/15", "0,30", "8-18/2", "mon-fri".  Bit n set if n matches.
+static bool parse_cron_field(const char *field, int min, int max, const char *const *names, uint64_t *mask, bool *any)
+{
+  const char *ptr = field;
+  const char *end;
+  char *send;
+  long start, stop, step, i;
+
+  *mask = 0;
+  if (any != NULL)
+    *any = (strcmp(field, "*") == 0);
+
+  while (*ptr != '\0') {
+    step = 1;
+    if (*ptr == '*') {
+      start = min;
+      stop = max;
+      ptr++;
+    } else {
+      start = stop = parse_cron_value(ptr, &end, names, min);
+      if (end == ptr)
+        return false;
+      ptr = end;
+      if (*ptr == '-') {
+        stop = parse_cron_value(++ptr, &end, names, min);
+        if (end == ptr)
+          return false;
+        ptr = end;
+      }
+    }
+    if (*ptr == '/') {
+      step = strtol(++ptr, &send, 10);
+      if (send == ptr || step <= 0)
+        return false;
+      ptr = send;
+      if (start == stop)
+        stop = max;
+    }
+    if (start < min || stop > max || start > stop)
+      return false;
+
+    for (i = start; i <= stop; i += step)
+      *mask |= ((uint64_t)1 << i);
+
+    if (*ptr == ',')
+      ptr++;
+    else if (*ptr != '\0')
+      return false;
+  }
+
+  return (*mask != 0);
+}
+
+static bool compile_schedule(aqs_schedule *sch)
+{
+  uint64_t mask;
+
+  if (!parse_cron_field(sch->cron.minute, 0, 59, NULL, &sch->minutes, NULL))
+    return false;
+  if (!parse_cron_field(sch->cron.hour, 0, 23, NULL, &mask, NULL))
+    return false;
+  sch->hours = (uint32_t)mask;
+  if (!parse_cron_field(sch->cron.daym, 1, 31, NULL, &mask, &sch->daym_any))
+    return false;
+  sch->daym = (uint32_t)mask;
+  if (!parse_cron_field(sch->cron.month, 1, 12, _cron_months, &mask, NULL))
+    return false;
+  sch->months = (uint16_t)mask;
+  if (!parse_cron_field(sch->cron.dayw, 0, 7, _cron_days, &mask, &sch->dayw_any))
+    return false;
+  // 7 is also Sunday
+  sch->dayw = (uint8_t)((mask | (mask >> 7)) & 0x7F);
+
+  return true;
+}
+
+static bool schedule_day_matches(const aqs_schedule *sch, const struct tm *tm)
+{
+  bool daym = (sch->daym & (1u << tm->tm_mday)) != 0;
+  bool dayw = (sch->dayw & (1u << tm->tm_wday)) != 0;
+
+  // Same as cron, if both are restricted either one matching is enough
+  if (sch->daym_any && sch->dayw_any)
+    return true;
+  if (sch->daym_any)
+    return dayw;
+  if (sch->dayw_any)
+    return daym;
+  return (daym || dayw);
+}
+
+static time_t normalize_tm(struct tm *tm)
+{
+  time_t t;
+
+  tm->tm_isdst = -1;
+  t = mktime(tm);
+  localtime_r(&t, tm);
+  return t;
+}
+
+// First minute after 'after' the schedule matches, -1 if it never does (ie 31st Feb).
+static time_t next_fire_time(const aqs_schedule *sch, time_t after)
+{
+  struct tm tm;
+  time_t t;
+  int i;
+
+  localtime_r(&after, &tm);
+  tm.tm_sec = 0;
+  tm.tm_min++;
+  t = normalize_tm(&tm);
+
+  // Skip whole months / days / hours that don't match, so this is only a few loops
+  for (i=0; i < SCHEDULE_SEARCH_LIMIT; i++) {
+    if ( (sch->months & (1u << (tm.tm_mon + 1))) == 0 ) {
+      tm.tm_mon++; tm.tm_mday = 1; tm.tm_hour = 0; tm.tm_min = 0;
+    } else if ( !schedule_day_matches(sch, &tm) ) {
+      tm.tm_mday++; tm.tm_hour = 0; tm.tm_min = 0;
+    } else if ( (sch->hours & (1u << tm.tm_hour)) == 0 ) {
+      tm.tm_hour++; tm.tm_min = 0;
+    } else if ( (sch->minutes & ((uint64_t)1 << tm.tm_min)) == 0 ) {
+      tm.tm_min++;
+    } else {
+      return t;
+    }
+    t = normalize_tm(&tm);
+  }
+
+  return (time_t)-1;
+}
+
+/*
+  Cron line we write (and have always written), optional leading # means disabled.
+  01 10 1 * * root curl -s -S --show-error -o /dev/null localhost:80/api/Filter_Pump/set -d value=2 -X PUT
+*/
+static bool parse_cron_line(const char *line, aqs_cron *cline)
+{
+  char *fields[5] = {cline->minute, cline->hour, cline->daym, cline->month, cline->dayw};
+  const char *ptr = line;
+  const char *url;
+  const char *url_end = NULL;
+  const char *value;
+  const char *set;
+  int i, len;
+
+  memset(cline, 0, sizeof(aqs_cron));
+  cline->enabled = true;
+
+  while (isspace((unsigned char)*ptr))
+    ptr++;
+  if (*ptr == '#') {
+    cline->enabled = false;
+    ptr++;
+  }
+
+  for (i=0; i < 5; i++) {
+    while (isspace((unsigned char)*ptr))
+      ptr++;
+    for (len=0; ptr[len] != '\0' && !isspace((unsigned char)ptr[len]); len++) {}
+    if (len == 0 || len >= CV_SIZE)
+      return false;
+    sprintf(fields[i], "%.*s", len, ptr);
+    ptr += len;
+  }
+
+  if ( (url = strstr(ptr, "/api/")) == NULL || (value = strstr(url, " value=")) == NULL )
+    return false;
+
+  // URL runs to the last /set before the value
+  for (set = url; (set = strstr(set, "/set")) != NULL && set < value; set += 4)
+    url_end = set + 4;
+  if (url_end == NULL || url_end - url >= (int)sizeof(cline->url))
+    return false;
+  sprintf(cline->url, "%.*s", (int)(url_end - url), url);
+
+  value += 7;
+  for (len=0; isdigit((unsigned char)value[len]); len++) {}
+  if (len == 0 || len >= CV_SIZE)
+    return false;
+  sprintf(cline->value, "%.*s", len, value);
+
+  return true;
+}
+
+// Must hold mutex
+static void heap_swap(int a, int b)
+{
+  aqs_schedule *tmp = _aqs.heap[a];
+  _aqs.heap[a] = _aqs.heap[b];
+  _aqs.heap[b] = tmp;
+}
+
+// Must hold mutex
+static void heap_down(int i)
+{
+  int child;
+
+  while ( (child = 2 * i + 1) < _aqs.heap_size ) {
+    if (child + 1 < _aqs.heap_size && _aqs.heap[child + 1]->next < _aqs.heap[child]->next)
+      child++;
+    if (_aqs.heap[i]->next <= _aqs.heap[child]->next)
+      break;
+    heap_swap(i, child);
+    i = child;
+  }
+}
+
+// Must hold mutex
+static void heap_push(aqs_schedule *sch)
+{
+  int i = _aqs.heap_size++;
+
+  _aqs.heap[i] = sch;
+  while (i > 0 && _aqs.heap[(i - 1) / 2]->next > _aqs.heap[i]->next) {
+    heap_swap(i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+// Must hold mutex
+static void heap_pop()
+{
+  _aqs.heap[0] = _aqs.heap[--_aqs.heap_size];
+  heap_down(0);
+}
+
+// Must hold mutex, work out when everything is next due.
+static void rebuild_schedule_heap()
+{
+  time_t now = time(NULL);
+  int i;
+
+  _aqs.heap_size = 0;
+  for (i=0; i < _aqs.num_schedules; i++) {
+    if (!_aqs.schedules[i].cron.enabled)
+      continue;
+    if ( (_aqs.schedules[i].next = next_fire_time(&_aqs.schedules[i], now)) != (time_t)-1 )
+      heap_push(&_aqs.schedules[i]);
+  }
+
+  pthread_cond_broadcast(&_aqs.cond);
+}
+
+// Must hold mutex
+static bool add_schedule(const aqs_cron *cline)
+{
+  aqs_schedule *sch;
+
+  if (_aqs.num_schedules >= MAX_SCHEDULES) {
+    LOG(SCHD_LOG,LOG_ERR, "Too many schedules, maximum is %d, ignoring %s %s\n", MAX_SCHEDULES, cline->url, cline->value);
+    return false;
+  }
+
+  sch = &_aqs.schedules[_aqs.num_schedules];
+  memset(sch, 0, sizeof(aqs_schedule));
+  sch->cron = *cline;
+  if (!compile_schedule(sch)) {
+    LOG(SCHD_LOG,LOG_ERR, "Couldn't understand schedule '%s %s %s %s %s', ignoring\n", cline->minute, cline->hour, cline->daym, cline->month, cline->dayw);
+    return false;
+  }
+
+  _aqs.num_schedules++;
+  return true;
+}
+
+// Must hold mutex
+static int read_schedule_file(const char *filename)
+{
+  FILE *fp;
+  char *line = NULL;
+  size_t len = 0;
   aqs_cron cline;
-  bool fileexists = false;
-  bool fs = false;
-  const net_iface *iface = get_first_valid_interface();
+  int count = 0;
 
-  if ( !_aqconfig_.enable_scheduler) {
-    LOG(SCHD_LOG,LOG_WARNING, "Schedules are disabled\n");
-    return sprintf(outBuf, "{\"message\":\"Error Schedules disabled\"}");
+  if ( (fp = fopen(filename, "r")) == NULL)
+    return -1;
+
+  while (getline(&line, &len, fp) != -1) {
+    if (parse_cron_line(line, &cline)) {
+      LOG(SCHD_LOG,LOG_DEBUG, "Read schedule. Enabled:%d Min:%s Hour:%s DayM:%s Month:%s DayW:%s URL:%s Value:%s\n",cline.enabled,cline.minute,cline.hour,cline.daym,cline.month,cline.dayw,cline.url,cline.value);
+      if (add_schedule(&cline))
+        count++;
+    }
   }
 
-  LOG(SCHD_LOG,LOG_NOTICE, "Saving Schedule:\n");
-  
-  /*
-  bool fs = remount_root_ro(false);
-  if (access(CRON_FILE, F_OK) == 0)
-    fileexists = true;
-  fp = fopen(CRON_FILE, "w");
-  */
-  
-  fp = aq_open_file( CRON_FILE, &fs, &fileexists);
+  free(line);
+  fclose(fp);
+
+  return count;
+}
+
+// Must hold mutex
+static bool write_schedule_file(const char *filename)
+{
+  FILE *fp;
+  bool fs = false;
+  bool fileexists = false;
+  int i;
+  const net_iface *iface = get_first_valid_interface();
+  aqs_cron *cline;
+
+  fp = aq_open_file( (char *)filename, &fs, &fileexists);
 
   if (fp == NULL) {
-    LOG(SCHD_LOG,LOG_ERR, "Open file failed '%s'\n", CRON_FILE);
-    //remount_root_ro(true);
+    LOG(SCHD_LOG,LOG_ERR, "Open file failed '%s'\n", filename);
     aq_close_file(fp, fs);
-    return sprintf(outBuf, "{\"message\":\"Error Saving Schedules\"}");
+    return false;
   }
 
   fprintf(fp, "#***** AUTO GENERATED DO NOT EDIT *****\n");
   fprintf(fp, "PATH=/usr/local/sbin:/usr/local/bin:/sbin:/bin:/usr/sbin:/usr/bin\n");
 
-  LOG(SCHD_LOG,LOG_DEBUG, "Schedules Message body:\n'%.*s'\n", inSize, inBuf);
-
-  for (i=0; i < inSize; i++) {
-      if ( inBuf[i] == '[' ) {
-        inarray=true;
-      } else if ( inBuf[i] == ']' ) {
-        inarray=false;
-      } else if ( inarray && inBuf[i] == '{') {
-        passJson_scObj( &inBuf[i], (inSize-i), &cline);
-        LOG(SCHD_LOG,LOG_DEBUG, "Write to cron Min:%s Hour:%s DayM:%s Month:%s DayW:%s URL:%s Value:%s\n",cline.minute,cline.hour,cline.daym,cline.month,cline.dayw,cline.url,cline.value);
-        //LOG(SCHD_LOG,LOG_INFO, "%s%s %s %s %s %s curl -s -S --show-error -o /dev/null localhost:%s%s -d value=%s -X PUT\n",(cline.enabled?"":"#"),cline.minute, cline.hour, cline.daym, cline.month, cline.dayw, _aqconfig_.socket_port, cline.url, cline.value);
-        //fprintf(fp, "%s%s %s %s %s %s root curl -s -S --show-error -o /dev/null localhost:%s%s -d value=%s -X PUT\n",(cline.enabled?"":"#"),cline.minute, cline.hour, cline.daym, cline.month, cline.dayw, _aqconfig_.socket_port, cline.url, cline.value);
-        LOG(SCHD_LOG,LOG_INFO, "%s%s %s %s %s %s curl -s -S --show-error %s -o /dev/null %s%s -d value=%s -X PUT\n",(cline.enabled?"":"#"),cline.minute, cline.hour, cline.daym, cline.month, cline.dayw, (iface->isLocalurlTLS?"--insecure":""),(iface->localurl==NULL?_aqconfig_.listen_address:iface->localurl), cline.url, cline.value);
-        fprintf(fp, "%s%s %s %s %s %s root curl -s -S --show-error %s -o /dev/null %s%s -d value=%s -X PUT\n",(cline.enabled?"":"#"),cline.minute, cline.hour, cline.daym, cline.month, cline.dayw, (iface->isLocalurlTLS?"--insecure":""),(iface->localurl==NULL?_aqconfig_.listen_address:iface->localurl), cline.url, cline.value);      
-      }
+  for (i=0; i < _aqs.num_schedules; i++) {
+    cline = &_aqs.schedules[i].cron;
+    LOG(SCHD_LOG,LOG_INFO, "%s%s %s %s %s %s %s=%s\n",(cline->enabled?"":"#"),cline->minute, cline->hour, cline->daym, cline->month, cline->dayw, cline->url, cline->value);
+    fprintf(fp, "%s%s %s %s %s %s root curl -s -S --show-error %s -o /dev/null %s%s -d value=%s -X PUT\n",(cline->enabled?"":"#"),cline->minute, cline->hour, cline->daym, cline->month, cline->dayw, (iface->isLocalurlTLS?"--insecure":""),(iface->localurl[0]=='\0'?_aqconfig_.listen_address:iface->localurl), cline->url, cline->value);
   }
-    
-  fprintf(fp, "#***** AUTO GENERATED DO NOT EDIT *****\n");
 
-  //fclose(fp);
+  fprintf(fp, "#***** AUTO GENERATED DO NOT EDIT *****\n");
 
   // if we created file, change the permissions
   if (!fileexists)
-    if ( chmod(CRON_FILE, S_IRUSR | S_IWUSR ) < 0 )
-      LOG(SCHD_LOG,LOG_ERR, "Could not change permissions on cron file %s, scheduling may not work\n",CRON_FILE);
+    if ( chmod(filename, S_IRUSR | S_IWUSR ) < 0 )
+      LOG(SCHD_LOG,LOG_WARNING, "Could not change permissions on schedule file %s\n",filename);
 
-  //remount_root_ro(fs);
   aq_close_file(fp, fs);
 
-  return sprintf(outBuf, "{\"message\":\"Saved Schedules\"}");
+  return true;
 }
 
-int build_schedules_js(char* buffer, int size)
+#define CRON_FILE_RETIRED "# AqualinkD now runs it's own schedules"
+
+// Already emptied by us, so nothing for cron to run (saves a rw remount every start).
+static bool cron_file_retired()
 {
-  memset(&buffer[0], 0, size);
+  char line[sizeof(CRON_FILE_RETIRED)];
   FILE *fp;
-  char *line = NULL;
-  int length = 0;
-  int rc;
-  aqs_cron cline;
-  size_t len = 0;
-  ssize_t read_size;
-  regex_t regexCompiled;
+  bool rtn = false;
 
-  if ( !_aqconfig_.enable_scheduler) {
-    LOG(SCHD_LOG,LOG_WARNING, "Schedules are disabled\n");
-    if (size > 0)
-      length += sprintf(buffer, "{\"message\":\"Error Schedules disabled\"}");
-    return length;
+  if ( (fp = fopen(CRON_FILE, "r")) == NULL)
+    return false;
+
+  if (fgets(line, sizeof(line), fp) != NULL)
+    rtn = (strncmp(line, CRON_FILE_RETIRED, strlen(CRON_FILE_RETIRED)) == 0);
+
+  fclose(fp);
+  return rtn;
+}
+
+// Cron would run the same schedules again, so empty it once we have what's in it.
+static void retire_cron_file()
+{
+  struct stat st;
+  FILE *fp;
+  bool fs = false;
+  bool fileexists = false;
+
+  if (lstat(CRON_FILE, &st) != 0)
+    return;
+
+  if (S_ISREG(st.st_mode) && cron_file_retired())
+    return;
+
+  if (S_ISLNK(st.st_mode)) {
+    fs = remount_root_ro(false);
+    if (unlink(CRON_FILE) != 0)
+      LOG(SCHD_LOG,LOG_ERR, "Couldn't remove link %s, schedules may run twice\n", CRON_FILE);
+    remount_root_ro(fs);
+    return;
+  }
+
+  if ( (fp = aq_open_file(CRON_FILE, &fs, &fileexists)) == NULL) {
+    LOG(SCHD_LOG,LOG_ERR, "Couldn't clear %s, schedules may run twice\n", CRON_FILE);
+    aq_close_file(fp, fs);
+    return;
   }
+  fprintf(fp, "%s, they have been moved to %s\n", CRON_FILE_RETIRED, schedule_file());
+  aq_close_file(fp, fs);
+}
 
-  // Below works for curl but not /usr/bin/curl in command.  NSF come back and fix the regexp
-  //char *regexString="([^\\s]+)\\s([^\\s]+)\\s([^\\s]+)\\s([^\\s]+)\\s([^\\s]+)\\s([^\\s]+)\\s.*(/api/.*)\\s-d value=([^\\d]+)\\s(.*)";
-  // \d doesn't seem to be supported, so using [0-9]+ instead
-  //char *regexString="([^\\s]+)\\s([^\\s]+)\\s([^\\s]+)\\s([^\\s]+)\\s([^\\s]+)\\s([^\\s]+)\\s.*(\\/api\\/.*\\/set).* value=([0-9]+).*";
-  
-  //char *regexString="([^\\s]+)\\s([^\\s]+)\\s([^\\s]+)\\s([^\\s]+)\\s([^\\s]+)\\s([^\\s]+)\\s([^\\s]+)\\s.*(\\/api\\/.*\\/set).* value=([0-9]+).*";
-  const char *regexString="(#{0,1})([^\\s]+)\\s([^\\s]+)\\s([^\\s]+)\\s([^\\s]+)\\s([^\\s]+)\\s([^\\s]+)\\s([^\\s]+)\\s.*(\\/api\\/.*\\/set).* value=([0-9]+).*";
+// Must hold mutex
+static void load_schedules()
+{
+  int count;
+
+  if (_aqs.loaded)
+    return;
+
+  _aqs.num_schedules = 0;
+  if ( (count = read_schedule_file(schedule_file())) >= 0 ) {
+    LOG(SCHD_LOG,LOG_INFO, "Loaded %d schedules from %s\n", count, schedule_file());
+    // Docker image used to link our file into cron.d, make sure cron isn't running them as well.
+    retire_cron_file();
+  } else if ( (count = read_schedule_file(CRON_FILE)) >= 0 ) {
+    LOG(SCHD_LOG,LOG_NOTICE, "Moving %d schedules from %s to %s\n", count, CRON_FILE, schedule_file());
+    // Leave cron with them if we couldn't save them, better than losing them.
+    if (write_schedule_file(schedule_file()))
+      retire_cron_file();
+  }
+  _aqs.loaded = true;
 
-  //char *regexString="([^\\s]+)\\s([^\\s]+)\\s([^\\s]+)\\s([^\\s]+)\\s([^\\s]+)\\s.*(/api/.*/set).*value=([0-9]+).*";
+  rebuild_schedule_heap();
+}
 
+static void *scheduler_worker(void *ptr)
+{
+  struct timespec due = {0, 0};
+  aqs_schedule *sch;
+  aqs_cron fire;
+  time_t now;
+  bool fire_now;
 
-  size_t maxGroups = 15;
-  regmatch_t groupArray[maxGroups];
-  //static char buf[100];
+  LOG(SCHD_LOG, LOG_NOTICE, "Started scheduler thread\n");
 
-  if (size > 0)
-    length += sprintf(buffer+length,"{\"type\": \"schedules\",");
+  pthread_mutex_lock(&_aqs.mutex);
 
-  if (0 != (rc = regcomp(&regexCompiled, regexString, REG_EXTENDED))) {
-      LOG(SCHD_LOG,LOG_ERR, "regcomp() failed, returning nonzero (%d)\n", rc);
-      if (size > 0)
-        length += sprintf(buffer+length,"\"message\": \"Error reading schedules\"}");
-      return length;
-   }
+  while (_aqs.running) {
+    if (_aqs.heap_size == 0) {
+      pthread_cond_wait(&_aqs.cond, &_aqs.mutex);
+      continue;
+    }
 
-  fp = fopen(CRON_FILE, "r");
-  if (fp == NULL) {
-    LOG(SCHD_LOG,LOG_WARNING, "Open file failed '%s'\n", CRON_FILE);
-    if (size > 0)
-      length += sprintf(buffer+length,"\"message\": \"Error reading schedules\"}");
-    return length;
+    sch = _aqs.heap[0];
+    now = time(NULL);
+    if (sch->next > now) {
+      due.tv_sec = sch->next;
+      pthread_cond_timedwait(&_aqs.cond, &_aqs.mutex, &due);
+      continue;
+    }
+
+    fire_now = (now - sch->next <= SCHEDULE_MISSED_LIMIT);
+    if (fire_now)
+      fire = sch->cron;
+    else
+      LOG(SCHD_LOG,LOG_WARNING, "Skipping schedule %s=%s, it was due %ld seconds ago (clock change?)\n", sch->cron.url, sch->cron.value, (long)(now - sch->next));
+
+    if ( (sch->next = next_fire_time(sch, now)) == (time_t)-1 )
+      heap_pop();
+    else
+      heap_down(0);
+
+    // Run by the net thread, see post_scheduled_URI()
+    if (fire_now) {
+      LOG(SCHD_LOG,LOG_NOTICE, "Running schedule %s=%s\n", fire.url, fire.value);
+      if ( ! post_scheduled_URI(fire.url, strtof(fire.value, NULL)) )
+        LOG(SCHD_LOG,LOG_ERR, "Schedule %s=%s dropped, too many waiting to run\n", fire.url, fire.value);
+    }
   }
 
-  if (size > 0)
-    length += sprintf(buffer+length,"\"schedules\": [ ");
-
-  while ((read_size = getline(&line, &len, fp)) != -1) {
-    //printf("Read from cron:-\n  %s", line);
-    //lc++;
-    //rc = regexec(&regexCompiled, line, maxGroups, groupArray, 0);
-    if (0 == (rc = regexec(&regexCompiled, line, maxGroups, groupArray, REG_EXTENDED))) {
-      // Group 1 is # (enable or not)
-      // Group 2 is minute
-      // Group 3 is hour
-      // Group 4 is day of month
-      // Group 5 is month
-      // Group 6 is day of week
-      // Group 7 is root
-      // Group 8 is curl
-      // Group 9 is URL
-      // Group 10 is value
-      if (groupArray[8].rm_so == (size_t)-1) {
-        if (size > 0) {
-          LOG(SCHD_LOG,LOG_ERR, "No matching information from cron file\n");
-        }
-      } else {
-        cline.enabled = (line[groupArray[1].rm_so] == '#')?false:true;
-        sprintf(cline.minute, "%.*s", (groupArray[2].rm_eo - groupArray[2].rm_so), (line + groupArray[2].rm_so));
-        sprintf(cline.hour, "%.*s",   (groupArray[3].rm_eo - groupArray[3].rm_so), (line + groupArray[3].rm_so));
-        sprintf(cline.daym, "%.*s",   (groupArray[4].rm_eo - groupArray[4].rm_so), (line + groupArray[4].rm_so));
-        sprintf(cline.month, "%.*s",  (groupArray[5].rm_eo - groupArray[5].rm_so), (line + groupArray[5].rm_so));
-        sprintf(cline.dayw, "%.*s",   (groupArray[6].rm_eo - groupArray[6].rm_so), (line + groupArray[6].rm_so)); 
-        sprintf(cline.url, "%.*s",    (groupArray[9].rm_eo - groupArray[9].rm_so), (line + groupArray[9].rm_so));
-        sprintf(cline.value, "%.*s",  (groupArray[10].rm_eo - groupArray[10].rm_so), (line + groupArray[10].rm_so));
-        if (size > 0) {
-          LOG(SCHD_LOG,LOG_INFO, "Read from cron. Enabled:%d Min:%s Hour:%s DayM:%s Month:%s DayW:%s URL:%s Value:%s\n",cline.enabled,cline.minute,cline.hour,cline.daym,cline.month,cline.dayw,cline.url,cline.value);
-          length += sprintf(buffer+length, "{\"enabled\":\"%d\", \"min\":\"%s\",\"hour\":\"%s\",\"daym\":\"%s\",\"month\":\"%s\",\"dayw\":\"%s\",\"url\":\"%s\",\"value\":\"%s\"},",
-                cline.enabled,
-                cline.minute,
-                cline.hour,
-                cline.daym,
-                cline.month,
-                cline.dayw,
-                cline.url,
-                cline.value);
-        }
-        //LOG(SCHD_LOG,LOG_DEBUG, "Read from cron Day %d | Time %d:%d | Zone %d | Runtime %d\n",day,hour,minute,zone,runtime);
-
-        // Test / get for pump start and end time
-        if (isAQS_USE_CRON_PUMP_TIME_ENABLED) {
-          // Could also check that dayw is *
-          if ( cline.enabled && strstr(cline.url, AQS_PUMP_URL ))
-          {
-            int value = strtoul(cline.value, NULL, 10);
-            int hour = strtoul(cline.hour, NULL, 10);
-            if (value == 0) {
-              if (hour > _aqconfig_.sched_chk_pumpoff_hour) // NSF this picks up the greatest offhour, (do we want the smallest???) 
-                _aqconfig_.sched_chk_pumpoff_hour = hour;
-            } else if (value == 1){
-              if (hour < _aqconfig_.sched_chk_pumpon_hour || _aqconfig_.sched_chk_pumpon_hour == 0)
-                _aqconfig_.sched_chk_pumpon_hour = hour;
-            } 
+  pthread_mutex_unlock(&_aqs.mutex);
+
+  LOG(SCHD_LOG, LOG_DEBUG, "End scheduler thread\n");
+  return NULL;
+}
+
+void start_scheduler()
+{
+  pthread_t thread_id;
+
+  if ( !_aqconfig_.enable_scheduler)
+    return;
+
+  pthread_mutex_lock(&_aqs.mutex);
+  // Restart, config may have moved so read them again.
+  _aqs.loaded = false;
+  load_schedules();
+
+  if (!_aqs.running) {
+    _aqs.running = true;
+    if (pthread_create(&thread_id, NULL, scheduler_worker, NULL) != 0) {
+      LOG(SCHD_LOG, LOG_ERR, "could not create scheduler thread\n");
+      _aqs.running = false;
+    } else {
+      pthread_detach(thread_id);
+    }
+  }
+  pthread_mutex_unlock(&_aqs.mutex);
+}
+
+void stop_scheduler()
+{
+  pthread_mutex_lock(&_aqs.mutex);
+  _aqs.running = false;
+  pthread_cond_broadcast(&_aqs.cond);
+  pthread_mutex_unlock(&_aqs.mutex);
+}
+
+int save_schedules_js(const char* inBuf, int inSize, char* outBuf, int outSize)
+{
+  int i;
+  int num = 0;
+  bool inarray = false;
+  bool rtn;
+  aqs_cron cline;
+  aqs_cron lines[MAX_SCHEDULES];
+  aqs_schedule check;
+  char error[256] = "";
+  json_writer w;
+
+  if ( !_aqconfig_.enable_scheduler) {
+    LOG(SCHD_LOG,LOG_WARNING, "Schedules are disabled\n");
+    return snprintf(outBuf, outSize, "{\"message\":\"Error Schedules disabled\"}");
+  }
+
+  LOG(SCHD_LOG,LOG_NOTICE, "Saving Schedule:\n");
+  LOG(SCHD_LOG,LOG_DEBUG, "Schedules Message body:\n'%.*s'\n", inSize, inBuf);
+
+  // Check them all before replacing anything, a row we can't run is an error not something to drop.
+  for (i=0; i < inSize; i++) {
+      if ( inBuf[i] == '[' ) {
+        inarray=true;
+      } else if ( inBuf[i] == ']' ) {
+        inarray=false;
+      } else if ( inarray && inBuf[i] == '{') {
+        memset(&cline, 0, sizeof(aqs_cron));
+        if (passJson_scObj( &inBuf[i], (inSize-i), &cline)) {
+          LOG(SCHD_LOG,LOG_DEBUG, "Schedule Min:%s Hour:%s DayM:%s Month:%s DayW:%s URL:%s Value:%s\n",cline.minute,cline.hour,cline.daym,cline.month,cline.dayw,cline.url,cline.value);
+          if (num >= MAX_SCHEDULES) {
+            snprintf(error, sizeof(error), "Error too many schedules, maximum is %d, nothing saved", MAX_SCHEDULES);
+            break;
           }
+          memset(&check, 0, sizeof(aqs_schedule));
+          check.cron = cline;
+          if (!compile_schedule(&check)) {
+            snprintf(error, sizeof(error), "Error schedule %d '%s %s %s %s %s' %s isn't a valid time, nothing saved",
+                     num+1, cline.minute, cline.hour, cline.daym, cline.month, cline.dayw, cline.url);
+            break;
+          }
+          lines[num++] = cline;
         }
       }
-    } else {
-      if (size > 0) {
-        LOG(SCHD_LOG,LOG_DEBUG, "regexp no match (%d) %s", rc, line);
-      }
-    }
   }
 
-  if (size > 0) {
-    buffer[--length] = '\0';
-    length += sprintf(buffer+length,"]}\n");
+  if (error[0] != '\0') {
+    LOG(SCHD_LOG,LOG_ERR, "%s\n", error);
+    jw_init(&w, outBuf, outSize);
+    jw_object_start(&w, NULL);
+    jw_string(&w, "message", error);
+    jw_object_end(&w);
+    return jw_finish(&w);
   }
 
-  fclose(fp);
-  regfree(&regexCompiled);
+  pthread_mutex_lock(&_aqs.mutex);
+
+  _aqs.num_schedules = 0;
+  for (i=0; i < num; i++)
+    add_schedule(&lines[i]);
+  _aqs.loaded = true;
+
+  rtn = write_schedule_file(schedule_file());
+  rebuild_schedule_heap();
+
+  pthread_mutex_unlock(&_aqs.mutex);
+
+  if (!rtn)
+    return snprintf(outBuf, outSize, "{\"message\":\"Error Saving Schedules\"}");
+
+  return snprintf(outBuf, outSize, "{\"message\":\"Saved Schedules\"}");
+}
 
-  return length;
+int build_schedules_js(char* buffer, int size)
+{
+  json_writer w;
+  aqs_cron *cline;
+  int i;
+
+  jw_init(&w, buffer, size);
+
+  if ( !_aqconfig_.enable_scheduler) {
+    LOG(SCHD_LOG,LOG_WARNING, "Schedules are disabled\n");
+    jw_object_start(&w, NULL);
+    jw_string(&w, "message", "Error Schedules disabled");
+    jw_object_end(&w);
+    return jw_finish(&w);
+  }
+
+  pthread_mutex_lock(&_aqs.mutex);
+  load_schedules();
+
+  jw_object_start(&w, NULL);
+  jw_string(&w, "type", "schedules");
+  jw_array_start(&w, "schedules");
+  for (i=0; i < _aqs.num_schedules; i++) {
+    cline = &_aqs.schedules[i].cron;
+    jw_object_start(&w, NULL);
+    jw_int_string(&w, "enabled", cline->enabled);
+    jw_string(&w, "min", cline->minute);
+    jw_string(&w, "hour", cline->hour);
+    jw_string(&w, "daym", cline->daym);
+    jw_string(&w, "month", cline->month);
+    jw_string(&w, "dayw", cline->dayw);
+    jw_string(&w, "url", cline->url);
+    jw_string(&w, "value", cline->value);
+    jw_object_end(&w);
+  }
+  jw_array_end(&w);
+  jw_object_end(&w);
+
+  pthread_mutex_unlock(&_aqs.mutex);
+
+  return jw_finish(&w);
 }
 
 void get_cron_pump_times()
 {
-  build_schedules_js(NULL, 0);
-  return;
+  aqs_cron *cline;
+  int i, value, hour;
+
+  if ( !_aqconfig_.enable_scheduler)
+    return;
+
+  pthread_mutex_lock(&_aqs.mutex);
+  load_schedules();
+
+  // Test / get for pump start and end time
+  for (i=0; i < _aqs.num_schedules; i++) {
+    cline = &_aqs.schedules[i].cron;
+    // Could also check that dayw is *
+    if ( cline->enabled && strstr(cline->url, AQS_PUMP_URL ))
+    {
+      value = strtoul(cline->value, NULL, 10);
+      hour = strtoul(cline->hour, NULL, 10);
+      if (value == 0) {
+        if (hour > _aqconfig_.sched_chk_pumpoff_hour) // NSF this picks up the greatest offhour, (do we want the smallest???) 
+          _aqconfig_.sched_chk_pumpoff_hour = hour;
+      } else if (value == 1){
+        if (hour < _aqconfig_.sched_chk_pumpon_hour || _aqconfig_.sched_chk_pumpon_hour == 0)
+          _aqconfig_.sched_chk_pumpon_hour = hour;
+      } 
+    }
+  }
+
+  pthread_mutex_unlock(&_aqs.mutex);
 }
 
 
@@ -7,7 +7,8 @@
 
 #include "config.h"
 
-#define CRON_FILE "/etc/cron.d/aqualinkd"
+#define CRON_FILE "/etc/cron.d/aqualinkd"  // Old location, imported once
+#define SCHEDULE_FILE "aqualinkd.schedule"   // Same directory as config file
 #define CURL "curl"
 
 #define CV_SIZE 20
@@ -27,6 +28,8 @@ typedef struct aqs_cron
 int build_schedules_js(char* buffer, int size);
 int save_schedules_js(const char* inBuf, int inSize, char* outBuf, int outSize);
 void get_cron_pump_times();
+void start_scheduler();
+void stop_scheduler();
 
 
 
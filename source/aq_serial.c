@@ -23,6 +23,7 @@
 #include <string.h>
 #include <sys/ioctl.h>
 #include <stdbool.h>
+#include <pthread.h>
 // Below is needed to set low latency.
 #include <linux/serial.h>
 
@@ -35,6 +36,8 @@
 #include "utils.h"
 #include "config.h"
 #include "packetLogger.h"
+#include "flight_recorder.h"
+#include "packetCapture.h"
 #include "timespec_subtract.h"
 #include "aqualink.h"
 #include <sys/select.h>
@@ -44,51 +47,99 @@
 
 static int _RS485_fds = -1;
 
-static struct timespec _last_serial_read_time;
+static struct timespec _last_serial_read_time; // CLOCK_MONOTONIC
+static long _last_send_latency_us = -1;
+
+static ack_latency_stats _ack_latency[ACK_LATENCY_EMULATIONS];
+static pthread_mutex_t _ack_latency_mutex = PTHREAD_MUTEX_INITIALIZER; // Readers are on the net thread
+// Upper bound of each bucket in usec, last bucket is everything over.
+static const long _ack_latency_buckets_us[ACK_LATENCY_BUCKETS-1] = {1000, 2000, 4000, 8000, 16000, 32000, 64000, 128000};
+
+// Read ahead buffer for get_packet(), we pull whatever the tty has in one read()
+// and frame packets from here, rather than one read() per byte.
+#define SERIAL_RX_BUFFER_SIZE 1024
+
+static struct {
+  int fd;
+  int pos;
+  int len;
+  unsigned char buffer[SERIAL_RX_BUFFER_SIZE];
+} _rx = { .fd = -1, .pos = 0, .len = 0 };
+
+static void reset_rx_buffer(int fd)
+{
+  _rx.fd = fd;
+  _rx.pos = 0;
+  _rx.len = 0;
+}
+
+/*
+ * Called after we reply to a frame addressed to one of our ID's, file the time from end of
+ * received frame to start of our reply against the emulation that replied.
+ */
+void record_ack_latency(emulation_type source)
+{
+  int i;
+
+  if (_last_send_latency_us < 0 || source < 0 || source >= ACK_LATENCY_EMULATIONS)
+    return;
+
+  ack_latency_stats *stats = &_ack_latency[source];
+
+  for (i=0; i < ACK_LATENCY_BUCKETS-1; i++) {
+    if (_last_send_latency_us <= _ack_latency_buckets_us[i])
+      break;
+  }
+
+  pthread_mutex_lock(&_ack_latency_mutex);
+  stats->buckets[i]++;
+  stats->count++;
+  stats->total_us += _last_send_latency_us;
+  if (_last_send_latency_us > stats->max_us)
+    stats->max_us = _last_send_latency_us;
+  pthread_mutex_unlock(&_ack_latency_mutex);
+
+  _last_send_latency_us = -1;
+}
+
+// Copy, so buckets, count & sum all agree (total_us is 64 bit so could tear on 32 bit as well).
+bool get_ack_latency(emulation_type source, ack_latency_stats *stats)
+{
+  if (source < 0 || source >= ACK_LATENCY_EMULATIONS)
+    return false;
+
+  pthread_mutex_lock(&_ack_latency_mutex);
+  *stats = _ack_latency[source];
+  pthread_mutex_unlock(&_ack_latency_mutex);
+
+  return true;
+}
+
+long get_ack_latency_bucket_us(int bucket)
+{
+  if (bucket < 0 || bucket >= ACK_LATENCY_BUCKETS-1)
+    return -1;
+
+  return _ack_latency_buckets_us[bucket];
+}
 
 void send_packet(int fd, unsigned char *packet, int length);
 //unsigned char getProtocolType(unsigned char* packet);
 
-emulation_type getJandyDeviceType(unsigned char ID) {
-  
-  // Using emulation_type from aqprogrammer. At some point may merge into one
-  // and call device type
-
-  if ( is_allbutton_id(ID) )
-    return ALLBUTTON;
-  if ( is_onetouch_id(ID))
-    return ONETOUCH;
-  if ( is_rsserialadapter_id(ID))
-    return RSSADAPTER;
-  if ( is_pda_id(ID))
-    return AQUAPDA;
-  if (is_aqualink_touch_id(ID ))
-    return IAQTOUCH;
-  if (is_iaqualink_id(ID))
-    return IAQUALNK;
+// Using emulation_type from aqprogrammer. At some point may merge into one
+// and call device type
+static const emulation_type _jandy_device_type[256] = {
+  [0x00 ... 0xFF] = SIM_NONE,
+  [ALLBUTTON_MIN ... ALLBUTTON_MAX] = ALLBUTTON,
+  [ONETOUCH_MIN ... ONETOUCH_MAX] = ONETOUCH,
+  [RS_SERIAL_ADAPTER_MIN ... RS_SERIAL_ADAPTER_MAX] = RSSADAPTER,
+  [PDA_MIN ... PDA_MAX] = AQUAPDA,
+  [AQUALINKTOUCH_MIN ... AQUALINKTOUCH_MAX] = IAQTOUCH,
+  [IAQUALINK_MIN ... IAQUALINK_MAX] = IAQUALNK,
+};
 
-/*
-  if (ID >= 0x00 && ID <= 0x03)
-    return MASTER;
-  if (ID >= 0x50 && ID <= 0x53)
-    return SWG;
-  if (ID >= 0x20 && ID <= 0x23)
-    return SPA_R;
-  if (ID >= 0x38 && ID <= 0x3B)
-    return LX_HEATER;
-  if (ID >= 0x58 && ID <= 0x5B)
-    return PC_DOCK; 
-  if (ID >= 0x68 && ID <= 0x6B)
-    return JXI_HEATER;
-  //if (ID >= 0x70 && ID <= 0x73)
-  if (ID >= 0x78 && ID <= 0x7B)
-    return EPUMP;
-  if (ID >= 0x80 && ID <= 0x83)
-    return CHEM;
-  //if (ID == 0x08)
-  //  return KEYPAD;
-*/
-  return SIM_NONE;
+emulation_type getJandyDeviceType(unsigned char ID) {
+  return _jandy_device_type[ID];
 }
 
 const char *getJandyDeviceName(emulation_type etype) {
@@ -595,6 +646,7 @@ int init_serial_port(const char* port)
   if (tcflush(_RS485_fds, TCIFLUSH) == -1) {
     LOG(RSSD_LOG,LOG_ERR,"Error %i from tcflush: %s\n", errno, strerror(errno));
   }
+  reset_rx_buffer(_RS485_fds);
 
   return _RS485_fds;
 }
@@ -609,6 +661,8 @@ void _close_serial_port(int fd)
 
   unlock_port(fd);
   close(fd);
+  if (_rx.fd == fd)
+    reset_rx_buffer(-1);
   LOG(RSSD_LOG,LOG_DEBUG_SERIAL, "Closed serial port\n");
 }
 
@@ -802,24 +856,20 @@ void send_packet(int fd, unsigned char *packet, int length)
   struct timespec now;
 
   if (_aqconfig_.frame_delay > 0) {
-    struct timespec min_frame_wait_time;
-    struct timespec frame_wait_time;
-    struct timespec remainder_time;
-    //struct timespec diff;
-
-    min_frame_wait_time.tv_sec = 0;
-    min_frame_wait_time.tv_nsec = _aqconfig_.frame_delay * 1000000;
-
-    do {
-      clock_gettime(CLOCK_REALTIME, &now);
-      timespec_subtract(&elapsed_time, &now, &_last_serial_read_time);
-      if (timespec_subtract(&frame_wait_time, &min_frame_wait_time, &elapsed_time)) {
-        break;
-      }
-    } while (nanosleep(&frame_wait_time, &remainder_time) != 0);
+    // Earliest we can transmit is frame_delay after the end of the last frame we read,
+    // sleep until that absolute time rather than polling the clock.
+    struct timespec deadline = _last_serial_read_time;
+    deadline.tv_nsec += (long)_aqconfig_.frame_delay * 1000000L;
+    while (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_nsec -= 1000000000L;
+      deadline.tv_sec++;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {}
   }
 
-  clock_gettime(CLOCK_REALTIME, &now);
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  timespec_subtract(&elapsed_time, &now, &_last_serial_read_time);
+  _last_send_latency_us = elapsed_time.tv_sec * 1000000L + elapsed_time.tv_nsec / 1000;
 
   if (true) {
     //int nwrite = write(fd, packet, length);
@@ -851,6 +901,7 @@ void send_packet(int fd, unsigned char *packet, int length)
   // MAYBE Change this back to debug serial
   //LOG(RSSD_LOG,LOG_DEBUG_SERIAL, "Serial write %d bytes\n",length-2);
   //LOG(RSSD_LOG,LOG_DEBUG, "Serial write %d bytes, type 0x%02hhx cmd 0x%02hhx\n",length-2,packet[5],packet[6]);
+  flight_recorder_frame(CAP_WRITE, &packet[1], length-1);
   if (_aqconfig_.log_protocol_packets || getLogLevel(RSSD_LOG) >= LOG_DEBUG_SERIAL)
     logPacketWrite(&packet[1], length-1);
 /*
@@ -875,7 +926,6 @@ void send_packet(int fd, unsigned char *packet, int length)
   //if (_aqconfig_.frame_delay > 0) {
 #ifndef SERIAL_LOGGER
   if (_aqconfig_.frame_delay > 0) {
-    timespec_subtract(&elapsed_time, &now, &_last_serial_read_time);
     LOG(RSTM_LOG, LOG_DEBUG, "Time from recv to send is %.3f sec\n",
                             roundf3(timespec2float(&elapsed_time)));
   }
@@ -967,6 +1017,9 @@ int _get_packet(int fd, unsigned char* packet, bool rawlog)
 
 #ifdef DUMMY_READER
 
+// Set when fix_packet() split a frame, the next get_packet() returns the 2nd half.
+static bool haveFixedPacket = false;
+
 int fix_packet(unsigned char *packet_buffer, int packet_length, bool getCached) {
   
   static unsigned char saved_buffer[AQ_MAXPKTLEN+1];
@@ -1081,6 +1134,12 @@ LXi status | HEX: 0x10|0x02|0x00|0x0d|0x00|0x00|0x00|0x1f|0x10|0x03|
              HEX: 0x10|0x02|0x00|0x0a|0x00|0x00|0x00|0x1f|0x10|0x03| // New read seems to use 0x0a and not 0x0d
 */
 
+// Bad frames always go to the flight recorder, same as good ones.
+static void rs_packet_error(const unsigned char *packet, int length)
+{
+  flight_recorder_frame(CAP_ERROR, packet, length);
+  logPacketError(packet, length);
+}
 
 int get_packet(int fd, unsigned char* packet)
 {
@@ -1096,6 +1155,7 @@ int get_packet(int fd, unsigned char* packet)
   //bool lastByteDLE = false;
   int PentairPreCnt = 0;
   int PentairDataCnt = -1;
+  int syscalls = 0;
   struct timespec packet_elapsed;
   struct timespec packet_end_time;
 
@@ -1110,126 +1170,146 @@ int get_packet(int fd, unsigned char* packet)
   // DLE STX ........ ETX DLE
   // sometimes we get ETX DLE and no start, so for now just ignoring that.  Seem to be more applicable when busy RS485 traffic
 
-  while (!endOfPacket) {
-    fd_set readfds;
-    FD_ZERO(&readfds);
-    FD_SET(fd, &readfds);
-    // Wait for up to read_tv.tv_sec second for data to become available
-    wait_val = select(fd + 1, &readfds, NULL, NULL, &read_tv);
-    if (wait_val == -1) {
-      return AQSERR_READ;
-    } else if (wait_val == 0) {
-      //return AQSERR_TIMEOUT;
-      return 0; // Should probably change to above
-    }
+  // Bytes left over from the last read belong to a different port, so drop them.
+  if (_rx.fd != fd)
+    reset_rx_buffer(fd);
 
-    bytesRead = read(fd, &byte, 1);
+#ifdef DUMMY_READER
+  if (haveFixedPacket) {
+    haveFixedPacket = false;
+    return fix_packet(packet, 0, true);
+  }
+#endif
 
-    if (bytesRead <= 0 && errno == EAGAIN ) { // We also get ENOTTY on some non FTDI adapters
-      if (jandyPacketStarted == false && pentairPacketStarted == false && lastByteDLE == false) {
-        return 0;
-      } else if (++retry > 10 ) {
-        LOG(RSSD_LOG,LOG_WARNING, "Serial read timeout\n");
-        if (index > 0) { logPacketError(packet, index); }
+  while (!endOfPacket) {
+    if (_rx.pos >= _rx.len) {
+      // Buffer is empty, wait for the tty and take everything it has.
+      fd_set readfds;
+      FD_ZERO(&readfds);
+      FD_SET(fd, &readfds);
+      // Wait for up to read_tv.tv_sec second for data to become available
+      wait_val = select(fd + 1, &readfds, NULL, NULL, &read_tv);
+      syscalls++;
+      if (wait_val == -1) {
         return AQSERR_READ;
-      } else {
-        continue;
+      } else if (wait_val == 0) {
+        //return AQSERR_TIMEOUT;
+        return 0; // Should probably change to above
       }
-    } else if(bytesRead <= 0) {
-      if (! isAqualinkDStopping() ) {
-        return AQSERR_READ;
-      } else {
-        return 0;
+
+      bytesRead = read(fd, _rx.buffer, SERIAL_RX_BUFFER_SIZE);
+      syscalls++;
+
+      if (bytesRead <= 0 && errno == EAGAIN ) { // We also get ENOTTY on some non FTDI adapters
+        if (jandyPacketStarted == false && pentairPacketStarted == false && lastByteDLE == false) {
+          return 0;
+        } else if (++retry > 10 ) {
+          LOG(RSSD_LOG,LOG_WARNING, "Serial read timeout\n");
+          if (index > 0) { rs_packet_error(packet, index); }
+          return AQSERR_READ;
+        } else {
+          continue;
+        }
+      } else if(bytesRead <= 0) {
+        if (! isAqualinkDStopping() ) {
+          return AQSERR_READ;
+        } else {
+          return 0;
+        }
       }
-    } else if (bytesRead == 1) {
       retry = 0;
+      _rx.pos = 0;
+      _rx.len = bytesRead;
+
       if (_aqconfig_.log_raw_bytes)
-        logPacketByte(&byte);
+        logPacketBytes(_rx.buffer, bytesRead);
+    }
 
-      if (lastByteDLE == true && byte == NUL)
-      {
-        // Check for DLE | NULL (that's escape DLE so delete the NULL)
-        //printf("IGNORE THIS PACKET\n");
-        lastByteDLE = false;
-      }
-      else if (lastByteDLE == true)
-      {
-        if (index == 0)
-          index++;
+    byte = _rx.buffer[_rx.pos++];
 
-        packet[index] = byte;
+    if (lastByteDLE == true && byte == NUL)
+    {
+      // Check for DLE | NULL (that's escape DLE so delete the NULL)
+      //printf("IGNORE THIS PACKET\n");
+      lastByteDLE = false;
+    }
+    else if (lastByteDLE == true)
+    {
+      if (index == 0)
         index++;
-        if (byte == STX && jandyPacketStarted == false)
-        {
-          jandyPacketStarted = true;
-          pentairPacketStarted = false;
-        }
-        else if (byte == ETX && jandyPacketStarted == true)
-        {
-          endOfPacket = true;
-        }
-      }
-      else if (jandyPacketStarted || pentairPacketStarted)
+
+      packet[index] = byte;
+      index++;
+      if (byte == STX && jandyPacketStarted == false)
       {
-        packet[index] = byte;
-        index++;
-        if (pentairPacketStarted == true && index == 9)
-        {
-          //printf("Read 0x%02hhx %d pentair\n", byte, byte);
-          PentairDataCnt = byte;
-        }
-        if (PentairDataCnt >= 0 && index - 11 >= PentairDataCnt && pentairPacketStarted == true)
-        {
-          endOfPacket = true;
-          PentairPreCnt = -1;
-        }
+        jandyPacketStarted = true;
+        pentairPacketStarted = false;
       }
-      else if (byte == DLE && jandyPacketStarted == false)
+      else if (byte == ETX && jandyPacketStarted == true)
       {
-        packet[index] = byte;
+        endOfPacket = true;
       }
-
-      // // reset index incase we have EOP before start
-      if (jandyPacketStarted == false && pentairPacketStarted == false)
+    }
+    else if (jandyPacketStarted || pentairPacketStarted)
+    {
+      packet[index] = byte;
+      index++;
+      if (pentairPacketStarted == true && index == 9)
       {
-        index = 0;
+        //printf("Read 0x%02hhx %d pentair\n", byte, byte);
+        PentairDataCnt = byte;
       }
-
-      if (byte == DLE && pentairPacketStarted == false)
+      if (PentairDataCnt >= 0 && index - 11 >= PentairDataCnt && pentairPacketStarted == true)
       {
-        lastByteDLE = true;
+        endOfPacket = true;
         PentairPreCnt = -1;
       }
-      else
+    }
+    else if (byte == DLE && jandyPacketStarted == false)
+    {
+      packet[index] = byte;
+    }
+
+    // // reset index incase we have EOP before start
+    if (jandyPacketStarted == false && pentairPacketStarted == false)
+    {
+      index = 0;
+    }
+
+    if (byte == DLE && pentairPacketStarted == false)
+    {
+      lastByteDLE = true;
+      PentairPreCnt = -1;
+    }
+    else
+    {
+      lastByteDLE = false;
+      if (byte == PP1 && PentairPreCnt == 0)
+        PentairPreCnt = 1;
+      else if (byte == PP2 && PentairPreCnt == 1)
+        PentairPreCnt = 2;
+      else if (byte == PP3 && PentairPreCnt == 2)
+        PentairPreCnt = 3;
+      else if (byte == PP4 && PentairPreCnt == 3)
       {
-        lastByteDLE = false;
-        if (byte == PP1 && PentairPreCnt == 0)
-          PentairPreCnt = 1;
-        else if (byte == PP2 && PentairPreCnt == 1)
-          PentairPreCnt = 2;
-        else if (byte == PP3 && PentairPreCnt == 2)
-          PentairPreCnt = 3;
-        else if (byte == PP4 && PentairPreCnt == 3)
-        {
-          pentairPacketStarted = true;
-          jandyPacketStarted = false;
-          PentairDataCnt = -1;
-          packet[0] = PP1;
-          packet[1] = PP2;
-          packet[2] = PP3;
-          packet[3] = byte;
-          index = 4;
-        }
-        else if (byte != PP1) // Don't reset counter if multiple PP1's
-          PentairPreCnt = 0;
+        pentairPacketStarted = true;
+        jandyPacketStarted = false;
+        PentairDataCnt = -1;
+        packet[0] = PP1;
+        packet[1] = PP2;
+        packet[2] = PP3;
+        packet[3] = byte;
+        index = 4;
       }
+      else if (byte != PP1) // Don't reset counter if multiple PP1's
+        PentairPreCnt = 0;
     }
 
     // Break out of the loop if we exceed maximum packet
     // length.
     if (index >= AQ_MAXPKTLEN) {
       LOG(RSSD_LOG,LOG_WARNING, "Serial packet too large for buffer, stopped reading\n");
-      logPacketError(packet, index);
+      rs_packet_error(packet, index);
       //log_packet(LOG_WARNING, "Bad receive packet ", packet, index);
       return AQSERR_2LARGE;
       break;
@@ -1257,14 +1337,14 @@ int get_packet(int fd, unsigned char* packet)
 #endif
       {
         LOG(RSSD_LOG,LOG_WARNING, "Serial read bad Jandy checksum, ignoring\n");
-        logPacketError(packet, index);
+        rs_packet_error(packet, index);
         return AQSERR_CHKSUM;
       }
     }
   } else if (pentairPacketStarted) {
     if (check_pentair_checksum(packet, index) != true){
       LOG(RSSD_LOG,LOG_WARNING, "Serial read bad Pentair checksum, ignoring\n");
-      logPacketError(packet, index);
+      rs_packet_error(packet, index);
       //log_packet(LOG_WARNING, "Bad receive packet ", packet, index);
       return AQSERR_CHKSUM;
     }
@@ -1279,32 +1359,24 @@ int get_packet(int fd, unsigned char* packet)
   } else*/ 
   if (index < AQ_MINPKTLEN && (jandyPacketStarted || pentairPacketStarted) ) { //NSF. Sometimes we get END sequence only, so just ignore.
     LOG(RSSD_LOG,LOG_WARNING, "Serial read too small\n");
-    logPacketError(packet, index);
+    rs_packet_error(packet, index);
     //log_packet(LOG_WARNING, "Bad receive packet ", packet, index);
     return AQSERR_2SMALL;
   }
 
 
-  if (_aqconfig_.frame_delay > 0 || getLogLevel(RSTM_LOG) >= LOG_DEBUG) {
-    clock_gettime(CLOCK_REALTIME, &packet_end_time);
-    if (getLogLevel(RSTM_LOG) >= LOG_DEBUG) {
-      timespec_subtract(&packet_elapsed, &packet_end_time, &_last_serial_read_time);
-      /*
-      LOG(RSTM_LOG, LOG_NOTICE, "Start sec=%ld nsec=%ld\n",_last_serial_read_time.tv_sec,_last_serial_read_time.tv_nsec);
-      LOG(RSTM_LOG, LOG_NOTICE, "End sec=%ld nsec=%ld\n",packet_end_time.tv_sec,packet_end_time.tv_nsec);
-      LOG(RSTM_LOG, LOG_NOTICE, "Elapsed sec=%ld nsec=%ld Time between packets (%.3f sec)\n",packet_elapsed.tv_sec,packet_elapsed.tv_nsec, roundf3(timespec2float(&packet_elapsed)) );
-      */
-      LOG(RSTM_LOG, LOG_DEBUG, "Time between packets (%.3f sec)\n", roundf3(timespec2float(&packet_elapsed)) );
-
-    }
-    //if (_aqconfig_.frame_delay > 0) {
-    memcpy(&_last_serial_read_time, &packet_end_time, sizeof(struct timespec));
-    //}
+  // Always record end of frame, send_packet() schedules it's reply and ack latency from this.
+  clock_gettime(CLOCK_MONOTONIC, &packet_end_time);
+  if (getLogLevel(RSTM_LOG) >= LOG_DEBUG) {
+    timespec_subtract(&packet_elapsed, &packet_end_time, &_last_serial_read_time);
+    LOG(RSTM_LOG, LOG_DEBUG, "Time between packets (%.3f sec), %d syscalls to read packet\n", roundf3(timespec2float(&packet_elapsed)), syscalls );
   }
+  memcpy(&_last_serial_read_time, &packet_end_time, sizeof(struct timespec));
 
   //clock_gettime(CLOCK_REALTIME, &_last_serial_read_time);
   //}
   //LOG(RSSD_LOG,LOG_DEBUG_SERIAL, "Serial read %d bytes\n",index);
+  flight_recorder_frame(CAP_READ, packet, index);
   if (_aqconfig_.log_protocol_packets || getLogLevel(RSSD_LOG) >= LOG_DEBUG_SERIAL)
     logPacketRead(packet, index);
   // Return the packet length.
@@ -4,6 +4,7 @@
 
 #include <termios.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "aq_programmer.h" // Need this for function getJandyDeviceType due to enum defined their.
 emulation_type getJandyDeviceType(unsigned char ID);
@@ -631,6 +632,21 @@ void send_ack(int file_descriptor, unsigned char command);
 void send_extended_ack(int fd, unsigned char ack_type, unsigned char command);
 //void send_cmd(int file_descriptor, unsigned char cmd, unsigned char args);
 int get_packet(int file_descriptor, unsigned char* packet);
+
+// Histogram of time from end of received frame to our reply, per emulation type.
+#define ACK_LATENCY_BUCKETS    9
+#define ACK_LATENCY_EMULATIONS (SIMULATOR + 1)
+
+typedef struct ack_latency_stats {
+  uint32_t buckets[ACK_LATENCY_BUCKETS];
+  uint32_t count;
+  uint64_t total_us;
+  long max_us;
+} ack_latency_stats;
+
+void record_ack_latency(emulation_type source);
+bool get_ack_latency(emulation_type source, ack_latency_stats *stats);
+long get_ack_latency_bucket_us(int bucket);
 //int get_packet_lograw(int fd, unsigned char* packet);
 int is_valid_port(int fd);
 
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2017 Shaun Feakes - All rights reserved
+ *
+ * You may use redistribute and/or modify this code under the terms of
+ * the GNU General Public License version 2 as published by the 
+ * Free Software Foundation. For the terms of this license, 
+ * see <http://www.gnu.org/licenses/>.
+ *
+ * You are free to use this software under the terms of the GNU General
+ * Public License, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ *  https://github.com/sfeakes/aqualinkd
+ */
+
+/*
+  Seqlock around struct aqualinkdata.
+
+  The RS485 threads take the write side while they decode a packet, so every field that packet
+  changes (pump RPM, watts & status etc) is updated as one.  The mutex only serializes writers
+  against each other.  The net thread takes a snapshot by copying and checking the sequence
+  didn't move, it never holds anything a writer would wait on.
+*/
+
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "aqualink.h"
+#include "aq_snapshot.h"
+#include "aq_timer.h"
+
+static pthread_mutex_t _aqdata_write_mutex = PTHREAD_MUTEX_INITIALIZER;
+static atomic_uint _aqdata_seq = 0;
+
+void aqdata_write_lock()
+{
+  pthread_mutex_lock(&_aqdata_write_mutex);
+  atomic_fetch_add_explicit(&_aqdata_seq, 1, memory_order_relaxed); // Odd, write in progress
+  atomic_thread_fence(memory_order_release);
+}
+
+void aqdata_write_unlock()
+{
+  atomic_fetch_add_explicit(&_aqdata_seq, 1, memory_order_release); // Even, done
+  pthread_mutex_unlock(&_aqdata_write_mutex);
+}
+
+// If ptr points inside src, point it to the same place inside dest.
+#define RELOCATE(ptr, src, dest) \
+  if ((const char *)(ptr) >= (const char *)(src) && (const char *)(ptr) < (const char *)((src)+1)) \
+    (ptr) = (void *)((char *)(dest) + ((const char *)(ptr) - (const char *)(src)))
+
+void aqdata_snapshot(const struct aqualinkdata *src, struct aqualinkdata *dest)
+{
+  unsigned int seq;
+  int i;
+
+  do {
+    while ((seq = atomic_load_explicit(&_aqdata_seq, memory_order_acquire)) & 1)
+      sched_yield();
+
+    memcpy(dest, src, sizeof(struct aqualinkdata));
+
+    atomic_thread_fence(memory_order_acquire);
+  } while (seq != atomic_load_explicit(&_aqdata_seq, memory_order_relaxed));
+
+  for (i=0; i < TOTAL_BUTTONS; i++) {
+    RELOCATE(dest->aqbuttons[i].led, src, dest);
+  }
+  for (i=0; i < MAX_PUMPS; i++) {
+    RELOCATE(dest->pumps[i].button, src, dest);
+  }
+  for (i=0; i < MAX_LIGHTS; i++) {
+    RELOCATE(dest->lights[i].button, src, dest);
+  }
+  RELOCATE(dest->chiller_button, src, dest);
+  RELOCATE(dest->unactioned.button, src, dest);
+}
+
+static struct aqualinkdata *_aqdata_tracked = NULL;
+
+// The master copy, only changes to this get counted (snapshots are read only).
+void aqdata_track_changes(struct aqualinkdata *aqdata)
+{
+  _aqdata_tracked = aqdata;
+}
+
+#define VERSION_BUMP(counter) __atomic_add_fetch(&(counter), 1, __ATOMIC_RELAXED)
+#define IN_ARRAY(addr, array) ((const char *)(addr) >= (const char *)(array) && (const char *)(addr) < (const char *)(array) + sizeof(array))
+#define ARRAY_INDEX(addr, array) (((const char *)(addr) - (const char *)(array)) / sizeof((array)[0]))
+
+/*
+ * Called from SET_IF_CHANGED() & SET_DIRTY(), work out which device addr belongs to and bump it's version.
+ * NULL (SET_DIRTY) means we don't know what changed.
+ */
+void aqdata_changed(const void *addr)
+{
+  struct aqualinkdata *aqdata = _aqdata_tracked;
+  aqdata_versions *v;
+
+  if (aqdata == NULL)
+    return;
+
+  v = &aqdata->versions;
+  VERSION_BUMP(v->any);
+
+  if (addr == NULL)
+    VERSION_BUMP(v->unknown);
+  else if (IN_ARRAY(addr, aqdata->aqualinkleds))
+    VERSION_BUMP(v->led[ARRAY_INDEX(addr, aqdata->aqualinkleds)]);
+  else if (IN_ARRAY(addr, aqdata->aqbuttons))
+    VERSION_BUMP(v->button[ARRAY_INDEX(addr, aqdata->aqbuttons)]);
+  else if (IN_ARRAY(addr, aqdata->pumps))
+    VERSION_BUMP(v->pump[ARRAY_INDEX(addr, aqdata->pumps)]);
+  else if (IN_ARRAY(addr, aqdata->lights))
+    VERSION_BUMP(v->light[ARRAY_INDEX(addr, aqdata->lights)]);
+  else if (IN_ARRAY(addr, aqdata->sensors))
+    VERSION_BUMP(v->sensor[ARRAY_INDEX(addr, aqdata->sensors)]);
+  else if ((const char *)addr >= (const char *)aqdata && (const char *)addr < (const char *)(aqdata+1))
+    VERSION_BUMP(v->general);
+  else
+    VERSION_BUMP(v->unknown); // ie altlabel_detail, malloc'd so could belong to anything
+
+  // LED states are the only thing timers wait on, virtual button LEDs are malloc'd so end up as unknown.
+  if (addr == NULL || IN_ARRAY(addr, aqdata->aqualinkleds) || !((const char *)addr >= (const char *)aqdata && (const char *)addr < (const char *)(aqdata+1)))
+    timer_state_changed();
+}
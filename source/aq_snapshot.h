@@ -0,0 +1,17 @@
+#ifndef AQ_SNAPSHOT_H_
+#define AQ_SNAPSHOT_H_
+
+#include "aqualink.h"
+
+// Writers wrap a complete update (ie processing one packet) so readers never see half of it.
+void aqdata_write_lock();
+void aqdata_write_unlock();
+
+// Coherent copy of src, pointers within aqualinkdata (button->led etc) point into dest.
+// Never blocks writers, retries if a write happened during the copy.
+void aqdata_snapshot(const struct aqualinkdata *src, struct aqualinkdata *dest);
+
+// Count changes made through SET_IF_CHANGED() / SET_DIRTY() to aqdata in aqdata->versions.
+void aqdata_track_changes(struct aqualinkdata *aqdata);
+
+#endif // AQ_SNAPSHOT_H_
@@ -6,6 +6,7 @@
   char* read_pem_file(bool silentError, const char* fmt, ...);
 #endif
 
+bool remount_root_ro(bool readonly);
 FILE *aq_open_file( char *filename, bool *ro_root, bool* created_file);
 bool aq_close_file(FILE *file, bool ro_root);
 bool copy_file(const char *source_path, const char *destination_path);
@@ -5,224 +5,362 @@
 #include <pthread.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdatomic.h>
 
 #include "aqualink.h"
 #include "utils.h"
 #include "aq_timer.h"
 
+/*
+  All device timers are run from one thread.
+  Each button has a fixed slot (indexed by deviceIndex) and active slots sit in a min-heap ordered
+  by when they next need attention, so the thread just sleeps until the top of the heap is due.
+  A timer first waits for the device to report ON. LED state changes wake us via timer_state_changed(),
+  the only deadlines while waiting are when to ask for it to be turned on and when to give up waiting.
+  Then it counts down duration_min and turns the device off.
+*/
 
-struct timerthread {
-  pthread_t thread_id;
-  pthread_mutex_t thread_mutex;
-  pthread_cond_t thread_cond;
+typedef enum {
+  TMR_IDLE = 0,
+  TMR_WAIT_ON,   // Waiting for device to turn on
+  TMR_RUNNING
+} timer_state;
+
+struct aqtimer {
+  timer_state state;
   aqkey *button;
   int deviceIndex;
   struct aqualinkdata *aqdata;
   int duration_min;
-  struct timespec timeout;
+  struct timespec due;     // CLOCK_MONOTONIC
   time_t started_at;
-  struct timerthread *next;
-  struct timerthread *prev;
+  bool asked_on;           // Passed WAIT_BEFORE_TURN_ON and asked the panel to turn the device on
+  int heap_pos;
 };
 
-/*volatile*/ static struct timerthread *_timerthread_ll = NULL;
+#define WAIT_BEFORE_TURN_ON       5 // seconds
+#define WAIT_BEFORE_GIVE_UP       10
+
+static struct aqtimer _timers[TOTAL_BUTTONS];
+static struct aqtimer *_timer_heap[TOTAL_BUTTONS];
+static int _timer_heap_size = 0;
+static atomic_int _timers_waiting_on = 0;
+
+static pthread_mutex_t _timer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _timer_cond;
+static bool _timer_thread_started = false;
 
 void *timer_worker( void *ptr );
 
-struct timerthread *find_timerthread(aqkey *button)
+static bool timespec_before(const struct timespec *a, const struct timespec *b)
 {
-  struct timerthread *t_ptr;
+  return (a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec));
+}
 
-  if (_timerthread_ll != NULL) {
-    for (t_ptr = _timerthread_ll; t_ptr != NULL; t_ptr = t_ptr->next) {
-      if (t_ptr->button == button) {
-        return t_ptr;
-      }
-    }
+static void heap_swap(int a, int b)
+{
+  struct aqtimer *tmp = _timer_heap[a];
+  _timer_heap[a] = _timer_heap[b];
+  _timer_heap[b] = tmp;
+  _timer_heap[a]->heap_pos = a;
+  _timer_heap[b]->heap_pos = b;
+}
+
+static void heap_fix(int pos)
+{
+  // Up
+  while (pos > 0 && timespec_before(&_timer_heap[pos]->due, &_timer_heap[(pos-1)/2]->due)) {
+    heap_swap(pos, (pos-1)/2);
+    pos = (pos-1)/2;
+  }
+  // Down
+  while (true) {
+    int smallest = pos;
+    int l = pos*2 + 1;
+    int r = l + 1;
+    if (l < _timer_heap_size && timespec_before(&_timer_heap[l]->due, &_timer_heap[smallest]->due))
+      smallest = l;
+    if (r < _timer_heap_size && timespec_before(&_timer_heap[r]->due, &_timer_heap[smallest]->due))
+      smallest = r;
+    if (smallest == pos)
+      break;
+    heap_swap(pos, smallest);
+    pos = smallest;
+  }
+}
+
+static void heap_remove(struct aqtimer *t)
+{
+  int pos = t->heap_pos;
+
+  _timer_heap_size--;
+  if (pos != _timer_heap_size) {
+    _timer_heap[pos] = _timer_heap[_timer_heap_size];
+    _timer_heap[pos]->heap_pos = pos;
+    heap_fix(pos);
+  }
+  t->heap_pos = -1;
+}
+
+// Set when the timer is next due, add to the heap if it's not there.
+static void schedule_timer(struct aqtimer *t, int seconds)
+{
+  clock_gettime(CLOCK_MONOTONIC, &t->due);
+  t->due.tv_sec += seconds;
+
+  if (t->heap_pos < 0) {
+    t->heap_pos = _timer_heap_size;
+    _timer_heap[_timer_heap_size++] = t;
+  }
+  heap_fix(t->heap_pos);
+}
+
+static void set_timer_state(struct aqtimer *t, timer_state state)
+{
+  if (t->state == TMR_WAIT_ON)
+    atomic_fetch_sub(&_timers_waiting_on, 1);
+  if (state == TMR_WAIT_ON)
+    atomic_fetch_add(&_timers_waiting_on, 1);
+
+  t->state = state;
+}
+
+static void run_timer(struct aqtimer *t)
+{
+  set_timer_state(t, TMR_RUNNING);
+  t->started_at = time(0);
+  schedule_timer(t, t->duration_min * 60);
+  LOG(TIMR_LOG, LOG_INFO, "Will turn off '%s' in %d minutes\n",t->button->name, t->duration_min);
+}
+
+static void end_timer(struct aqtimer *t)
+{
+  if (t->heap_pos >= 0)
+    heap_remove(t);
+  set_timer_state(t, TMR_IDLE);
+}
+
+static bool start_timer_thread()
+{
+  pthread_condattr_t attr;
+  pthread_t thread_id;
+  int i;
+
+  if (_timer_thread_started)
+    return true;
+
+  for (i=0; i < TOTAL_BUTTONS; i++)
+    _timers[i].heap_pos = -1;
+
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&_timer_cond, &attr);
+  pthread_condattr_destroy(&attr);
+
+  if( pthread_create( &thread_id , NULL ,  timer_worker, NULL) != 0) {
+    LOG(TIMR_LOG, LOG_ERR, "could not create timer thread\n");
+    return false;
   }
+  pthread_detach(thread_id);
+  _timer_thread_started = true;
 
-  return NULL;
+  return true;
 }
 
-int get_timer_left(aqkey *button)
+// Callers can have a snapshot of aqualinkdata (net thread), so look up by index not button pointer.
+int get_timer_left(int deviceIndex)
 {
-  struct timerthread *t_ptr = find_timerthread(button);
+  struct aqtimer *t;
+  int left = 0;
+
+  if (deviceIndex < 0 || deviceIndex >= TOTAL_BUTTONS)
+    return 0;
+
+  t = &_timers[deviceIndex];
 
-  if (t_ptr != NULL) {
+  pthread_mutex_lock(&_timer_mutex);
+  if (t->state != TMR_IDLE) {
     time_t now = time(0);
-    double seconds = difftime(now, t_ptr->started_at);
-    return (int) ((t_ptr->duration_min - (seconds / 60)) +0.5) ;
+    double seconds = (t->state == TMR_RUNNING)?difftime(now, t->started_at):0;
+    left = (int) ((t->duration_min - (seconds / 60)) +0.5);
   }
+  pthread_mutex_unlock(&_timer_mutex);
 
-  return 0;
+  return left;
 }
 
 void clear_timer(struct aqualinkdata *aqdata, /*aqkey *button,*/ int deviceIndex)
 {
-  //struct timerthread *t_ptr = find_timerthread(button);
-  struct timerthread *t_ptr = find_timerthread(&aqdata->aqbuttons[deviceIndex]);
-
-  if (t_ptr != NULL) {
-    LOG(TIMR_LOG, LOG_INFO, "Clearing timer for '%s'\n",t_ptr->button->name);
-    t_ptr->duration_min = 0;
-    pthread_cond_broadcast(&t_ptr->thread_cond);
+  struct aqtimer *t = &_timers[deviceIndex];
+  bool cleared = false;
+
+  pthread_mutex_lock(&_timer_mutex);
+  if (t->state != TMR_IDLE) {
+    LOG(TIMR_LOG, LOG_INFO, "Clearing timer for '%s'\n",t->button->name);
+    end_timer(t);
+    t->button->special_mask &= ~ TIMER_ACTIVE;
+    cleared = true;
   }
+  pthread_mutex_unlock(&_timer_mutex);
+
+  if (cleared)
+    LOG(TIMR_LOG, LOG_NOTICE, "End timer for '%s'\n",aqdata->aqbuttons[deviceIndex].name);
 }
 
 void start_timer(struct aqualinkdata *aqdata, /*aqkey *button,*/ int deviceIndex, int duration)
 {
   aqkey *button = &aqdata->aqbuttons[deviceIndex];
-  struct timerthread *t_ptr = find_timerthread(button);
+  struct aqtimer *t = &_timers[deviceIndex];
 
-  if (t_ptr != NULL) {
-    LOG(TIMR_LOG, LOG_INFO, "Timer already active for '%s', resetting\n",t_ptr->button->name);
-    t_ptr->duration_min = duration;
-    pthread_cond_broadcast(&t_ptr->thread_cond);
-    return;
-  }
+  pthread_mutex_lock(&_timer_mutex);
 
-  struct timerthread *tmthread = calloc(1, sizeof(struct timerthread));
-  tmthread->aqdata = aqdata;
-  tmthread->button = button;
-  tmthread->deviceIndex = deviceIndex;
-  tmthread->thread_id = 0;
-  tmthread->duration_min = duration;
-  tmthread->next = NULL;
-  tmthread->started_at = time(0); // This will get reset once we actually start. But need it here incase someone calls get_timer_left() before we start
-
-  if( pthread_create( &tmthread->thread_id , NULL ,  timer_worker, (void*)tmthread) < 0) {
-    LOG(TIMR_LOG, LOG_ERR, "could not create timer thread for button '%s'\n",button->name);
-    free(tmthread);
+  if (!start_timer_thread()) {
+    pthread_mutex_unlock(&_timer_mutex);
+    LOG(TIMR_LOG, LOG_ERR, "could not start timer for button '%s'\n",button->name);
     return;
   }
 
-  if (_timerthread_ll == NULL) {
-    _timerthread_ll = tmthread;
-    _timerthread_ll->prev = NULL;
-    //LOG(TIMR_LOG, LOG_NOTICE, "Added Timer '%s' at beginning LL\n",_timerthread_ll->button->name);
-  }
-  else
-  {
-    for (t_ptr = _timerthread_ll; t_ptr->next != NULL; t_ptr = t_ptr->next) {} // Simply run to the end of the list
-    t_ptr->next = tmthread;
-    tmthread->prev = t_ptr;
-    //LOG(TIMR_LOG, LOG_NOTICE, "Added Timer '%s' at end LL \n",tmthread->button->name);
-  }
-  
-  if ( tmthread->thread_id != 0 ) {
-    pthread_detach(tmthread->thread_id);
+  if (t->state != TMR_IDLE) {
+    LOG(TIMR_LOG, LOG_INFO, "Timer already active for '%s', resetting\n",t->button->name);
+    t->duration_min = duration;
+    if (t->state == TMR_RUNNING) {
+      if (duration <= 0)
+        schedule_timer(t, 0);
+      else
+        run_timer(t);
+    }
+  } else {
+    t->aqdata = aqdata;
+    t->button = button;
+    t->deviceIndex = deviceIndex;
+    t->duration_min = duration;
+    t->started_at = time(0); // This will get reset once device is on, need it here incase someone calls get_timer_left() before.
+    t->asked_on = false;
+    // Add mask so we know timer is active
+    button->special_mask |= TIMER_ACTIVE;
+    LOG(TIMR_LOG, LOG_NOTICE, "Start timer for '%s'\n",button->name);
+
+    if (button->led->state == OFF) {
+      set_timer_state(t, TMR_WAIT_ON);
+      schedule_timer(t, WAIT_BEFORE_TURN_ON);
+    } else {
+      run_timer(t);
+    }
   }
-}
 
-#define WAIT_TIME_BEFORE_ON_CHECK 1000
-//#define WAIT_TIME_BEFORE_ON_CHECK 1000000 // 1 second
+  pthread_cond_signal(&_timer_cond);
+  pthread_mutex_unlock(&_timer_mutex);
+}
 
-void *timer_worker( void *ptr )
+/*
+ * Called when device state might have changed (see aqdata_changed()), only costs anything
+ * if a timer is waiting for it's device to turn on.
+ */
+void timer_state_changed()
 {
-  struct timerthread *tmthread;
-  tmthread = (struct timerthread *) ptr;
-  int retval = 0;
-  int cnt=0;
+  if (atomic_load_explicit(&_timers_waiting_on, memory_order_relaxed) <= 0)
+    return;
 
-  LOG(TIMR_LOG, LOG_NOTICE, "Start timer for '%s'\n",tmthread->button->name);
+  pthread_mutex_lock(&_timer_mutex);
+  pthread_cond_signal(&_timer_cond);
+  pthread_mutex_unlock(&_timer_mutex);
+}
 
-  // Add mask so we know timer is active
-  tmthread->button->special_mask |= TIMER_ACTIVE;
+// Anything waiting for device to turn on that now is, start counting down.
+static void check_waiting_timers()
+{
+  int i;
 
-/*
-#ifndef PRESTATE_ONOFF
-  delay(WAIT_TIME_BEFORE_ON_CHECK);
-  LOG(TIMR_LOG, LOG_DEBUG, "wait finished for button state '%s'\n",tmthread->button->name);
-#endif
-
-  // device should be on, but check, ignore for PDA as that may not have been turned on yet
-  if (!isPDA_PANEL && tmthread->button->led->state == OFF) {
-    if ((tmthread->button->special_mask & PROGRAM_LIGHT) == PROGRAM_LIGHT && in_light_programming_mode(tmthread->aqdata)) {
-      LOG(TIMR_LOG, LOG_NOTICE, "Not turning on '%s' as programmer is\n",tmthread->button->name);
-    } else {
-      LOG(TIMR_LOG, LOG_NOTICE, "turning on '%s'\n",tmthread->button->name);
-      panel_device_request(tmthread->aqdata, ON_OFF, tmthread->deviceIndex, false, NET_TIMER);
-    }
-  }
-*/
+  if (atomic_load_explicit(&_timers_waiting_on, memory_order_relaxed) <= 0)
+    return;
 
-  while (tmthread->button->led->state == OFF) {
-    LOG(TIMR_LOG, LOG_DEBUG, "waiting for button state '%s' to change\n",tmthread->button->name);
-    delay(WAIT_TIME_BEFORE_ON_CHECK);
-    if (cnt++ == 5 && !isPDA_PANEL) {
-       LOG(TIMR_LOG, LOG_NOTICE, "turning on '%s'\n",tmthread->button->name);
-       panel_device_request(tmthread->aqdata, ON_OFF, tmthread->deviceIndex, true, NET_TIMER);
-    } else if (cnt == 10) {
-       LOG(TIMR_LOG, LOG_ERR, "button state never turned on'%s'\n",tmthread->button->name);
-       break;
+  for (i=0; i < TOTAL_BUTTONS; i++) {
+    if (_timers[i].state == TMR_WAIT_ON && _timers[i].button->led->state != OFF) {
+      if (_timers[i].duration_min <= 0) {
+        end_timer(&_timers[i]);
+        _timers[i].button->special_mask &= ~ TIMER_ACTIVE;
+      } else {
+        run_timer(&_timers[i]);
+      }
     }
   }
+}
 
-  pthread_mutex_lock(&tmthread->thread_mutex);
+void *timer_worker( void *ptr )
+{
+  struct timespec now;
+  struct aqtimer *t;
+  int retval;
 
-  do {
-    if (retval != 0) {
-      LOG(TIMR_LOG, LOG_ERR, "pthread_cond_timedwait failed for '%s', error %d %s\n",tmthread->button->name,retval,strerror(retval));
-      break;
-    } else if (tmthread->duration_min <= 0) {
-      //LOG(TIMR_LOG, LOG_INFO, "Timer has been reset to 0 for '%s'\n",tmthread->button->name);
-      break;
-    }
-    clock_gettime(CLOCK_REALTIME, &tmthread->timeout);
-    tmthread->timeout.tv_sec += (tmthread->duration_min * 60);
-    tmthread->started_at = time(0);
-    LOG(TIMR_LOG, LOG_INFO, "Will turn off '%s' in %d minutes\n",tmthread->button->name, tmthread->duration_min);
-  } while ((retval = pthread_cond_timedwait(&tmthread->thread_cond, &tmthread->thread_mutex, &tmthread->timeout)) != ETIMEDOUT);
+  pthread_mutex_lock(&_timer_mutex);
 
+  while (true) {
+    check_waiting_timers();
 
-  pthread_mutex_unlock(&tmthread->thread_mutex);
+    if (_timer_heap_size == 0) {
+      pthread_cond_wait(&_timer_cond, &_timer_mutex);
+      continue;
+    }
 
-  LOG(TIMR_LOG, LOG_NOTICE, "End timer for '%s'\n",tmthread->button->name);    
+    t = _timer_heap[0];
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (timespec_before(&now, &t->due)) {
+      retval = pthread_cond_timedwait(&_timer_cond, &_timer_mutex, &t->due);
+      if (retval != 0 && retval != ETIMEDOUT) {
+        LOG(TIMR_LOG, LOG_ERR, "pthread_cond_timedwait failed, error %d %s\n",retval,strerror(retval));
+        delay(1000);
+      }
+      continue;
+    }
 
-  // We need to detect if we ended on time or were killed.  
-  // If killed the device is probable off (or being set to off), so we should probably poll a few times before turning off.
-  // Either that of change ap_panel to not turn off device if timer is set.
+    // Device didn't turn on by itself (check_waiting_timers() would have started the countdown).
+    if (t->state == TMR_WAIT_ON) {
+      if (t->asked_on) {
+        LOG(TIMR_LOG, LOG_ERR, "button state never turned on'%s'\n",t->button->name);
+        run_timer(t);
+      } else {
+        t->asked_on = true;
+        schedule_timer(t, WAIT_BEFORE_GIVE_UP - WAIT_BEFORE_TURN_ON);
+        if (!isPDA_PANEL) {
+          int deviceIndex = t->deviceIndex;
+          struct aqualinkdata *aqdata = t->aqdata;
+          LOG(TIMR_LOG, LOG_NOTICE, "turning on '%s'\n",t->button->name);
+          // Don't hold our lock while the panel request runs, it can call back into start / clear timer.
+          pthread_mutex_unlock(&_timer_mutex);
+          panel_device_request(aqdata, ON_OFF, deviceIndex, true, NET_TIMER);
+          pthread_mutex_lock(&_timer_mutex);
+        }
+      }
+      continue;
+    }
 
-  //LOG(TIMR_LOG, LOG_NOTICE, "End timer duration '%d'\n",tmthread->duration_min); 
+    // Countdown finished (or timer was reset to 0)
+    {
+      int deviceIndex = t->deviceIndex;
+      int duration_min = t->duration_min;
+      struct aqualinkdata *aqdata = t->aqdata;
+      aqkey *button = t->button;
 
-  // if duration_min is 0 we were killed, if not we got here on timeout, so turn off device.
+      end_timer(t);
+      pthread_mutex_unlock(&_timer_mutex);
 
-  if (tmthread->duration_min != 0 && tmthread->button->led->state != OFF) {
-    LOG(TIMR_LOG, LOG_INFO, "Timer waking turning '%s' off\n",tmthread->button->name);
-    panel_device_request(tmthread->aqdata, ON_OFF, tmthread->deviceIndex, false, NET_TIMER);
-  } else if (tmthread->button->led->state == OFF) {
-    LOG(TIMR_LOG, LOG_INFO, "Timer waking '%s' is already off\n",tmthread->button->name);
-  }
-  
-  if (tmthread->button->led->state != OFF) {
-    // Need to wait
-  }
+      LOG(TIMR_LOG, LOG_NOTICE, "End timer for '%s'\n",button->name);
 
-  // remove mask so we know timer is dead
-  tmthread->button->special_mask &= ~ TIMER_ACTIVE;
-
-  if (tmthread->next != NULL && tmthread->prev != NULL){
-    // Middle of linked list
-    tmthread->next->prev = tmthread->prev;
-    tmthread->prev->next = tmthread->next;
-    //LOG(TIMR_LOG, LOG_NOTICE, "Removed Timer '%s' from middle LL\n",tmthread->button->name);
-  } else if (tmthread->next == NULL && tmthread->prev != NULL){
-    // end of linked list
-    tmthread->prev->next = NULL;
-    //LOG(TIMR_LOG, LOG_NOTICE, "Removed Timer '%s' from end LL\n",tmthread->button->name);
-  } else if (tmthread->next != NULL && tmthread->prev == NULL){
-    // beginning of linked list
-    _timerthread_ll = tmthread->next;
-    _timerthread_ll->prev = NULL;
-    //LOG(TIMR_LOG, LOG_NOTICE, "Removed Timer '%s' from beginning LL\n",tmthread->button->name);
-  } else if (tmthread->next == NULL && tmthread->prev == NULL){
-    // only item in list
-    _timerthread_ll = NULL;
-    //LOG(TIMR_LOG, LOG_NOTICE, "Removed Timer '%s' last LL\n",tmthread->button->name);
-  }
+      // if duration_min is 0 we were reset, if not we got here on timeout, so turn off device.
+      if (duration_min != 0 && button->led->state != OFF) {
+        LOG(TIMR_LOG, LOG_INFO, "Timer waking turning '%s' off\n",button->name);
+        panel_device_request(aqdata, ON_OFF, deviceIndex, false, NET_TIMER);
+      } else if (button->led->state == OFF) {
+        LOG(TIMR_LOG, LOG_INFO, "Timer waking '%s' is already off\n",button->name);
+      }
 
-  free(tmthread);
-  pthread_exit(0);
+      pthread_mutex_lock(&_timer_mutex);
+      // remove mask so we know timer is dead, unless it's been started again in the meantime
+      if (t->state == TMR_IDLE)
+        button->special_mask &= ~ TIMER_ACTIVE;
+    }
+  }
 
+  pthread_mutex_unlock(&_timer_mutex);
   return ptr;
 }
@@ -5,8 +5,9 @@
 #include "aqualink.h"
 
 void start_timer(struct aqualinkdata *aq_data, /*aqkey *button,*/ int deviceIndex, int duration);
-int get_timer_left(aqkey *button);
+int get_timer_left(int deviceIndex);
 void clear_timer(struct aqualinkdata *aq_data, /*aqkey *button,*/ int deviceIndex);
+void timer_state_changed();
 // Not best place for this, but leave it here so all requests are in net services, this is forward decleration of function in net_services.c
 #ifdef AQ_PDA
 void create_PDA_on_off_request(aqkey *button, bool isON);
@@ -5,6 +5,7 @@
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdatomic.h>
 #include "aq_serial.h"
 #include "aq_programmer.h"
 #include "sensors.h"
@@ -360,7 +361,12 @@ typedef struct clightd
  *
  * This macro uses GCC extensions for type safety and to prevent
  * double-evaluation of the `val` argument.
+ *
+ * These (and SET_DIRTY) also tell aqdata_changed() in aq_snapshot.c what moved, so per device
+ * caches know what to rebuild.
  */
+void aqdata_changed(const void *addr);
+
 //#define DEBUG_SET_IF_CHANGED
 #ifndef DEBUG_SET_IF_CHANGED
 
@@ -370,6 +376,7 @@ typedef struct clightd
         if ((src) != __new_val) {                                \
             (src) = __new_val;                                   \
             (flag) = true;                                       \
+            aqdata_changed(&(src));                              \
         }                                                        \
     })
 
@@ -380,10 +387,11 @@ typedef struct clightd
             strncpy((src), __new_val, sizeof(src));            \
             (src)[sizeof(src) - 1] = '\0';                     \
             (flag) = true;                                     \
+            aqdata_changed(src);                               \
         }                                                      \
     })
 
-#define SET_DIRTY(flag)    ((flag) = true)
+#define SET_DIRTY(flag)    do { (flag) = true; aqdata_changed(NULL); } while(0)
 #define CLEAR_DIRTY(flag)  ((flag) = false)
 
 #else
@@ -395,6 +403,7 @@ typedef struct clightd
         if (__old_val != __new_val) { \
             (src) = __new_val; \
             (flag) = true; \
+            aqdata_changed(&(src)); \
             printf("[%s:%d] Changed %s: %d -> %d\n", __FILE__, __LINE__, #src, (int)__old_val, (int)__new_val); \
         } \
     })
@@ -407,11 +416,13 @@ typedef struct clightd
             strncpy((src), __new_val, sizeof(src));                    \
             (src)[sizeof(src) - 1] = '\0';                             \
             (flag) = true;                                             \
+            aqdata_changed(src);                                       \
         }                                                              \
     })
 
 #define SET_DIRTY(flag)  \
     do {                  \
+        aqdata_changed(NULL); \
         if (!(flag)) {    \
             (flag) = true;\
             printf("[%s:%d] Set dirty flag\n", __FILE__, __LINE__); \
@@ -429,6 +440,22 @@ typedef struct clightd
 #endif // DEBUG_SET_IF_CHANGED
 
 
+/*
+ * Bumped by aqdata_changed(), one counter per device so anything caching output per device
+ * (json_messages.c device fragments) can tell if it's stale. unknown is for changes we can't
+ * place (SET_DIRTY or something outside aqualinkdata) and means everything may have changed.
+ */
+typedef struct aqdata_versions {
+  uint32_t any;
+  uint32_t unknown;
+  uint32_t general;   // Anything in aqualinkdata that's not in one of the arrays below
+  uint32_t led[TOTAL_LEDS];
+  uint32_t button[TOTAL_BUTTONS];
+  uint32_t pump[MAX_PUMPS];
+  uint32_t light[MAX_LIGHTS];
+  uint32_t sensor[MAX_SENSORS];
+} aqdata_versions;
+
 struct aqualinkdata
 {
   //panel_status panelstatus;
@@ -504,7 +531,8 @@ struct aqualinkdata
   unsigned char raw_status[AQ_PSTLEN];
   // Multiple threads update this value.
   //volatile bool updated;
-  volatile bool is_dirty;
+  atomic_bool is_dirty;
+  aqdata_versions versions;
   char self[AQ_MSGLEN*2];
 
   int num_sensors;
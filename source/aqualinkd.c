@@ -60,6 +60,12 @@
 #include "json_messages.h"
 #include "aq_systemutils.h"
 #include "auto_configure.h"
+#include "rs_packet_queue.h"
+#include "rs_dispatch.h"
+#include "aq_snapshot.h"
+#include "aq_metrics.h"
+#include "flight_recorder.h"
+#include "replay.h"
 
 #ifdef AQ_MANAGER
 #include "serial_logger.h"
@@ -88,6 +94,8 @@ int _cmdln_loglevel = -1;
 bool _cmdln_debugRS485 = false;
 bool _cmdln_lograwRS485 = false;
 bool _cmdln_nostartupcheck = false;
+char *_cmdln_replay = NULL;
+char *_cmdln_replay_state = REPLAY_STATE_FILE;
 
 #ifdef AQ_TM_DEBUG
   //struct timespec _rs_packet_readitme;
@@ -106,6 +114,7 @@ bool _cmdln_nostartupcheck = false;
 
 
 void main_loop();
+int replay_main();
 int startup(char *self, char *cfgFile);
 
 
@@ -160,7 +169,7 @@ bool isVirtualButtonEnabled() {
 bool checkAqualinkTime()
 {
   static time_t last_checked = 0;
-  time_t now = time(0); // get time now
+  time_t now = aq_time(NULL); // get time now
   int time_difference;
   struct tm aq_tm;
   time_t aqualink_time;
@@ -455,6 +464,8 @@ void printHelp()
   printf("\t-vv        (Serial Debug logging)\n");
   printf("\t-rsd       (RS485 debug)\n");
   printf("\t-rsrd      (RS485 raw debug)\n");
+  printf("\t-replay <file>     (Replay RS485 capture or log as fast as possible, report & exit)\n");
+  printf("\t-replay-out <file> (Where replay writes final state, default %s)\n", REPLAY_STATE_FILE);
 }
 
 int main(int argc, char *argv[])
@@ -542,6 +553,14 @@ int main(int argc, char *argv[])
     {
       _cmdln_nostartupcheck = true;
     }
+    else if (strcmp(argv[i], "-replay") == 0 && i+1 < argc)
+    {
+      _cmdln_replay = argv[++i];
+    }
+    else if (strcmp(argv[i], "-replay-out") == 0 && i+1 < argc)
+    {
+      _cmdln_replay_state = argv[++i];
+    }
   }
 
   // Set this here, so it doesn;t get reset if the manager restarts the AqualinkD process.
@@ -608,6 +627,13 @@ int startup(char *self, char *cfgFile)
 
   if (_cmdln_lograwRS485)
     _aqconfig_.log_raw_bytes = true;
+
+  // Replay is a foreground tool, and mustn't overwrite the capture it's reading.
+  if (_cmdln_replay != NULL) {
+    _aqconfig_.deamonize = false;
+    _aqconfig_.log_protocol_packets = false;
+    _aqconfig_.log_raw_bytes = false;
+  }
       
 
 #ifdef AQ_MANAGER
@@ -674,6 +700,11 @@ int startup(char *self, char *cfgFile)
 
 
 
+  if (_cmdln_replay != NULL)
+  {
+    exit(replay_main());
+  }
+
   if (_aqconfig_.deamonize == true)
   {
     char pidfile[256];
@@ -770,6 +801,8 @@ void caculate_ack_packet(int rs_fd, unsigned char *packet_buffer, emulation_type
       //DEBUG_TIMER_STOP(_rs_packet_timer,AQUA_LOG,"Unknown Emulation type Processed packet in");
     break;
   }
+
+  record_ack_latency(source);
 }
 
 
@@ -797,21 +830,12 @@ unsigned char find_unused_address(unsigned char* packet) {
   return 0x00;
 }
 
-void main_loop()
+// Defaults before we hear from the panel, shared by main_loop() and replay.
+void init_aqualinkdata()
 {
-  int exit_code = EXIT_SUCCESS;
-  int rs_fd;
-  int packet_length;
-  unsigned char packet_buffer[AQ_MAXPKTLEN+1];
   int i;
-  //int delayAckCnt = 0;
-  bool got_probe = false;
-  bool got_probe_extended = false;
-  bool got_probe_rssa = false;
-  bool print_once = false;
-  int blank_read_reconnect = MAX_ZERO_READ_BEFORE_RECONNECT; // Will get reset if non blocking
-  bool auto_config_complete = true;
 
+  aqdata_track_changes(&_aqualink_data);
 
   //_aqualink_data.panelstatus = STARTING;
   AddAQDstatusMask(CHECKING_CONFIG);
@@ -896,6 +920,95 @@ void main_loop()
     _aqualink_data.ph = 0;
     _aqualink_data.orp = 0;
   }
+}
+
+// Once ID's are known (probes seen / auto configure done), set up what protocols the panel is using.
+void init_panel_interfaces()
+{
+#ifdef AQ_PDA
+  if (isPDA_PANEL) {
+    init_pda(&_aqualink_data);
+    if (_aqconfig_.extended_device_id != 0x00)
+    {
+      LOG(AQUA_LOG,LOG_ERR, "Aqualink daemon can't use extended_device_id in PDA mode, ignoring value '0x%02hhx' from cfg\n",_aqconfig_.extended_device_id);
+      _aqconfig_.extended_device_id = 0x00;
+      _aqconfig_.extended_device_id_programming = false;
+    }
+  }
+#endif
+
+  if ( is_rsserialadapter_id(_aqconfig_.rssa_device_id )) {
+    addPanelRSserialAdapterInterface();
+  }
+
+  if ( is_onetouch_id(_aqconfig_.extended_device_id)) {
+    addPanelOneTouchInterface();
+  } else if ( is_aqualink_touch_id(_aqconfig_.extended_device_id)) {
+    addPanelIAQTouchInterface();
+  }
+
+  // We can only get panel size info from extended ID
+  if (_aqconfig_.extended_device_id != 0x00) {
+    RemoveAQDstatusMask(AUTOCONFIGURE_PANEL);
+    SET_DIRTY(_aqualink_data.is_dirty);
+  }
+
+  if (_aqconfig_.extended_device_id_programming == true && (isONET_ENABLED || isIAQT_ENABLED) )
+  {
+    changePanelToExtendedIDProgramming();
+  } else if (_aqconfig_.extended_device_id_programming == true) {
+    LOG(AQUA_LOG,LOG_ERR, "Aqualink daemon has no valid extended_device_id, ignoring value '%s' from cfg\n",CFG_N_extended_device_id_programming);
+    _aqconfig_.extended_device_id = 0x00;
+    _aqconfig_.extended_device_id_programming = false;
+  }
+}
+
+/*
+ * aqualinkd -replay, no serial port, no web / mqtt, just the packet handlers.
+ * Panel ID's have to be in the config, there's no auto configure from a recording.
+ */
+int replay_main()
+{
+  start_log_writer();
+
+  init_aqualinkdata();
+
+  if (_aqconfig_.device_id == 0x00 || _aqconfig_.device_id == 0xFF) {
+    LOG(AQUA_LOG,LOG_ERR, "Replay needs device_id set in config, can't auto configure from a recording\n");
+    return EXIT_FAILURE;
+  }
+
+  init_panel_interfaces();
+  build_rs_dispatch_table();
+
+  RemoveAQDstatusMask(CHECKING_CONFIG);
+  RemoveAQDstatusMask(NOT_CONNECTED);
+  AddAQDstatusMask(CONNECTED);
+
+  return replay_rs485_trace(_cmdln_replay, _cmdln_replay_state, &_aqualink_data);
+}
+
+void main_loop()
+{
+  int exit_code = EXIT_SUCCESS;
+  int rs_fd;
+  int packet_length;
+  unsigned char packet_buffer[AQ_MAXPKTLEN+1];
+  struct timespec packet_time;
+  const rs_dispatch_entry *dispatch;
+  int i;
+  //int delayAckCnt = 0;
+  bool got_probe = false;
+  bool got_probe_extended = false;
+  bool got_probe_rssa = false;
+  bool print_once = false;
+  int blank_read_reconnect = MAX_ZERO_READ_BEFORE_RECONNECT; // Will get reset if non blocking
+  bool auto_config_complete = true;
+
+  // Has to be after daemonise() has forked.
+  start_log_writer();
+
+  init_aqualinkdata();
 
   signal(SIGINT, intHandler);
   signal(SIGTERM, intHandler);
@@ -1114,49 +1227,17 @@ void main_loop()
     SET_DIRTY(_aqualink_data.is_dirty);
   }
 
-#ifdef AQ_PDA
-  if (isPDA_PANEL) {
-    init_pda(&_aqualink_data);
-    if (_aqconfig_.extended_device_id != 0x00)
-    {
-      LOG(AQUA_LOG,LOG_ERR, "Aqualink daemon can't use extended_device_id in PDA mode, ignoring value '0x%02hhx' from cfg\n",_aqconfig_.extended_device_id);
-      _aqconfig_.extended_device_id = 0x00;
-      _aqconfig_.extended_device_id_programming = false;
-    }
-  }
-#endif
-
-  if ( is_rsserialadapter_id(_aqconfig_.rssa_device_id )) {
-    addPanelRSserialAdapterInterface();
-  }
-
-  if ( is_onetouch_id(_aqconfig_.extended_device_id)) {
-    addPanelOneTouchInterface();
-  } else if ( is_aqualink_touch_id(_aqconfig_.extended_device_id)) {
-    addPanelIAQTouchInterface();
-  }
-
-  // We can only get panel size info from extended ID
-  if (_aqconfig_.extended_device_id != 0x00) {
-    RemoveAQDstatusMask(AUTOCONFIGURE_PANEL);
-    SET_DIRTY(_aqualink_data.is_dirty);
-  }
-
-  if (_aqconfig_.extended_device_id_programming == true && (isONET_ENABLED || isIAQT_ENABLED) )
-  {
-    changePanelToExtendedIDProgramming();
-  } else if (_aqconfig_.extended_device_id_programming == true) {
-    LOG(AQUA_LOG,LOG_ERR, "Aqualink daemon has no valid extended_device_id, ignoring value '%s' from cfg\n",CFG_N_extended_device_id_programming);
-    _aqconfig_.extended_device_id = 0x00;
-    _aqconfig_.extended_device_id_programming = false;
-  }
-
-
+  init_panel_interfaces();
 
   if ( _aqualink_data.num_sensors > 0){
     start_sensors_thread(&_aqualink_data);
   }
 
+  start_scheduler();
+
+  build_rs_dispatch_table();
+  start_rs_packet_queue(&_aqualink_data);
+
   /*
    *
    *    This is the main loop  
@@ -1195,6 +1276,7 @@ void main_loop()
       {
         sprintf(_aqualink_data.last_display_message, CONNECTION_ERROR);
         LOG(AQUA_LOG,LOG_ERR, "Aqualink daemon looks like serial error, resetting.\n");
+        flight_recorder_anomaly("serial reset");
         SET_DIRTY(_aqualink_data.is_dirty);
         AddAQDstatusMask(ERROR_SERIAL);
         //broadcast_aqualinkstate_error(CONNECTION_ERROR);
@@ -1225,6 +1307,11 @@ void main_loop()
 
     packet_length = get_packet(rs_fd, packet_buffer);
 
+    if (packet_length > 0)
+      metric_rs_packet(packet_buffer, packet_length);
+    else
+      metric_rs_error(packet_length);
+
     if (packet_length <= 0 && _keepRunning)
     {
       // AQSERR_2SMALL // no reset (-5)
@@ -1237,8 +1324,13 @@ void main_loop()
         //blank_read = blank_read_reconnect;
       } else if (packet_length == AQSERR_READ) {
         LOG(AQUA_LOG,LOG_ERR, "Error read on serial port, resetting\n");
+        flight_recorder_anomaly("serial read error");
         blank_read = blank_read_reconnect;
       } else {
+        if (packet_length == AQSERR_CHKSUM)
+          flight_recorder_anomaly("checksum error");
+        else if (packet_length == AQSERR_2LARGE)
+          flight_recorder_anomaly("oversized frame");
         // In non blocking, so sleep for 2 milliseconds
         LOG(AQUA_LOG,LOG_WARNING, "Nothing read on serial port\n");
       }
@@ -1250,6 +1342,7 @@ void main_loop()
     }
     else if (packet_length > 0)
     {
+      clock_gettime(CLOCK_MONOTONIC, &packet_time);
       RemoveAQDstatusMask(ERROR_SERIAL);
       RemoveAQDstatusMask(CONNECTING);
       AddAQDstatusMask(CONNECTED);
@@ -1263,7 +1356,9 @@ void main_loop()
         // Check if we have a valid connection
         if ( _aqualink_data.simulator_id != NUL && packet_buffer[PKT_DEST] == _aqualink_data.simulator_id) {
           // Action comand and Send to web
+          aqdata_write_lock();
           processSimulatorPacket(packet_buffer, packet_length, &_aqualink_data);
+          aqdata_write_unlock();
           caculate_ack_packet(rs_fd, packet_buffer, SIMULATOR);
           DEBUG_TIMER_STOP(_rs_packet_timer,AQUA_LOG,"Simulator Emulation Processed packet in");
         }
@@ -1274,10 +1369,12 @@ void main_loop()
                   ) 
         {
           if (is_simulator_packet(&_aqualink_data, packet_buffer, packet_length)) {
-            _aqualink_data.simulator_id = packet_buffer[PKT_DEST];
             // reply to probe
             LOG(SIM_LOG,LOG_NOTICE, "Got probe on '0x%02hhx', using for simulator ID\n",packet_buffer[PKT_DEST]);
+            aqdata_write_lock();
+            _aqualink_data.simulator_id = packet_buffer[PKT_DEST];
             processSimulatorPacket(packet_buffer, packet_length, &_aqualink_data);
+            aqdata_write_unlock();
             caculate_ack_packet(rs_fd, packet_buffer, SIMULATOR);
           } else {
             LOG(SIM_LOG,LOG_INFO, "Got probe on '0x%02hhx' Still waiting for valid simulator probe\n",packet_buffer[PKT_DEST]);
@@ -1287,61 +1384,25 @@ void main_loop()
       }
 
       // Process and packets of devices we are acting as
-      if (packet_length > 0 && getProtocolType(packet_buffer) == JANDY && packet_buffer[PKT_DEST] != 0x00 &&
-          (packet_buffer[PKT_DEST] == _aqconfig_.device_id ||
-           packet_buffer[PKT_DEST] == _aqconfig_.rssa_device_id ||
-           packet_buffer[PKT_DEST] == _aqconfig_.extended_device_id ||
-           packet_buffer[PKT_DEST] == _aqconfig_.extended_device_id2
-           ))
+      if (packet_length > 0 && getProtocolType(packet_buffer) == JANDY &&
+          (dispatch = get_rs_dispatch_entry(packet_buffer[PKT_DEST]))->emulation != SIM_NONE)
       {
         AddAQDstatusMask(CONNECTED);
-        switch(getJandyDeviceType(packet_buffer[PKT_DEST])){
-          case ALLBUTTON:
-            process_allbutton_packet(packet_buffer, packet_length, &_aqualink_data);
-            caculate_ack_packet(rs_fd, packet_buffer, ALLBUTTON);
-          break;
-          case RSSADAPTER:
-            process_rssadapter_packet(packet_buffer, packet_length, &_aqualink_data);
-            caculate_ack_packet(rs_fd, packet_buffer, RSSADAPTER);    
-          break;
-          case IAQTOUCH:
-            process_iaqtouch_packet(packet_buffer, packet_length, &_aqualink_data);
-            caculate_ack_packet(rs_fd, packet_buffer, IAQTOUCH);
-          break;
-          case ONETOUCH:
-            process_onetouch_packet(packet_buffer, packet_length, &_aqualink_data);
-            caculate_ack_packet(rs_fd, packet_buffer, ONETOUCH);
-          break;
-          case AQUAPDA:
-            process_pda_packet(packet_buffer, packet_length);
-            caculate_ack_packet(rs_fd, packet_buffer, AQUAPDA);
-          break;
-          case IAQUALNK:
-            process_iaqualink_packet(packet_buffer, packet_length, &_aqualink_data);
-            caculate_ack_packet(rs_fd, packet_buffer, IAQUALNK);
-          break;
-          default:
-          break;
-        }
+        aqdata_write_lock();
+        dispatch->process_emulation(packet_buffer, packet_length, &_aqualink_data);
+        aqdata_write_unlock();
+        caculate_ack_packet(rs_fd, packet_buffer, dispatch->emulation);
 #ifdef AQ_TM_DEBUG
         char message[128];
-        sprintf(message,"%s Emulation Processed packet in",getJandyDeviceName(getJandyDeviceType(packet_buffer[PKT_DEST])));
+        sprintf(message,"%s Emulation Processed packet in",getJandyDeviceName(dispatch->emulation));
         DEBUG_TIMER_STOP(_rs_packet_timer,AQUA_LOG,message);
 #endif
       }
-      // Process any packets to readonly devices.
+      // Packets to readonly devices are decoded on the RS device thread, don't hold up the next read.
       else if (packet_length > 0 && _aqconfig_.read_RS485_devmask > 0)
       {
-        if (getProtocolType(packet_buffer) == JANDY)
-        {
-          processJandyPacket(packet_buffer, packet_length, &_aqualink_data);
-        }
-        // Process Pentair Device Packed (pentair have to & from in message, so no need to)
-        else if (getProtocolType(packet_buffer) == PENTAIR && READ_RSDEV_vsfPUMP) {
-          processPentairPacket(packet_buffer, packet_length, &_aqualink_data);
-          // In the future probably add code to catch device offline (ie missing reply message)
-        }
-        DEBUG_TIMER_STOP(_rs_packet_timer,AQUA_LOG,"Processed (readonly) packet in");
+        push_rs_packet_queue(packet_buffer, packet_length, &packet_time);
+        DEBUG_TIMER_STOP(_rs_packet_timer,AQUA_LOG,"Queued (readonly) packet in");
       } else {
         DEBUG_TIMER_CLEAR(_rs_packet_timer); // Clear timer, no need to print anything
       }
@@ -1350,7 +1411,7 @@ void main_loop()
     if (_aqualink_data.unactioned.type != NO_ACTION)
     {
       time_t now;
-      time(&now);
+      aq_time(&now);
       if (difftime(now, _aqualink_data.unactioned.requested) > 2)
       {
         LOG(AQUA_LOG,LOG_DEBUG, "Actioning delayed request\n");
@@ -1363,6 +1424,8 @@ void main_loop()
     //delay(10);
   }
   
+  stop_rs_packet_queue();
+
   //if (_aqconfig_.debug_RSProtocol_packets) stopPacketLogger();
   stopPacketLogger();
 
@@ -1373,6 +1436,7 @@ void main_loop()
      // Stop network if we are not restarting
      stop_net_services();
      stop_sensors_thread();
+     stop_scheduler();
   }
 
   // Reset and close the port.
@@ -0,0 +1,280 @@
+/*
+ * Copyright (c) 2017 Shaun Feakes - All rights reserved
+ *
+ * You may use redistribute and/or modify this code under the terms of
+ * the GNU General Public License version 2 as published by the
+ * Free Software Foundation. For the terms of this license,
+ * see <http://www.gnu.org/licenses/>.
+ *
+ * You are free to use this software under the terms of the GNU General
+ * Public License, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ *  https://github.com/sfeakes/aqualinkd
+ */
+
+/*
+  Pushes come from web / mqtt / programming threads, pops from the RS485 thread while
+  it's building an ACK, so everything is under the queue mutex (never contended for long).
+  Each priority is a ring, so popping is O(1) rather than shuffling the array down.
+
+  Protocols that send a command and then remove it after the ACK has gone (RS serial adapter,
+  iAqualink) use cmdq_peek() / cmdq_remove().  The peeked entry is pinned so a coalescing push
+  can't change it underneath us.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "aq_serial.h"
+#include "cmd_queue.h"
+
+static cmd_queue *_cmdq_list = NULL;
+static pthread_mutex_t _cmdq_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+#define RING_ENTRY(q, prio, i) (&(q)->ring[prio][((q)->head[prio] + (i)) % CMDQ_DEPTH])
+
+static int cmdq_depth(cmd_queue *q)
+{
+  int i, depth = 0;
+
+  for (i=0; i < CMDQ_PRIORITIES; i++)
+    depth += q->count[i];
+
+  return depth;
+}
+
+static int cmdq_capacity(cmd_queue *q)
+{
+  return (q->capacity > 0 && q->capacity < CMDQ_DEPTH) ? q->capacity : CMDQ_DEPTH;
+}
+
+static void cmdq_register(cmd_queue *q)
+{
+  pthread_mutex_lock(&_cmdq_list_mutex);
+  if (!q->registered) {
+    q->next = _cmdq_list;
+    _cmdq_list = q;
+    q->registered = true;
+  }
+  pthread_mutex_unlock(&_cmdq_list_mutex);
+}
+
+// Find a waiting (not pinned) group with the same key, overwrite it in place so it keeps it's position.
+static bool cmdq_coalesce(cmd_queue *q, cmdq_priority prio, uint32_t key, int parts, const unsigned char **cmds, const int *lengths)
+{
+  cmdq_entry *entry;
+  int i, p;
+
+  for (i = (q->pinned == prio ? 1 : 0); i + parts <= q->count[prio]; i++) {
+    entry = RING_ENTRY(q, prio, i);
+    if (entry->key != key || entry->part != 0)
+      continue;
+
+    for (p=1; p < parts; p++) {
+      entry = RING_ENTRY(q, prio, i+p);
+      if (entry->key != key || entry->part != p)
+        break;
+    }
+    if (p < parts)
+      continue;
+
+    for (p=0; p < parts; p++) {
+      entry = RING_ENTRY(q, prio, i+p);
+      memcpy(entry->cmd, cmds[p], lengths[p]);
+      entry->length = lengths[p];
+    }
+    q->stats.coalesced++;
+    return true;
+  }
+
+  return false;
+}
+
+static bool cmdq_push_group(cmd_queue *q, cmdq_priority prio, uint32_t key, int parts, const unsigned char **cmds, const int *lengths)
+{
+  cmdq_entry *entry;
+  bool rtn = true;
+  int p;
+
+  for (p=0; p < parts; p++) {
+    if (lengths[p] <= 0 || lengths[p] > CMDQ_MAX_CMD) {
+      LOG(q->log, LOG_ERR, "Command of %d bytes is too large for %s queue\n", lengths[p], q->name);
+      return false;
+    }
+  }
+
+  if (!q->registered)
+    cmdq_register(q);
+
+  pthread_mutex_lock(&q->mutex);
+
+  if (key != 0 && cmdq_coalesce(q, prio, key, parts, cmds, lengths)) {
+    LOG(q->log, LOG_DEBUG, "Replaced waiting command in %s queue, length %d\n", q->name, cmdq_depth(q));
+  } else if (cmdq_depth(q) + parts > cmdq_capacity(q)) {
+    q->stats.dropped += parts;
+    rtn = false;
+  } else {
+    for (p=0; p < parts; p++) {
+      entry = RING_ENTRY(q, prio, q->count[prio]);
+      memcpy(entry->cmd, cmds[p], lengths[p]);
+      entry->length = lengths[p];
+      entry->part = p;
+      entry->key = key;
+      q->count[prio]++;
+    }
+    q->stats.pushed += parts;
+    q->stats.depth = cmdq_depth(q);
+    if (q->stats.depth > q->stats.max_depth)
+      q->stats.max_depth = q->stats.depth;
+  }
+
+  pthread_mutex_unlock(&q->mutex);
+
+  if (!rtn)
+    LOG(q->log, LOG_ERR, "Command queue overflow, too many unsent commands to RS control panel, last command ignored!\n");
+
+  return rtn;
+}
+
+bool cmdq_push(cmd_queue *q, cmdq_priority prio, uint32_t key, const unsigned char *cmd, int length)
+{
+  return cmdq_push_group(q, prio, key, 1, &cmd, &length);
+}
+
+// Two commands that must go one after the other, ie ready & set value on RS serial adapter.
+bool cmdq_push_pair(cmd_queue *q, cmdq_priority prio, uint32_t key, const unsigned char *cmd1, int length1, const unsigned char *cmd2, int length2)
+{
+  const unsigned char *cmds[2] = {cmd1, cmd2};
+  int lengths[2] = {length1, length2};
+
+  return cmdq_push_group(q, prio, key, 2, cmds, lengths);
+}
+
+// Must hold mutex
+static int cmdq_front(cmd_queue *q)
+{
+  int prio;
+
+  for (prio=0; prio < CMDQ_PRIORITIES; prio++) {
+    if (q->count[prio] > 0)
+      return prio;
+  }
+  return -1;
+}
+
+// Must hold mutex
+static void cmdq_drop_front(cmd_queue *q, int prio)
+{
+  q->head[prio] = (q->head[prio] + 1) % CMDQ_DEPTH;
+  q->count[prio]--;
+  q->stats.popped++;
+  q->stats.depth = cmdq_depth(q);
+  if (q->pinned == prio)
+    q->pinned = -1;
+}
+
+// Single key queues, returns NUL if nothing waiting.
+unsigned char cmdq_pop_byte(cmd_queue *q)
+{
+  unsigned char cmd = NUL;
+  int prio;
+
+  pthread_mutex_lock(&q->mutex);
+  if ( (prio = cmdq_front(q)) >= 0 ) {
+    cmd = RING_ENTRY(q, prio, 0)->cmd[0];
+    cmdq_drop_front(q, prio);
+  }
+  pthread_mutex_unlock(&q->mutex);
+
+  return cmd;
+}
+
+// Copy next command into cmd (CMDQ_MAX_CMD bytes) and pin it, returns length or 0 if empty.
+int cmdq_peek(cmd_queue *q, unsigned char *cmd)
+{
+  cmdq_entry *entry;
+  int length = 0;
+  int prio;
+
+  pthread_mutex_lock(&q->mutex);
+  q->pinned = prio = cmdq_front(q);
+  if (prio >= 0) {
+    entry = RING_ENTRY(q, prio, 0);
+    memcpy(cmd, entry->cmd, entry->length);
+    length = entry->length;
+  }
+  pthread_mutex_unlock(&q->mutex);
+
+  return length;
+}
+
+// Remove the command given out by cmdq_peek(), it's been sent.
+void cmdq_remove(cmd_queue *q)
+{
+  pthread_mutex_lock(&q->mutex);
+  if (q->pinned >= 0 && q->count[q->pinned] > 0)
+    cmdq_drop_front(q, q->pinned);
+  q->pinned = -1;
+  pthread_mutex_unlock(&q->mutex);
+}
+
+// Peeked command wasn't sent, leave it queued.
+void cmdq_unpin(cmd_queue *q)
+{
+  pthread_mutex_lock(&q->mutex);
+  q->pinned = -1;
+  pthread_mutex_unlock(&q->mutex);
+}
+
+// Copy the most recent queued command for key (and part of group) into cmd, returns length or 0 if none.
+int cmdq_pending(cmd_queue *q, uint32_t key, int part, unsigned char *cmd)
+{
+  cmdq_entry *entry;
+  int length = 0;
+  int prio, i;
+
+  pthread_mutex_lock(&q->mutex);
+  for (prio=0; prio < CMDQ_PRIORITIES; prio++) {
+    for (i=0; i < q->count[prio]; i++) {
+      entry = RING_ENTRY(q, prio, i);
+      if (entry->key == key && entry->part == part) {
+        memcpy(cmd, entry->cmd, entry->length);
+        length = entry->length;
+      }
+    }
+  }
+  pthread_mutex_unlock(&q->mutex);
+
+  return length;
+}
+
+int cmdq_length(cmd_queue *q)
+{
+  int depth;
+
+  pthread_mutex_lock(&q->mutex);
+  depth = cmdq_depth(q);
+  pthread_mutex_unlock(&q->mutex);
+
+  return depth;
+}
+
+// Only queues that have been used are listed
+int get_cmd_queue_stats(cmdq_info *info, int max)
+{
+  cmd_queue *q;
+  int n = 0;
+
+  pthread_mutex_lock(&_cmdq_list_mutex);
+  for (q = _cmdq_list; q != NULL && n < max; q = q->next, n++) {
+    pthread_mutex_lock(&q->mutex);
+    info[n].name = q->name;
+    info[n].stats = q->stats;
+    pthread_mutex_unlock(&q->mutex);
+  }
+  pthread_mutex_unlock(&_cmdq_list_mutex);
+
+  return n;
+}
@@ -0,0 +1,77 @@
+#ifndef CMD_QUEUE_H_
+#define CMD_QUEUE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "utils.h"
+
+/*
+  Commands waiting to be sent to the panel in reply to a packet addressed to us.
+  One of these per emulation (allbutton keys, RS serial adapter, iAqualink etc).
+  User actions are sent ahead of background polls, commands pushed with the same
+  key replace the one still waiting rather than queue again, and overflows are counted.
+*/
+
+#define CMDQ_MAX_CMD 20  // Largest is iAqualink full command (19)
+#define CMDQ_DEPTH   40  // Per priority, capacity below can be smaller
+
+typedef enum {
+  CMDQ_USER = 0,  // Someone pressed something, send first
+  CMDQ_POLL,      // Status requests we make ourselves
+  CMDQ_PRIORITIES
+} cmdq_priority;
+
+// key 0 never coalesces, otherwise (type, id) ie (setpoint, pool)
+#define CMDQ_KEY(type, id) ((uint32_t)(type) << 16 | (uint32_t)(id))
+
+typedef struct cmdq_entry {
+  unsigned char cmd[CMDQ_MAX_CMD];
+  uint8_t length;
+  uint8_t part;   // Position in a group that must be sent together (ie ready then set)
+  uint32_t key;
+} cmdq_entry;
+
+typedef struct cmdq_stats {
+  uint32_t depth;
+  uint32_t max_depth;
+  uint64_t pushed;
+  uint64_t popped;
+  uint64_t coalesced;  // Replaced a waiting command rather than queue another
+  uint64_t dropped;    // Queue full
+} cmdq_stats;
+
+typedef struct cmd_queue {
+  const char *name;
+  logmask_t log;
+  int capacity;
+  cmdq_entry ring[CMDQ_PRIORITIES][CMDQ_DEPTH];
+  int head[CMDQ_PRIORITIES];
+  int count[CMDQ_PRIORITIES];
+  int pinned;  // Priority whose head has been handed out by cmdq_peek(), -1 for none
+  cmdq_stats stats;
+  pthread_mutex_t mutex;
+  bool registered;
+  struct cmd_queue *next;
+} cmd_queue;
+
+#define CMD_QUEUE_INIT(qname, logmask, cap) { .name = (qname), .log = (logmask), .capacity = (cap), .pinned = -1, .mutex = PTHREAD_MUTEX_INITIALIZER }
+
+bool cmdq_push(cmd_queue *q, cmdq_priority prio, uint32_t key, const unsigned char *cmd, int length);
+bool cmdq_push_pair(cmd_queue *q, cmdq_priority prio, uint32_t key, const unsigned char *cmd1, int length1, const unsigned char *cmd2, int length2);
+unsigned char cmdq_pop_byte(cmd_queue *q);
+int  cmdq_peek(cmd_queue *q, unsigned char *cmd);
+void cmdq_remove(cmd_queue *q);
+void cmdq_unpin(cmd_queue *q);
+int  cmdq_pending(cmd_queue *q, uint32_t key, int part, unsigned char *cmd);
+int  cmdq_length(cmd_queue *q);
+
+typedef struct cmdq_info {
+  const char *name;
+  cmdq_stats stats;
+} cmdq_info;
+
+int get_cmd_queue_stats(cmdq_info *info, int max);
+
+#endif // CMD_QUEUE_H_
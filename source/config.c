@@ -37,7 +37,6 @@
 //#include <sys/types.h>
 //#include <unistd.h>
 #include <net/if.h>
-#include <regex.h>
 #include <limits.h>
 
 
@@ -55,6 +54,7 @@
 #include "rs_msg_utils.h"
 #include "aq_systemutils.h"
 #include "net_interface.h"
+#include "uri_routes.h"
 
 #define MAXCFGLINE 256
 
@@ -175,6 +175,7 @@ const int           _dcfg_light_programming_initial_off = 12;
 
 
 const int           _dcfg_sensor_poll_time = 300;
+const int           _dcfg_websocket_min_interval = 250;
 
 void init_parameters (struct aqconfig * parms)
 {
@@ -615,6 +616,32 @@ void init_parameters (struct aqconfig * parms)
   _cfgParams[_numCfgParams].default_value = (void *)&_dcfg_sensor_poll_time;
   _cfgParams[_numCfgParams].config_mask |= CFG_GRP_ADVANCED;
 
+  // Minimum time between websocket status broadcasts, changes in between are coalesced.
+  _numCfgParams++;
+  _cfgParams[_numCfgParams].value_ptr = &_aqconfig_.websocket_min_interval;
+  _cfgParams[_numCfgParams].value_type = CFG_INT;
+  _cfgParams[_numCfgParams].name = CFG_N_websocket_min_interval;
+  _cfgParams[_numCfgParams].default_value = (void *)&_dcfg_websocket_min_interval;
+  _cfgParams[_numCfgParams].config_mask |= CFG_GRP_ADVANCED;
+
+  // Serve web_directory from memory, watch reloads it when files change.  Both default on,
+  // a cache that never notices an edited or upgraded web file serves stale pages until restart.
+  _numCfgParams++;
+  _cfgParams[_numCfgParams].value_ptr = &_aqconfig_.web_cache;
+  _cfgParams[_numCfgParams].value_type = CFG_BOOL;
+  _cfgParams[_numCfgParams].name = CFG_N_web_cache;
+  _cfgParams[_numCfgParams].default_value = (void *)&_dcfg_true;
+  _cfgParams[_numCfgParams].config_mask |= CFG_GRP_ADVANCED;
+  _cfgParams[_numCfgParams].config_mask |= CFG_FORCE_RESTART;
+
+  _numCfgParams++;
+  _cfgParams[_numCfgParams].value_ptr = &_aqconfig_.web_cache_watch;
+  _cfgParams[_numCfgParams].value_type = CFG_BOOL;
+  _cfgParams[_numCfgParams].name = CFG_N_web_cache_watch;
+  _cfgParams[_numCfgParams].default_value = (void *)&_dcfg_true;
+  _cfgParams[_numCfgParams].config_mask |= CFG_GRP_ADVANCED;
+  _cfgParams[_numCfgParams].config_mask |= CFG_FORCE_RESTART;
+
 
   // Optional values to store in config
   _numCfgParams++;
@@ -662,6 +689,57 @@ void init_parameters (struct aqconfig * parms)
   //generate_mqtt_id(parms->mqtt_ID, MQTT_ID_LEN);
 
   set_config_defaults();
+
+  build_cfg_index();
+}
+
+/*
+  Case insensitive hash index over _cfgParams names, so setConfigValue() doesn't
+  strncasecmp every parameter for every config line.
+  Open addressing, slots hold index+1 so 0 is empty.
+*/
+#define CFG_INDEX_SIZE 256 // Power of 2, keep well over size of _cfgParams
+
+static uint8_t _cfgIndex[CFG_INDEX_SIZE];
+
+static uint32_t cfg_name_hash(const char *name, int len)
+{
+  uint32_t hash = 2166136261u; // FNV-1a
+
+  for (int i=0; i < len; i++) {
+    hash ^= (unsigned char)tolower((unsigned char)name[i]);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+void build_cfg_index()
+{
+  uint32_t slot;
+
+  memset(_cfgIndex, 0, sizeof(_cfgIndex));
+
+  for (int i=0; i <= _numCfgParams; i++) {
+    slot = cfg_name_hash(_cfgParams[i].name, strlen(_cfgParams[i].name)) & (CFG_INDEX_SIZE - 1);
+    while (_cfgIndex[slot] != 0)
+      slot = (slot + 1) & (CFG_INDEX_SIZE - 1);
+    _cfgIndex[slot] = i + 1;
+  }
+}
+
+cfgParam *find_cfg_param(const char *name, int len)
+{
+  uint32_t slot = cfg_name_hash(name, len) & (CFG_INDEX_SIZE - 1);
+  cfgParam *parm;
+
+  while (_cfgIndex[slot] != 0) {
+    parm = &_cfgParams[_cfgIndex[slot] - 1];
+    if (strncasecmp(name, parm->name, len) == 0 && parm->name[len] == '\0')
+      return parm;
+    slot = (slot + 1) & (CFG_INDEX_SIZE - 1);
+  }
+
+  return NULL;
 }
 
 
@@ -828,84 +906,111 @@ bool mac(char *buf, int len, bool useDelimiter)
 
 
 
+// Returns true if value is what the parameter is already set to, so we don't re-apply it.
+static bool cfg_param_unchanged(cfgParam *parm, char *value)
+{
+  char *current;
+
+  switch (parm->value_type) {
+    case CFG_STRING:
+      current = *(char **)parm->value_ptr;
+      return (current != NULL && strcmp(current, value) == 0);
+    case CFG_INT:
+      return (*(int *)parm->value_ptr == (int)strtoul(value, NULL, 10));
+    case CFG_BOOL:
+      return (*(bool *)parm->value_ptr == text2bool(value));
+    case CFG_HEX:
+      return (*(unsigned char *)parm->value_ptr == (unsigned char)strtoul(value, NULL, 16));
+    case CFG_FLOAT:
+      return (*(float *)parm->value_ptr == (float)atof(value));
+    case CFG_BITMASK:
+      return (((*(uint16_t *)parm->value_ptr & parm->mask) == parm->mask) == text2bool(value));
+    case CFG_SPECIAL:
+      // panel_type rebuilds buttons, so always apply these.
+    break;
+  }
+
+  return false;
+}
+
 bool setConfigValue(struct aqualinkdata *aqdata, char *param, char *value) {
   bool rtn = false;
-  char *tmpval;
+  cfgParam *parm;
+  int keylen;
  
-//#ifdef CONFIG_DEV_TEST
-  //int val;
-  //char *sval;
-  for (int i=0; i <= _numCfgParams; i++) {
-    //printf ("** Test against '%s' %d\n",_cfgParams[i].name, (int)strlen(_cfgParams[i].name));
-    if (strncasecmp(param, _cfgParams[i].name, (int)strlen(_cfgParams[i].name) ) == 0) {
-      //printf ("MATCH = %s\n",param);
+  // Key ends at whitespace or '=', value only needs cleaning once.
+  for (keylen=0; param[keylen] != '\0' && param[keylen] != '=' && !isspace((unsigned char)param[keylen]); keylen++) {}
+  value = cleanwhitespace(value);
+
+  if ( (parm = find_cfg_param(param, keylen)) != NULL) {
       rtn=true;
 
       // Any special 
-      if ( _cfgParams[i].valid_values != NULL ) {
-        //printf("Checking %s in %s\n",value,_cfgParams[i].valid_values);
-        if ( rsm_strstr(_cfgParams[i].valid_values, cleanwhitespace(value)) == NULL) {
-          LOG(AQUA_LOG,LOG_ERR, "Config entry '%s',  %s is not valid\n",param, value);
+      if ( parm->valid_values != NULL ) {
+        //printf("Checking %s in %s\n",value,parm->valid_values);
+        if ( rsm_strstr(parm->valid_values, value) == NULL) {
+          LOG(AQUA_LOG,LOG_ERR, "Config entry '%.*s',  %s is not valid\n",keylen, param, value);
           //rtn=false;
           return false;
         }
       }
 
-      if (strlen(cleanwhitespace(value)) <= 0) {
-        LOG(AQUA_LOG,LOG_INFO,"Set configuration option `%s` to default since value is blank\n",_cfgParams[i].name );
-        set_cfg_parm_to_default(&_cfgParams[i]);
+      if (value[0] == '\0') {
+        LOG(AQUA_LOG,LOG_INFO,"Set configuration option `%s` to default since value is blank\n",parm->name );
+        set_cfg_parm_to_default(parm);
         return true;
       }
 
-      if (isMASK_SET(_cfgParams[i].config_mask, CFG_PASSWD_MASK)) {
+      if (isMASK_SET(parm->config_mask, CFG_PASSWD_MASK)) {
         if (strncmp(value, PASSWD_MASK_TEXT, strlen(PASSWD_MASK_TEXT)) == 0) {
           // Don't set password when it's the mask text
           return false;
         }
       }
 
-      switch (_cfgParams[i].value_type) {
+      if (cfg_param_unchanged(parm, value)) {
+        return true;
+      }
+
+      switch (parm->value_type) {
         case CFG_STRING:
-          if (_cfgParams[i].value_ptr != NULL && *(char **)_cfgParams[i].value_ptr != _cfgParams[i].default_value) {
-            LOG(AQUA_LOG,LOG_DEBUG,"FREE Memory for config %s %s\n",_cfgParams[i].name, *(char **)_cfgParams[i].value_ptr);
-            free(*(char **)_cfgParams[i].value_ptr);
-            *(char **)_cfgParams[i].value_ptr = NULL;
+          if (parm->value_ptr != NULL && *(char **)parm->value_ptr != parm->default_value) {
+            LOG(AQUA_LOG,LOG_DEBUG,"FREE Memory for config %s %s\n",parm->name, *(char **)parm->value_ptr);
+            free(*(char **)parm->value_ptr);
+            *(char **)parm->value_ptr = NULL;
           }
-          *(char **)_cfgParams[i].value_ptr = cleanalloc(value);
+          *(char **)parm->value_ptr = cleanalloc(value);
         break;
         case CFG_INT:
-          *(int *)_cfgParams[i].value_ptr = strtoul(cleanwhitespace(value), NULL, 10);
+          *(int *)parm->value_ptr = strtoul(value, NULL, 10);
         break;
         case CFG_BOOL:
-          *(bool *)_cfgParams[i].value_ptr = text2bool(value);
+          *(bool *)parm->value_ptr = text2bool(value);
         break;
         case CFG_HEX:
-          *(unsigned char *)_cfgParams[i].value_ptr = strtoul(cleanwhitespace(value), NULL, 16); 
+          *(unsigned char *)parm->value_ptr = strtoul(value, NULL, 16); 
         break;
         case CFG_FLOAT:
-          tmpval = cleanalloc(value);
-          *(float *)_cfgParams[i].value_ptr = atof(tmpval);
-          free(tmpval);
+          *(float *)parm->value_ptr = atof(value);
         break;
         case CFG_BITMASK:
           if (text2bool(value))
-            *(uint16_t *)_cfgParams[i].value_ptr |= _cfgParams[i].mask;
+            *(uint16_t *)parm->value_ptr |= parm->mask;
           else
-            *(uint16_t *)_cfgParams[i].value_ptr &= ~_cfgParams[i].mask;
+            *(uint16_t *)parm->value_ptr &= ~parm->mask;
         break;
         case CFG_SPECIAL:
-          if (strncasecmp(param, CFG_N_log_level, strlen(CFG_N_log_level)) == 0) {
-            *(int *)_cfgParams[i].value_ptr = text2elevel(cleanwhitespace(value));
-          } else if (strncasecmp(param, CFG_N_panel_type, strlen(CFG_N_panel_type)) == 0) {
-            setPanelByName(aqdata, cleanwhitespace(value)); 
+          if (strcasecmp(parm->name, CFG_N_log_level) == 0) {
+            *(int *)parm->value_ptr = text2elevel(value);
+          } else if (strcasecmp(parm->name, CFG_N_panel_type) == 0) {
+            setPanelByName(aqdata, value); 
           } else {
-            LOG(AQUA_LOG,LOG_ERR, "ADD SPECIAL CONFIG FOR '%s'\n",param);
+            LOG(AQUA_LOG,LOG_ERR, "ADD SPECIAL CONFIG FOR '%.*s'\n",keylen, param);
           }
         break;
       }
 
       return rtn;
-    }
   }
   //_cfgParams[_numCfgParams].value_ptr = _aqconfig_.testChar;
   //_cfgParams[_numCfgParams].value_type = CFG_STRING;
@@ -915,7 +1020,7 @@ bool setConfigValue(struct aqualinkdata *aqdata, char *param, char *value) {
 
 //#endif
 
-if (strlen(cleanwhitespace(value)) <= 0) {
+if (value[0] == '\0') {
   LOG(AQUA_LOG,LOG_WARNING,"Configuration value is blank for option `%s`, Ignoring\n",param );
   return true;
 }
@@ -1053,12 +1158,14 @@ if (strlen(cleanwhitespace(value)) <= 0) {
       rtn=false;
     } else if (strncasecmp(param + 9, "_label", 6) == 0) {
       aqdata->aqbuttons[num].label = cleanalloc(value);
+      invalidate_uri_button_index();
       rtn=true;
 #ifdef AQ_PDA
     } else if (strncasecmp(param + 9, "_PDA_label", 10) == 0) {
       LOG(AQUA_LOG,LOG_WARNING, "Config error, 'button_%d_PDA_label' is no longer supported, please use 'button_%d_label'\n",num,num);
       //aqdata->aqbuttons[num].pda_label = cleanalloc(value);
       aqdata->aqbuttons[num].label = cleanalloc(value);
+      invalidate_uri_button_index();
       rtn=true;
 #endif
     /*
@@ -1167,7 +1274,7 @@ if (strlen(cleanwhitespace(value)) <= 0) {
     } else if (strncasecmp(param + 17, "_pump", 5) == 0) {
       aqkey *vbutton = getVirtualButton(aqdata, num);
       if (vbutton != NULL) {
-        vbutton->led->state = ON; //Virtual pump default to on 
+        SET_IF_CHANGED(vbutton->led->state, ON, aqdata->is_dirty); //Virtual pump default to on 
         if ( ! populatePumpData(aqdata, param + 18, vbutton, value) ) 
         {
           LOG(AQUA_LOG,LOG_ERR, "Config error, VSP Pumps limited to %d, ignoring : %s",MAX_PUMPS,param);
@@ -1230,8 +1337,10 @@ if (strlen(cleanwhitespace(value)) <= 0) {
     int num = strtoul(param + 7, NULL, 10) - 1;
     if (num + 1 > MAX_SENSORS || num < 0) {
       LOG(AQUA_LOG,LOG_ERR, "Config error, Maximum of %d sensors allowd `%s` ignored!",MAX_SENSORS,param);
-    } else if (strlen(cleanwhitespace(value)) > 0) {
+    } else if (value[0] != '\0') {
       if ( num + 1 > aqdata->num_sensors ) {
+        for (int i=aqdata->num_sensors; i <= num; i++)
+          aqdata->sensors[i].hysteresis = SENSOR_HYSTERESIS_UNSET;
         aqdata->num_sensors = num + 1;
       }
       sprintf(aqdata->sensors[num].ID, "Aux_S%d", num+1);
@@ -1255,6 +1364,12 @@ if (strlen(cleanwhitespace(value)) <= 0) {
       } else if (strncasecmp(param + 9, "_uom", 3) == 0) {
         aqdata->sensors[num].uom = cleanalloc(value);
         rtn=true;
+      } else if (strncasecmp(param + 9, "_poll_time", 10) == 0) {
+        aqdata->sensors[num].poll_time = strtoul(value, NULL, 10);
+        rtn=true;
+      } else if (strncasecmp(param + 9, "_hysteresis", 11) == 0) {
+        aqdata->sensors[num].hysteresis = atof(value);
+        rtn=true;
       }
     } else {
       LOG(AQUA_LOG,LOG_ERR, "Config error, blank value for `%s`\n",param);
@@ -1516,6 +1631,7 @@ void read_config (struct aqualinkdata *aqdata, char *cfgFile)
       {
         b_ptr = &bufr[0];
         char *indx;
+        char *end;
         // Eat leading whitespace
         while(isspace(*b_ptr)) b_ptr++;
         if ( b_ptr[0] != '\0' && b_ptr[0] != '#')
@@ -1523,11 +1639,12 @@ void read_config (struct aqualinkdata *aqdata, char *cfgFile)
           indx = strchr(b_ptr, '=');  
           if ( indx != NULL) 
           {
+            // Split into key & value here, so nothing below has to find the end of the key again.
+            end = indx;
+            while(end > b_ptr && isspace(*(end-1))) end--;
+            *end = '\0';
             if ( ! setConfigValue(aqdata, b_ptr, indx+1)) {
-              //LOG(AQUA_LOG,LOG_ERR, "Unknown config parameter '%.*s'\n",strlen(b_ptr), b_ptr);
-              char *end = b_ptr + strlen(b_ptr) - 1;
-              while(end > b_ptr && isspace(*end)) end--;
-              LOG(AQUA_LOG,LOG_ERR, "Unknown config parameter '%.*s'\n",end-b_ptr+1, b_ptr);
+              LOG(AQUA_LOG,LOG_ERR, "Unknown config parameter '%s'\n",b_ptr);
             }
           } 
         }
@@ -1628,6 +1745,8 @@ void check_print_config (struct aqualinkdata *aqdata)
           aqdata->sensors[j].factor = aqdata->sensors[j+1].factor;
           aqdata->sensors[j].regex = aqdata->sensors[j+1].regex;
           aqdata->sensors[j].uom = aqdata->sensors[j+1].uom;
+          aqdata->sensors[j].poll_time = aqdata->sensors[j+1].poll_time;
+          aqdata->sensors[j].hysteresis = aqdata->sensors[j+1].hysteresis;
           //aqdata->sensors[j].ID = aqdata->sensors[j+1].ID;
           sprintf(aqdata->sensors[j].ID, "Aux_S%d", j+1);
           //printf("Sensor %d = %s, %s\n",j,aqdata->sensors[j].ID,aqdata->sensors[j].label);
@@ -2007,19 +2126,48 @@ void writeIntValue (FILE *fp, char *msg, int value)
     fprintf(fp, "%s = %d\n", msg, value);
 }
 
+/*
+  Pull the next "key" : "value" pair out of the web config JSON, moving cursor past it.
+  Same pairs the old regex " *\"([^\",:]+) *\" *: *\"([^\",]*)\" *,*" matched, but in one pass.
+*/
+static bool next_cfg_json_pair(const char **cursor, char *key, int ksize, char *value, int vsize)
+{
+  const char *ptr;
+  const char *kstart, *kend, *vstart;
+
+  for (ptr = *cursor; (ptr = strchr(ptr, '"')) != NULL; ptr++) {
+    kstart = ptr + 1;
+    for (kend = kstart; *kend != '\0' && *kend != '"' && *kend != ',' && *kend != ':'; kend++) {}
+    if (*kend != '"' || kend == kstart)
+      continue;
+    for (vstart = kend + 1; *vstart == ' '; vstart++) {}
+    if (*vstart++ != ':')
+      continue;
+    while (*vstart == ' ') vstart++;
+    if (*vstart++ != '"')
+      continue;
+    for (ptr = vstart; *ptr != '\0' && *ptr != '"' && *ptr != ','; ptr++) {}
+    if (*ptr != '"')
+      continue;
+
+    snprintf(key, ksize, "%.*s", (int)(kend - kstart), kstart);
+    snprintf(value, vsize, "%.*s", (int)(ptr - vstart), vstart);
+    // Trailing spaces in key were allowed before
+    for (int i = strlen(key) - 1; i >= 0 && key[i] == ' '; i--)
+      key[i] = '\0';
+    *cursor = ptr + 1;
+    return true;
+  }
+
+  return false;
+}
+
 int save_config_js(const char* inBuf, int inSize, char* outBuf, int outSize, struct aqualinkdata *aqdata)
 {
   //printf("\n%.*s\n",inSize,inBuf);
 
-  //const char *regexString=" *\"([^\",:]+) *\" *: *\"([^\",:]+)\" *,*";
-  const char *regexString=" *\"([^\",:]+) *\" *: *\"([^\",]*)\" *,*";
-  size_t maxGroups = 3;
   size_t maxMatches = 200;
-  //size_t maxGroups = 3;
-  regmatch_t groupArray[maxGroups];
-  regex_t regexCompiled;
-  int rc;
-  char * cursor = (char *)inBuf;
+  const char *cursor = inBuf;
   unsigned int m;
   char key[64];
   char value[64];
@@ -2059,6 +2207,8 @@ int save_config_js(const char* inBuf, int inSize, char* outBuf, int outSize, str
     //aqdata->sensors[i].regex = NULL;
     free(aqdata->sensors[i].uom);
     aqdata->sensors[i].uom = NULL;
+    aqdata->sensors[i].poll_time = 0;
+    aqdata->sensors[i].hysteresis = SENSOR_HYSTERESIS_UNSET;
   }
   aqdata->num_sensors=0;
 
@@ -2080,23 +2230,14 @@ int save_config_js(const char* inBuf, int inSize, char* outBuf, int outSize, str
     return snprintf(outBuf, outSize, "{\"message\":\"ERROR in Config\"}"); 
   }
 
-  if (0 != (rc = regcomp(&regexCompiled, regexString, REG_EXTENDED))) {
-    LOG(AQUA_LOG,LOG_ERR, "Saving config regcomp() failed, returning nonzero (%d)\n", rc);
-    return snprintf(outBuf, outSize, "{\"message\":\"ERROR in Config\"}"); 
-  }
-
   //cursor = inBuf+start+1;
   for (m = 0; m < maxMatches; m ++)
   {
     ignorePair = false;
 
-    if (0 != (rc = regexec(&regexCompiled, cursor, maxGroups, groupArray, 0))) {
-      //printf("Failed to match '%s' with '%s',returning %d.\n", cursor, pattern, rc);
+    if ( ! next_cfg_json_pair(&cursor, key, sizeof(key), value, sizeof(value))) {
       break;
-    }    
-
-    snprintf(key, 64, "%.*s", (groupArray[1].rm_eo - groupArray[1].rm_so), (cursor + groupArray[1].rm_so));
-    snprintf(value, 64, "%.*s",   (groupArray[2].rm_eo - groupArray[2].rm_so), (cursor + groupArray[2].rm_so));
+    }
     //printf("**** Pair = %s : %s \n",key,value);
 
     LOG(AQUA_LOG,LOG_DEBUG, "Read json cfg Pair = %s : %s \n",key,value);
@@ -2115,14 +2256,13 @@ int save_config_js(const char* inBuf, int inSize, char* outBuf, int outSize, str
     }
 
     // Check if panel size has changed
-    if (strncasecmp(key, CFG_N_panel_type, (int)strlen(CFG_N_panel_type) ) == 0) {
+    if (strcasecmp(key, CFG_N_panel_type) == 0) {
       if (psize != PANEL_SIZE()) {
         // Panel size changed
         ignodeBtnLabelsGrater = PANEL_SIZE();
       }
     }
 
-    cursor += groupArray[0].rm_eo;
   }
 
   // The above will reset all the panel profocol masks since it re-sets the panel, so set them back here.
@@ -2136,8 +2276,6 @@ int save_config_js(const char* inBuf, int inSize, char* outBuf, int outSize, str
     addPanelIAQTouchInterface();
   }
 
-  regfree(&regexCompiled);
-
   check_print_config(aqdata);
   writeCfg(aqdata);
 
@@ -2276,6 +2414,12 @@ bool writeCfg (struct aqualinkdata *aqdata)
     if (aqdata->sensors[i-1].uom != NULL) {
       fprintf(fp,"sensor_%.2d_uom=%s\n",i,aqdata->sensors[i-1].uom);
     }
+    if (aqdata->sensors[i-1].poll_time > 0) {
+      fprintf(fp,"sensor_%.2d_poll_time=%d\n",i,aqdata->sensors[i-1].poll_time);
+    }
+    if (aqdata->sensors[i-1].hysteresis >= 0) {
+      fprintf(fp,"sensor_%.2d_hysteresis=%f\n",i,aqdata->sensors[i-1].hysteresis);
+    }
     /*
     if (aqdata->sensors[i-1].regex != NULL) {
       fprintf(fp,"sensor_%.2d_regex=%f\n",i,aqdata->sensors[i-1].regex);
@@ -112,6 +112,9 @@ struct aqconfig
   bool save_debug_log_masks;
   bool save_light_programming_value;
   int sensor_poll_time;
+  int websocket_min_interval; // ms
+  bool web_cache;
+  bool web_cache_watch;
 };
 
 #ifndef CONFIG_C
@@ -225,6 +228,9 @@ cfgParam _cfgParams[100];
 int _numCfgParams;
 #endif // CONFIG_C
 
+void build_cfg_index();
+cfgParam *find_cfg_param(const char *name, int len);
+
 
 // Below are missed
 //RSSD_LOG_filter
@@ -315,6 +321,9 @@ int _numCfgParams;
 
 #define CFG_N_ftdi_low_latency                  "ftdi_low_latency"
 #define CFG_N_rs485_frame_delay                 "rs485_frame_delay"
+#define CFG_N_websocket_min_interval            "websocket_min_interval"
+#define CFG_N_web_cache                         "web_cache"
+#define CFG_N_web_cache_watch                   "web_cache_watch"
 
 #define CFG_N_save_debug_log_masks              "save_debug_log_masks"
 #define CFG_N_save_light_programming_value      "save_light_programming_value"
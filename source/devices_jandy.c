@@ -21,6 +21,7 @@
 
 #include "rs_devices.h"
 #include "devices_jandy.h"
+#include "rs_dispatch.h"
 #include "aq_serial.h"
 #include "aqualink.h"
 #include "utils.h"
@@ -77,48 +78,16 @@ bool processJandyPacket(unsigned char *packet_buffer, int packet_length, struct
   static unsigned char previous_packet_to = NUL; // bad name, it's not previous, it's previous that we were interested in.
   int rtn = false;
 
+  const rs_dispatch_entry *entry;
+
   // We received the ack from a Jandy device we are interested in
   if (packet_buffer[PKT_DEST] == DEV_MASTER && interestedInNextAck != DRS_NONE)
   {
-    if (interestedInNextAck == DRS_SWG)
+    entry = get_rs_dispatch_entry(previous_packet_to);
+    if (entry->device == interestedInNextAck && entry->process_from != NULL)
     {
-      printJandyDebugPacket("SWG", packet_buffer, packet_length);
-      rtn = processPacketFromSWG(packet_buffer, packet_length, aqdata, previous_packet_to);
-    }
-    else if (interestedInNextAck == DRS_EPUMP)
-    {
-      printJandyDebugPacket("EPump", packet_buffer, packet_length);
-      rtn = processPacketFromJandyPump(packet_buffer, packet_length, aqdata, previous_packet_to);
-    }
-    else if (interestedInNextAck == DRS_JXI)
-    {
-      printJandyDebugPacket("JXi", packet_buffer, packet_length);
-      rtn = processPacketFromJandyJXiHeater(packet_buffer, packet_length, aqdata, previous_packet_to);
-    }
-    else if (interestedInNextAck == DRS_LX)
-    {
-      printJandyDebugPacket("LX", packet_buffer, packet_length);
-      rtn = processPacketFromJandyLXHeater(packet_buffer, packet_length, aqdata, previous_packet_to);
-    }
-    else if (interestedInNextAck == DRS_CHEM_FEED)
-    {
-      printJandyDebugPacket("ChemL", packet_buffer, packet_length);
-      rtn = processPacketFromJandyChemFeeder(packet_buffer, packet_length, aqdata, previous_packet_to);
-    }
-    else if (interestedInNextAck == DRS_CHEM_ANLZ)
-    {
-      printJandyDebugPacket("CemSnr", packet_buffer, packet_length);
-      rtn = processPacketFromJandyChemAnalyzer(packet_buffer, packet_length, aqdata, previous_packet_to);
-    }
-    else if (interestedInNextAck == DRS_HEATPUMP)
-    {
-      printJandyDebugPacket("HPump", packet_buffer, packet_length);
-      rtn = processPacketFromHeatPump(packet_buffer, packet_length, aqdata, previous_packet_to);
-    }
-    else if (interestedInNextAck == DRS_JLIGHT)
-    {
-      printJandyDebugPacket("JLight", packet_buffer, packet_length);
-      rtn = processPacketFromJandyLight(packet_buffer, packet_length, aqdata, previous_packet_to);
+      printJandyDebugPacket(entry->device_name, packet_buffer, packet_length);
+      rtn = entry->process_from(packet_buffer, packet_length, aqdata, previous_packet_to);
     }
     interestedInNextAck = DRS_NONE;
     previous_packet_to = NUL;
@@ -137,66 +106,14 @@ bool processJandyPacket(unsigned char *packet_buffer, int packet_length, struct
     interestedInNextAck = DRS_NONE;
     previous_packet_to = NUL;
   }
-  else if (READ_RSDEV_SWG && is_swg_id(packet_buffer[PKT_DEST]))
+  else if ( (entry = get_rs_dispatch_entry(packet_buffer[PKT_DEST]))->process_to != NULL )
   {
-    interestedInNextAck = DRS_SWG;
-    printJandyDebugPacket("SWG", packet_buffer, packet_length);
-    rtn = processPacketToSWG(packet_buffer, packet_length, aqdata/*, _aqconfig_.swg_zero_ignore*/);
-    previous_packet_to = packet_buffer[PKT_DEST];
-  }
-  else if (READ_RSDEV_ePUMP && is_jandy_pump_id(packet_buffer[PKT_DEST]))
-  {
-    interestedInNextAck = DRS_EPUMP;
-    printJandyDebugPacket("EPump", packet_buffer, packet_length);
-    rtn = processPacketToJandyPump(packet_buffer, packet_length, aqdata);
-    previous_packet_to = packet_buffer[PKT_DEST];
-  }
-  else if (READ_RSDEV_JXI && is_jxi_heater_id(packet_buffer[PKT_DEST]))
-  {
-    interestedInNextAck = DRS_JXI;
-    printJandyDebugPacket("JXi", packet_buffer, packet_length);
-    rtn = processPacketToJandyJXiHeater(packet_buffer, packet_length, aqdata);
-    previous_packet_to = packet_buffer[PKT_DEST];
-  }
-  else if (READ_RSDEV_LX && is_lx_heater_id(packet_buffer[PKT_DEST]))
-  {
-    interestedInNextAck = DRS_LX;
-    printJandyDebugPacket("LX", packet_buffer, packet_length);
-    rtn = processPacketToJandyLXHeater(packet_buffer, packet_length, aqdata);
-    previous_packet_to = packet_buffer[PKT_DEST];
-  }
-  else if (READ_RSDEV_CHEM_FEDR && is_chem_feeder_id(packet_buffer[PKT_DEST] ))
-  {
-    interestedInNextAck = DRS_CHEM_FEED;
-    printJandyDebugPacket("ChemL", packet_buffer, packet_length);
-    rtn = processPacketToJandyChemFeeder(packet_buffer, packet_length, aqdata);
-    previous_packet_to = packet_buffer[PKT_DEST];
-  }
-  else if (READ_RSDEV_CHEM_ANLZ && is_chem_anlzer_id(packet_buffer[PKT_DEST]))
-  {
-    interestedInNextAck = DRS_CHEM_ANLZ;
-    printJandyDebugPacket("CemSnr", packet_buffer, packet_length);
-    rtn = processPacketToJandyChemAnalyzer(packet_buffer, packet_length, aqdata);
-    previous_packet_to = packet_buffer[PKT_DEST];
-  }
-  else if (READ_RSDEV_iAQLNK && is_aqualink_touch_id(packet_buffer[PKT_DEST]) // should we add is_iaqualink_id() as well????
-          && packet_buffer[PKT_DEST] != _aqconfig_.extended_device_id) // We would have already read extended_device_id frame
-  {
-    process_iAqualinkStatusPacket(packet_buffer, packet_length, aqdata);
-  }
-  else if (READ_RSDEV_HPUMP && is_heat_pump_id(packet_buffer[PKT_DEST] ))
-  {
-    interestedInNextAck = DRS_HEATPUMP;
-    printJandyDebugPacket("HPump", packet_buffer, packet_length);
-    rtn = processPacketToHeatPump(packet_buffer, packet_length, aqdata);
-    previous_packet_to = packet_buffer[PKT_DEST];
-  }
-  else if (READ_RSDEV_JLIGHT && is_jandy_light_id(packet_buffer[PKT_DEST]))
-  {
-    interestedInNextAck = DRS_JLIGHT;
-    printJandyDebugPacket("JLight", packet_buffer, packet_length);
-    rtn = processPacketToJandyLight(packet_buffer, packet_length, aqdata);
-    previous_packet_to = packet_buffer[PKT_DEST];
+    if (entry->device != DRS_NONE) {
+      interestedInNextAck = entry->device;
+      previous_packet_to = packet_buffer[PKT_DEST];
+      printJandyDebugPacket(entry->device_name, packet_buffer, packet_length);
+    }
+    rtn = entry->process_to(packet_buffer, packet_length, aqdata);
   }
   else
   {
@@ -275,10 +192,9 @@ bool processPacketFromSWG(unsigned char *packet, int packet_length, struct aqual
     }
 
     if ( (packet[4] * 100) != aqdata->swg_ppm ) {
-      aqdata->swg_ppm = packet[4] * 100;
+      SET_IF_CHANGED(aqdata->swg_ppm, packet[4] * 100, aqdata->is_dirty);
       LOG(DJAN_LOG, LOG_INFO, "Received SWG PPM %d from SWG packet\n", aqdata->swg_ppm);
       changedAnything = true;
-      SET_DIRTY(aqdata->is_dirty);
     }
     // logMessage(LOG_DEBUG, "Read SWG PPM %d from ID 0x%02hhx\n", aqdata.swg_ppm, SWG_DEV_ID);
   }
@@ -809,7 +725,7 @@ bool processPacketFromJandyJXiHeater(unsigned char *packet_buffer, int packet_le
   }
   
   // No error is 0x00, so blindly set it.
-  aqdata->heater_err_status = packet_buffer[6];
+  SET_IF_CHANGED(aqdata->heater_err_status, packet_buffer[6], aqdata->is_dirty);
    // Check if error first
   if (packet_buffer[6] != 0x00) {
     
@@ -14,6 +14,7 @@
 #include "aq_serial.h"
 #include "utils.h"
 #include "packetLogger.h"
+#include "packetCapture.h"
 #include "rs_msg_utils.h"
 
 #define CONFIG_C // Make us look like config.c when we load config.h so we get globals.
@@ -32,67 +33,18 @@ bool isAqualinkDStopping() {
   return !_keepRunning;
 }
 
-int get_bytes(FILE *fd, unsigned char* buffer)
+int get_bytes(FILE *fd, unsigned char* buffer, int size)
 {
-  int packet_length = 0;
+  int packet_length;
   char line[4000];
-  char hex[6];
-  int i;
-  bool foundHex=false;
-  /*
-    const char *hex_string = "0xFF";
-    unsigned char value;
-
-    // Use strtoul to convert the hex string to an unsigned long
-    // The third argument, 16, specifies the base (hexadecimal)
-    unsigned long temp_value = strtoul(hex_string, NULL, 16);
-
-    // Cast the unsigned long to unsigned char
-    value = (unsigned char)temp_value;
-  */
-
-  if ( fgets ( line, sizeof line, fd ) != NULL ) /* read a line */
-  {
-    packet_length=0;
-    for (i=0; i < strlen(line); i++)
-    {
-      if (line[i] == 'H' && line[i+1] == 'E' && line[i+2] == 'X' && line[i+3] == ':') {
-        foundHex=true;
-        i=i+4;
-      }
-      if (line[i] == '0' && line[i+1] == 'x' && foundHex) {
-        break;
-      }
-      if (i<=1 && line[i] == '0' && line[i+1] == 'x') {
-        //printf(stdout,"Line starting with hex\n");
-        break;
-      }
-    }
 
-    if (i == strlen(line)) {
-      //printf( "PLAYBACK No binary\n");
-      return 0;
-    } else {
-      //printf(" Transposed from index %d=",i);
-      //printf( "%s",line);
-      LOG(SLOG_LOG, LOG_DEBUG, "Read bytes %s", line);
-    }
-
-    for (i=i; i < strlen(line); i=i+5)
-    {
-      strncpy(hex, &line[i], 4);
-      hex[5] = '\0';
-      buffer[packet_length] = (int)strtol(hex, NULL, 16);
-      packet_length++;
-    }
-    packet_length--;
+  if ( fgets ( line, sizeof line, fd ) == NULL ) /* read a line */
+    return -1;
 
-    //printf("End Char = 0x%02hhx\n",buffer[packet_length-1]);
-    buffer[packet_length] = '\0';
+  if ( (packet_length = parseHexPacketLine(line, buffer, size)) > 0 )
+    LOG(SLOG_LOG, LOG_DEBUG, "Read bytes %s", line);
 
-    return packet_length;
-  }
-  return -1;
+  return packet_length;
 }
 
 bool createBinaryFile(char *dest, char *source) {
@@ -115,7 +67,7 @@ bool createBinaryFile(char *dest, char *source) {
   }
 
   while (size != -1) {
-     size = get_bytes(sfp, buffer);
+     size = get_bytes(sfp, buffer, sizeof(buffer));
 
      if (size > 0) {
         //printf("GOT %d bytes\n",size);
@@ -152,11 +104,23 @@ int main(int argc, char *argv[])
     fprintf(stderr, "ERROR, first param must be valid filename\n");
     return 1;
   }
+#ifdef AQ_MANAGER
   setLoggingPrms(logLevel, false, NULL);
+#else
+  setLoggingPrms(logLevel, false, NULL, NULL);
+#endif
 
   LOG(SLOG_LOG, LOG_INFO, "Start reading %s\n", basename(argv[1]));
 
-  createBinaryFile("/tmp/tmp.tmp", argv[1]);
+  // Binary capture or text RS485.log
+  if (isPacketCaptureFile(argv[1])) {
+    if (packetCaptureToBinary(argv[1], "/tmp/tmp.tmp") < 0) {
+      fprintf(stderr, "Cannot read capture %s\n",argv[1]);
+      return 1;
+    }
+  } else {
+    createBinaryFile("/tmp/tmp.tmp", argv[1]);
+  }
 
   
   if ((fp = open("/tmp/tmp.tmp", O_RDONLY)) == -1)
@@ -167,8 +131,10 @@ int main(int argc, char *argv[])
 
   //packet_length = get_packet(fp, packet_buffer);
 
-  while ((packet_length = get_packet(fp, packet_buffer)) != 0) {
-    LOG(SLOG_LOG, LOG_INFO, "Read %d bytes\n", packet_length);
+  // A read error is the end of the file, bad frames are logged by get_packet() so keep going.
+  while ((packet_length = get_packet(fp, packet_buffer)) != 0 && packet_length != AQSERR_READ) {
+    if (packet_length > 0)
+      LOG(SLOG_LOG, LOG_INFO, "Read %d bytes\n", packet_length);
   }
 /*
   if (packet_length == 0)
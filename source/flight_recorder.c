@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2017 Shaun Feakes - All rights reserved
+ *
+ * You may use redistribute and/or modify this code under the terms of
+ * the GNU General Public License version 2 as published by the
+ * Free Software Foundation. For the terms of this license,
+ * see <http://www.gnu.org/licenses/>.
+ *
+ * You are free to use this software under the terms of the GNU General
+ * Public License, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ *  https://github.com/sfeakes/aqualinkd
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "flight_recorder.h"
+#include "packetCapture.h"
+#include "utils.h"
+
+/*
+  Writers take the next slot with one atomic add and then just memcpy, each slot has a sequence
+  (frame number + 1, 0 while it's being written) so a dump taken while frames are still coming
+  in skips any slot that changed under it rather than taking a lock on the serial thread.
+*/
+
+typedef struct fr_slot {
+  atomic_uint seq;
+  uint16_t length;
+  uint8_t type;
+  uint64_t time_ns;
+  unsigned char data[FLIGHT_RECORDER_FRAME_LEN];
+} fr_slot;
+
+typedef struct fr_frame {
+  uint16_t length;
+  uint8_t type;
+  uint64_t time_ns;
+  unsigned char data[FLIGHT_RECORDER_FRAME_LEN];
+} fr_frame;
+
+static fr_slot _fr_slots[FLIGHT_RECORDER_FRAMES];
+static atomic_uint _fr_next = 0;
+
+static pthread_mutex_t _fr_dump_mutex = PTHREAD_MUTEX_INITIALIZER;
+static atomic_long _fr_last_anomaly = 0;
+static atomic_bool _fr_dumping = false;
+
+void flight_recorder_frame(uint8_t type, const unsigned char *packet, int length)
+{
+  unsigned int frame = atomic_fetch_add_explicit(&_fr_next, 1, memory_order_relaxed);
+  fr_slot *slot = &_fr_slots[frame & (FLIGHT_RECORDER_FRAMES - 1)];
+  struct timespec now;
+
+  if (length > FLIGHT_RECORDER_FRAME_LEN)
+    length = FLIGHT_RECORDER_FRAME_LEN;
+  else if (length < 0)
+    length = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  slot->length = length;
+  slot->type = type;
+  slot->time_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+  memcpy(slot->data, packet, length);
+
+  atomic_store_explicit(&slot->seq, frame + 1, memory_order_release);
+}
+
+// Copy out a consistent slot, false if it's empty, being written, or not the frame we wanted.
+static bool read_slot(unsigned int frame, fr_frame *out)
+{
+  fr_slot *slot = &_fr_slots[frame & (FLIGHT_RECORDER_FRAMES - 1)];
+  unsigned int seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+
+  if (seq != frame + 1)
+    return false;
+
+  out->length = slot->length;
+  out->type = slot->type;
+  out->time_ns = slot->time_ns;
+  memcpy(out->data, slot->data, out->length <= FLIGHT_RECORDER_FRAME_LEN ? out->length : FLIGHT_RECORDER_FRAME_LEN);
+
+  atomic_thread_fence(memory_order_acquire);
+
+  return atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq;
+}
+
+int flight_recorder_dump(const char *reason)
+{
+  unsigned int next = atomic_load_explicit(&_fr_next, memory_order_acquire);
+  unsigned int first = (next > FLIGHT_RECORDER_FRAMES) ? next - FLIGHT_RECORDER_FRAMES : 0;
+  uint64_t data_size = 0;
+  fr_frame *frames;
+  FILE *fp;
+  int count = 0;
+  int i;
+
+  if ((frames = malloc(sizeof(fr_frame) * FLIGHT_RECORDER_FRAMES)) == NULL)
+    return -1;
+
+  for (unsigned int frame = first; frame != next; frame++) {
+    if (read_slot(frame, &frames[count]) && frames[count].length > 0) {
+      data_size += sizeof(packet_capture_record) + frames[count].length;
+      count++;
+    }
+  }
+
+  pthread_mutex_lock(&_fr_dump_mutex);
+
+  if ((fp = createPacketCaptureFile(FLIGHT_RECORDER_FILE, data_size)) == NULL) {
+    LOG(RSSD_LOG, LOG_ERR, "Flight recorder, unable to write %s\n", FLIGHT_RECORDER_FILE);
+    count = -1;
+  } else {
+    for (i=0; i < count; i++)
+      writePacketCaptureRecord(fp, frames[i].type, frames[i].time_ns, frames[i].data, frames[i].length);
+    fclose(fp);
+    LOG(RSSD_LOG, LOG_NOTICE, "Flight recorder (%s), wrote last %d RS485 frames to %s\n", reason, count, FLIGHT_RECORDER_FILE);
+  }
+
+  pthread_mutex_unlock(&_fr_dump_mutex);
+
+  free(frames);
+  return count;
+}
+
+static void *anomaly_dump_thread(void *reason)
+{
+  flight_recorder_dump((const char *)reason);
+  atomic_store(&_fr_dumping, false);
+  return NULL;
+}
+
+// reason must be a string literal, it's used after we return.
+void flight_recorder_anomaly(const char *reason)
+{
+  struct timespec now;
+  pthread_t thread;
+  long last;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  last = atomic_load(&_fr_last_anomaly);
+
+  if (last != 0 && now.tv_sec - last < FLIGHT_RECORDER_INTERVAL)
+    return;
+  if (!atomic_compare_exchange_strong(&_fr_last_anomaly, &last, (long)now.tv_sec))
+    return; // Another thread got here first
+  if (atomic_exchange(&_fr_dumping, true))
+    return;
+
+  // Don't hold up whoever saw the problem (usually the serial thread) with file IO.
+  if (pthread_create(&thread, NULL, anomaly_dump_thread, (void *)reason) == 0) {
+    pthread_detach(thread);
+  } else {
+    atomic_store(&_fr_dumping, false);
+  }
+}
@@ -0,0 +1,26 @@
+#ifndef FLIGHT_RECORDER_H_
+#define FLIGHT_RECORDER_H_
+
+#include <stdint.h>
+
+/*
+  Always on record of the last FLIGHT_RECORDER_FRAMES RS485 frames (read, write & bad reads),
+  so when something goes wrong we have what led up to it without packet logging turned on.
+  Dumps are written as a capture file (packetCapture.h), read them with serial_logger -ctext.
+*/
+
+#define FLIGHT_RECORDER_FRAMES    4096 // Power of 2
+#define FLIGHT_RECORDER_FRAME_LEN 128  // Frames bigger than this (very rare) are truncated
+#define FLIGHT_RECORDER_FILE      "/tmp/RS485flight.cap"
+#define FLIGHT_RECORDER_INTERVAL  60   // Min seconds between anomaly dumps
+
+// type is CAP_READ, CAP_WRITE or CAP_ERROR.  Lock free, safe from any thread.
+void flight_recorder_frame(uint8_t type, const unsigned char *packet, int length);
+
+// Write the window to FLIGHT_RECORDER_FILE now, returns frames written or -1.
+int flight_recorder_dump(const char *reason);
+
+// Something went wrong, dump in the background (rate limited to one per FLIGHT_RECORDER_INTERVAL).
+void flight_recorder_anomaly(const char *reason);
+
+#endif // FLIGHT_RECORDER_H_
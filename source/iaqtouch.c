@@ -28,6 +28,7 @@
 #include "aq_programmer.h"
 #include "rs_msg_utils.h"
 #include "devices_jandy.h"
+#include "rs_dispatch.h"
 
 
 #define NEW_POLL_CYCLE
@@ -1014,6 +1015,7 @@ bool process_iaqtouch_packet(unsigned char *packet, int length, struct aqualinkd
           _aqconfig_.extended_device_id2 = _aqconfig_.extended_device_id + 112; // 0x70 in dec
         }
         LOG(IAQT_LOG,LOG_NOTICE, "Enabling iAqualink Protocol on 0x%02hhx\n",_aqconfig_.extended_device_id2);
+        build_rs_dispatch_table();
       }
       // Don't like this here.  Come back and rethink getting panel string.
       //iaqt_queue_cmd(KEY_IAQTCH_HELP);
@@ -69,6 +69,12 @@ bool iaqt_queue_cmd(unsigned char cmd) {
 
 void set_iaq_cansend(bool cansend){
   _cansend = cansend;
+  signal_prog_event(IAQTOUCH);
+}
+
+bool iaqt_cmd_pending()
+{
+  return (_iaqt_pgm_command != NUL);
 }
 
 unsigned char pop_iaqt_cmd(unsigned char receive_type)
@@ -81,6 +87,7 @@ unsigned char pop_iaqt_cmd(unsigned char receive_type)
   if (receive_type == CMD_IAQ_POLL) {
     cmd = _iaqt_pgm_command;
     _iaqt_pgm_command = NUL;
+    signal_prog_event(IAQTOUCH);
   } 
 
   if (cmd != NUL)
@@ -89,28 +96,29 @@ unsigned char pop_iaqt_cmd(unsigned char receive_type)
 }
 
 
-void waitfor_iaqt_queue2empty()
+static bool iaqt_can_send(void *arg)
 {
-  int i=0;
+  return _cansend;
+}
 
-  while ( (_iaqt_pgm_command != NUL) && ( i++ < PROGRAMMING_POLL_COUNTER) ) {
-    delay(PROGRAMMING_POLL_DELAY_TIME);
-  }
+void waitfor_iaqt_queue2empty()
+{
+  bool sent = wait_for_prog_cmd_sent(IAQTOUCH, &_iaqt_pgm_command, PROGRAMMING_POLL_COUNTER * PROGRAMMING_POLL_DELAY_TIME);
 
   // Initial startup can take some time, _cansend should be false during this time.
   // If we start programming before we receive the first status page, nothing works, this forces that wait
-  while(_cansend == false) {
-    delay(PROGRAMMING_POLL_DELAY_TIME * 2);
+  while ( ! wait_for_prog_event(IAQTOUCH, iaqt_can_send, NULL, PROGRAMMING_KICK_TIMEOUT * 1000) ) {
+    if (aq_programmer_job_overdue())
+      break;
+    LOG(IAQT_LOG,LOG_DEBUG, "Waiting for first status page before sending\n");
   }
 
-  if (_iaqt_pgm_command != NUL) {
-      // Wait for longer interval
-      while ( (_iaqt_pgm_command != NUL) && ( i++ < PROGRAMMING_POLL_COUNTER * 2 ) ) {
-        delay(PROGRAMMING_POLL_DELAY_TIME * 2);
-      }
+  if (!sent) {
+    // Wait for longer interval
+    sent = wait_for_prog_cmd_sent(IAQTOUCH, &_iaqt_pgm_command, PROGRAMMING_POLL_COUNTER * PROGRAMMING_POLL_DELAY_TIME * 2);
   }
 
-  if (_iaqt_pgm_command != NUL) {
+  if (!sent) {
     LOG(IAQT_LOG,LOG_WARNING, "Send command Queue did not empty, timeout\n");
   }
 }
@@ -153,16 +161,19 @@ void rem_iaqt_control_cmd(unsigned char *cmd)
 {
   memset(_iaqt_control_cmd, 0, AQ_MAXPKTLEN_SEND * sizeof(unsigned char));
   _iaqt_control_cmd_len = 0;
+  signal_prog_event(IAQTOUCH);
+}
+
+static bool iaqt_ctrl_queue_empty(void *arg)
+{
+  return (_iaqt_control_cmd_len <= 0);
 }
 
 bool waitfor_iaqt_ctrl_queue2empty()
 {
-  int i=0;
+  LOG(IAQT_LOG,LOG_DEBUG, "Waiting for commandset to send\n");
 
-  while ( (_iaqt_control_cmd_len >0 ) && ( i++ < 100) ) {
-    LOG(IAQT_LOG,LOG_DEBUG, "Waiting for commandset to send\n");
-    delay(50);
-  }
+  wait_for_prog_event(IAQTOUCH, iaqt_ctrl_queue_empty, NULL, 100 * 50);
 
   LOG(IAQT_LOG,LOG_DEBUG, "Wait for commandset over!\n");
 
@@ -184,7 +195,7 @@ unsigned const char _waitfor_iaqt_nextPage(struct aqualinkdata *aqdata, int numM
   while( ++i <= numMessageReceived)
   {
     //LOG(IAQT_LOG,LOG_DEBUG, "waitfor_iaqt_nextPage (%d of %d)\n",i,numMessageReceived);
-    pthread_cond_wait(&aqdata->active_thread.thread_cond, &aqdata->active_thread.thread_mutex);
+    wait_for_prog_kick(aqdata);
     if(wasiaqtThreadKickTypePage()) break;
   }
 
@@ -217,7 +228,7 @@ unsigned const char waitfor_iaqt_messages(struct aqualinkdata *aqdata, int numMe
   while( ++i <= numMessageReceived)
   {
     //LOG(IAQT_LOG,LOG_DEBUG, "waitfor_iaqt_nextPage (%d of %d)\n",i,numMessageReceived);
-    pthread_cond_wait(&aqdata->active_thread.thread_cond, &aqdata->active_thread.thread_mutex);
+    wait_for_prog_kick(aqdata);
     LOG(IAQT_LOG,LOG_DEBUG, "waitfor_iaqt_message (%d of %d) - received message 0x%02hhx\n",i,numMessageReceived,iaqtLastMsg());
   }
 
@@ -241,7 +252,7 @@ unsigned const char waitfor_iaqt_nextPage(struct aqualinkdata *aqdata) {
   while( ++i <= numMessageReceived)
   {
     //LOG(IAQT_LOG,LOG_DEBUG, "waitfor_iaqt_nextPage (%d of %d)\n",i,numMessageReceived);
-    pthread_cond_wait(&aqdata->active_thread.thread_cond, &aqdata->active_thread.thread_mutex);
+    wait_for_prog_kick(aqdata);
     if(wasiaqtThreadKickTypePage()) break;
 
     LOG(IAQT_LOG,LOG_DEBUG, "waitfor_iaqt_nextPage (%d of %d) - received message 0x%02hhx\n",i,numMessageReceived,iaqtLastMsg());
@@ -271,7 +282,7 @@ unsigned const char waitfor_iaqt_nextMessage(struct aqualinkdata *aqdata, const
   while( ++i <= numMessageReceived)
   {
     LOG(IAQT_LOG,LOG_DEBUG, "waitfor_iaqt_nextMessage 0x%02hhx (%d of %d)\n",msg_type,i,numMessageReceived);
-    pthread_cond_wait(&aqdata->active_thread.thread_cond, &aqdata->active_thread.thread_mutex);
+    wait_for_prog_kick(aqdata);
     if( msg_type == NUL || iaqtLastMsg() == msg_type) break;
 
     LOG(IAQT_LOG,LOG_DEBUG, "waitfor_iaqt_nextMessage (%d of %d) - received message 0x%02hhx\n",i,numMessageReceived,iaqtLastMsg());
@@ -568,7 +579,7 @@ void *set_aqualink_iaqtouch_device_on_off( void *ptr )
   goto_iaqt_page(IAQ_PAGE_HOME, aqdata);
   cleanAndTerminateThread(threadCtrl);
 
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 #else
@@ -648,7 +659,7 @@ void *set_aqualink_iaqtouch_device_on_off( void *ptr )
   goto_iaqt_page(IAQ_PAGE_HOME, aqdata);
   cleanAndTerminateThread(threadCtrl);
 
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 #endif
@@ -882,7 +893,7 @@ PRINTF("******** WAIT for next page\n");
   goto_iaqt_page(IAQ_PAGE_HOME, aqdata);
   cleanAndTerminateThread(threadCtrl);
 
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -991,7 +1002,7 @@ void *set_aqualink_iaqtouch_pump_rpm( void *ptr )
   goto_iaqt_page(IAQ_PAGE_HOME, aqdata);
   cleanAndTerminateThread(threadCtrl);
 
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -1040,7 +1051,7 @@ void *set_aqualink_iaqtouch_vsp_assignments( void *ptr )
   goto_iaqt_page(IAQ_PAGE_HOME, aqdata);
   cleanAndTerminateThread(threadCtrl);
 
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -1077,7 +1088,7 @@ void *get_aqualink_iaqtouch_freezeprotect( void *ptr )
   goto_iaqt_page(IAQ_PAGE_HOME, aqdata);
   cleanAndTerminateThread(threadCtrl);
 
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 void *get_aqualink_iaqtouch_setpoints( void *ptr )
@@ -1213,7 +1224,7 @@ void *get_aqualink_iaqtouch_setpoints( void *ptr )
   goto_iaqt_page(IAQ_PAGE_HOME, aqdata);
   cleanAndTerminateThread(threadCtrl);
 
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -1306,7 +1317,7 @@ bool set_aqualink_iaqtouch_aquapure( struct aqualinkdata *aqdata, bool boost, in
     send_aqt_cmd(button->keycode);
     waitfor_iaqt_queue2empty();
     waitfor_iaqt_nextPage(aqdata);
-    aqdata->boost = val;
+    SET_IF_CHANGED(aqdata->boost, val, aqdata->is_dirty);
   } else {
     if (aqdata->aqbuttons[SPA_INDEX].led->state != OFF) {
       if (b_spa != NUL)
@@ -1437,13 +1448,13 @@ bool set_aqualink_iaqtouch_heater_setpoint( struct aqualinkdata *aqdata, SP_TYPE
   if (button != NULL) {
     int value = 0;
     if (type == SP_POOL) {
-      aqdata->pool_htr_set_point = rsm_atoi((char *)&button->name + strlen(name));
+      SET_IF_CHANGED(aqdata->pool_htr_set_point, rsm_atoi((char *)&button->name + strlen(name)), aqdata->is_dirty);
       value = aqdata->pool_htr_set_point;
     } else if (type == SP_SPA) {
-      aqdata->spa_htr_set_point = rsm_atoi((char *)&button->name + strlen(name));
+      SET_IF_CHANGED(aqdata->spa_htr_set_point, rsm_atoi((char *)&button->name + strlen(name)), aqdata->is_dirty);
       value = aqdata->spa_htr_set_point;
     } else if (type == SP_CHILLER) {
-      aqdata->chiller_set_point = rsm_atoi((char *)&button->name + strlen(name));
+      SET_IF_CHANGED(aqdata->chiller_set_point, rsm_atoi((char *)&button->name + strlen(name)), aqdata->is_dirty);
       value = aqdata->chiller_set_point;
     }
     LOG(IAQT_LOG,LOG_DEBUG, "IAQ Touch set %s heater setpoint to %d\n",name,value);
@@ -25,20 +25,20 @@
 #include "aq_serial.h"
 #include "serialadapter.h"
 #include "rs_msg_utils.h"
+#include "cmd_queue.h"
 
 #include "color_lights.h"
 
 #define IAQUA_QLEN 20
 
-typedef struct iaqulnkcmd
-{
-  unsigned char command[20];
-  int length;
-} iaqualink_cmd;
+// Coalescing keys, a newer request for the same thing replaces the one waiting.
+// Device commands are toggles so they never coalesce (key 0), on then off has to send both.
+#define IAQUA_KEY_SETPOINT 2
+#define IAQUA_KEY_GET      3
 
-iaqualink_cmd _iqaua_queue[IAQUA_QLEN];
+static cmd_queue _iaqua_queue = CMD_QUEUE_INIT("iaqualink", IAQL_LOG, IAQUA_QLEN);
+static unsigned char _iaqua_cmd[CMDQ_MAX_CMD];
 unsigned char _std_cmd[2];
-int _iaqua_q_length = 0;
 bool _aqua_last_cmdfrom_queue = false;
 
 
@@ -47,16 +47,10 @@ unsigned char _fullcmd[] = {0x00, 0x24, 0x73, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00
 
 
 bool push_iaqualink_cmd(unsigned char *cmd, int length) {
-  if (_iaqua_q_length >= IAQUA_QLEN ) {
-    LOG(IAQL_LOG,LOG_ERR, "Queue overflow, last command ignored!\n");
+  if ( ! cmdq_push(&_iaqua_queue, CMDQ_USER, 0, cmd, length) )
     return false;
-  }
 
-  memcpy(_iqaua_queue[_iaqua_q_length].command, cmd, length);
-  _iqaua_queue[_iaqua_q_length].length = length;
-  _iaqua_q_length++;
-
-  LOG(IAQL_LOG, LOG_INFO, "Queue cmd, size %d,  queu length=%d\n",length, _iaqua_q_length);
+  LOG(IAQL_LOG, LOG_INFO, "Queue cmd, size %d,  queu length=%d\n",length, cmdq_length(&_iaqua_queue));
 
   //LOG(IAQL_LOG,LOG_DEBUG, "Added to message queue, position %d 0x%02hhx|0x%02hhx|0x%02hhx|0x%02hhx\n",_rssa_q_length-1,_rssa_queue[_rssa_q_length-1][0],_rssa_queue[_rssa_q_length-1][1],_rssa_queue[_rssa_q_length-1][2],_rssa_queue[_rssa_q_length-1][3]);
   return true;
@@ -64,6 +58,20 @@ bool push_iaqualink_cmd(unsigned char *cmd, int length) {
 }
 
 //unsigned char *get_iaqualink_cmd(unsigned char source_message_type, unsigned char *dest_message, int *len) {
+// Ready command then the full command, these have to go one after the other.
+static bool push_iaqualink_set(uint32_t key, unsigned char *cmd) {
+  if ( ! cmdq_push_pair(&_iaqua_queue, CMDQ_USER, key, _cmd_readyCommand, 2, cmd, 19) )
+    return false;
+
+  LOG(IAQL_LOG, LOG_INFO, "Queue set cmd, queu length=%d\n", cmdq_length(&_iaqua_queue));
+  return true;
+}
+
+// Status request, if we are already waiting on the same one don't ask again.
+static bool poll_iaqualink_cmd(unsigned char *cmd) {
+  return cmdq_push(&_iaqua_queue, CMDQ_POLL, CMDQ_KEY(IAQUA_KEY_GET, cmd[1]), cmd, 2);
+}
+
 int get_iaqualink_cmd(unsigned char source_message_type, unsigned char **dest_message) {
 
   //LOG(IAQL_LOG, LOG_INFO, "Caculating cmd\n");
@@ -74,22 +82,26 @@ int get_iaqualink_cmd(unsigned char source_message_type, unsigned char **dest_me
   _std_cmd[1] = 0x00;
   *dest_message = _std_cmd;
   int len = 2;
+  int qlen;
 
-  if (source_message_type == 0x73 && _iaqua_q_length > 0) 
+  if ( (source_message_type != 0x73 && source_message_type != 0x53) || (qlen = cmdq_peek(&_iaqua_queue, _iaqua_cmd)) <= 0 ) {
+    // Nothing to send from queue
+  }
+  else if (source_message_type == 0x73) 
   { // Send big/long message
-    if ( _iqaua_queue[0].length >= 19 ) {
-      *dest_message = _iqaua_queue[0].command;
-      len = _iqaua_queue[0].length;
+    if ( qlen >= 19 ) {
+      *dest_message = _iaqua_cmd;
+      len = qlen;
       _aqua_last_cmdfrom_queue = true;
     } else {
       LOG(IAQL_LOG,LOG_WARNING,"Next command in queue is not full command, ignoring\n");
     }
   }
-  else if (source_message_type == 0x53 && _iaqua_q_length > 0) 
+  else if (source_message_type == 0x53) 
   { // Send small command
-    if ( _iqaua_queue[0].length <= 2 ) {
-      *dest_message = _iqaua_queue[0].command;
-      len = _iqaua_queue[0].length;
+    if ( qlen <= 2 ) {
+      *dest_message = _iaqua_cmd;
+      len = qlen;
       _aqua_last_cmdfrom_queue = true;
     } else {
       LOG(IAQL_LOG,LOG_WARNING,"Next command in queue is too large, ignoring\n");
@@ -104,10 +116,11 @@ int get_iaqualink_cmd(unsigned char source_message_type, unsigned char **dest_me
 }
 
 void remove_iaqualink_cmd() {
-  if (_iaqua_q_length > 0 && _aqua_last_cmdfrom_queue == true) {
-    LOG(IAQL_LOG,LOG_DEBUG, "Remove from message queue, length %d\n",_iaqua_q_length-1);
-    memmove(&_iqaua_queue[0], &_iqaua_queue[1], (sizeof(iaqualink_cmd)) * _iaqua_q_length);
-    _iaqua_q_length--;
+  if (_aqua_last_cmdfrom_queue == true) {
+    cmdq_remove(&_iaqua_queue);
+    LOG(IAQL_LOG,LOG_DEBUG, "Remove from message queue, length %d\n",cmdq_length(&_iaqua_queue));
+  } else {
+    cmdq_unpin(&_iaqua_queue);
   }
 }
 
@@ -270,8 +283,7 @@ void set_iaqualink_aux_state(aqkey *button, bool isON) {
   _fullcmd[4] = iAqalnkDevID(button);
 
   if (_fullcmd[4] != 0xFF) {
-    push_iaqualink_cmd(_cmd_readyCommand, 2);
-    push_iaqualink_cmd(_fullcmd, 19);
+    push_iaqualink_set(0, _fullcmd);
   } else {
      LOG(IAQL_LOG, LOG_ERR, "Couldn't find iaqualink keycode for button %s\n",button->label);
   }
@@ -308,8 +320,7 @@ void set_iaqualink_heater_setpoint(int value, SP_TYPE type) {
   // Should check value is valid here.
   //_fullcmd[6] = value;
 
-  push_iaqualink_cmd(_cmd_readyCommand, 2);
-  push_iaqualink_cmd(_fullcmd, 19);
+  push_iaqualink_set(CMDQ_KEY(IAQUA_KEY_SETPOINT, type), _fullcmd);
 
   // reset 
   _fullcmd[4] = 0x00;
@@ -690,9 +701,9 @@ bool process_iaqualink_packet(unsigned char *packet, int length, struct aqualink
         push_iaqualink_cmd(_fullcmd, 19);
         _fullcmd[4] = 0x00;
 */
-        push_iaqualink_cmd(cmd_getMainstatus, 2);
-        push_iaqualink_cmd(cmd_getTouchstatus, 2);
-        push_iaqualink_cmd(cmd_getAuxstatus, 2);
+        poll_iaqualink_cmd(cmd_getMainstatus);
+        poll_iaqualink_cmd(cmd_getTouchstatus);
+        poll_iaqualink_cmd(cmd_getAuxstatus);
 /*
         LOG(IAQL_LOG, LOG_INFO,"*****************************************\n");
         LOG(IAQL_LOG, LOG_INFO,"********** Send %d 0x%02hhx ************\n",ID,ID);
@@ -36,6 +36,8 @@
 #include "color_lights.h"
 #include "iaqualink.h"
 #include "aq_panel.h"
+#include "json_writer.h"
+#include "web_cache.h"
 
 //#define test_message "{\"type\": \"status\",\"version\": \"8157 REV MMM\",\"date\": \"09/01/16 THU\",\"time\": \"1:16 PM\",\"temp_units\": \"F\",\"air_temp\": \"96\",\"pool_temp\": \"86\",\"spa_temp\": \" \",\"battery\": \"ok\",\"pool_htr_set_pnt\": \"85\",\"spa_htr_set_pnt\": \"99\",\"freeze_protection\": \"off\",\"frz_protect_set_pnt\": \"0\",\"leds\": {\"pump\": \"on\",\"spa\": \"off\",\"aux1\": \"off\",\"aux2\": \"off\",\"aux3\": \"off\",\"aux4\": \"off\",\"aux5\": \"off\",\"aux6\": \"off\",\"aux7\": \"off\",\"pool_heater\": \"off\",\"spa_heater\": \"off\",\"solar_heater\": \"off\"}}"
 //#define test_labels "{\"type\": \"aux_labels\",\"aux1_label\": \"Cleaner\",\"aux2_label\": \"Waterfall\",\"aux3_label\": \"Spa Blower\",\"aux4_label\": \"Pool Light\",\"aux5_label\": \"Spa Light\",\"aux6_label\": \"Unassigned\",\"aux7_label\": \"Unassigned\"}"
@@ -261,358 +263,407 @@ int LED2int(aqledstate state)
   }
 }
 
-#define AUX_BUFFER_SIZE 200
+static const char *temp_units2text(struct aqualinkdata *aqdata)
+{
+  if ( aqdata->temp_units == FAHRENHEIT )
+    return JSON_FAHRENHEIT;
+  else if ( aqdata->temp_units == CELSIUS )
+    return JSON_CELSIUS;
+
+  return JSON_UNKNOWN;
+}
 
-char *get_aux_information(aqkey *button, struct aqualinkdata *aqdata, char *buffer)
+static const char *pumpType2text(pump_type ptype)
+{
+  return (ptype==VFPUMP?"vfPump":(ptype==VSPUMP?"vsPump":"ePump"));
+}
+
+static void write_aux_information(json_writer *w, aqkey *button, struct aqualinkdata *aqdata)
 {
   int i;
-  int length = 0;
-  buffer[0] = '\0';
 
   //if ((button->special_mask & VS_PUMP) == VS_PUMP)
   if (isVS_PUMP(button->special_mask))
   {
-//printf("Button %s is VSP\n", button->name);
     for (i=0; i < aqdata->num_pumps; i++) {
-      if (button == aqdata->pumps[i].button) {       
-          length += sprintf(buffer, ",\"type_ext\":\"switch_vsp\",\"Pump_RPM\":\"%d\",\"Pump_GPM\":\"%d\",\"Pump_Watts\":\"%d\",\"Pump_Type\":\"%s\",\"Pump_Status\":\"%d\",\"Pump_Speed\":\"%d\"", 
-                  aqdata->pumps[i].rpm,
-                  aqdata->pumps[i].gpm,
-                  aqdata->pumps[i].watts,
-                  (aqdata->pumps[i].pumpType==VFPUMP?"vfPump":(aqdata->pumps[i].pumpType==VSPUMP?"vsPump":"ePump")),
-                  getPumpStatus(i, aqdata),
-                  getPumpSpeedAsPercent(&aqdata->pumps[i]));
-
-          return buffer;
+      if (button == aqdata->pumps[i].button) {
+        jw_string(w, "type_ext", "switch_vsp");
+        jw_int_string(w, "Pump_RPM", aqdata->pumps[i].rpm);
+        jw_int_string(w, "Pump_GPM", aqdata->pumps[i].gpm);
+        jw_int_string(w, "Pump_Watts", aqdata->pumps[i].watts);
+        jw_string(w, "Pump_Type", pumpType2text(aqdata->pumps[i].pumpType));
+        jw_int_string(w, "Pump_Status", getPumpStatus(i, aqdata));
+        jw_int_string(w, "Pump_Speed", getPumpSpeedAsPercent(&aqdata->pumps[i]));
+        return;
       }
     }
   } 
   //else if ((button->special_mask & PROGRAM_LIGHT) == PROGRAM_LIGHT)
   else if (isPLIGHT(button->special_mask))
   {
-//printf("Button %s is ProgramableLight\n", button->name);
     for (i=0; i < aqdata->num_lights; i++) {
       if (button == aqdata->lights[i].button) {
         if (aqdata->lights[i].lightType == LC_DIMMER2) {
-          length += sprintf(buffer, ",\"type_ext\": \"light_dimmer\", \"Light_Type\":\"%d\", \"Light_Program\":\"%d\", \"Program_Name\":\"%d%%\" ",
-                                  aqdata->lights[i].lightType,
-                                  aqdata->lights[i].currentValue,
-                                  aqdata->lights[i].currentValue);
+          jw_string(w, "type_ext", "light_dimmer");
+          jw_int_string(w, "Light_Type", aqdata->lights[i].lightType);
+          jw_int_string(w, "Light_Program", aqdata->lights[i].currentValue);
+          jw_stringf(w, "Program_Name", "%d%%", aqdata->lights[i].currentValue);
         } else {
-          length += sprintf(buffer, ",\"type_ext\": \"switch_program\", \"Light_Type\":\"%d\", \"Light_Program\":\"%d\", \"Program_Name\":\"%s\" ",
-                                  aqdata->lights[i].lightType,
-                                  aqdata->lights[i].currentValue,
-                                  get_currentlight_mode_name(aqdata->lights[i], ALLBUTTON));
-                                  //light_mode_name(aqdata->lights[i].lightType, aqdata->lights[i].currentValue, ALLBUTTON));
+          jw_string(w, "type_ext", "switch_program");
+          jw_int_string(w, "Light_Type", aqdata->lights[i].lightType);
+          jw_int_string(w, "Light_Program", aqdata->lights[i].currentValue);
+          jw_string(w, "Program_Name", get_currentlight_mode_name(aqdata->lights[i], ALLBUTTON));
         }
-        return buffer;
+        return;
       }
     }
   }
   if (isVBUTTON_ALTLABEL(button->special_mask))
   {
-    length += sprintf(buffer, ",\"alt_label\":\"%s\", \"in_alt_mode\": \"%s\" ",((altlabel_detail *)button->special_mask_ptr)->altlabel, ((altlabel_detail *)button->special_mask_ptr)->in_alt_mode?JSON_ON:JSON_OFF );
-    //return buffer;
+    jw_string(w, "alt_label", ((altlabel_detail *)button->special_mask_ptr)->altlabel);
+    jw_string(w, "in_alt_mode", ((altlabel_detail *)button->special_mask_ptr)->in_alt_mode?JSON_ON:JSON_OFF);
   }
 
-//printf("Button %s is Switch\n", button->name);
-  length += sprintf(buffer+length, ",\"type_ext\": \"switch_timer\", \"timer_active\":\"%s\"", (((button->special_mask & TIMER_ACTIVE) == TIMER_ACTIVE)?JSON_ON:JSON_OFF) );
+  jw_string(w, "type_ext", "switch_timer");
+  jw_string(w, "timer_active", (((button->special_mask & TIMER_ACTIVE) == TIMER_ACTIVE)?JSON_ON:JSON_OFF));
   if ((button->special_mask & TIMER_ACTIVE) == TIMER_ACTIVE) {
-    length += sprintf(buffer+length,",\"timer_duration\":\"%d\"", get_timer_left(button));
+    jw_int_string(w, "timer_duration", get_timer_left(button - aqdata->aqbuttons));
   }
-  return buffer;
 }
 
-//int build_device_JSON(struct aqualinkdata *aqdata, int programable_switch1, int programable_switch2, char* buffer, int size, bool homekit)
-int build_device_JSON(struct aqualinkdata *aqdata, char* buffer, int size, bool homekit)
+/*
+ * Start of a {"type":"setpoint_xxx", ... } device, spvalue & value are converted to C with 2 decimal places for homekit.
+ * Caller adds anything extra and closes the object.
+ */
+static void jw_setpoint_device_start(json_writer *w, const char *type, const char *id, const char *name, const char *state, const char *status,
+                                     float spvalue, float value, int int_status, bool homekit, bool homekit_f)
 {
-  char aux_info[AUX_BUFFER_SIZE];
-  memset(&buffer[0], 0, size);
-  int length = 0;
+  jw_object_start(w, NULL);
+  jw_string(w, "type", type);
+  jw_string(w, "id", id);
+  jw_string(w, "name", name);
+  jw_string(w, "state", state);
+  jw_string(w, "status", status);
+  jw_float_string(w, "spvalue", (homekit_f?degFtoC(spvalue):spvalue), (homekit?2:0));
+  jw_float_string(w, "value", (homekit_f?degFtoC(value):value), (homekit?2:0));
+  jw_int_string(w, "int_status", int_status);
+}
+
+// {"type":"value|temperature", ... }, uom of NULL means don't add it.
+static void jw_value_device(json_writer *w, const char *type, const char *id, const char *name, float value, int precision, const char *uom)
+{
+  jw_object_start(w, NULL);
+  jw_string(w, "type", type);
+  jw_string(w, "id", id);
+  jw_string(w, "name", name);
+  jw_string(w, "state", JSON_ON);
+  jw_float_string(w, "value", value, precision);
+  if (uom != NULL)
+    jw_string(w, "uom", uom);
+  jw_object_end(w);
+}
+
+/*
+ * Each entry in the devices list is kept pre-rendered, keyed on the aqdata->versions counters it depends
+ * on (bumped by SET_IF_CHANGED), so /api/devices & homebridge only rebuild what's actually changed.
+ * Only the net thread builds device JSON, so no locking.
+ */
+#define DEVICE_FRAGMENT_SIZE 1024
+
+enum {
+  FRAG_BUTTONS = 0,
+  FRAG_FREEZE = FRAG_BUTTONS + TOTAL_BUTTONS,
+  FRAG_CHILLER,
+  FRAG_SWG,
+  FRAG_SWG_PPM,
+  FRAG_PH,
+  FRAG_ORP,
+  FRAG_AIR_TEMP,
+  FRAG_POOL_TEMP,
+  FRAG_SPA_TEMP,
+  FRAG_SENSORS,
+  FRAG_TOTAL = FRAG_SENSORS + MAX_SENSORS
+};
+
+typedef struct device_fragment {
+  bool valid;
+  uint32_t version;     // Sum of the versions counters the device uses
+  uint32_t mask;        // special_mask, timer code changes it directly
+  const void *owner;    // label it was built for, catches a config reload
+  char json[DEVICE_FRAGMENT_SIZE];
+} device_fragment;
+
+static device_fragment _device_fragments[2][FRAG_TOTAL]; // [homekit]
+static unsigned long _device_fragment_hits = 0;
+static unsigned long _device_fragment_misses = 0;
+
+static bool is_heater_button(aqkey *button)
+{
+  return (strcmp(BTN_POOL_HTR,button->name) == 0 || strcmp(BTN_SPA_HTR,button->name) == 0);
+}
+
+static uint32_t device_fragment_version(struct aqualinkdata *aqdata, int slot)
+{
+  const aqdata_versions *v = &aqdata->versions;
+  uint32_t version = v->unknown;
   int i;
 
-  // IF temp units are F assume homekit is using F
-  bool homekit_f = (homekit && ( aqdata->temp_units==FAHRENHEIT || aqdata->temp_units == UNKNOWN) );
+  if (slot < FRAG_FREEZE) {
+    aqkey *button = &aqdata->aqbuttons[slot - FRAG_BUTTONS];
+
+    version += v->button[slot - FRAG_BUTTONS];
+    if (button->led >= aqdata->aqualinkleds && button->led < aqdata->aqualinkleds + TOTAL_LEDS)
+      version += v->led[button->led - aqdata->aqualinkleds];
+    if (is_heater_button(button))
+      version += v->general;
+    if (isVS_PUMP(button->special_mask)) {
+      for (i=0; i < MAX_PUMPS; i++)
+        version += v->pump[i];
+    }
+    if (isPLIGHT(button->special_mask)) {
+      for (i=0; i < MAX_LIGHTS; i++)
+        version += v->light[i];
+    }
+    return version;
+  } else if (slot == FRAG_CHILLER) {
+    return v->any; // Chiller button can be any button, just rebuild on anything.
+  } else if (slot >= FRAG_SENSORS) {
+    return version + v->general + v->sensor[slot - FRAG_SENSORS];
+  }
 
-  length += sprintf(buffer+length, "{\"type\": \"devices\"");
-  length += sprintf(buffer+length, ",\"aqualinkd_version\":\"%s\"",AQUALINKD_VERSION);//"09/01/16 THU",
-  length += sprintf(buffer+length, ",\"date\":\"%s\"",aqdata->date );//"09/01/16 THU",
-  length += sprintf(buffer+length, ",\"time\":\"%s\"",aqdata->time );//"1:16 PM",
-  if ( aqdata->temp_units == FAHRENHEIT )
-    length += sprintf(buffer+length, ",\"temp_units\":\"%s\"",JSON_FAHRENHEIT );
-  else if ( aqdata->temp_units == CELSIUS )
-    length += sprintf(buffer+length, ",\"temp_units\":\"%s\"", JSON_CELSIUS);
-  else
-    length += sprintf(buffer+length, ",\"temp_units\":\"%s\"",JSON_UNKNOWN );
+  return version + v->general;
+}
 
-  length += sprintf(buffer+length,  ", \"devices\": [");
-  
-  for (i=0; i < aqdata->total_buttons; i++) 
-  {
-    if ( strcmp(BTN_POOL_HTR,aqdata->aqbuttons[i].name) == 0 && (ENABLE_HEATERS || aqdata->pool_htr_set_point != TEMP_UNKNOWN)) {
-      length += sprintf(buffer+length, "{\"type\": \"setpoint_thermo\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"status\": \"%s\", \"spvalue\": \"%.*f\", \"value\": \"%.*f\", \"int_status\": \"%d\", \"timer_active\":\"%s\" },",
-                                     aqdata->aqbuttons[i].name, 
-                                     aqdata->aqbuttons[i].label,
-                                     aqdata->aqbuttons[i].led->state==ON?JSON_ON:JSON_OFF,
-                                     LED2text(aqdata->aqbuttons[i].led->state),
-                                     ((homekit)?2:0),
-                                     ((homekit_f)?degFtoC(aqdata->pool_htr_set_point):aqdata->pool_htr_set_point),
-                                     ((homekit)?2:0),
-                                     ((homekit_f)?degFtoC(aqdata->pool_temp):aqdata->pool_temp),
-                                     LED2int(aqdata->aqbuttons[i].led->state),
-                                     ((aqdata->aqbuttons[i].special_mask & TIMER_ACTIVE) == TIMER_ACTIVE?JSON_ON:JSON_OFF) );
-
-    } else if ( strcmp(BTN_SPA_HTR,aqdata->aqbuttons[i].name)==0 && (ENABLE_HEATERS || aqdata->spa_htr_set_point != TEMP_UNKNOWN)) {
-      length += sprintf(buffer+length, "{\"type\": \"setpoint_thermo\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"status\": \"%s\", \"spvalue\": \"%.*f\", \"value\": \"%.*f\", \"int_status\": \"%d\", \"timer_active\":\"%s\" },",
-                                     aqdata->aqbuttons[i].name, 
-                                     aqdata->aqbuttons[i].label,
-                                     aqdata->aqbuttons[i].led->state==ON?JSON_ON:JSON_OFF,
-                                     LED2text(aqdata->aqbuttons[i].led->state),
-                                     ((homekit)?2:0),
-                                     ((homekit_f)?degFtoC(aqdata->spa_htr_set_point):aqdata->spa_htr_set_point),
-                                     ((homekit)?2:0),
-                                     ((homekit_f)?degFtoC(aqdata->spa_temp):aqdata->spa_temp),
-                                     LED2int(aqdata->aqbuttons[i].led->state),
-                                     ((aqdata->aqbuttons[i].special_mask & TIMER_ACTIVE) == TIMER_ACTIVE?JSON_ON:JSON_OFF));
+// Is the device in the list at all right now, config can change so this isn't cached.
+static bool device_fragment_wanted(struct aqualinkdata *aqdata, int slot, bool homekit)
+{
+  if (slot < FRAG_FREEZE) {
+    aqkey *button = &aqdata->aqbuttons[slot - FRAG_BUTTONS];
+    if (slot - FRAG_BUTTONS >= aqdata->total_buttons)
+      return false;
+    // Chiller VButton gets added as a thermostat
+    return !(!homekit && ENABLE_CHILLER && isVBUTTON_CHILLER(button->special_mask));
+  } else if (slot >= FRAG_SENSORS) {
+    return (slot - FRAG_SENSORS < aqdata->num_sensors && aqdata->sensors[slot - FRAG_SENSORS].value != TEMP_UNKNOWN);
+  }
+
+  switch (slot) {
+    case FRAG_FREEZE:
+      return ( ENABLE_FREEZEPROTECT || (aqdata->frz_protect_set_point != TEMP_UNKNOWN && aqdata->air_temp != TEMP_UNKNOWN) );
+    case FRAG_CHILLER:
+      return ( (ENABLE_CHILLER || (aqdata->chiller_set_point != TEMP_UNKNOWN && getWaterTemp(aqdata) != TEMP_UNKNOWN)) && (aqdata->chiller_button != NULL) );
+    case FRAG_SWG:
+      return (aqdata->swg_led_state != LED_S_UNKNOWN && aqdata->swg_percent != TEMP_UNKNOWN);
+    case FRAG_SWG_PPM:
+      return (aqdata->swg_led_state != LED_S_UNKNOWN && aqdata->swg_ppm != TEMP_UNKNOWN);
+    case FRAG_PH:
+      return (aqdata->ph != TEMP_UNKNOWN);
+    case FRAG_ORP:
+      return (aqdata->orp != TEMP_UNKNOWN);
+    default:
+      return true;
+  }
+}
+
+static void write_device_fragment(json_writer *w, struct aqualinkdata *aqdata, int slot, bool homekit)
+{
+  // IF temp units are F assume homekit is using F
+  bool homekit_f = (homekit && ( aqdata->temp_units==FAHRENHEIT || aqdata->temp_units == UNKNOWN) );
 
+  if (slot < FRAG_FREEZE) {
+    aqkey *button = &aqdata->aqbuttons[slot - FRAG_BUTTONS];
+
+    if ( strcmp(BTN_POOL_HTR,button->name) == 0 && (ENABLE_HEATERS || aqdata->pool_htr_set_point != TEMP_UNKNOWN)) {
+      jw_setpoint_device_start(w, "setpoint_thermo", button->name, button->label,
+                               button->led->state==ON?JSON_ON:JSON_OFF, LED2text(button->led->state),
+                               aqdata->pool_htr_set_point, aqdata->pool_temp, LED2int(button->led->state), homekit, homekit_f);
+      jw_string(w, "timer_active", (button->special_mask & TIMER_ACTIVE) == TIMER_ACTIVE?JSON_ON:JSON_OFF);
+      jw_object_end(w);
+    } else if ( strcmp(BTN_SPA_HTR,button->name)==0 && (ENABLE_HEATERS || aqdata->spa_htr_set_point != TEMP_UNKNOWN)) {
+      jw_setpoint_device_start(w, "setpoint_thermo", button->name, button->label,
+                               button->led->state==ON?JSON_ON:JSON_OFF, LED2text(button->led->state),
+                               aqdata->spa_htr_set_point, aqdata->spa_temp, LED2int(button->led->state), homekit, homekit_f);
+      jw_string(w, "timer_active", (button->special_mask & TIMER_ACTIVE) == TIMER_ACTIVE?JSON_ON:JSON_OFF);
+      jw_object_end(w);
     } else {
-      if (!homekit && ENABLE_CHILLER && isVBUTTON_CHILLER(aqdata->aqbuttons[i].special_mask) ) {
-        // We will add this VButton as a thermostat
-        continue;
-      }
-      get_aux_information(&aqdata->aqbuttons[i], aqdata, aux_info);
-      //length += sprintf(buffer+length, "{\"type\": \"switch\", \"type_ext\": \"switch_vsp\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"status\": \"%s\", \"int_status\": \"%d\" %s},", 
-      length += sprintf(buffer+length, "{\"type\": \"switch\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"status\": \"%s\", \"int_status\": \"%d\" %s},", 
-                                     aqdata->aqbuttons[i].name, 
-                                     aqdata->aqbuttons[i].label,
-                                     aqdata->aqbuttons[i].led->state==ON?JSON_ON:JSON_OFF,
-                                     LED2text(aqdata->aqbuttons[i].led->state),
-                                     LED2int(aqdata->aqbuttons[i].led->state),
-                                     aux_info);
+      jw_object_start(w, NULL);
+      jw_string(w, "type", "switch");
+      jw_string(w, "id", button->name);
+      jw_string(w, "name", button->label);
+      jw_string(w, "state", button->led->state==ON?JSON_ON:JSON_OFF);
+      jw_string(w, "status", LED2text(button->led->state));
+      jw_int_string(w, "int_status", LED2int(button->led->state));
+      write_aux_information(w, button, aqdata);
+      jw_object_end(w);
     }
-    /*    
-    } else if ( (programable_switch1 > 0 && programable_switch1 == i) || 
-                (programable_switch2 > 0 && programable_switch2 == i)) {
-        length += sprintf(buffer+length, "{\"type\": \"switch\", \"type_ext\": \"switch_program\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"status\": \"%s\", \"int_status\": \"%d\"},", 
-                                     aqdata->aqbuttons[i].name, 
-                                     aqdata->aqbuttons[i].label,
-                                     aqdata->aqbuttons[i].led->state==ON?JSON_ON:JSON_OFF,
-                                     LED2text(aqdata->aqbuttons[i].led->state),
-                                     LED2int(aqdata->aqbuttons[i].led->state));
-    } else {
-      if ( get_aux_information(&aqdata->aqbuttons[i], aqdata, aux_info)[0] == '\0' ) {
-        length += sprintf(buffer+length, "{\"type\": \"switch\", \"type_ext\": \"switch\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"status\": \"%s\", \"int_status\": \"%d\"},", 
-                                     aqdata->aqbuttons[i].name, 
-                                     aqdata->aqbuttons[i].label,
-                                     aqdata->aqbuttons[i].led->state==ON?JSON_ON:JSON_OFF,
-                                     LED2text(aqdata->aqbuttons[i].led->state),
-                                     LED2int(aqdata->aqbuttons[i].led->state));
-      } else {
-        length += sprintf(buffer+length, "{\"type\": \"switch\", \"type_ext\": \"switch_vsp\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"status\": \"%s\", \"int_status\": \"%d\" %s},", 
-                                     aqdata->aqbuttons[i].name, 
-                                     aqdata->aqbuttons[i].label,
-                                     aqdata->aqbuttons[i].led->state==ON?JSON_ON:JSON_OFF,
-                                     LED2text(aqdata->aqbuttons[i].led->state),
-                                     LED2int(aqdata->aqbuttons[i].led->state),
-                                     aux_info);
-                                     //get_aux_information(&aqdata->aqbuttons[i], aqdata, aux_info));
-      }
-    }*/
-  }
-
-  if ( ENABLE_FREEZEPROTECT || (aqdata->frz_protect_set_point != TEMP_UNKNOWN && aqdata->air_temp != TEMP_UNKNOWN) ) {
-    length += sprintf(buffer+length, "{\"type\": \"setpoint_freeze\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"status\": \"%s\", \"spvalue\": \"%.*f\", \"value\": \"%.*f\", \"int_status\": \"%d\" },",
-                                     FREEZE_PROTECT,
-                                    "Freeze Protection",
-                                    aqdata->frz_protect_state==ON?JSON_ON:JSON_OFF,
-                                    aqdata->frz_protect_state==ON?LED2text(ON):LED2text(ENABLE),
-                                    ((homekit)?2:0),
-                                    ((homekit_f)?degFtoC(aqdata->frz_protect_set_point):aqdata->frz_protect_set_point),
-                                    ((homekit)?2:0),
-                                    ((homekit_f)?degFtoC(aqdata->air_temp):aqdata->air_temp),
-                                    aqdata->frz_protect_state==ON?1:0);
-  }
-
-  if ( (ENABLE_CHILLER || (aqdata->chiller_set_point != TEMP_UNKNOWN && getWaterTemp(aqdata) != TEMP_UNKNOWN)) && (aqdata->chiller_button != NULL) ) {
-    length += sprintf(buffer+length, "{\"type\": \"setpoint_chiller\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"status\": \"%s\", \"spvalue\": \"%.*f\", \"value\": \"%.*f\", \"int_status\": \"%d\" },",
-      CHILLER,
-     "Heat Pump Chiller",
-     aqdata->chiller_button->led->state==ON?JSON_ON:JSON_OFF,
-     //((vbutton_detail *)aqdata->chiller_button->special_mask_ptr)->in_alt_mode?JSON_ON:JSON_OFF,
-     aqdata->chiller_button->led->state==ON?LED2text(ON):LED2text(ENABLE),
-     //((vbutton_detail *)aqdata->chiller_button->special_mask_ptr)->in_alt_mode?(aqdata->chiller_button->led->state==ON?LED2text(ON):LED2text(ENABLE)):JSON_OFF,
-     ((homekit)?2:0),
-     ((homekit_f)?degFtoC(aqdata->chiller_set_point):aqdata->chiller_set_point),
-     ((homekit)?2:0),
-     ((homekit_f)?degFtoC(getWaterTemp(aqdata)):getWaterTemp(aqdata)),
-     aqdata->chiller_button->led->state==ON?1:0);
+    return;
   }
 
-  if (aqdata->swg_led_state != LED_S_UNKNOWN) {
-    if ( aqdata->swg_percent != TEMP_UNKNOWN ) {
-      length += sprintf(buffer+length, "{\"type\": \"setpoint_swg\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"status\": \"%s\", \"spvalue\": \"%.*f\", \"value\": \"%.*f\", \"int_status\": \"%d\" },",
-                                     SWG_TOPIC,
-                                    "Salt Water Generator",
-                                    //aqdata->ar_swg_status == SWG_STATUS_OFF?JSON_OFF:JSON_ON,
-                                    aqdata->swg_led_state == OFF?JSON_OFF:JSON_ON,
-                                    //LED2text(get_swg_led_state(aqdata)),
-                                    LED2text(aqdata->swg_led_state),
-                                    ((homekit)?2:0),
-                                    ((homekit_f)?degFtoC(aqdata->swg_percent):aqdata->swg_percent),
-                                    ((homekit)?2:0),
-                                    ((homekit_f)?degFtoC(aqdata->swg_percent):aqdata->swg_percent),
-                                    LED2int(aqdata->swg_led_state) );
-                                    //aqdata->ar_swg_status == SWG_STATUS_OFF?LED2int(OFF):LED2int(ON));
-
-    //length += sprintf(buffer+length, "{\"type\": \"value\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"value\": \"%d\" },",
-      length += sprintf(buffer+length, "{\"type\": \"value\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"value\": \"%.*f\" },",
-                                   ((homekit_f)?SWG_PERCENT_F_TOPIC:SWG_PERCENT_TOPIC),
-                                   "Salt Water Generator Percent",
-                                   "on",
-                                   ((homekit_f)?2:0),
-                                   ((homekit_f)?degFtoC(aqdata->swg_percent):aqdata->swg_percent));
-      //if (!homekit) { // For the moment keep boost off homekit   
-
-        length += sprintf(buffer+length, "{\"type\": \"switch\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"status\": \"%s\", \"int_status\": \"%d\"},", 
-                                     SWG_BOOST_TOPIC, 
-                                     "SWG Boost",
-                                     aqdata->boost?JSON_ON:JSON_OFF,
-                                     aqdata->boost?JSON_ON:JSON_OFF,
-                                     aqdata->boost?LED2int(ON):LED2int(OFF));
-      //}
-    }
+  if (slot >= FRAG_SENSORS) {
+    external_sensor *sensor = &aqdata->sensors[slot - FRAG_SENSORS];
+    temperatureUOM t_uom = getTemperatureUOM(sensor->uom);
+    char id[128];
+
+    snprintf(id, sizeof(id), "%s%s", FULL_SENSOR_TOPIC, sensor->ID);
 
-    if ( aqdata->swg_ppm != TEMP_UNKNOWN ) {
-
-      length += sprintf(buffer+length, "{\"type\": \"value\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"value\": \"%.*f\" },",
-                                     ((homekit_f)?SWG_PPM_F_TOPIC:SWG_PPM_TOPIC),
-                                     "Salt Level PPM",
-                                     "on",
-                                     ((homekit)?2:0),
-                                     ((homekit_f)?roundf(degFtoC(aqdata->swg_ppm)):aqdata->swg_ppm)); 
-                                   
-     /*         
-   length += sprintf(buffer+length, "{\"type\": \"value\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"value\": \"%d\" },",
-                                   SWG_PPM_TOPIC,
-                                   "Salt Level PPM",
-                                   "on",
-                                   aqdata->swg_ppm);
-   */
-                                   
+    if (sensor->uom == NULL) {
+      jw_value_device(w, "value", id, sensor->label, sensor->value, 2, "");
+    } else if (t_uom == UNKNOWN) {
+      jw_value_device(w, "value", id, sensor->label, sensor->value, 2, sensor->uom);
+    } else if ( !homekit && (aqdata->temp_units == FAHRENHEIT && t_uom == CELSIUS) ) {
+      jw_value_device(w, "temperature", id, sensor->label, degCtoF(sensor->value), 2, NULL);
+    } else {
+      jw_value_device(w, "temperature", id, sensor->label, sensor->value, ((homekit)?2:0), NULL);
     }
+    return;
   }
 
-  if ( aqdata->ph != TEMP_UNKNOWN ) {
-    length += sprintf(buffer+length, "{\"type\": \"value\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"value\": \"%.*f\" },",
-                                   ((homekit_f)?CHRM_PH_F_TOPIC:CHEM_PH_TOPIC),
-                                   "Water Chemistry pH",
-                                   "on",
-                                   ((homekit)?2:1),
-                                   ((homekit_f)?(degFtoC(aqdata->ph)):aqdata->ph)); 
-  }
-  if ( aqdata->orp != TEMP_UNKNOWN ) {
-    length += sprintf(buffer+length, "{\"type\": \"value\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"value\": \"%.*f\" },",
-                                   ((homekit_f)?CHRM_ORP_F_TOPIC:CHEM_ORP_TOPIC),
-                                   "Water Chemistry ORP",
-                                   "on",
-                                   ((homekit)?2:0),
-                                   ((homekit_f)?(degFtoC(aqdata->orp)):aqdata->orp)); 
-  }
-
-  length += sprintf(buffer+length, "{\"type\": \"temperature\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"value\": \"%.*f\" },",
-                                   AIR_TEMP_TOPIC,
-                                   /*AIR_TEMPERATURE,*/
-                                   "Pool Air Temperature",
-                                   "on",
-                                   ((homekit)?2:0),
-                                   ((homekit_f)?degFtoC(aqdata->air_temp):aqdata->air_temp));
-  length += sprintf(buffer+length, "{\"type\": \"temperature\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"value\": \"%.*f\" },",
-                                   POOL_TEMP_TOPIC,
-                                   /*POOL_TEMPERATURE,*/
-                                   "Pool Water Temperature",
-                                   "on",
-                                   ((homekit)?2:0),
-                                   ((homekit_f)?degFtoC(aqdata->pool_temp):aqdata->pool_temp));
-  length += sprintf(buffer+length, "{\"type\": \"temperature\", \"id\": \"%s\", \"name\": \"%s\", \"state\": \"%s\", \"value\": \"%.*f\" },",
-                                   SPA_TEMP_TOPIC,
-                                   /*SPA_TEMPERATURE,*/
-                                   "Spa Water Temperature",
-                                   "on",
-                                   ((homekit)?2:0),
-                                   ((homekit_f)?degFtoC(aqdata->spa_temp):aqdata->spa_temp));
+  switch (slot) {
+    case FRAG_FREEZE:
+      jw_setpoint_device_start(w, "setpoint_freeze", FREEZE_PROTECT, "Freeze Protection",
+                               aqdata->frz_protect_state==ON?JSON_ON:JSON_OFF,
+                               aqdata->frz_protect_state==ON?LED2text(ON):LED2text(ENABLE),
+                               aqdata->frz_protect_set_point, aqdata->air_temp, aqdata->frz_protect_state==ON?1:0, homekit, homekit_f);
+      jw_object_end(w);
+    break;
+    case FRAG_CHILLER:
+      jw_setpoint_device_start(w, "setpoint_chiller", CHILLER, "Heat Pump Chiller",
+                               aqdata->chiller_button->led->state==ON?JSON_ON:JSON_OFF,
+                               aqdata->chiller_button->led->state==ON?LED2text(ON):LED2text(ENABLE),
+                               aqdata->chiller_set_point, getWaterTemp(aqdata), aqdata->chiller_button->led->state==ON?1:0, homekit, homekit_f);
+      jw_object_end(w);
+    break;
+    case FRAG_SWG:
+      jw_setpoint_device_start(w, "setpoint_swg", SWG_TOPIC, "Salt Water Generator",
+                               aqdata->swg_led_state == OFF?JSON_OFF:JSON_ON,
+                               LED2text(aqdata->swg_led_state),
+                               aqdata->swg_percent, aqdata->swg_percent, LED2int(aqdata->swg_led_state), homekit, homekit_f);
+      jw_object_end(w);
+
+      jw_value_device(w, "value", ((homekit_f)?SWG_PERCENT_F_TOPIC:SWG_PERCENT_TOPIC), "Salt Water Generator Percent",
+                      ((homekit_f)?degFtoC(aqdata->swg_percent):aqdata->swg_percent), ((homekit_f)?2:0), NULL);
+
+      jw_object_start(w, NULL);
+      jw_string(w, "type", "switch");
+      jw_string(w, "id", SWG_BOOST_TOPIC);
+      jw_string(w, "name", "SWG Boost");
+      jw_string(w, "state", aqdata->boost?JSON_ON:JSON_OFF);
+      jw_string(w, "status", aqdata->boost?JSON_ON:JSON_OFF);
+      jw_int_string(w, "int_status", aqdata->boost?LED2int(ON):LED2int(OFF));
+      jw_object_end(w);
+    break;
+    case FRAG_SWG_PPM:
+      jw_value_device(w, "value", ((homekit_f)?SWG_PPM_F_TOPIC:SWG_PPM_TOPIC), "Salt Level PPM",
+                      ((homekit_f)?roundf(degFtoC(aqdata->swg_ppm)):aqdata->swg_ppm), ((homekit)?2:0), NULL);
+    break;
+    case FRAG_PH:
+      jw_value_device(w, "value", ((homekit_f)?CHRM_PH_F_TOPIC:CHEM_PH_TOPIC), "Water Chemistry pH",
+                      ((homekit_f)?(degFtoC(aqdata->ph)):aqdata->ph), ((homekit)?2:1), NULL);
+    break;
+    case FRAG_ORP:
+      jw_value_device(w, "value", ((homekit_f)?CHRM_ORP_F_TOPIC:CHEM_ORP_TOPIC), "Water Chemistry ORP",
+                      ((homekit_f)?(degFtoC(aqdata->orp)):aqdata->orp), ((homekit)?2:0), NULL);
+    break;
+    case FRAG_AIR_TEMP:
+      jw_value_device(w, "temperature", AIR_TEMP_TOPIC, "Pool Air Temperature",
+                      ((homekit_f)?degFtoC(aqdata->air_temp):aqdata->air_temp), ((homekit)?2:0), NULL);
+    break;
+    case FRAG_POOL_TEMP:
+      jw_value_device(w, "temperature", POOL_TEMP_TOPIC, "Pool Water Temperature",
+                      ((homekit_f)?degFtoC(aqdata->pool_temp):aqdata->pool_temp), ((homekit)?2:0), NULL);
+    break;
+    case FRAG_SPA_TEMP:
+      jw_value_device(w, "temperature", SPA_TEMP_TOPIC, "Spa Water Temperature",
+                      ((homekit_f)?degFtoC(aqdata->spa_temp):aqdata->spa_temp), ((homekit)?2:0), NULL);
+    break;
+  }
+}
 
-  for (i=0; i < aqdata->num_sensors; i++) 
-  {
-    if (aqdata->sensors[i].value != TEMP_UNKNOWN) {
-       //length += sprintf(buffer+length, "\"%s\": \"%.2f\",", aqdata->sensors[i].label, aqdata->sensors[i].value );
-       /*
-      length += sprintf(buffer+length, "{\"type\": \"temperature\", \"id\": \"%s/%s\", \"name\": \"%s\", \"state\": \"%s\", \"value\": \"%.*f\" },",
-        SENSOR_TOPIC,aqdata->sensors[i].label,
-        aqdata->sensors[i].label,
-        "on",
-        ((homekit)?2:0),
-        ((homekit_f)?aqdata->sensors[i].value:aqdata->sensors[i].value));*/
-
-      temperatureUOM t_uom = getTemperatureUOM(aqdata->sensors[i].uom);
-
-      if (aqdata->sensors[i].uom == NULL) {
-        length += sprintf(buffer+length, "{\"type\": \"value\", \"id\": \"%s%s\", \"name\": \"%s\", \"state\": \"on\", \"value\": \"%.*f\", \"uom\": \"\" },",
-        FULL_SENSOR_TOPIC,
-        aqdata->sensors[i].ID,
-        aqdata->sensors[i].label,
-        2,
-        aqdata->sensors[i].value);
-      } else if (t_uom == UNKNOWN) {
-        length += sprintf(buffer+length, "{\"type\": \"value\", \"id\": \"%s%s\", \"name\": \"%s\", \"state\": \"on\", \"value\": \"%.*f\", \"uom\": \"%s\" },",
-        FULL_SENSOR_TOPIC,
-        aqdata->sensors[i].ID,
-        aqdata->sensors[i].label,
-        2,
-        aqdata->sensors[i].value,
-        aqdata->sensors[i].uom);
-      } else if ( !homekit && (aqdata->temp_units == FAHRENHEIT && t_uom == CELSIUS) ) {
-        length += sprintf(buffer+length, "{\"type\": \"temperature\", \"id\": \"%s%s\", \"name\": \"%s\", \"state\": \"on\", \"value\": \"%.*f\" },",
-        FULL_SENSOR_TOPIC,
-        aqdata->sensors[i].ID,
-        aqdata->sensors[i].label,
-        2,
-        degCtoF(aqdata->sensors[i].value));
-      } else {
-        length += sprintf(buffer+length, "{\"type\": \"temperature\", \"id\": \"%s%s\", \"name\": \"%s\", \"state\": \"%s\", \"value\": \"%.*f\" },",
-        FULL_SENSOR_TOPIC,
-        aqdata->sensors[i].ID,
-        aqdata->sensors[i].label,
-        "on",
-        ((homekit)?2:0),
-        ((homekit_f)?aqdata->sensors[i].value:aqdata->sensors[i].value));
-      }
+static void write_cached_device_fragment(json_writer *w, struct aqualinkdata *aqdata, int slot, bool homekit)
+{
+  device_fragment *frag = &_device_fragments[homekit?1:0][slot];
+  uint32_t version = device_fragment_version(aqdata, slot);
+  uint32_t mask = 0;
+  const void *owner = NULL;
+  json_writer fw;
+
+  if (slot < FRAG_FREEZE) {
+    aqkey *button = &aqdata->aqbuttons[slot - FRAG_BUTTONS];
+    // Timer duration counts down without anything changing, so never cache those.
+    if ((button->special_mask & TIMER_ACTIVE) == TIMER_ACTIVE) {
+      write_device_fragment(w, aqdata, slot, homekit);
+      return;
     }
+    mask = button->special_mask;
+    owner = button->label;
+  } else if (slot >= FRAG_SENSORS) {
+    owner = aqdata->sensors[slot - FRAG_SENSORS].label;
   }
-/*
-  length += sprintf(buffer+length,  "], \"aux_device_detail\": [");
-  for (i=0; i < MAX_PUMPS; i++) {
+
+  if (frag->valid && frag->version == version && frag->mask == mask && frag->owner == owner) {
+    _device_fragment_hits++;
+  } else {
+    _device_fragment_misses++;
+    jw_init(&fw, frag->json, sizeof(frag->json));
+    write_device_fragment(&fw, aqdata, slot, homekit);
+    jw_finish(&fw);
+    if (fw.overflow) {
+      LOG(NET_LOG,LOG_WARNING, "JSON: device fragment %d too big to cache\n", slot);
+      frag->valid = false;
+      write_device_fragment(w, aqdata, slot, homekit);
+      return;
+    }
+    frag->valid = true;
+    frag->version = version;
+    frag->mask = mask;
+    frag->owner = owner;
   }
-*/
-  if (buffer[length-1] == ',')
-    length--;
 
-  length += sprintf(buffer+length, "]}");
+  if (frag->json[0] != '\0')
+    jw_raw(w, NULL, frag->json);
+}
+
+void get_device_fragment_stats(unsigned long *hits, unsigned long *misses)
+{
+  *hits = _device_fragment_hits;
+  *misses = _device_fragment_misses;
+}
 
-  // Really crap test
-  if (length >= size) {
-    LOG(NET_LOG,LOG_ERR, "JSON: %s went over buffer size %d of %d\n", homekit?"homebridge":"web", length, size);
-    buffer[size - 1] = '\0';
+void write_device_JSON(json_writer *w, struct aqualinkdata *aqdata, bool homekit)
+{
+  int slot;
+
+  jw_object_start(w, NULL);
+  jw_string(w, "type", "devices");
+  jw_string(w, "aqualinkd_version", AQUALINKD_VERSION);
+  jw_string(w, "date", aqdata->date);//"09/01/16 THU",
+  jw_string(w, "time", aqdata->time);//"1:16 PM",
+  jw_string(w, "temp_units", temp_units2text(aqdata));
+
+  jw_array_start(w, "devices");
+  for (slot=0; slot < FRAG_TOTAL; slot++) {
+    if (device_fragment_wanted(aqdata, slot, homekit))
+      write_cached_device_fragment(w, aqdata, slot, homekit);
   }
+  jw_array_end(w);
 
-  LOG(NET_LOG,LOG_DEBUG, "JSON: %s used %d of %d\n", homekit?"homebridge":"web", length, size);
+  jw_object_end(w);
+}
 
-  buffer[length] = '\0';
+//int build_device_JSON(struct aqualinkdata *aqdata, int programable_switch1, int programable_switch2, char* buffer, int size, bool homekit)
+int build_device_JSON(struct aqualinkdata *aqdata, char* buffer, int size, bool homekit)
+{
+  json_writer w;
 
-//printf("%s\n",buffer);
+  jw_init(&w, buffer, size);
+  write_device_JSON(&w, aqdata, homekit);
 
-  return strlen(buffer);
-  
-  //return length;
+  if (w.overflow)
+    LOG(NET_LOG,LOG_ERR, "JSON: %s went over buffer size %d\n", homekit?"homebridge":"web", size);
+  else
+    LOG(NET_LOG,LOG_DEBUG, "JSON: %s used %d of %d\n", homekit?"homebridge":"web", (int)w.length, size);
+
+  return jw_finish(&w);
 }
 
 int logmaskjsonobject(logmask_t flag, char* buffer)
@@ -637,6 +688,299 @@ int logleveljsonobject(int level, char* buffer)
   return length;
 }
 
+/*
+ * {"type":"ack_latency","buckets_ms":[1,2,4,...],"emulations":{"AllButton":{"count":n,"avg_ms":n,"max_ms":n,"histogram":[n,n,...]},...}}
+ * Last histogram entry is everything over the last bucket.
+ */
+int build_ack_latency_JSON(char* buffer, int size)
+{
+  int length = 0;
+  int i, b;
+  bool first = true;
+  emulation_type emulations[] = {ALLBUTTON, RSSADAPTER, ONETOUCH, IAQTOUCH, AQUAPDA, IAQUALNK, SIMULATOR};
+
+  length += snprintf(buffer+length, size-length, "{\"type\": \"ack_latency\",\"frame_delay_ms\":%d,\"buckets_ms\":[", _aqconfig_.frame_delay);
+  for (b=0; b < ACK_LATENCY_BUCKETS-1; b++) {
+    length += snprintf(buffer+length, size-length, "%s%ld", (b==0?"":","), get_ack_latency_bucket_us(b)/1000);
+  }
+  length += snprintf(buffer+length, size-length, "],\"emulations\":{");
+
+  for (i=0; i < sizeof(emulations)/sizeof(emulations[0]); i++) {
+    ack_latency_stats stats;
+    if (!get_ack_latency(emulations[i], &stats) || stats.count == 0)
+      continue;
+
+    length += snprintf(buffer+length, size-length, "%s\"%s\":{\"count\":%u,\"avg_ms\":%.3f,\"max_ms\":%.3f,\"histogram\":[",
+                                                   (first?"":","),
+                                                   (emulations[i]==SIMULATOR?"Simulator":getJandyDeviceName(emulations[i])),
+                                                   stats.count,
+                                                   ((float)stats.total_us / stats.count) / 1000,
+                                                   (float)stats.max_us / 1000);
+    for (b=0; b < ACK_LATENCY_BUCKETS; b++) {
+      length += snprintf(buffer+length, size-length, "%s%u", (b==0?"":","), stats.buckets[b]);
+    }
+    length += snprintf(buffer+length, size-length, "]}");
+    first = false;
+  }
+
+  length += snprintf(buffer+length, size-length, "}}");
+
+  return length;
+}
+
+/*
+ * {"type":"programmer","jobs":[{"id":n,"type":"...","running":"on","age_ms":n},...],
+ *  "stats":{"depth":n,"max_depth":n,"queued":n,"completed":n,"rejected":n,"cancelled":n,"timed_out":n,
+ *           "avg_wait_ms":n,"max_wait_ms":n,"avg_run_ms":n,"max_run_ms":n,"last":{"type":"...","wait_ms":n,"run_ms":n}}}
+ */
+void write_aq_programmer_JSON(json_writer *w)
+{
+  aq_programmer_job_info jobs[AQ_PROGRAMMER_QUEUE_SIZE + 1];
+  aq_programmer_stats stats;
+  int i, count;
+
+  count = get_aq_programmer_jobs(jobs, AQ_PROGRAMMER_QUEUE_SIZE + 1);
+  get_aq_programmer_stats(&stats);
+
+  jw_object_start(w, NULL);
+  jw_string(w, "type", "programmer");
+
+  jw_array_start(w, "jobs");
+  for (i=0; i < count; i++) {
+    jw_object_start(w, NULL);
+    jw_int(w, "id", jobs[i].id);
+    jw_string(w, "type", ptypeName(jobs[i].type));
+    jw_string(w, "running", jobs[i].running?JSON_ON:JSON_OFF);
+    jw_int(w, "age_ms", jobs[i].age_ms);
+    jw_object_end(w);
+  }
+  jw_array_end(w);
+
+  jw_object_start(w, "stats");
+  jw_int(w, "depth", stats.depth);
+  jw_int(w, "max_depth", stats.max_depth);
+  jw_int(w, "queued", stats.queued);
+  jw_int(w, "completed", stats.completed);
+  jw_int(w, "rejected", stats.rejected);
+  jw_int(w, "cancelled", stats.cancelled);
+  jw_int(w, "timed_out", stats.timed_out);
+  jw_int(w, "avg_wait_ms", stats.completed?stats.total_wait_ms / stats.completed:0);
+  jw_int(w, "max_wait_ms", stats.max_wait_ms);
+  jw_int(w, "avg_run_ms", stats.completed?stats.total_run_ms / stats.completed:0);
+  jw_int(w, "max_run_ms", stats.max_run_ms);
+  if (stats.completed > 0) {
+    jw_object_start(w, "last");
+    jw_string(w, "type", ptypeName(stats.last_type));
+    jw_int(w, "wait_ms", stats.last_wait_ms);
+    jw_int(w, "run_ms", stats.last_run_ms);
+    jw_object_end(w);
+  }
+  jw_object_end(w);
+
+  jw_object_end(w);
+}
+
+/*
+ * {"type":"webcache","enabled":"on","files":n,"bytes":n,"hits":n,"misses":n,"not_modified":n,"gzip":n,"rebuilds":n}
+ */
+void write_web_cache_JSON(json_writer *w)
+{
+  web_cache_stats stats;
+
+  get_web_cache_stats(&stats);
+
+  jw_object_start(w, NULL);
+  jw_string(w, "type", "webcache");
+  jw_string(w, "enabled", _aqconfig_.web_cache?JSON_ON:JSON_OFF);
+  jw_int(w, "files", stats.files);
+  jw_int(w, "bytes", stats.bytes);
+  jw_int(w, "hits", stats.hits);
+  jw_int(w, "misses", stats.misses);
+  jw_int(w, "not_modified", stats.not_modified);
+  jw_int(w, "gzip", stats.gzip);
+  jw_int(w, "rebuilds", stats.rebuilds);
+  jw_object_end(w);
+}
+
+/*
+ * Walk the top level members of a JSON object such as the one from build_aqualink_status_JSON().
+ * Returns where to continue from, or NULL when there are no more members.
+ * member / member_len is the full '"key":value' text, key / key_len the key without quotes.
+ */
+static const char *next_json_member(const char *json, const char **member, int *member_len, const char **key, int *key_len)
+{
+  const char *p = json;
+  int depth = 0;
+  bool in_str = false;
+
+  while (*p == '{' || *p == ',' || *p == ' ')
+    p++;
+
+  if (*p != '"')
+    return NULL;
+
+  *member = p;
+  *key = ++p;
+  while (*p != '"' && *p != '\0') {
+    if (*p == '\\' && *(p+1) != '\0')
+      p++;
+    p++;
+  }
+  *key_len = p - *key;
+  if (*p == '"')
+    p++;
+
+  for (; *p != '\0'; p++) {
+    if (in_str) {
+      if (*p == '\\' && *(p+1) != '\0')
+        p++;
+      else if (*p == '"')
+        in_str = false;
+    } else if (*p == '"') {
+      in_str = true;
+    } else if (*p == '{' || *p == '[') {
+      depth++;
+    } else if (*p == '}' || *p == ']') {
+      if (depth-- == 0)
+        break;
+    } else if (*p == ',' && depth == 0) {
+      break;
+    }
+  }
+
+  *member_len = p - *member;
+  return p;
+}
+
+#define DELTA_MAX_MEMBERS 256  // Top level status members, there are ~40
+#define DELTA_INDEX_SIZE  512  // Power of 2, open addressing, slots hold index+1 so 0 is empty
+
+typedef struct json_member {
+  const char *member;
+  int member_len;
+  const char *key;
+  int key_len;
+  bool seen;
+} json_member;
+
+typedef struct json_member_index {
+  json_member members[DELTA_MAX_MEMBERS];
+  int num_members;
+  uint16_t slots[DELTA_INDEX_SIZE];
+} json_member_index;
+
+static uint32_t json_key_hash(const char *key, int key_len)
+{
+  uint32_t hash = 2166136261u; // FNV-1a
+  int i;
+
+  for (i=0; i < key_len; i++) {
+    hash ^= (unsigned char)key[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static json_member *find_json_member(json_member_index *index, const char *key, int key_len)
+{
+  uint32_t slot = json_key_hash(key, key_len) & (DELTA_INDEX_SIZE - 1);
+  json_member *m;
+
+  for (; index->slots[slot] != 0; slot = (slot + 1) & (DELTA_INDEX_SIZE - 1)) {
+    m = &index->members[index->slots[slot] - 1];
+    if (m->key_len == key_len && strncmp(m->key, key, key_len) == 0)
+      return m;
+  }
+  return NULL;
+}
+
+// Returns false if there are too many members to index.
+static bool index_json_members(json_member_index *index, const char *json)
+{
+  const char *p, *member, *key;
+  int member_len, key_len;
+  uint32_t slot;
+
+  memset(index->slots, 0, sizeof(index->slots));
+  index->num_members = 0;
+
+  for (p = json; p != NULL && (p = next_json_member(p, &member, &member_len, &key, &key_len)) != NULL; ) {
+    if (find_json_member(index, key, key_len) != NULL)
+      continue;
+    if (index->num_members >= DELTA_MAX_MEMBERS)
+      return false;
+
+    slot = json_key_hash(key, key_len) & (DELTA_INDEX_SIZE - 1);
+    while (index->slots[slot] != 0)
+      slot = (slot + 1) & (DELTA_INDEX_SIZE - 1);
+
+    index->members[index->num_members] = (json_member){member, member_len, key, key_len, false};
+    index->slots[slot] = ++index->num_members;
+  }
+  return true;
+}
+
+/*
+ * Websocket delta protocol, only the top level status members that differ between base and current.
+ * {"type":"status_delta","version":N,"base":N,<changed members>,"removed":["key",...]}
+ * base of 0 / NULL base_json means everything, ie a full status with a version number.
+ * Returns 0 if nothing changed, -1 if it didn't fit in buffer.
+ */
+int build_aqualink_status_delta_JSON(const char *base_json, uint32_t base, const char *json, uint32_t version, char* buffer, int size)
+{
+  json_member_index index;
+  json_member *old;
+  json_writer w;
+  const char *p, *member, *key;
+  int member_len, key_len, i;
+  int changes = 0;
+  bool removed = false;
+
+  // Index base once so the diff is one pass over each, rather than a search per member.
+  if (base_json != NULL && !index_json_members(&index, base_json))
+    base_json = NULL; // Can't diff it, send everything
+  if (base_json == NULL)
+    index_json_members(&index, NULL);
+
+  jw_init(&w, buffer, size);
+  jw_object_start(&w, NULL);
+  jw_string(&w, "type", "status_delta");
+  jw_int(&w, "version", version);
+  jw_int(&w, "base", (base_json==NULL?0:base));
+
+  for (p = json; (p = next_json_member(p, &member, &member_len, &key, &key_len)) != NULL; ) {
+    if ((old = find_json_member(&index, key, key_len)) != NULL)
+      old->seen = true;
+    if (key_len == 4 && strncmp(key, "type", 4) == 0)
+      continue;
+    if (old != NULL && old->member_len == member_len && strncmp(old->member, member, member_len) == 0)
+      continue;
+
+    jw_raw_len(&w, NULL, member, member_len);
+    changes++;
+  }
+
+  for (i=0; i < index.num_members; i++) {
+    if (index.members[i].seen)
+      continue;
+    if (!removed)
+      jw_array_start(&w, "removed");
+    removed = true;
+    // Key is already JSON text, so take it quotes & all from the member.
+    jw_raw_len(&w, NULL, index.members[i].member, index.members[i].key_len + 2);
+    changes++;
+  }
+  if (removed)
+    jw_array_end(&w);
+
+  jw_object_end(&w);
+
+  if (w.overflow)
+    return -1;
+
+  return (changes > 0 || base_json == NULL)?jw_finish(&w):0;
+}
+
 int build_aqualink_aqmanager_JSON(struct aqualinkdata *aqdata, char* buffer, int size)
 {
   memset(&buffer[0], 0, size);
@@ -702,214 +1046,168 @@ int build_aqualink_aqmanager_JSON(struct aqualinkdata *aqdata, char* buffer, int
   return length;
 }
 
-int build_aqualink_status_JSON(struct aqualinkdata *aqdata, char* buffer, int size)
+static void jw_temp_string(json_writer *w, const char *key, int value)
 {
-  //strncpy(buffer, test_message, strlen(test_message)+1);
-  //return strlen(test_message);
-  //char buffer2[600];
-  
-  memset(&buffer[0], 0, size);
-  int length = 0;
-  int i;
+  if ( value == TEMP_UNKNOWN )
+    jw_string(w, key, " ");
+  else
+    jw_int_string(w, key, value);
+}
 
-  length += sprintf(buffer+length, "{\"type\": \"status\"");
-  length += sprintf(buffer+length, ",\"status\":\"%s\"",getStatus(aqdata) );
-  length += sprintf(buffer+length, ",\"panel_message\":\"%s\"",aqdata->last_message );
-  length += sprintf(buffer+length, ",\"panel_type_full\":\"%s\"",getPanelString());
-  length += sprintf(buffer+length, ",\"panel_type\":\"%s\"",getShortPanelString());
-  //length += sprintf(buffer+length, ",\"message\":\"%s\"",aqdata->message );
-  //length += sprintf(buffer+length, ",\"version\":\"%s\"",aqdata->version );//8157 REV MMM",
-  length += sprintf(buffer+length, ",\"version\":\"%s %s\"",aqdata->panel_cpu, aqdata->panel_rev );//8157 REV MMM",
-  length += sprintf(buffer+length, ",\"aqualinkd_version\":\"%s\"", AQUALINKD_VERSION ); //1.0b,
-  length += sprintf(buffer+length, ",\"date\":\"%s\"",aqdata->date );//"09/01/16 THU",
-  length += sprintf(buffer+length, ",\"time\":\"%s\"",aqdata->time );//"1:16 PM",
-  //length += sprintf(buffer+length, ",\"air_temp\":\"%d\"",aqdata->air_temp );//"96",
-  //length += sprintf(buffer+length, ",\"pool_temp\":\"%d\"",aqdata->pool_temp );//"86",
-  //length += sprintf(buffer+length, ",\"spa_temp\":\"%d\"",aqdata->spa_temp );//" ",
-  
-  length += sprintf(buffer+length, ",\"pool_htr_set_pnt\":\"%d\"",aqdata->pool_htr_set_point );//"85",
-  length += sprintf(buffer+length, ",\"spa_htr_set_pnt\":\"%d\"",aqdata->spa_htr_set_point );//"99",
-  //length += sprintf(buffer+length, ",\"freeze_protection":\"%s\"",aqdata->frz_protect_set_point );//"off",
-  length += sprintf(buffer+length, ",\"frz_protect_set_pnt\":\"%d\"",aqdata->frz_protect_set_point );//"0",
+void write_aqualink_status_JSON(json_writer *w, struct aqualinkdata *aqdata)
+{
+  int i;
+  char buf[64];
+
+  jw_object_start(w, NULL);
+  jw_string(w, "type", "status");
+  jw_string(w, "status", getStatus(aqdata));
+  jw_string(w, "panel_message", aqdata->last_message);
+  jw_string(w, "panel_type_full", getPanelString());
+  jw_string(w, "panel_type", getShortPanelString());
+  jw_stringf(w, "version", "%s %s", aqdata->panel_cpu, aqdata->panel_rev);//8157 REV MMM",
+  jw_string(w, "aqualinkd_version", AQUALINKD_VERSION); //1.0b,
+  jw_string(w, "date", aqdata->date);//"09/01/16 THU",
+  jw_string(w, "time", aqdata->time);//"1:16 PM",
+
+  jw_int_string(w, "pool_htr_set_pnt", aqdata->pool_htr_set_point);//"85",
+  jw_int_string(w, "spa_htr_set_pnt", aqdata->spa_htr_set_point);//"99",
+  jw_int_string(w, "frz_protect_set_pnt", aqdata->frz_protect_set_point);//"0",
   if ( (ENABLE_CHILLER || aqdata->chiller_set_point != TEMP_UNKNOWN) && aqdata->chiller_button != NULL) {
-    length += sprintf(buffer+length, ",\"chiller_set_pnt\":\"%d\"",aqdata->chiller_set_point );//"0",
+    jw_int_string(w, "chiller_set_pnt", aqdata->chiller_set_point);//"0",
     if (isVBUTTON_CHILLER(aqdata->chiller_button->special_mask))
-      length += sprintf(buffer+length, ",\"chiller_mode\":\"%s\"",((altlabel_detail *)aqdata->chiller_button->special_mask_ptr)->in_alt_mode?"cool":"heat");
+      jw_string(w, "chiller_mode", ((altlabel_detail *)aqdata->chiller_button->special_mask_ptr)->in_alt_mode?"cool":"heat");
   }
-  
-  if ( aqdata->air_temp == TEMP_UNKNOWN )
-    length += sprintf(buffer+length, ",\"air_temp\":\" \"");
-  else
-    length += sprintf(buffer+length, ",\"air_temp\":\"%d\"",aqdata->air_temp );
-  
-  if ( aqdata->pool_temp == TEMP_UNKNOWN )
-    length += sprintf(buffer+length, ",\"pool_temp\":\" \"");
-  else
-    length += sprintf(buffer+length, ",\"pool_temp\":\"%d\"",aqdata->pool_temp );
-    
-  if ( aqdata->spa_temp == TEMP_UNKNOWN )
-    length += sprintf(buffer+length, ",\"spa_temp\":\" \"");
-  else
-    length += sprintf(buffer+length, ",\"spa_temp\":\"%d\"",aqdata->spa_temp );
+
+  jw_temp_string(w, "air_temp", aqdata->air_temp);
+  jw_temp_string(w, "pool_temp", aqdata->pool_temp);
+  jw_temp_string(w, "spa_temp", aqdata->spa_temp);
 
   if (aqdata->swg_led_state != LED_S_UNKNOWN) {
     if ( aqdata->swg_percent != TEMP_UNKNOWN )
-      length += sprintf(buffer+length, ",\"swg_percent\":\"%d\"",aqdata->swg_percent );
+      jw_int_string(w, "swg_percent", aqdata->swg_percent);
   
     if ( aqdata->swg_ppm != TEMP_UNKNOWN )
-      length += sprintf(buffer+length, ",\"swg_ppm\":\"%d\"",aqdata->swg_ppm );
+      jw_int_string(w, "swg_ppm", aqdata->swg_ppm);
   }
 
-  if ( aqdata->temp_units == FAHRENHEIT )
-    length += sprintf(buffer+length, ",\"temp_units\":\"%s\"",JSON_FAHRENHEIT );
-  else if ( aqdata->temp_units == CELSIUS )
-    length += sprintf(buffer+length, ",\"temp_units\":\"%s\"", JSON_CELSIUS);
-  else
-    length += sprintf(buffer+length, ",\"temp_units\":\"%s\"",JSON_UNKNOWN );
-  
-  if (aqdata->battery == OK)
-    length += sprintf(buffer+length, ",\"battery\":\"%s\"",JSON_OK );//"ok",
-  else
-    length += sprintf(buffer+length, ",\"battery\":\"%s\"",JSON_LOW );//"ok",
+  jw_string(w, "temp_units", temp_units2text(aqdata));
+  jw_string(w, "battery", (aqdata->battery == OK)?JSON_OK:JSON_LOW);
 
   if ( aqdata->swg_percent == 101 )
-    length += sprintf(buffer+length, ",\"swg_boost_msg\":\"%s\"",aqdata->boost_msg );
+    jw_string(w, "swg_boost_msg", aqdata->boost_msg);
   
   if ( aqdata->ph != TEMP_UNKNOWN )
-    length += sprintf(buffer+length, ",\"chem_ph\":\"%.1f\"",aqdata->ph );
+    jw_float_string(w, "chem_ph", aqdata->ph, 1);
     
   if ( aqdata->orp != TEMP_UNKNOWN )
-    length += sprintf(buffer+length, ",\"chem_orp\":\"%d\"",aqdata->orp );
+    jw_int_string(w, "chem_orp", aqdata->orp);
 
-  //if ( READ_RSDEV_SWG )
-    length += sprintf(buffer+length, ",\"swg_fullstatus\": \"%d\"", aqdata->ar_swg_device_status);
+  jw_int_string(w, "swg_fullstatus", aqdata->ar_swg_device_status);
 
-  length += sprintf(buffer+length, ",\"leds\":{" );
+  jw_object_start(w, "leds");
   for (i=0; i < aqdata->total_buttons; i++) 
   {
-    char *state = LED2text(aqdata->aqbuttons[i].led->state);
-    length += sprintf(buffer+length, "\"%s\": \"%s\"", aqdata->aqbuttons[i].name, state);
-
-    if (i+1 < aqdata->total_buttons)
-      length += sprintf(buffer+length, "," );
+    jw_string(w, aqdata->aqbuttons[i].name, LED2text(aqdata->aqbuttons[i].led->state));
   }
 
   if ( aqdata->swg_percent != TEMP_UNKNOWN && aqdata->swg_led_state != LED_S_UNKNOWN ) {
-    //length += sprintf(buffer+length, ", \"%s\": \"%s\"", SWG_TOPIC, LED2text(get_swg_led_state(aqdata)));
-    length += sprintf(buffer+length, ", \"%s\": \"%s\"", SWG_TOPIC, LED2text(aqdata->swg_led_state));
-    //length += sprintf(buffer+length, ", \"%s\": \"%s\"", SWG_TOPIC, aqdata->ar_swg_status == SWG_STATUS_OFF?JSON_OFF:JSON_ON);
-    length += sprintf(buffer+length, ", \"%s\": \"%s\"", SWG_BOOST_TOPIC, aqdata->boost?JSON_ON:JSON_OFF);
+    jw_string(w, SWG_TOPIC, LED2text(aqdata->swg_led_state));
+    jw_string(w, SWG_BOOST_TOPIC, aqdata->boost?JSON_ON:JSON_OFF);
   }
   //NSF Need to come back and read what the display states when Freeze protection is on
   if ( aqdata->frz_protect_set_point != TEMP_UNKNOWN || ENABLE_FREEZEPROTECT ) {
-    //length += sprintf(buffer+length, ", \"%s\": \"%s\"", FREEZE_PROTECT, aqdata->frz_protect_state==ON?JSON_ON:JSON_ENABLED);
-    length += sprintf(buffer+length, ", \"%s\": \"%s\"", FREEZE_PROTECT, LED2text(aqdata->frz_protect_state) );
+    jw_string(w, FREEZE_PROTECT, LED2text(aqdata->frz_protect_state));
   }
   // Add Chiller if exists
   if (aqdata->chiller_button != NULL) {
-    length += sprintf(buffer+length, ", \"%s\": \"%s\"", CHILLER, LED2text(aqdata->chiller_button->led->state) );
+    jw_string(w, CHILLER, LED2text(aqdata->chiller_button->led->state));
   }
-  //length += sprintf(buffer+length, "}, \"extra\":{" );
-  length += sprintf(buffer+length, "},");
+  jw_object_end(w);
 
   // NSF Check below needs to be for VSP Pump (any state), not just known state
   for (i=0; i < aqdata->num_pumps; i++) {
-    /*  NSF There is a problem here that needs to be fixed.
-printf("Loop %d Message '%s'\n",i,buffer);
-printf("Pump Label %s\n",aqdata->pumps[i].button->label);
-printf("Pump Name %s\n",aqdata->pumps[i].button->name);
-printf("Pump RPM %d\n",aqdata->pumps[i].rpm);
-printf("Pump GPM %d\n",aqdata->pumps[i].gpm);
-printf("Pump GPM %d\n",aqdata->pumps[i].watts);
-printf("Pump Type %d\n",aqdata->pumps[i].pumpType);
-    */
-    //if (aqdata->pumps[i].pumpType != PT_UNKNOWN && (aqdata->pumps[i].rpm != TEMP_UNKNOWN || aqdata->pumps[i].gpm != TEMP_UNKNOWN || aqdata->pumps[i].watts != TEMP_UNKNOWN)) {
     if (aqdata->pumps[i].pumpType != PT_UNKNOWN ) {
-      length += sprintf(buffer+length, "\"Pump_%d\":{\"name\":\"%s\",\"id\":\"%s\",\"RPM\":\"%d\",\"GPM\":\"%d\",\"Watts\":\"%d\",\"Pump_Type\":\"%s\",\"Status\":\"%d\"},",
-                        i+1,aqdata->pumps[i].button->label,aqdata->pumps[i].button->name,aqdata->pumps[i].rpm,aqdata->pumps[i].gpm,aqdata->pumps[i].watts,
-                        (aqdata->pumps[i].pumpType==VFPUMP?"vfPump":(aqdata->pumps[i].pumpType==VSPUMP?"vsPump":"ePump")),
-                        getPumpStatus(i, aqdata));
+      sprintf(buf, "Pump_%d", i+1);
+      jw_object_start(w, buf);
+      jw_string(w, "name", aqdata->pumps[i].button->label);
+      jw_string(w, "id", aqdata->pumps[i].button->name);
+      jw_int_string(w, "RPM", aqdata->pumps[i].rpm);
+      jw_int_string(w, "GPM", aqdata->pumps[i].gpm);
+      jw_int_string(w, "Watts", aqdata->pumps[i].watts);
+      jw_string(w, "Pump_Type", pumpType2text(aqdata->pumps[i].pumpType));
+      jw_int_string(w, "Status", getPumpStatus(i, aqdata));
+      jw_object_end(w);
     }
   }
-  if (buffer[length-1] == ',')
-    length--;
 
-  length += sprintf(buffer+length, ",\"timers\":{" );
+  jw_object_start(w, "timers");
   for (i=0; i < aqdata->total_buttons; i++) 
   {
     if ((aqdata->aqbuttons[i].special_mask & TIMER_ACTIVE) == TIMER_ACTIVE) {
-      length += sprintf(buffer+length, "\"%s\": \"on\",", aqdata->aqbuttons[i].name);
-      //length += sprintf(buffer+length, "\"%s_duration\": \"%d\",", aqdata->aqbuttons[i].name, get_timer_left(&aqdata->aqbuttons[i]) );
+      jw_string(w, aqdata->aqbuttons[i].name, JSON_ON);
     }
   }
-  if (buffer[length-1] == ',')
-    length--;
-  length += sprintf(buffer+length, "}");
+  jw_object_end(w);
 
-  length += sprintf(buffer+length, ",\"timer_durations\":{" );
+  jw_object_start(w, "timer_durations");
   for (i=0; i < aqdata->total_buttons; i++) 
   {
     if ((aqdata->aqbuttons[i].special_mask & TIMER_ACTIVE) == TIMER_ACTIVE) {
-      length += sprintf(buffer+length, "\"%s\": \"%d\",", aqdata->aqbuttons[i].name, get_timer_left(&aqdata->aqbuttons[i]) );
+      jw_int_string(w, aqdata->aqbuttons[i].name, get_timer_left(i));
     }
   }
-  if (buffer[length-1] == ',')
-    length--;
-  length += sprintf(buffer+length, "}");
+  jw_object_end(w);
 
-  length += sprintf(buffer+length, ",\"light_program_names\":{" );
+  jw_object_start(w, "light_program_names");
   for (i=0; i < aqdata->num_lights; i++) 
   {
     if (aqdata->lights[i].lightType == LC_DIMMER2) {
-      length += sprintf(buffer+length, "\"%s\": \"%d%%\",", aqdata->lights[i].button->name, aqdata->lights[i].currentValue );
+      jw_stringf(w, aqdata->lights[i].button->name, "%d%%", aqdata->lights[i].currentValue);
     } else {
-      //length += sprintf(buffer+length, "\"%s\": \"%s\",", aqdata->lights[i].button->name, light_mode_name(aqdata->lights[i].lightType, aqdata->lights[i].currentValue, RSSADAPTER) );
-      length += sprintf(buffer+length, "\"%s\": \"%s\",", aqdata->lights[i].button->name, get_currentlight_mode_name(aqdata->lights[i], RSSADAPTER) );
+      jw_string(w, aqdata->lights[i].button->name, get_currentlight_mode_name(aqdata->lights[i], RSSADAPTER));
     }
   }
-  if (buffer[length-1] == ',')
-    length--;
-  length += sprintf(buffer+length, "}");
-
+  jw_object_end(w);
 
-  length += sprintf(buffer+length, ",\"alternate_modes\":{" );
+  jw_object_start(w, "alternate_modes");
   if (aqdata->virtual_button_start > 0) {
     for (i=aqdata->virtual_button_start; i < aqdata->total_buttons; i++) 
     {
       if (isVBUTTON_ALTLABEL(aqdata->aqbuttons[i].special_mask)) {
-        length += sprintf(buffer+length, "\"%s\": \"%s\",",aqdata->aqbuttons[i].name, ((altlabel_detail *)aqdata->aqbuttons[i].special_mask_ptr)->in_alt_mode?JSON_ON:JSON_OFF );
+        jw_string(w, aqdata->aqbuttons[i].name, ((altlabel_detail *)aqdata->aqbuttons[i].special_mask_ptr)->in_alt_mode?JSON_ON:JSON_OFF);
       }
     }
-    if (buffer[length-1] == ',')
-      length--;
   }
-  length += sprintf(buffer+length, "}");
+  jw_object_end(w);
 
-
-  length += sprintf(buffer+length, ",\"sensors\":{" );
+  jw_object_start(w, "sensors");
   for (i=0; i < aqdata->num_sensors; i++) 
   {
-    //printf("Sensor value %f %.2f\n",aqdata->sensors[i].value,aqdata->sensors[i].value);
-    
     if (aqdata->sensors[i].value != TEMP_UNKNOWN) {
-      //length += sprintf(buffer+length, "\"%s\": \"%.2f\",", aqdata->sensors[i].label, aqdata->sensors[i].value );
       if ( aqdata->temp_units == FAHRENHEIT && getTemperatureUOM(aqdata->sensors[i].uom) == CELSIUS ) {
-        length += sprintf(buffer+length, "\"%s\": \"%.1f\",", aqdata->sensors[i].ID, degCtoF(aqdata->sensors[i].value) );
+        jw_float_string(w, aqdata->sensors[i].ID, degCtoF(aqdata->sensors[i].value), 1);
       } else {
-        length += sprintf(buffer+length, "\"%s\": \"%.1f\",", aqdata->sensors[i].ID, aqdata->sensors[i].value );
+        jw_float_string(w, aqdata->sensors[i].ID, aqdata->sensors[i].value, 1);
       }
     }
   }
-  if (buffer[length-1] == ',')
-    length--;
-  length += sprintf(buffer+length, "}");
+  jw_object_end(w);
 
+  jw_object_end(w);
+}
 
-  length += sprintf(buffer+length, "}" );
-  
-  buffer[length] = '\0';
-  
-  return strlen(buffer);
+int build_aqualink_status_JSON(struct aqualinkdata *aqdata, char* buffer, int size)
+{
+  json_writer w;
+
+  jw_init(&w, buffer, size);
+  write_aqualink_status_JSON(&w, aqdata);
+
+  if (w.overflow)
+    LOG(NET_LOG,LOG_ERR, "JSON: status went over buffer size %d\n", size);
+
+  return jw_finish(&w);
 }
 
 int build_aux_labels_JSON(struct aqualinkdata *aqdata, char* buffer, int size)
@@ -1180,94 +1478,92 @@ int json_cfg_element_OLD(char* buffer, int size, const char *name, const void *v
 
 //#ifdef CONFIG_EDITOR
 
-int json_cfg_element(char* buffer, int size, const char *name, const void *value, cfg_value_type type, uint16_t mask, char *valid_val, uint8_t config_mask) {
-  int result = 0;
+static void json_cfg_element(json_writer *w, const char *name, const void *value, cfg_value_type type, uint16_t mask, char *valid_val, uint8_t config_mask) {
 
-  char valid_values[256];
-  char adv[256];
-  int adv_size=0;
-
-  // We shouldn't get CFG_HIDE here. Since we can't exit with 0, simply add a space
+  // We shouldn't get CFG_HIDE here.
   if (isMASKSET(config_mask, CFG_HIDE)) {
-    return snprintf(buffer, size, " ");
-  }
-
-  if (valid_val != NULL) {
-    sprintf(valid_values,",\"valid values\":%s",valid_val);
+    return;
   }
 
-  adv_size = sprintf(adv,",\"advanced\": \"%s\"", isMASKSET(config_mask, CFG_GRP_ADVANCED)?"yes":"no");
-  
-  if (isMASKSET(config_mask, CFG_READONLY))
-    adv_size += sprintf(adv+adv_size,",\"readonly\": \"yes\"");
-
-  if (isMASKSET(config_mask, CFG_FORCE_RESTART)) {
-    adv_size += sprintf(adv+adv_size,",\"force_restart\": \"yes\"");
-    if ( strcmp(name, CFG_N_panel_type) == 0 ) {
-      adv_size += sprintf(adv+adv_size,",\"force_restart_msg\": \"If you panel_type, you must save and reload config for correct config options to show, and must also restart AqualinkD once finished!\"");
-    }
-
-  }
-
-  if (isMASKSET(config_mask, CFG_ALLOW_BLANK))
-    adv_size += sprintf(adv+adv_size,",\"allow_blank\": \"yes\"");
-
-   if (isMASKSET(config_mask, CFG_GREYED_OUT))
-    adv_size += sprintf(adv+adv_size,",\"greyed_out\": \"yes\"");
-  
+  jw_object_start(w, name);
 
   switch(type){
     case CFG_INT:
-      if (*(int *)value == AQ_UNKNOWN) { 
-        result = snprintf(buffer, size, ",\"%s\" : {\"value\":\"\", \"type\":\"int\" %s %s}", name, (valid_val==NULL?"":valid_values),adv );
-      } else {
-        result = snprintf(buffer, size, ",\"%s\" : {\"value\":\"%d\", \"type\":\"int\" %s %s}", name, *(int *)value, (valid_val==NULL?"":valid_values),adv );
-      }
+      if (*(int *)value == AQ_UNKNOWN)
+        jw_string(w, "value", "");
+      else
+        jw_int_string(w, "value", *(int *)value);
+      jw_string(w, "type", "int");
     break;
     case CFG_STRING:
-      if (*(char **)value == NULL) {
-        result = snprintf(buffer, size, ",\"%s\" : {\"value\":\"\", \"type\":\"string\" %s %s}", name, (valid_val==NULL?"":valid_values),adv );
+      if (*(char **)value != NULL && isMASK_SET(config_mask, CFG_PASSWD_MASK)) {
+        jw_string(w, "value", PASSWD_MASK_TEXT);
+        jw_string(w, "type", "string");
+        jw_string(w, "passwd_mask", "yes");
+        valid_val = NULL;
       } else {
-        if (isMASK_SET(config_mask, CFG_PASSWD_MASK)) {
-          result = snprintf(buffer, size, ",\"%s\" : {\"value\":\"%s\", \"type\":\"string\", \"passwd_mask\":\"yes\" %s}", name, PASSWD_MASK_TEXT,adv);
-        } else {
-          result = snprintf(buffer, size, ",\"%s\" : {\"value\":\"%s\", \"type\":\"string\" %s %s}", name, *(char **)value, (valid_val==NULL?"":valid_values),adv );
-        }
+        jw_string(w, "value", (*(char **)value == NULL)?"":*(char **)value);
+        jw_string(w, "type", "string");
       }
     break;
     case CFG_BOOL:
-      //result = snprintf(buffer, size, ",\"%s\" : {\"value\":\"%s\", \"type\":\"bool\" %s}", name, bool2text(*(bool *)value), (valid_val==NULL?"":valid_values));
-      result = snprintf(buffer, size, ",\"%s\" : {\"value\":\"%s\", \"type\":\"bool\", \"valid values\": %s %s}", name, bool2text(*(bool *)value), CFG_V_BOOL, adv);
+      jw_string(w, "value", bool2text(*(bool *)value));
+      jw_string(w, "type", "bool");
+      valid_val = CFG_V_BOOL;
     break;
     case CFG_HEX:
-      result = snprintf(buffer, size, ",\"%s\" : {\"value\":\"0x%02hhx\", \"type\":\"hex\" %s %s}", name, *(unsigned char *)value, (valid_val==NULL?"":valid_values), adv );
+      jw_stringf(w, "value", "0x%02hhx", *(unsigned char *)value);
+      jw_string(w, "type", "hex");
     break;
     case CFG_FLOAT:
-      result = snprintf(buffer, size, ",\"%s\" : {\"value\":\"%f\", \"type\":\"float\" %s %s}", name, *(float *)value, (valid_val==NULL?"":valid_values), adv );
+      jw_float_string(w, "value", *(float *)value, 6);
+      jw_string(w, "type", "float");
     break;
     case CFG_BITMASK:
-      result = snprintf(buffer, size, ",\"%s\" : {\"value\":\"%s\", \"type\":\"bool\", \"valid values\": %s %s}", name, (*(uint16_t *)value & mask) == mask? bool2text(true):bool2text(false) ,CFG_V_BOOL, adv );
+      jw_string(w, "value", (*(uint16_t *)value & mask) == mask? bool2text(true):bool2text(false));
+      jw_string(w, "type", "bool");
+      valid_val = CFG_V_BOOL;
     break;
     case CFG_SPECIAL:
       if (strncasecmp(name, CFG_N_log_level, strlen(CFG_N_log_level)) == 0) {
-        //fprintf(fp, "%s=%s\n", _cfgParams[i].name, loglevel2cgn_name(_aqconfig_.log_level));
-        //result = json_cfg_element(buffer+length, size-length, CFG_N_log_level, &stringptr, CFG_STRING, "[\"DEBUG\", \"INFO\", \"NOTICE\", \"WARNING\", \"ERROR\"]"));
-        //stringptr = loglevel2cgn_name(_aqconfig_.log_level);
-        result = snprintf(buffer, size, ",\"%s\" : {\"value\":\"%s\", \"type\":\"string\" %s %s}",name,loglevel2cgn_name(*(int *)value), ",\"valid values\":[\"DEBUG\", \"INFO\", \"NOTICE\", \"WARNING\", \"ERROR\"]", adv);
+        jw_string(w, "value", loglevel2cgn_name(*(int *)value));
+        jw_string(w, "type", "string");
+        valid_val = "[\"DEBUG\", \"INFO\", \"NOTICE\", \"WARNING\", \"ERROR\"]";
       } else if (strncasecmp(name, CFG_N_panel_type, strlen(CFG_N_panel_type)) == 0) {
-        result = snprintf(buffer, size, ",\"%s\" : {\"value\":\"%s\", \"type\":\"string\" %s}",name,getShortPanelString(), adv);
+        jw_string(w, "value", getShortPanelString());
+        jw_string(w, "type", "string");
+        valid_val = NULL;
       } else {
-        result = snprintf(buffer, size, ",\"%s\" : {\"value\":\"Something went wrong\", \"type\":\"string\"}",name);
+        jw_string(w, "value", "Something went wrong");
+        jw_string(w, "type", "string");
+        jw_object_end(w);
+        return;
       }
     break;
   }
 
-  if (result <= 0 || result >= size) {
-    LOG(NET_LOG,LOG_ERR, "Buffer full, result truncated! size left=%d needed=%d @ element %s\n",size,result,name);     
-    return 0;
+  if (valid_val != NULL)
+    jw_raw(w, "valid values", valid_val);
+
+  jw_string(w, "advanced", isMASKSET(config_mask, CFG_GRP_ADVANCED)?"yes":"no");
+
+  if (isMASKSET(config_mask, CFG_READONLY))
+    jw_string(w, "readonly", "yes");
+
+  if (isMASKSET(config_mask, CFG_FORCE_RESTART)) {
+    jw_string(w, "force_restart", "yes");
+    if ( strcmp(name, CFG_N_panel_type) == 0 ) {
+      jw_string(w, "force_restart_msg", "If you panel_type, you must save and reload config for correct config options to show, and must also restart AqualinkD once finished!");
+    }
   }
 
-  return result;
+  if (isMASKSET(config_mask, CFG_ALLOW_BLANK))
+    jw_string(w, "allow_blank", "yes");
+
+  if (isMASKSET(config_mask, CFG_GREYED_OUT))
+    jw_string(w, "greyed_out", "yes");
+
+  jw_object_end(w);
 }
 
 
@@ -1292,39 +1588,21 @@ const char *pumpType2String(pump_type ptype) {
 }
 */
 
-int build_aqualink_config_JSON(char* buffer, int size, struct aqualinkdata *aqdata)
+void write_aqualink_config_JSON(json_writer *w, struct aqualinkdata *aqdata)
 {
-  memset(&buffer[0], 0, size);
-  int length = 0;
-  int result;
   int i;
   char buf[256];
   char buf1[256];
   const char *stringptr;
-  int delectCharAt = 0;
 
-  if ((result = snprintf(buffer+length, size-length, "{\"type\": \"config\"")) < 0 || result >= size-length) {
-    length += snprintf(buffer+length, size-length, "}");
-    return length;
-  } else {
-    length += result;
-  }
-/*
-  if ((result = snprintf(buffer+length, size-length, ",\"status\": \"!!!! NOT FULLY IMPLIMENTED YET !!!!\"")) < 0 || result >= size-length) {
-    length += snprintf(buffer+length, size-length, "}");
-    return length;
-  } else {
-    length += result;
-  }
-*/
-  if ((result = snprintf(buffer+length, size-length, ",\"max_pumps\": \"%d\",\"max_lights\": \"%d\",\"max_sensors\": \"%d\",\"max_light_programs\": \"%d\",\"max_vbuttons\": \"%d\"",
-                         MAX_PUMPS,MAX_LIGHTS,MAX_SENSORS,LIGHT_COLOR_OPTIONS-1, (TOTAL_BUTTONS - aqdata->virtual_button_start) )) < 0 || result >= size-length) {
-    length += snprintf(buffer+length, size-length, "}");
-    return length;
-  } else {
-    length += result;
-  }
+  jw_object_start(w, NULL);
+  jw_string(w, "type", "config");
 
+  jw_int_string(w, "max_pumps", MAX_PUMPS);
+  jw_int_string(w, "max_lights", MAX_LIGHTS);
+  jw_int_string(w, "max_sensors", MAX_SENSORS);
+  jw_int_string(w, "max_light_programs", LIGHT_COLOR_OPTIONS-1);
+  jw_int_string(w, "max_vbuttons", (TOTAL_BUTTONS - aqdata->virtual_button_start));
 
   //#ifdef CONFIG_DEV_TEST
   for (int i=0; i <= _numCfgParams; i++) {
@@ -1338,65 +1616,38 @@ int build_aqualink_config_JSON(char* buffer, int size, struct aqualinkdata *aqda
       continue;
     }
 
-    if ((result = json_cfg_element(buffer+length, size-length, _cfgParams[i].name, _cfgParams[i].value_ptr, _cfgParams[i].value_type, _cfgParams[i].mask, _cfgParams[i].valid_values, _cfgParams[i].config_mask)) <= 0) {
-      LOG(NET_LOG,LOG_ERR, "Config json buffer full in, result truncated! size=%d curently used=%d\n",size,length);
-      return length;
-    } else {
-      length += result;
-    }
+    json_cfg_element(w, _cfgParams[i].name, _cfgParams[i].value_ptr, _cfgParams[i].value_type, _cfgParams[i].mask, _cfgParams[i].valid_values, _cfgParams[i].config_mask);
   }
 
   for (i = 1; i <= aqdata->num_sensors; i++)
   {
-    length += sprintf(buffer+length, ",\"sensor_%.2d\":{ \"advanced\":\"yes\",",i );
-    // The next json_cfg_element() call will add a , at the beginning, so save the next char index so we can delete it later.
-    delectCharAt = length;
+    sprintf(buf,"sensor_%.2d", i);
+    jw_object_start(w, buf);
+    jw_string(w, "advanced", "yes");
 
-    //fprintf(fp,"\nsensor_%.2d_path=%s\n",i+1,aqdata->sensors->path);
-    //fprintf(fp,"sensor_%.2d_label=%s\n",i+1,aqdata->sensors->label);
-    //fprintf(fp,"sensor_%.2d_factor=%f\n",i+1,aqdata->sensors->factor);
     sprintf(buf,"sensor_%.2d_path", i);
-    if ((result = json_cfg_element(buffer+length, size-length, buf, &aqdata->sensors[i-1].path, CFG_STRING, 0, NULL, CFG_GRP_ADVANCED)) <= 0)
-      return length;
-    else
-      length += result;
-  
+    json_cfg_element(w, buf, &aqdata->sensors[i-1].path, CFG_STRING, 0, NULL, CFG_GRP_ADVANCED);
     sprintf(buf,"sensor_%.2d_label", i);
-    if ((result = json_cfg_element(buffer+length, size-length, buf, &aqdata->sensors[i-1].label, CFG_STRING, 0, NULL, CFG_GRP_ADVANCED)) <= 0)
-      return length;
-    else
-      length += result;
-
+    json_cfg_element(w, buf, &aqdata->sensors[i-1].label, CFG_STRING, 0, NULL, CFG_GRP_ADVANCED);
     sprintf(buf,"sensor_%.2d_factor", i);
-    if ((result = json_cfg_element(buffer+length, size-length, buf, &aqdata->sensors[i-1].factor, CFG_FLOAT, 0, NULL, CFG_GRP_ADVANCED)) <= 0)
-      return length;
-    else
-      length += result;
-
+    json_cfg_element(w, buf, &aqdata->sensors[i-1].factor, CFG_FLOAT, 0, NULL, CFG_GRP_ADVANCED);
     sprintf(buf,"sensor_%.2d_uom", i);
-    if ((result = json_cfg_element(buffer+length, size-length, buf, &aqdata->sensors[i-1].uom, CFG_STRING, 0, NULL, CFG_GRP_ADVANCED)) <= 0)
-      return length;
-    else
-      length += result;
-      //(&aqdata->sensors[i-1].uom==NULL ? "" : &aqdata->sensors[i-1].uom)
+    json_cfg_element(w, buf, &aqdata->sensors[i-1].uom, CFG_STRING, 0, NULL, CFG_GRP_ADVANCED);
+    sprintf(buf,"sensor_%.2d_poll_time", i);
+    json_cfg_element(w, buf, &aqdata->sensors[i-1].poll_time, CFG_INT, 0, NULL, CFG_GRP_ADVANCED);
+    sprintf(buf,"sensor_%.2d_hysteresis", i);
+    json_cfg_element(w, buf, &aqdata->sensors[i-1].hysteresis, CFG_FLOAT, 0, NULL, CFG_GRP_ADVANCED);
 
     /*
     // Need to escape / with /// for this to work, and fix the disply that will show // for ////
     // Don;t forget config.c, Line 2096, search comment // NSF When fixed the JSON & config editor, put these lines back.
     if (&aqdata->sensors[i-1].regex != NULL) {
       sprintf(buf,"sensor_%.2d_regex", i);
-      if ((result = json_cfg_element(buffer+length, size-length, buf, &aqdata->sensors[i-1].regex, CFG_STRING, 0, NULL, CFG_GRP_ADVANCED)) <= 0)
-        return length;
-      else
-        length += result;
+      json_cfg_element(w, buf, &aqdata->sensors[i-1].regex, CFG_STRING, 0, NULL, CFG_GRP_ADVANCED);
     }
     */
 
-    length += sprintf(buffer+length, "}" );
-    if (delectCharAt != 0) {
-      buffer[delectCharAt] = ' ';
-      delectCharAt = 0;
-    }
+    jw_object_end(w);
   }
 
   //  add custom light modes/colors
@@ -1405,15 +1656,9 @@ int build_aqualink_config_JSON(char* buffer, int size, struct aqualinkdata *aqda
   const char *bufptr = buf1;
   for (i=1; i < LIGHT_COLOR_OPTIONS; i++) {
     if ((lname = get_aqualinkd_light_mode_name(i, &isShow)) != NULL) {
-      //fprintf(fp,"light_program_%.2d=%s%s\n",i,lname,isShow?" - show":"");
       sprintf(buf,"light_program_%.2d", i);
       sprintf(buf1,"%s%s",lname,isShow?" - show":"");
-      //printf("%s %s\n",buf,buf1);
-      if ((result = json_cfg_element(buffer+length, size-length, buf, &bufptr, CFG_STRING, 0, NULL, CFG_GRP_ADVANCED)) <= 0)
-        return length;
-      else
-        length += result;
-      
+      json_cfg_element(w, buf, &bufptr, CFG_STRING, 0, NULL, CFG_GRP_ADVANCED);
     } else {
       break;
     }
@@ -1430,135 +1675,82 @@ int build_aqualink_config_JSON(char* buffer, int size, struct aqualinkdata *aqda
       sprintf(prefix,"button_%.2d",i+1);
     }
 
-    //length += sprintf(buffer+length, ",\"%s\":{",prefix );
-    length += sprintf(buffer+length, ",\"%s\":{ \"default\":\"%s\", ",prefix, aqdata->aqbuttons[i].name );
-    // The next json_cfg_element() call will add a , at the beginning, so save the next char index so we can delete it later.
-    delectCharAt = length;
+    jw_object_start(w, prefix);
+    jw_string(w, "default", aqdata->aqbuttons[i].name);
     
     sprintf(buf,"%s_label", prefix);
-    if ((result = json_cfg_element(buffer+length, size-length, buf, &aqdata->aqbuttons[i].label, CFG_STRING, 0, NULL, 0)) <= 0) {
-      LOG(NET_LOG,LOG_ERR, "Config json buffer full in, result truncated! size=%d curently used=%d\n",size,length);
-      return length;
-    } else
-      length += result;
+    json_cfg_element(w, buf, &aqdata->aqbuttons[i].label, CFG_STRING, 0, NULL, 0);
 
     if (isVS_PUMP(aqdata->aqbuttons[i].special_mask)) 
     {
-      if (((pump_detail *)aqdata->aqbuttons[i].special_mask_ptr)->pumpIndex > 0) {
+      pump_detail *pump = (pump_detail *)aqdata->aqbuttons[i].special_mask_ptr;
+
+      if (pump->pumpIndex > 0) {
         sprintf(buf,"%s_pumpIndex", prefix);
-        if ((result = json_cfg_element(buffer+length, size-length, buf, &((pump_detail *)aqdata->aqbuttons[i].special_mask_ptr)->pumpIndex, CFG_INT, 0, NULL, 0)) <= 0) {
-          LOG(NET_LOG,LOG_ERR, "Config json buffer full in, result truncated! size=%d curently used=%d\n",size,length);
-          return length;
-        } else
-          length += result;
+        json_cfg_element(w, buf, &pump->pumpIndex, CFG_INT, 0, NULL, 0);
       }
       
-      if (((pump_detail *)aqdata->aqbuttons[i].special_mask_ptr)->pumpID != NUL) {
+      if (pump->pumpID != NUL) {
         sprintf(buf,"%s_pumpID", prefix);
-        if ((result = json_cfg_element(buffer+length, size-length, buf, &((pump_detail *)aqdata->aqbuttons[i].special_mask_ptr)->pumpID, CFG_HEX, 0, NULL, 0)) <= 0) {
-          LOG(NET_LOG,LOG_ERR, "Config json buffer full in, result truncated! size=%d curently used=%d\n",size,length);
-          return length;
-        } else
-          length += result;
+        json_cfg_element(w, buf, &pump->pumpID, CFG_HEX, 0, NULL, 0);
       }
 
-      if (((pump_detail *)aqdata->aqbuttons[i].special_mask_ptr)->pumpName[0] != '\0') {
+      if (pump->pumpName[0] != '\0') {
         sprintf(buf,"%s_pumpName", prefix);
-        stringptr = ((pump_detail *)aqdata->aqbuttons[i].special_mask_ptr)->pumpName;
-        if ((result = json_cfg_element(buffer+length, size-length, buf, &stringptr, CFG_STRING, 0, NULL, 0)) <= 0) {
-          LOG(NET_LOG,LOG_ERR, "Config json buffer full in, result truncated! size=%d curently used=%d\n",size,length);
-          return length;
-        } else
-          length += result;
+        stringptr = pump->pumpName;
+        json_cfg_element(w, buf, &stringptr, CFG_STRING, 0, NULL, 0);
       }
 
-      if (((pump_detail *)aqdata->aqbuttons[i].special_mask_ptr)->pumpType != PT_UNKNOWN) {
+      if (pump->pumpType != PT_UNKNOWN) {
         sprintf(buf,"%s_pumpType", prefix);
-        stringptr = pumpType2String(((pump_detail *)aqdata->aqbuttons[i].special_mask_ptr)->pumpType);
-        if ((result = json_cfg_element(buffer+length, size-length, buf, &stringptr, CFG_STRING, 0, "[\"\", \"JANDY ePUMP\",\"Pentair VS\",\"Pentair VF\"]", 0) ) <= 0) {
-          LOG(NET_LOG,LOG_ERR, "Config json buffer full in, result truncated! size=%d curently used=%d\n",size,length);
-          return length;
-        } else
-          length += result;
+        stringptr = pumpType2String(pump->pumpType);
+        json_cfg_element(w, buf, &stringptr, CFG_STRING, 0, "[\"\", \"JANDY ePUMP\",\"Pentair VS\",\"Pentair VF\"]", 0);
       }
 
-      if (((pump_detail *)aqdata->aqbuttons[i].special_mask_ptr)->minSpeed != PT_UNKNOWN &&
-          ((pump_detail *)aqdata->aqbuttons[i].special_mask_ptr)->minSpeed != getPumpDefaultSpeed((pump_detail *)aqdata->aqbuttons[i].special_mask_ptr, false) ) 
-      {
+      if (pump->minSpeed != PT_UNKNOWN && pump->minSpeed != getPumpDefaultSpeed(pump, false) ) {
         sprintf(buf,"%s_pumpMinSpeed", prefix);
-        stringptr = pumpType2String(((pump_detail *)aqdata->aqbuttons[i].special_mask_ptr)->pumpType);
-        if ((result = json_cfg_element(buffer+length, size-length, buf, &((pump_detail *)aqdata->aqbuttons[i].special_mask_ptr)->minSpeed, CFG_INT, 0, NULL, 0) ) <= 0) {
-          LOG(NET_LOG,LOG_ERR, "Config json buffer full in, result truncated! size=%d curently used=%d\n",size,length);
-          return length;
-        } else
-          length += result;
+        json_cfg_element(w, buf, &pump->minSpeed, CFG_INT, 0, NULL, 0);
       }
 
-      if (((pump_detail *)aqdata->aqbuttons[i].special_mask_ptr)->maxSpeed != PT_UNKNOWN &&
-          ((pump_detail *)aqdata->aqbuttons[i].special_mask_ptr)->maxSpeed != getPumpDefaultSpeed((pump_detail *)aqdata->aqbuttons[i].special_mask_ptr, true) ) 
-      {
+      if (pump->maxSpeed != PT_UNKNOWN && pump->maxSpeed != getPumpDefaultSpeed(pump, true) ) {
         sprintf(buf,"%s_pumpMaxSpeed", prefix);
-        stringptr = pumpType2String(((pump_detail *)aqdata->aqbuttons[i].special_mask_ptr)->pumpType);
-        if ((result = json_cfg_element(buffer+length, size-length, buf, &((pump_detail *)aqdata->aqbuttons[i].special_mask_ptr)->maxSpeed, CFG_INT, 0, NULL, 0) ) <= 0) {
-          LOG(NET_LOG,LOG_ERR, "Config json buffer full in, result truncated! size=%d curently used=%d\n",size,length);
-          return length;
-        } else
-          length += result;
+        json_cfg_element(w, buf, &pump->maxSpeed, CFG_INT, 0, NULL, 0);
       }
 
-
-
     } else if (isPLIGHT(aqdata->aqbuttons[i].special_mask)) {
       if (((clight_detail *)aqdata->aqbuttons[i].special_mask_ptr)->lightType >= 0) {
         sprintf(buf,"%s_lightMode", prefix);
-        if ((result = json_cfg_element(buffer+length, size-length, buf, &((clight_detail *)aqdata->aqbuttons[i].special_mask_ptr)->lightType, CFG_INT, 0, NULL, 0)) <= 0) {
-          LOG(NET_LOG,LOG_ERR, "Config json buffer full in, result truncated! size=%d curently used=%d\n",size,length);
-          return length;
-        } else
-          length += result;
+        json_cfg_element(w, buf, &((clight_detail *)aqdata->aqbuttons[i].special_mask_ptr)->lightType, CFG_INT, 0, NULL, 0);
       }
     } else if ( (isVBUTTON(aqdata->aqbuttons[i].special_mask) && aqdata->aqbuttons[i].rssd_code >= IAQ_ONETOUCH_1 && aqdata->aqbuttons[i].rssd_code <= IAQ_ONETOUCH_6 ) ) {
         sprintf(buf,"%s_onetouchID", prefix);
         int oID = (aqdata->aqbuttons[i].rssd_code - 15);
-        if ((result = json_cfg_element(buffer+length, size-length, buf, &oID, CFG_INT, 0, "[\"\", \"1\",\"2\",\"3\",\"4\",\"5\",\"6\"]", 0)) <= 0) {
-          LOG(NET_LOG,LOG_ERR, "Config json buffer full in, result truncated! size=%d curently used=%d\n",size,length);
-          return length;
-        } else
-          length += result;
+        json_cfg_element(w, buf, &oID, CFG_INT, 0, "[\"\", \"1\",\"2\",\"3\",\"4\",\"5\",\"6\"]", 0);
     } else if ( isVBUTTON_ALTLABEL(aqdata->aqbuttons[i].special_mask)) {
       sprintf(buf,"%s_altlabel", prefix);
-      if ((result = json_cfg_element(buffer+length, size-length, buf, &((altlabel_detail *)aqdata->aqbuttons[i].special_mask_ptr)->altlabel, CFG_STRING, 0, NULL, 0)) <= 0) {
-        LOG(NET_LOG,LOG_ERR, "Config json buffer full in, result truncated! size=%d curently used=%d\n",size,length);
-        return length;
-      } else
-        length += result;
+      json_cfg_element(w, buf, &((altlabel_detail *)aqdata->aqbuttons[i].special_mask_ptr)->altlabel, CFG_STRING, 0, NULL, 0);
     }
 
-    length += sprintf(buffer+length, "}" );
-    if (delectCharAt != 0) {
-      buffer[delectCharAt] = ' ';
-      delectCharAt = 0;
-    }
-    
+    jw_object_end(w);
   }
 
   // Need to add one last element, can be crap. Makes the HTML/JS easier in the loop
-  if ((result = snprintf(buffer+length, size-length, ",\"version\": \"1.0\"")) < 0 || result >= size-length) {
-    length += snprintf(buffer+length, size-length, "}");
-    return length;
-  } else {
-    length += result;
-  }
+  jw_string(w, "version", "1.0");
 
+  jw_object_end(w);
+}
 
-  if ((result = snprintf(buffer+length, size-length, "}")) < 0) {
-    return 0;
-  } else {
-    length += result;
-  }
+int build_aqualink_config_JSON(char* buffer, int size, struct aqualinkdata *aqdata)
+{
+  json_writer w;
 
+  jw_init(&w, buffer, size);
+  write_aqualink_config_JSON(&w, aqdata);
 
-  return length;
+  if (w.overflow)
+    LOG(NET_LOG,LOG_ERR, "Config json buffer full, result truncated! size=%d\n",size);
+
+  return jw_finish(&w);
 }
 
 
@@ -1,6 +1,10 @@
 #ifndef JSON_MESSAGES_H_
 #define JSON_MESSAGES_H_
 
+#include <stdint.h>
+
+#include "json_writer.h"
+
 //FUNCTION PROTOTYPES
 
 //#define JSON_LABEL_SIZE 300
@@ -62,6 +66,16 @@ int build_aqualink_aqmanager_JSON(struct aqualinkdata *aqdata, char* buffer, int
 int build_device_JSON(struct aqualinkdata *aqdata, char* buffer, int size, bool homekit);
 int build_aqualink_simulator_packet_JSON(struct aqualinkdata *aqdata, char* buffer, int size);
 int build_aqualink_config_JSON(char* buffer, int size, struct aqualinkdata *aq_data);
+int build_ack_latency_JSON(char* buffer, int size);
+// Same as the build_ functions but stream into a writer, ie straight into a connection's send buffer
+void write_aqualink_status_JSON(json_writer *w, struct aqualinkdata *aqdata);
+void write_device_JSON(json_writer *w, struct aqualinkdata *aqdata, bool homekit);
+void write_aqualink_config_JSON(json_writer *w, struct aqualinkdata *aqdata);
+void write_aq_programmer_JSON(json_writer *w);
+void write_web_cache_JSON(json_writer *w);
+void get_device_fragment_stats(unsigned long *hits, unsigned long *misses);
+
+int build_aqualink_status_delta_JSON(const char *base_json, uint32_t base, const char *json, uint32_t version, char* buffer, int size);
 
 char *LED2text(aqledstate state);
 
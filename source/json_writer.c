@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2017 Shaun Feakes - All rights reserved
+ *
+ * You may use redistribute and/or modify this code under the terms of
+ * the GNU General Public License version 2 as published by the
+ * Free Software Foundation. For the terms of this license,
+ * see <http://www.gnu.org/licenses/>.
+ *
+ * You are free to use this software under the terms of the GNU General
+ * Public License, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ *  https://github.com/sfeakes/aqualinkd
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "json_writer.h"
+
+void jw_init(json_writer *w, char *buffer, int size)
+{
+  memset(w, 0, sizeof(json_writer));
+  w->buffer = buffer;
+  w->size = size;
+  if (size > 0)
+    buffer[0] = '\0';
+}
+
+void jw_init_iobuf(json_writer *w, struct mg_iobuf *io)
+{
+  memset(w, 0, sizeof(json_writer));
+  w->io = io;
+}
+
+// Returns length written, check w->overflow to see if it's all there.
+int jw_finish(json_writer *w)
+{
+  if (w->io == NULL && w->size > 0)
+    w->buffer[w->length] = '\0';
+
+  return w->length;
+}
+
+static void jw_write(json_writer *w, const char *data, size_t len)
+{
+  if (w->overflow || len == 0)
+    return;
+
+  if (w->io != NULL) {
+    if (mg_iobuf_add(w->io, w->io->len, data, len) != len) {
+      w->overflow = true;
+      return;
+    }
+  } else {
+    // Always leave room for the terminating NUL
+    if (w->length + len >= w->size) {
+      w->overflow = true;
+      return;
+    }
+    memcpy(w->buffer + w->length, data, len);
+  }
+  w->length += len;
+}
+
+static void jw_escaped(json_writer *w, const char *str)
+{
+  const char *start;
+  char esc[7];
+
+  jw_write(w, "\"", 1);
+
+  if (str != NULL) {
+    // Write runs of plain characters in one go, only break for ones that need escaping.
+    for (start = str; *str != '\0'; str++) {
+      unsigned char ch = (unsigned char)*str;
+      if (ch >= 0x20 && ch != '"' && ch != '\\')
+        continue;
+
+      jw_write(w, start, str - start);
+      switch (ch) {
+        case '"':
+          jw_write(w, "\\\"", 2);
+        break;
+        case '\\':
+          jw_write(w, "\\\\", 2);
+        break;
+        case '\n':
+          jw_write(w, "\\n", 2);
+        break;
+        case '\r':
+          jw_write(w, "\\r", 2);
+        break;
+        case '\t':
+          jw_write(w, "\\t", 2);
+        break;
+        default:
+          jw_write(w, esc, snprintf(esc, sizeof(esc), "\\u%04x", ch));
+        break;
+      }
+      start = str + 1;
+    }
+    jw_write(w, start, str - start);
+  }
+
+  jw_write(w, "\"", 1);
+}
+
+static void jw_member(json_writer *w, const char *key)
+{
+  if (w->need_comma[w->depth])
+    jw_write(w, ",", 1);
+  w->need_comma[w->depth] = true;
+
+  if (key != NULL) {
+    jw_escaped(w, key);
+    jw_write(w, ":", 1);
+  }
+}
+
+static void jw_open(json_writer *w, const char *key, const char *bracket)
+{
+  jw_member(w, key);
+  jw_write(w, bracket, 1);
+
+  if (w->depth+1 >= JW_MAX_DEPTH) {
+    w->overflow = true;
+    return;
+  }
+  w->need_comma[++w->depth] = false;
+}
+
+static void jw_close(json_writer *w, const char *bracket)
+{
+  if (w->depth > 0)
+    w->depth--;
+  jw_write(w, bracket, 1);
+}
+
+void jw_object_start(json_writer *w, const char *key) { jw_open(w, key, "{"); }
+void jw_object_end(json_writer *w)                    { jw_close(w, "}"); }
+void jw_array_start(json_writer *w, const char *key)  { jw_open(w, key, "["); }
+void jw_array_end(json_writer *w)                     { jw_close(w, "]"); }
+
+void jw_string(json_writer *w, const char *key, const char *value)
+{
+  jw_member(w, key);
+  jw_escaped(w, value);
+}
+
+void jw_stringf(json_writer *w, const char *key, const char *format, ...)
+{
+  char buf[256];
+  va_list args;
+
+  va_start(args, format);
+  vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+
+  jw_string(w, key, buf);
+}
+
+// Integers are the bulk of what we write, so don't go through printf for them.
+static int jw_itoa(char *buf, long value)
+{
+  char tmp[24];
+  int i = 0;
+  int len = 0;
+  unsigned long v = (value < 0) ? -(unsigned long)value : (unsigned long)value;
+
+  do {
+    tmp[i++] = '0' + (v % 10);
+    v /= 10;
+  } while (v != 0);
+
+  if (value < 0)
+    buf[len++] = '-';
+  while (i > 0)
+    buf[len++] = tmp[--i];
+
+  return len;
+}
+
+void jw_int(json_writer *w, const char *key, long value)
+{
+  char buf[24];
+
+  jw_member(w, key);
+  jw_write(w, buf, jw_itoa(buf, value));
+}
+
+// Number as a string "85", which is what the web UI & homebridge expect for most values
+void jw_int_string(json_writer *w, const char *key, long value)
+{
+  char buf[26];
+  int len;
+
+  buf[0] = '"';
+  len = jw_itoa(buf+1, value) + 1;
+  buf[len++] = '"';
+
+  jw_member(w, key);
+  jw_write(w, buf, len);
+}
+
+void jw_float_string(json_writer *w, const char *key, double value, int precision)
+{
+  char buf[64];
+
+  if (precision == 0 && value == (double)(long)value) {
+    jw_int_string(w, key, (long)value);
+    return;
+  }
+
+  jw_member(w, key);
+  jw_write(w, buf, snprintf(buf, sizeof(buf), "\"%.*f\"", precision, value));
+}
+
+// Value that's already JSON, ie a list of valid values.
+void jw_raw(json_writer *w, const char *key, const char *json)
+{
+  jw_raw_len(w, key, json, strlen(json));
+}
+
+// As above for JSON that isn't NUL terminated, ie a member picked out of a larger object.
+void jw_raw_len(json_writer *w, const char *key, const char *json, int len)
+{
+  jw_member(w, key);
+  jw_write(w, json, len);
+}
@@ -0,0 +1,45 @@
+#ifndef JSON_WRITER_H_
+#define JSON_WRITER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "mongoose.h"
+
+#define JW_MAX_DEPTH 16
+
+/*
+  Streaming JSON emitter.
+  Writes either into a fixed size buffer (bounded, sets overflow rather than running off the end)
+  or appends to a mongoose iobuf (ie a connection's send buffer) growing it as needed.
+  Commas between members are handled for you, keys & string values are escaped.
+*/
+typedef struct json_writer {
+  struct mg_iobuf *io;
+  char *buffer;
+  size_t size;
+  size_t length;      // Bytes we have written
+  bool overflow;
+  int depth;
+  bool need_comma[JW_MAX_DEPTH];
+} json_writer;
+
+void jw_init(json_writer *w, char *buffer, int size);
+void jw_init_iobuf(json_writer *w, struct mg_iobuf *io);
+int  jw_finish(json_writer *w);
+
+void jw_object_start(json_writer *w, const char *key);
+void jw_object_end(json_writer *w);
+void jw_array_start(json_writer *w, const char *key);
+void jw_array_end(json_writer *w);
+
+// key is NULL for array elements / top level
+void jw_string(json_writer *w, const char *key, const char *value);
+void jw_stringf(json_writer *w, const char *key, const char *format, ...) __attribute__ ((format (printf, 3, 4)));
+void jw_int(json_writer *w, const char *key, long value);
+void jw_int_string(json_writer *w, const char *key, long value);
+void jw_float_string(json_writer *w, const char *key, double value, int precision);
+void jw_raw(json_writer *w, const char *key, const char *json);
+void jw_raw_len(json_writer *w, const char *key, const char *json, int len);
+
+#endif // JSON_WRITER_H_
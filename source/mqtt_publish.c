@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2017 Shaun Feakes - All rights reserved
+ *
+ * You may use redistribute and/or modify this code under the terms of
+ * the GNU General Public License version 2 as published by the
+ * Free Software Foundation. For the terms of this license,
+ * see <http://www.gnu.org/licenses/>.
+ *
+ * You are free to use this software under the terms of the GNU General
+ * Public License, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ *  https://github.com/sfeakes/aqualinkd
+ */
+
+/*
+  MQTT status topic table & publish queue.
+  Only ever used from the net thread, so no locking.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mongoose.h"
+
+#include "aqualink.h"
+#include "aq_mqtt.h"
+#include "config.h"
+#include "mqtt_publish.h"
+
+// Same as mqtt_discovery.c, not exposed from net_services.h.
+void send_mqtt(struct mg_connection *nc, const char *toppic, const char *message);
+
+#define MQTT_NUM_LEN 16                 // Numbers & on/off states
+#define MQTT_MSG_LEN (AQ_MSGLONGLEN+1)  // Display messages
+
+typedef struct mqtt_topic {
+  char *topic;          // Full topic, _aqconfig_.mqtt_aq_topic/...
+  char *value;          // Last value queued
+  int value_size;
+  bool valid;           // value has been set since we last connected
+  bool queued;
+  const void *owner;    // Name the topic was built from, so we know to rebuild if config changes it.
+} mqtt_topic;
+
+static mqtt_topic _mqtt_topics[MQT_TOTAL];
+static int _mqtt_queue[MQT_TOTAL];
+static int _mqtt_queued = 0;
+static int _mqtt_refresh_next = MQT_TOTAL;
+
+static const struct {
+  mqtt_fixed_topic id;
+  const char *name;
+  int value_size;
+} _mqtt_fixed_topics[] = {
+  {MQT_SERVICE_MODE,       SERVICE_MODE_TOPIC,             MQTT_NUM_LEN},
+  {MQT_DISPLAY_MSG,        DISPLAY_MSG_TOPIC,              MQTT_MSG_LEN},
+  {MQT_AIR_TEMP,           AIR_TEMP_TOPIC,                 MQTT_NUM_LEN},
+  {MQT_POOL_TEMP,          POOL_TEMP_TOPIC,                MQTT_NUM_LEN},
+  {MQT_SPA_TEMP,           SPA_TEMP_TOPIC,                 MQTT_NUM_LEN},
+  {MQT_POOL_HTR_SETPOINT,  BTN_POOL_HTR "/setpoint",       MQTT_NUM_LEN},
+  {MQT_SPA_HTR_SETPOINT,   BTN_SPA_HTR "/setpoint",        MQTT_NUM_LEN},
+  {MQT_FREEZE_SETPOINT,    FREEZE_PROTECT "/setpoint",     MQTT_NUM_LEN},
+  {MQT_FREEZE,             FREEZE_PROTECT,                 MQTT_NUM_LEN},
+  {MQT_FREEZE_ENABLED,     FREEZE_PROTECT_ENABELED,        MQTT_NUM_LEN},
+  {MQT_CHILLER_SETPOINT,   CHILLER "/setpoint",            MQTT_NUM_LEN},
+  {MQT_CHILLER,            CHILLER,                        MQTT_NUM_LEN},
+  {MQT_CHILLER_ENABLED,    CHILLER_ENABELED,               MQTT_NUM_LEN},
+  {MQT_BATTERY,            BATTERY_STATE,                  MQTT_NUM_LEN},
+  {MQT_PH,                 CHEM_PH_TOPIC,                  MQTT_NUM_LEN},
+  {MQT_PH_F,               CHRM_PH_F_TOPIC,                MQTT_NUM_LEN},
+  {MQT_ORP,                CHEM_ORP_TOPIC,                 MQTT_NUM_LEN},
+  {MQT_ORP_F,              CHRM_ORP_F_TOPIC,               MQTT_NUM_LEN},
+  {MQT_SWG,                SWG_TOPIC,                      MQTT_NUM_LEN},
+  {MQT_SWG_ENABLED,        SWG_ENABELED_TOPIC,             MQTT_NUM_LEN},
+  {MQT_SWG_PERCENT,        SWG_PERCENT_TOPIC,              MQTT_NUM_LEN},
+  {MQT_SWG_PERCENT_F,      SWG_PERCENT_F_TOPIC,            MQTT_NUM_LEN},
+  {MQT_SWG_SETPOINT,       SWG_SETPOINT_TOPIC,             MQTT_NUM_LEN},
+  {MQT_SWG_PPM,            SWG_PPM_TOPIC,                  MQTT_NUM_LEN},
+  {MQT_SWG_PPM_F,          SWG_PPM_F_TOPIC,                MQTT_NUM_LEN},
+  {MQT_SWG_BOOST,          SWG_BOOST_TOPIC,                MQTT_NUM_LEN},
+  {MQT_SWG_BOOST_DURATION, SWG_BOOST_DURATION_TOPIC,       MQTT_NUM_LEN},
+  {MQT_SWG_EXTENDED,       SWG_EXTENDED_TOPIC,             MQTT_NUM_LEN},
+  {MQT_SWG_STATUS_MSG,     SWG_STATUS_MSG_TOPIC,           MQTT_MSG_LEN},
+  {MQT_LXI_ERROR_CODE,     LXI_ERROR_CODE,                 MQTT_NUM_LEN},
+  {MQT_LXI_ERROR_MESSAGE,  LXI_ERROR_MESSAGE,              MQTT_MSG_LEN},
+};
+
+static const char *_mqtt_button_subtopics[MQT_BTN_TOPICS] = {"", "/delay", ENABELED_SUBT, "/timer", "/timer/duration"};
+static const char *_mqtt_pump_subtopics[MQT_PUMP_TOPICS] = {PUMP_RPM_TOPIC, PUMP_GPM_TOPIC, PUMP_WATTS_TOPIC, PUMP_MODE_TOPIC,
+                                                            PUMP_PPC_TOPIC, PUMP_STATUS_TOPIC, PUMP_SPEED_TOPIC};
+static const char *_mqtt_light_subtopics[MQT_LIGHT_TOPICS] = {LIGHT_PROGRAM_TOPIC, LIGHT_PROGRAM_TOPIC "/name", LIGHT_DIMMER_VALUE_TOPIC};
+
+static void set_topic(int id, const void *owner, const char *prefix, const char *name, const char *suffix, int value_size)
+{
+  mqtt_topic *t = &_mqtt_topics[id];
+  int len = snprintf(NULL, 0, "%s/%s%s%s", _aqconfig_.mqtt_aq_topic, prefix, name, suffix);
+
+  free(t->topic);
+  // One block, topic then value.
+  t->topic = malloc(len + 1 + value_size);
+  if (t->topic == NULL) {
+    LOG(NET_LOG,LOG_ERR, "MQTT: Failed to allocate topic %s%s%s\n", prefix, name, suffix);
+    t->value = NULL;
+    t->valid = false;
+    return;
+  }
+  sprintf(t->topic, "%s/%s%s%s", _aqconfig_.mqtt_aq_topic, prefix, name, suffix);
+  t->value = t->topic + len + 1;
+  t->value[0] = '\0';
+  t->value_size = value_size;
+  t->valid = false;
+  t->owner = owner;
+}
+
+static void set_topic_group(int first, int count, const void *owner, const char *prefix, const char *name, const char **suffix)
+{
+  int i;
+
+  if (_mqtt_topics[first].topic != NULL && _mqtt_topics[first].owner == owner)
+    return;
+
+  for (i=0; i < count; i++) {
+    // Light program name is a string, everything else per device is a number.
+    set_topic(first + i, owner, prefix, name, suffix[i], (suffix == _mqtt_light_subtopics && i == MQT_LIGHT_PROGRAM_NAME)?MQTT_MSG_LEN:MQTT_NUM_LEN);
+  }
+
+  LOG(NET_LOG,LOG_DEBUG, "MQTT: Built topics for %s%s\n", prefix, name);
+}
+
+// Called when MQTT starts, device topics are added by mqtt_check_topics() as we see them.
+void mqtt_init_topics()
+{
+  int i;
+
+  for (i=0; i < (int)(sizeof(_mqtt_fixed_topics) / sizeof(_mqtt_fixed_topics[0])); i++) {
+    set_topic(_mqtt_fixed_topics[i].id, NULL, "", _mqtt_fixed_topics[i].name, "", _mqtt_fixed_topics[i].value_size);
+  }
+
+  _mqtt_queued = 0;
+  for (i=0; i < MQT_TOTAL; i++)
+    _mqtt_topics[i].queued = false;
+}
+
+// Make sure every device has topics, and they are for the name it has now.  Just pointer compares if nothing moved.
+void mqtt_check_topics(struct aqualinkdata *aqdata)
+{
+  int i;
+
+  for (i=0; i < aqdata->total_buttons; i++)
+    set_topic_group(MQT_BUTTON(i, 0), MQT_BTN_TOPICS, aqdata->aqbuttons[i].name, "", aqdata->aqbuttons[i].name, _mqtt_button_subtopics);
+
+  for (i=0; i < aqdata->num_pumps; i++) {
+    if (aqdata->pumps[i].button != NULL)
+      set_topic_group(MQT_PUMP(i, 0), MQT_PUMP_TOPICS, aqdata->pumps[i].button->name, "", aqdata->pumps[i].button->name, _mqtt_pump_subtopics);
+  }
+
+  for (i=0; i < aqdata->num_lights; i++) {
+    if (aqdata->lights[i].button != NULL)
+      set_topic_group(MQT_LIGHT(i, 0), MQT_LIGHT_TOPICS, aqdata->lights[i].button->name, "", aqdata->lights[i].button->name, _mqtt_light_subtopics);
+  }
+
+  for (i=0; i < aqdata->num_sensors; i++) {
+    static const char *none[] = {""};
+    set_topic_group(MQT_SENSOR(i), 1, aqdata->sensors[i].label, FULL_SENSOR_TOPIC, aqdata->sensors[i].ID, none);
+  }
+}
+
+// New connection to the broker, everything needs to be sent again.
+void mqtt_forget_values()
+{
+  int i;
+
+  for (i=0; i < MQT_TOTAL; i++) {
+    _mqtt_topics[i].valid = false;
+    _mqtt_topics[i].queued = false;
+  }
+  _mqtt_queued = 0;
+  _mqtt_refresh_next = MQT_TOTAL;
+}
+
+static void mqtt_enqueue(int id)
+{
+  if (!_mqtt_topics[id].queued) {
+    _mqtt_topics[id].queued = true;
+    _mqtt_queue[_mqtt_queued++] = id;
+  }
+}
+
+// Queue value for topic if it's different to what was last sent.  If it's already queued this replaces the value.
+void mqtt_queue(int id, const char *value)
+{
+  mqtt_topic *t = &_mqtt_topics[id];
+
+  if (t->topic == NULL)
+    return;
+
+  if (t->valid && strcmp(t->value, value) == 0)
+    return;
+
+  snprintf(t->value, t->value_size, "%s", value);
+  t->valid = true;
+  mqtt_enqueue(id);
+}
+
+void mqtt_queue_int(int id, int value)
+{
+  char buf[MQTT_NUM_LEN];
+  snprintf(buf, MQTT_NUM_LEN, "%d", value);
+  mqtt_queue(id, buf);
+}
+
+void mqtt_queue_float(int id, float value)
+{
+  char buf[MQTT_NUM_LEN];
+  snprintf(buf, MQTT_NUM_LEN, "%.2f", value);
+  mqtt_queue(id, buf);
+}
+
+// Send the current value again, even though it's not changed.
+void mqtt_requeue(int id)
+{
+  if (_mqtt_topics[id].topic != NULL && _mqtt_topics[id].valid)
+    mqtt_enqueue(id);
+}
+
+// Publish everything queued since last flush, returns number sent.
+int mqtt_flush(struct mg_connection *nc)
+{
+  int i;
+  int sent = _mqtt_queued;
+
+  for (i=0; i < _mqtt_queued; i++) {
+    mqtt_topic *t = &_mqtt_topics[_mqtt_queue[i]];
+    send_mqtt(nc, t->topic, t->value);
+    t->queued = false;
+  }
+  _mqtt_queued = 0;
+
+  if (sent > 0)
+    LOG(NET_LOG,LOG_DEBUG, "MQTT: Published %d topics\n", sent);
+
+  return sent;
+}
+
+/*
+ * Timed full update, rather than sending every retained topic in one go, mqtt_refresh_step() re-sends
+ * the next count topics each time it's called.
+ */
+void mqtt_refresh_start()
+{
+  _mqtt_refresh_next = 0;
+}
+
+// Returns true while there is still more of the refresh to go.
+bool mqtt_refresh_step(int count)
+{
+  while (count > 0 && _mqtt_refresh_next < MQT_TOTAL) {
+    if (_mqtt_topics[_mqtt_refresh_next].topic != NULL && _mqtt_topics[_mqtt_refresh_next].valid) {
+      mqtt_enqueue(_mqtt_refresh_next);
+      count--;
+    }
+    _mqtt_refresh_next++;
+  }
+
+  return (_mqtt_refresh_next < MQT_TOTAL);
+}
@@ -0,0 +1,96 @@
+#ifndef MQTT_PUBLISH_H_
+#define MQTT_PUBLISH_H_
+
+#include <stdbool.h>
+
+#include "mongoose.h"
+#include "aqualink.h"
+
+/*
+  Every topic AqualinkD publishes status on has a slot here, full topic string is built once
+  (not sprintf'd on every publish) and the last value is kept so only real changes get queued.
+  Queue is flushed to the broker once per broadcast.
+*/
+typedef enum {
+  MQT_SERVICE_MODE = 0,
+  MQT_DISPLAY_MSG,
+  MQT_AIR_TEMP,
+  MQT_POOL_TEMP,
+  MQT_SPA_TEMP,
+  MQT_POOL_HTR_SETPOINT,
+  MQT_SPA_HTR_SETPOINT,
+  MQT_FREEZE_SETPOINT,
+  MQT_FREEZE,
+  MQT_FREEZE_ENABLED,
+  MQT_CHILLER_SETPOINT,
+  MQT_CHILLER,
+  MQT_CHILLER_ENABLED,
+  MQT_BATTERY,
+  MQT_PH,
+  MQT_PH_F,
+  MQT_ORP,
+  MQT_ORP_F,
+  MQT_SWG,
+  MQT_SWG_ENABLED,
+  MQT_SWG_PERCENT,
+  MQT_SWG_PERCENT_F,
+  MQT_SWG_SETPOINT,
+  MQT_SWG_PPM,
+  MQT_SWG_PPM_F,
+  MQT_SWG_BOOST,
+  MQT_SWG_BOOST_DURATION,
+  MQT_SWG_EXTENDED,
+  MQT_SWG_STATUS_MSG,
+  MQT_LXI_ERROR_CODE,
+  MQT_LXI_ERROR_MESSAGE,
+  MQT_FIXED_TOTAL
+} mqtt_fixed_topic;
+
+// Topics under each button / pump / light name
+typedef enum {
+  MQT_BTN_STATE = 0,
+  MQT_BTN_DELAY,
+  MQT_BTN_ENABLED,
+  MQT_BTN_TIMER,
+  MQT_BTN_TIMER_DURATION,
+  MQT_BTN_TOPICS
+} mqtt_button_topic;
+
+typedef enum {
+  MQT_PUMP_RPM = 0,
+  MQT_PUMP_GPM,
+  MQT_PUMP_WATTS,
+  MQT_PUMP_MODE,
+  MQT_PUMP_PPC,
+  MQT_PUMP_STATUS,
+  MQT_PUMP_SPEED,
+  MQT_PUMP_TOPICS
+} mqtt_pump_topic;
+
+typedef enum {
+  MQT_LIGHT_PROGRAM = 0,
+  MQT_LIGHT_PROGRAM_NAME,
+  MQT_LIGHT_DIMMER,
+  MQT_LIGHT_TOPICS
+} mqtt_light_topic;
+
+#define MQT_BUTTON(i, t) (MQT_FIXED_TOTAL + (i) * MQT_BTN_TOPICS + (t))
+#define MQT_PUMP(i, t)   (MQT_BUTTON(TOTAL_BUTTONS, 0) + (i) * MQT_PUMP_TOPICS + (t))
+#define MQT_LIGHT(i, t)  (MQT_PUMP(MAX_PUMPS, 0) + (i) * MQT_LIGHT_TOPICS + (t))
+#define MQT_SENSOR(i)    (MQT_LIGHT(MAX_LIGHTS, 0) + (i))
+#define MQT_TOTAL        MQT_SENSOR(MAX_SENSORS)
+
+void mqtt_init_topics();
+void mqtt_check_topics(struct aqualinkdata *aqdata);
+void mqtt_forget_values();
+
+void mqtt_queue(int topic, const char *value);
+void mqtt_queue_int(int topic, int value);
+void mqtt_queue_float(int topic, float value);
+void mqtt_requeue(int topic);
+int  mqtt_flush(struct mg_connection *nc);
+
+void mqtt_refresh_start();
+bool mqtt_refresh_step(int count);
+
+#endif // MQTT_PUBLISH_H_
@@ -48,6 +48,13 @@
 #include "color_lights.h"
 #include "net_interface.h"
 #include "aq_systemutils.h"
+#include "aq_snapshot.h"
+#include "json_writer.h"
+#include "mqtt_publish.h"
+#include "web_cache.h"
+#include "uri_routes.h"
+#include "aq_metrics.h"
+#include "flight_recorder.h"
 
 #ifdef AQ_PDA
 #include "pda.h"
@@ -81,16 +88,14 @@ static pthread_t _net_thread_id = 0;
 static bool _keepNetServicesRunning = false;
 static struct mg_mgr _mgr;
 static int _mqtt_exit_flag = false;
+static unsigned long _etag_not_modified = 0; // 304 replies, polls that saved a full device list
 
 
 void start_mqtt(struct mg_mgr *mgr);
-static struct aqualinkdata _last_mqtt_aqualinkdata;
-static aqled _last_mqtt_chiller_led;
-void mqtt_broadcast_aqualinkstate(struct mg_connection *nc);
+void mqtt_broadcast_aqualinkstate(struct mg_connection *nc, struct aqualinkdata *aqdata);
 
 
 void reset_last_mqtt_status();
-bool uri_strcmp(const char *uri, const char *string);
 
 //static const char *s_http_port = "8080";
 //static struct mg_serve_http_opts _http_server_opts;
@@ -137,6 +142,18 @@ static void set_mqttconnected(struct mg_connection *nc) {
   nc->aq_flags |= AQ_MG_CON_MQTT;
   nc->aq_flags &= ~AQ_MG_CON_MQTT_CONNECTING;
 }
+static void set_websocket_delta(struct mg_connection *nc, uint32_t version) {
+  nc->aq_flags |= AQ_MG_CON_WS_DELTA;
+  memcpy(nc->data, &version, sizeof(version));
+}
+static int is_websocket_delta(const struct mg_connection *nc) {
+  return nc->aq_flags & AQ_MG_CON_WS_DELTA;
+}
+static uint32_t get_websocket_delta_version(const struct mg_connection *nc) {
+  uint32_t version;
+  memcpy(&version, nc->data, sizeof(version));
+  return version;
+}
 
 static void ws_send(struct mg_connection *nc, char *msg)
 {
@@ -147,6 +164,120 @@ static void ws_send(struct mg_connection *nc, char *msg)
   //LOG(NET_LOG,LOG_DEBUG, "WS: Sent %d characters '%s'\n",size, msg);
 }
 
+/*
+ * Stream JSON straight into the connection's send buffer, saves building it on the stack and copying.
+ * Start/end pair, write what you want with the json_writer in between.
+ */
+static size_t ws_json_start(struct mg_connection *nc, json_writer *w)
+{
+  jw_init_iobuf(w, &nc->send);
+  return nc->send.len;
+}
+static void ws_json_end(struct mg_connection *nc, json_writer *w, size_t start)
+{
+  if (w->overflow)
+    LOG(NET_LOG,LOG_ERR, "WS: Failed to grow send buffer, JSON truncated\n");
+
+  if (nc->send.len > start)
+    mg_ws_wrap(nc, nc->send.len - start, WEBSOCKET_OP_TEXT);
+}
+
+// Same padded Content-Length trick as mg_http_reply(), we fill it in once we know the length.
+static size_t http_json_start(struct mg_connection *nc, json_writer *w)
+{
+  mg_printf(nc, "HTTP/1.1 200 OK\r\n%sContent-Length:            \r\n\r\n", CONTENT_JSON);
+  jw_init_iobuf(w, &nc->send);
+  return nc->send.len;
+}
+static void http_reply_end(struct mg_connection *nc, size_t start)
+{
+  size_t n;
+
+  n = mg_snprintf((char *)&nc->send.buf[start - 15], 11, "%-10lu", (unsigned long)(nc->send.len - start));
+  nc->send.buf[start - 15 + n] = ' ';
+  nc->is_resp = 0;
+}
+static void http_json_end(struct mg_connection *nc, json_writer *w, size_t start)
+{
+  if (w->overflow)
+    LOG(NET_LOG,LOG_ERR, "WEB: Failed to grow send buffer, JSON truncated\n");
+
+  http_reply_end(nc, start);
+}
+
+/*
+ * As above but with an ETag (hash of the body), polls that send a matching If-None-Match get a 304.
+ * We only know the hash once the body is written, so it's patched into the header like Content-Length,
+ * or the whole reply is thrown away for the 304.
+ */
+#define ETAG_REPLY_HEAD "HTTP/1.1 200 OK\r\n" CONTENT_JSON_REVALIDATE "ETag: "
+#define ETAG_LEN 18 // "0123456789abcdef" with quotes
+
+static size_t http_json_etag_start(struct mg_connection *nc, json_writer *w, size_t *reply_start)
+{
+  *reply_start = nc->send.len;
+  mg_printf(nc, "%s\"%016llx\"\r\nContent-Length:            \r\n\r\n", ETAG_REPLY_HEAD, 0ULL);
+  jw_init_iobuf(w, &nc->send);
+  return nc->send.len;
+}
+
+static bool etag_matches(struct mg_str *if_none_match, const char *etag)
+{
+  size_t i;
+
+  if (if_none_match == NULL)
+    return false;
+
+  for (i=0; i + ETAG_LEN <= if_none_match->len; i++) {
+    if (strncmp(&if_none_match->buf[i], etag, ETAG_LEN) == 0)
+      return true;
+  }
+  return false;
+}
+
+static void http_json_etag_end(struct mg_connection *nc, struct mg_http_message *http_msg, json_writer *w, size_t reply_start, size_t start)
+{
+  char etag[ETAG_LEN+1];
+  uint64_t hash = 14695981039346656037ULL; // FNV-1a
+  size_t i;
+
+  for (i=start; i < nc->send.len; i++) {
+    hash ^= (unsigned char)nc->send.buf[i];
+    hash *= 1099511628211ULL;
+  }
+  snprintf(etag, sizeof(etag), "\"%016llx\"", (unsigned long long)hash);
+
+  if (!w->overflow && etag_matches(mg_http_get_header(http_msg, "If-None-Match"), etag)) {
+    nc->send.len = reply_start;
+    mg_printf(nc, "HTTP/1.1 304 Not Modified\r\n%sETag: %s\r\nContent-Length: 0\r\n\r\n", REVALIDATE, etag);
+    nc->is_resp = 0;
+    _etag_not_modified++;
+    return;
+  }
+
+  memcpy(&nc->send.buf[reply_start + strlen(ETAG_REPLY_HEAD)], etag, ETAG_LEN);
+  http_json_end(nc, w, start);
+}
+
+static void get_net_metrics(struct mg_mgr *mgr, net_metrics *net)
+{
+  struct mg_connection *c;
+
+  memset(net, 0, sizeof(net_metrics));
+
+  for (c = mg_next(mgr, NULL); c != NULL; c = mg_next(mgr, c)) {
+    if (is_websocket(c)) {
+      net->websockets++;
+      if (is_websocket_delta(c))
+        net->websockets_delta++;
+    } else if (is_mqtt(c)) {
+      net->mqtt++;
+    } else if (c->is_accepted) {
+      net->http++;
+    }
+  }
+}
+
 void _broadcast_aqualinkstate_error(struct mg_connection *nc, const char *msg) 
 {
   struct mg_connection *c;
@@ -439,17 +570,105 @@ bool write_systemd_logmessages_2file(char *fname, int lines)
 
 #endif
 
+/*
+ * Last few status documents, each with a version number that only goes up when the status changes.
+ * Websockets using the delta protocol ack a version and get sent what changed since then.
+ */
+#define WS_STATUS_HISTORY 8
+
+static struct {
+  uint32_t version;
+  char json[JSON_STATUS_SIZE];
+} _ws_status[WS_STATUS_HISTORY];
+static uint32_t _ws_status_version = 0;
+static struct timespec _ws_last_broadcast;
+
+/*
+ * Everything the net thread builds JSON / MQTT from is a coherent copy, RS485 threads may be
+ * half way through updating the live aqualinkdata.  Requests that change state still use the live one.
+ */
+static struct aqualinkdata _net_snapshot;
+
+static struct aqualinkdata *get_aqualinkdata_snapshot()
+{
+  aqdata_snapshot(_aqualink_data, &_net_snapshot);
+  return &_net_snapshot;
+}
+
+static const char *get_ws_status(uint32_t version)
+{
+  if (version == 0 || _ws_status[version % WS_STATUS_HISTORY].version != version)
+    return NULL;
+
+  return _ws_status[version % WS_STATUS_HISTORY].json;
+}
+
+// Returns true if status is different from the last version.
+static bool update_ws_status(struct aqualinkdata *snapshot)
+{
+  char data[JSON_STATUS_SIZE];
+  const char *last = get_ws_status(_ws_status_version);
+
+  build_aqualink_status_JSON(snapshot, data, JSON_STATUS_SIZE);
+
+  if (last != NULL && strcmp(last, data) == 0)
+    return false;
+
+  _ws_status_version++;
+  _ws_status[_ws_status_version % WS_STATUS_HISTORY].version = _ws_status_version;
+  strcpy(_ws_status[_ws_status_version % WS_STATUS_HISTORY].json, data);
+
+  return true;
+}
+
+static void ws_send_status_delta(struct mg_connection *nc)
+{
+  char message[JSON_BUFFER_SIZE];
+  uint32_t base = get_websocket_delta_version(nc);
+  const char *current = get_ws_status(_ws_status_version);
+
+  if (current == NULL || base == _ws_status_version)
+    return;
+
+  if (build_aqualink_status_delta_JSON(get_ws_status(base), base, current, _ws_status_version, message, JSON_BUFFER_SIZE) > 0)
+    ws_send(nc, message);
+}
+
+// ms left before we are allowed to broadcast status again.
+static int ws_broadcast_wait()
+{
+  struct timespec now;
+  long elapsed;
+
+  if (_aqconfig_.websocket_min_interval <= 0)
+    return 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  elapsed = (now.tv_sec - _ws_last_broadcast.tv_sec) * 1000 + (now.tv_nsec - _ws_last_broadcast.tv_nsec) / 1000000;
+
+  if (elapsed < 0 || elapsed >= _aqconfig_.websocket_min_interval)
+    return 0;
+
+  return _aqconfig_.websocket_min_interval - elapsed;
+}
+
 void _broadcast_aqualinkstate(struct mg_connection *nc) 
 {
   static int mqtt_count=0;
   struct mg_connection *c;
-  char data[JSON_STATUS_SIZE];
+  struct aqualinkdata *snapshot;
+  bool changed;
+  char *data;
 #ifdef AQ_TM_DEBUG
   int tid;
 #endif
+  struct timespec finished;
   DEBUG_TIMER_START(&tid);
 
-  build_aqualink_status_JSON(_aqualink_data, data, JSON_STATUS_SIZE);
+  clock_gettime(CLOCK_MONOTONIC, &_ws_last_broadcast);
+  snapshot = get_aqualinkdata_snapshot();
+  changed = update_ws_status(snapshot);
+  data = (char *)get_ws_status(_ws_status_version);
   
   if (_mqtt_exit_flag == true) {
     mqtt_count++;
@@ -462,15 +681,20 @@ void _broadcast_aqualinkstate(struct mg_connection *nc)
 
   for (c = mg_next(nc->mgr, NULL); c != NULL; c = mg_next(nc->mgr, c)) {
     //if (is_websocket(c) && !is_websocket_simulator(c)) // No need to broadcast status messages to simulator.
-    if (is_websocket(c)) // All button simulator needs status messages
+    if (is_websocket(c) && is_websocket_delta(c))
+      ws_send_status_delta(c);
+    else if (is_websocket(c) && changed) // All button simulator needs status messages
       ws_send(c, data);
     else if (is_mqtt(c))
-      mqtt_broadcast_aqualinkstate(c);
+      mqtt_broadcast_aqualinkstate(c, snapshot);
 
   }
 
   DEBUG_TIMER_STOP(tid, NET_LOG, "broadcast_aqualinkstate() completed, took ");
 
+  clock_gettime(CLOCK_MONOTONIC, &finished);
+  metric_broadcast((finished.tv_sec - _ws_last_broadcast.tv_sec) * 1000000 + (finished.tv_nsec - _ws_last_broadcast.tv_nsec) / 1000);
+
   return;
 }
 
@@ -493,464 +717,271 @@ void send_mqtt(struct mg_connection *nc, const char *toppic, const char *message
                                 .retain = true};
   uint16_t msg_id = mg_mqtt_pub(nc, &pub_opts);
 
-  LOG(NET_LOG,LOG_INFO, "MQTT: Published id=%d: %s %s\n", msg_id, toppic, message);
+  LOG(NET_LOG,LOG_DEBUG, "MQTT: Published id=%d: %s %s\n", msg_id, toppic, message);
 }
 
-void send_mqtt_state_msg(struct mg_connection *nc, char *dev_name, aqledstate state)
+// Use "not CELS" over "equal FAHR" so we default to FAHR for unknown units
+static void mqtt_queue_temp(struct aqualinkdata *aqdata, int topic, long value)
 {
-  static char mqtt_pub_topic[250];
-
-  sprintf(mqtt_pub_topic, "%s/%s/delay",_aqconfig_.mqtt_aq_topic, dev_name);
-  send_mqtt(nc, mqtt_pub_topic, (state==FLASH?MQTT_ON:MQTT_OFF));
-
-  sprintf(mqtt_pub_topic, "%s/%s",_aqconfig_.mqtt_aq_topic, dev_name);
-  send_mqtt(nc, mqtt_pub_topic, (state==OFF?MQTT_OFF:MQTT_ON));
+  mqtt_queue_float(topic, (aqdata->temp_units!=CELSIUS && _aqconfig_.convert_mqtt_temp)?degFtoC(value):value);
 }
 
-
-void send_mqtt_timer_duration_msg(struct mg_connection *nc, char *dev_name, aqkey *button)
+static void mqtt_queue_led_state(int topic, int enabled_topic, aqledstate state, const char *onS, const char *offS)
 {
-  static char mqtt_pub_topic[250];
-  sprintf(mqtt_pub_topic, "%s/%s/timer/duration",_aqconfig_.mqtt_aq_topic, dev_name);
-  if ((button->special_mask & TIMER_ACTIVE) == TIMER_ACTIVE) {
-    char val[10];
-    sprintf(val, "%d", get_timer_left(button));
-    send_mqtt(nc, mqtt_pub_topic, val);
+  if (state == ENABLE) {
+    mqtt_queue(topic, offS);
+    mqtt_queue(enabled_topic, onS);
   } else {
-    send_mqtt(nc, mqtt_pub_topic, "0");
+    mqtt_queue(topic, (state==OFF?offS:onS));
+    mqtt_queue(enabled_topic, (state==OFF?offS:onS));
   }
 }
 
-void send_mqtt_timer_state_msg(struct mg_connection *nc, char *dev_name, aqkey *button)
-{
-  static char mqtt_pub_topic[250];
-
-  sprintf(mqtt_pub_topic, "%s/%s/timer",_aqconfig_.mqtt_aq_topic, dev_name);
-
-  send_mqtt(nc, mqtt_pub_topic, ( ((button->special_mask & TIMER_ACTIVE) == TIMER_ACTIVE) && (button->led->state != OFF) )?MQTT_ON:MQTT_OFF );
-
-  send_mqtt_timer_duration_msg(nc, dev_name, button);
-}
-
-//void send_mqtt_aux_msg(struct mg_connection *nc, char *root_topic, int dev_index, char *dev_topic, int value)
-void send_mqtt_aux_msg(struct mg_connection *nc, char *dev_name, char *dev_topic, int value)
+static void mqtt_queue_button(struct aqualinkdata *aqdata, int i)
 {
-  static char mqtt_pub_topic[250];
-  static char msg[10];
-  
-  sprintf(msg, "%d", value);
-
-  //sprintf(mqtt_pub_topic, "%s/%s%d%s",_aqconfig_.mqtt_aq_topic, root_topic, dev_index, dev_topic);
-  sprintf(mqtt_pub_topic, "%s/%s%s",_aqconfig_.mqtt_aq_topic, dev_name, dev_topic);
-  send_mqtt(nc, mqtt_pub_topic, msg);
-}
-
-void send_mqtt_led_state_msg(struct mg_connection *nc, char *dev_name, aqledstate state, char *onS, char *offS)
-{
-
-  static char mqtt_pub_topic[250];
-
-  sprintf(mqtt_pub_topic, "%s/%s",_aqconfig_.mqtt_aq_topic, dev_name);
+  aqkey *button = &aqdata->aqbuttons[i];
+  bool timer = ((button->special_mask & TIMER_ACTIVE) == TIMER_ACTIVE);
 
-  if (state == ENABLE) {
-    send_mqtt(nc, mqtt_pub_topic, offS);
-    sprintf(mqtt_pub_topic, "%s/%s%s",_aqconfig_.mqtt_aq_topic, dev_name, ENABELED_SUBT);
-    send_mqtt(nc, mqtt_pub_topic, onS);
+  if (button->code == KEY_POOL_HTR || button->code == KEY_SPA_HTR) {
+    mqtt_queue_led_state(MQT_BUTTON(i, MQT_BTN_STATE), MQT_BUTTON(i, MQT_BTN_ENABLED), button->led->state, MQTT_ON, MQTT_OFF);
   } else {
-    send_mqtt(nc, mqtt_pub_topic, (state==OFF?offS:onS));
-    sprintf(mqtt_pub_topic, "%s/%s%s",_aqconfig_.mqtt_aq_topic, dev_name, ENABELED_SUBT);
-    send_mqtt(nc, mqtt_pub_topic, (state==OFF?offS:onS));
+    mqtt_queue(MQT_BUTTON(i, MQT_BTN_DELAY), (button->led->state==FLASH?MQTT_ON:MQTT_OFF));
+    mqtt_queue(MQT_BUTTON(i, MQT_BTN_STATE), (button->led->state==OFF?MQTT_OFF:MQTT_ON));
   }
-}
 
-void send_mqtt_swg_state_msg(struct mg_connection *nc, char *dev_name, aqledstate state)
-{
-  //send_mqtt_led_state_msg(nc, dev_name, state, SWG_ON, SWG_OFF);
-  send_mqtt_led_state_msg(nc, dev_name, state, MQTT_COOL, MQTT_OFF);
+  mqtt_queue(MQT_BUTTON(i, MQT_BTN_TIMER), (timer && button->led->state != OFF)?MQTT_ON:MQTT_OFF);
+  mqtt_queue_int(MQT_BUTTON(i, MQT_BTN_TIMER_DURATION), timer?get_timer_left(i):0);
 }
 
-void send_mqtt_heater_state_msg(struct mg_connection *nc, char *dev_name, aqledstate state)
+/*
+ * Only devices whose aqdata->versions counters have moved since the last pass get looked at, the counters
+ * are bumped where the value is written (SET_IF_CHANGED).  mqtt_queue() then drops anything that's the
+ * same as what we last sent, so all that goes to the broker is real changes, in one flush per broadcast.
+ */
+enum {
+  MQG_GENERAL = 0,
+  MQG_BUTTONS,
+  MQG_PUMPS = MQG_BUTTONS + TOTAL_BUTTONS,
+  MQG_LIGHTS = MQG_PUMPS + MAX_PUMPS,
+  MQG_SENSORS = MQG_LIGHTS + MAX_LIGHTS,
+  MQG_TOTAL = MQG_SENSORS + MAX_SENSORS
+};
+
+static uint32_t _mqtt_seen_version[MQG_TOTAL];
+static uint8_t _mqtt_seen_mask[TOTAL_BUTTONS];  // Timer code changes special_mask directly
+static bool _mqtt_seen_all = false;             // false forces a full pass
+
+static bool mqtt_group_changed(int group, uint32_t version)
 {
-  send_mqtt_led_state_msg(nc, dev_name, state, MQTT_ON, MQTT_OFF);
-}
-
+  if (_mqtt_seen_all && _mqtt_seen_version[group] == version)
+    return false;
 
-// NSF need to change this function to the _new once finished.
-void send_mqtt_temp_msg(struct mg_connection *nc, char *dev_name, long value)
-{
-  static char mqtt_pub_topic[250];
-  static char degC[10];
-  // Use "not CELS" over "equal FAHR" so we default to FAHR for unknown units
-  //sprintf(degC, "%.2f", (_aqualink_data->temp_units==FAHRENHEIT && _aqconfig_.convert_mqtt_temp)?degFtoC(value):value );
-  sprintf(degC, "%.2f", (_aqualink_data->temp_units!=CELSIUS && _aqconfig_.convert_mqtt_temp)?degFtoC(value):value );
-  sprintf(mqtt_pub_topic, "%s/%s", _aqconfig_.mqtt_aq_topic, dev_name);
-  send_mqtt(nc, mqtt_pub_topic, degC);
+  _mqtt_seen_version[group] = version;
+  return true;
 }
 
-void send_mqtt_setpoint_msg(struct mg_connection *nc, char *dev_name, long value)
-{
-  static char mqtt_pub_topic[250];
-  static char degC[11];
-  // Use "not CELS" over "equal FAHR" so we default to FAHR for unknown units
-  //sprintf(degC, "%.2f", (_aqualink_data->temp_units==FAHRENHEIT && _aqconfig_.convert_mqtt_temp)?degFtoC(value):value );
-  sprintf(degC, "%.2f", (_aqualink_data->temp_units!=CELSIUS && _aqconfig_.convert_mqtt_temp)?degFtoC(value):value );
-  sprintf(mqtt_pub_topic, "%s/%s/setpoint", _aqconfig_.mqtt_aq_topic, dev_name);
-  send_mqtt(nc, mqtt_pub_topic, degC);
-}
-void send_mqtt_numeric_msg(struct mg_connection *nc, char *dev_name, int value)
+static uint32_t led_version(struct aqualinkdata *aqdata, aqled *led)
 {
-  static char mqtt_pub_topic[250];
-  static char msg[11];
-  
-  sprintf(msg, "%d", value);
-  sprintf(mqtt_pub_topic, "%s/%s", _aqconfig_.mqtt_aq_topic, dev_name);
-  send_mqtt(nc, mqtt_pub_topic, msg);
-}
-void send_mqtt_float_msg(struct mg_connection *nc, char *dev_name, float value) {
-  static char mqtt_pub_topic[250];
-  static char msg[11];
-
-  sprintf(msg, "%.2f", value);
-  sprintf(mqtt_pub_topic, "%s/%s", _aqconfig_.mqtt_aq_topic, dev_name);
-  send_mqtt(nc, mqtt_pub_topic, msg);
-}
-
-void send_mqtt_int_msg(struct mg_connection *nc, char *dev_name, int value) {
-  send_mqtt_numeric_msg(nc, dev_name, value);
-}
-
-void send_mqtt_string_msg(struct mg_connection *nc, const char *dev_name, const char *msg) {
-  static char mqtt_pub_topic[250];
+  if (led >= aqdata->aqualinkleds && led < aqdata->aqualinkleds + TOTAL_LEDS)
+    return aqdata->versions.led[led - aqdata->aqualinkleds];
 
-  sprintf(mqtt_pub_topic, "%s/%s", _aqconfig_.mqtt_aq_topic, dev_name);
-  send_mqtt(nc, mqtt_pub_topic, msg);
+  return 0;
 }
 
-#define MQTT_TIMED_UDATE 300 //(in seconds)
+#define MQTT_TIMED_UDATE 300   //(in seconds)
+#define MQTT_REFRESH_CYCLES 30 // Timed update is spread over this many broadcasts (about a second apart)
 
-void mqtt_broadcast_aqualinkstate(struct mg_connection *nc)
+void mqtt_broadcast_aqualinkstate(struct mg_connection *nc, struct aqualinkdata *aqdata)
 {
   int i;
-  const char *status;
-  int pumpStatus;
-  static struct timespec last_update_timestamp = {0, 0};
+  const aqdata_versions *v = &aqdata->versions;
 
+  mqtt_check_topics(aqdata);
 
-  // We get called about every second, so check time every MQTT_TIMED_UDATE / 2
   if (_aqconfig_.mqtt_timed_update) {
-    static int cnt=0;
-    if (cnt >= (MQTT_TIMED_UDATE/2)) {
-      static time_t last_full_update = 0;
-      time_t now = time(0); // get time now
-      if ( (int)difftime(now, last_full_update) > MQTT_TIMED_UDATE ) {
-        reset_last_mqtt_status();
-        memcpy(&last_full_update, &now, sizeof(time_t));
-      }
-      cnt = 0;
-    } else {
-      cnt++;
-    }
-  }
-
-//LOG(NET_LOG,LOG_INFO, "mqtt_broadcast_aqualinkstate: START\n");
-
-  if (_aqualink_data->service_mode_state != _last_mqtt_aqualinkdata.service_mode_state) {
-     _last_mqtt_aqualinkdata.service_mode_state = _aqualink_data->service_mode_state;
-     send_mqtt_string_msg(nc, SERVICE_MODE_TOPIC, _aqualink_data->service_mode_state==OFF?MQTT_OFF:(_aqualink_data->service_mode_state==FLASH?MQTT_FLASH:MQTT_ON));
-  }
+    static time_t last_full_update = 0;
+    static bool refreshing = false;
+    time_t now = time(0); // get time now
 
-  // Only send to display messag topic if not in simulator mode
-  //if (!_aqualink_data->simulate_panel) {
-    status = getAqualinkDStatusMessage(_aqualink_data);
-    if (strcmp(status, _last_mqtt_aqualinkdata.last_display_message) != 0) {
-      strcpy(_last_mqtt_aqualinkdata.last_display_message, status);
-      send_mqtt_string_msg(nc, DISPLAY_MSG_TOPIC, status);
+    if (last_full_update == 0) {
+      last_full_update = now; // Everything was just sent on connect
+    } else if (!refreshing && (int)difftime(now, last_full_update) > MQTT_TIMED_UDATE) {
+      mqtt_refresh_start();
+      refreshing = true;
+      last_full_update = now;
     }
-  //}
 
-  if (_aqualink_data->air_temp != TEMP_UNKNOWN && _aqualink_data->air_temp != _last_mqtt_aqualinkdata.air_temp) {
-    _last_mqtt_aqualinkdata.air_temp = _aqualink_data->air_temp;
-    send_mqtt_temp_msg(nc, AIR_TEMP_TOPIC, _aqualink_data->air_temp);
-    //send_mqtt_temp_msg_new(nc, AIR_TEMPERATURE_TOPIC, _aqualink_data->air_temp);
+    if (refreshing)
+      refreshing = mqtt_refresh_step(MQT_TOTAL / MQTT_REFRESH_CYCLES + 1);
   }
 
-  if (_aqualink_data->pool_temp != _last_mqtt_aqualinkdata.pool_temp) {
-    if (_aqualink_data->pool_temp == TEMP_UNKNOWN && _aqconfig_.report_zero_pool_temp) {
-      _last_mqtt_aqualinkdata.pool_temp = TEMP_UNKNOWN;
-      send_mqtt_temp_msg(nc, POOL_TEMP_TOPIC, 0);
-    } if (_aqualink_data->pool_temp == TEMP_UNKNOWN && ! _aqconfig_.report_zero_pool_temp) {
-      // Don't post anything in this case, ie leave last posted value alone
-    } else if (_aqualink_data->pool_temp != TEMP_UNKNOWN) {
-      _last_mqtt_aqualinkdata.pool_temp = _aqualink_data->pool_temp;
-      send_mqtt_temp_msg(nc, POOL_TEMP_TOPIC, _aqualink_data->pool_temp);
-    }
-  } 
-  
-  if (_aqualink_data->spa_temp != _last_mqtt_aqualinkdata.spa_temp) {
-    if (_aqualink_data->spa_temp == TEMP_UNKNOWN && _aqconfig_.report_zero_spa_temp) {
-      _last_mqtt_aqualinkdata.spa_temp = TEMP_UNKNOWN;
-      send_mqtt_temp_msg(nc, SPA_TEMP_TOPIC, 0);
-    } if (_aqualink_data->spa_temp == TEMP_UNKNOWN && ! _aqconfig_.report_zero_spa_temp && _aqualink_data->pool_temp != TEMP_UNKNOWN ) {
-      // Use Pool Temp as spa temp
-      if (_last_mqtt_aqualinkdata.spa_temp != _aqualink_data->pool_temp) {
-        _last_mqtt_aqualinkdata.spa_temp = _aqualink_data->pool_temp;
-        send_mqtt_temp_msg(nc, SPA_TEMP_TOPIC, _aqualink_data->pool_temp);
-      }
-    } else if (_aqualink_data->spa_temp != TEMP_UNKNOWN) {
-      _last_mqtt_aqualinkdata.spa_temp = _aqualink_data->spa_temp;
-      send_mqtt_temp_msg(nc, SPA_TEMP_TOPIC, _aqualink_data->spa_temp);
-    }
-  } 
+  // Status message can change without anything in aqualinkdata changing (programming etc), so always check it.
+  mqtt_queue(MQT_DISPLAY_MSG, getAqualinkDStatusMessage(aqdata));
 
-  if (_aqualink_data->pool_htr_set_point != TEMP_UNKNOWN && _aqualink_data->pool_htr_set_point != _last_mqtt_aqualinkdata.pool_htr_set_point) {
-    _last_mqtt_aqualinkdata.pool_htr_set_point = _aqualink_data->pool_htr_set_point;
-    send_mqtt_setpoint_msg(nc, BTN_POOL_HTR, _aqualink_data->pool_htr_set_point);
-  }
+  if (mqtt_group_changed(MQG_GENERAL, v->unknown + v->general)) {
+    mqtt_queue(MQT_SERVICE_MODE, aqdata->service_mode_state==OFF?MQTT_OFF:(aqdata->service_mode_state==FLASH?MQTT_FLASH:MQTT_ON));
 
-  if (_aqualink_data->spa_htr_set_point != TEMP_UNKNOWN && _aqualink_data->spa_htr_set_point != _last_mqtt_aqualinkdata.spa_htr_set_point) {
-    _last_mqtt_aqualinkdata.spa_htr_set_point = _aqualink_data->spa_htr_set_point;
-    send_mqtt_setpoint_msg(nc, BTN_SPA_HTR, _aqualink_data->spa_htr_set_point);
-  }
+    if (aqdata->air_temp != TEMP_UNKNOWN)
+      mqtt_queue_temp(aqdata, MQT_AIR_TEMP, aqdata->air_temp);
 
-  if (_aqualink_data->frz_protect_set_point != TEMP_UNKNOWN && _aqualink_data->frz_protect_set_point != _last_mqtt_aqualinkdata.frz_protect_set_point) {
-    _last_mqtt_aqualinkdata.frz_protect_set_point = _aqualink_data->frz_protect_set_point;
-    send_mqtt_setpoint_msg(nc, FREEZE_PROTECT, _aqualink_data->frz_protect_set_point);
-    send_mqtt_string_msg(nc, FREEZE_PROTECT_ENABELED, MQTT_ON);
-    // Duplicate of below if statment.  NSF come back and check if necessary for startup.
-    send_mqtt_string_msg(nc, FREEZE_PROTECT, _aqualink_data->frz_protect_state==ON?MQTT_ON:MQTT_OFF);
-    _last_mqtt_aqualinkdata.frz_protect_state = _aqualink_data->frz_protect_state;
-  }
-
-  if (_aqualink_data->frz_protect_state != _last_mqtt_aqualinkdata.frz_protect_state) {
-    _last_mqtt_aqualinkdata.frz_protect_state = _aqualink_data->frz_protect_state;
-    send_mqtt_string_msg(nc, FREEZE_PROTECT, _aqualink_data->frz_protect_state==ON?MQTT_ON:MQTT_OFF);
-    //send_mqtt_string_msg(nc, FREEZE_PROTECT_ENABELED, MQTT_ON);
-  }
+    // Unknown pool temp, leave last posted value alone unless told to report zero
+    if (aqdata->pool_temp != TEMP_UNKNOWN)
+      mqtt_queue_temp(aqdata, MQT_POOL_TEMP, aqdata->pool_temp);
+    else if (_aqconfig_.report_zero_pool_temp)
+      mqtt_queue_temp(aqdata, MQT_POOL_TEMP, 0);
 
-  if (ENABLE_CHILLER) {
-    if (_aqualink_data->chiller_set_point != TEMP_UNKNOWN && _aqualink_data->chiller_set_point != _last_mqtt_aqualinkdata.chiller_set_point) {
-      _last_mqtt_aqualinkdata.chiller_set_point = _aqualink_data->chiller_set_point;
-      send_mqtt_setpoint_msg(nc, CHILLER, _aqualink_data->chiller_set_point);
-    }
+    // Unknown spa temp, use pool temp unless told to report zero
+    if (aqdata->spa_temp != TEMP_UNKNOWN)
+      mqtt_queue_temp(aqdata, MQT_SPA_TEMP, aqdata->spa_temp);
+    else if (_aqconfig_.report_zero_spa_temp)
+      mqtt_queue_temp(aqdata, MQT_SPA_TEMP, 0);
+    else if (aqdata->pool_temp != TEMP_UNKNOWN)
+      mqtt_queue_temp(aqdata, MQT_SPA_TEMP, aqdata->pool_temp);
 
-    // Chiller is only on when in_alt_mode = true and led != off 
-    if ( _aqualink_data->chiller_button != NULL && ((altlabel_detail *) _aqualink_data->chiller_button->special_mask_ptr)->in_alt_mode == false ) {
-      // Chiller is off (in heat pump mode)
-      if (OFF != _last_mqtt_chiller_led.state) {
-        _last_mqtt_chiller_led.state = OFF;
-        send_mqtt_led_state_msg(nc, CHILLER, OFF, MQTT_COOL, MQTT_OFF);
-      }
-    } else if (_aqualink_data->chiller_button != NULL && ((altlabel_detail *) _aqualink_data->chiller_button->special_mask_ptr)->in_alt_mode == true ) {
-      // post actual LED state, in chiller mode
-      if (_aqualink_data->chiller_button->led->state != _last_mqtt_chiller_led.state) {
-        _last_mqtt_chiller_led.state = _aqualink_data->chiller_button->led->state;
-        send_mqtt_led_state_msg(nc, CHILLER, _aqualink_data->chiller_button->led->state, MQTT_COOL, MQTT_OFF);
-      }
-    }
-  }
+    if (aqdata->pool_htr_set_point != TEMP_UNKNOWN)
+      mqtt_queue_temp(aqdata, MQT_POOL_HTR_SETPOINT, aqdata->pool_htr_set_point);
 
-  if (_aqualink_data->battery != _last_mqtt_aqualinkdata.battery) {
-    _last_mqtt_aqualinkdata.battery = _aqualink_data->battery;
-    send_mqtt_string_msg(nc, BATTERY_STATE, _aqualink_data->battery==OK?MQTT_ON:MQTT_OFF); 
-  }
+    if (aqdata->spa_htr_set_point != TEMP_UNKNOWN)
+      mqtt_queue_temp(aqdata, MQT_SPA_HTR_SETPOINT, aqdata->spa_htr_set_point);
 
-  if (_aqualink_data->ph != TEMP_UNKNOWN && _aqualink_data->ph != _last_mqtt_aqualinkdata.ph) {
-    _last_mqtt_aqualinkdata.ph = _aqualink_data->ph;
-    send_mqtt_float_msg(nc, CHEM_PH_TOPIC, _aqualink_data->ph);
-    send_mqtt_float_msg(nc, CHRM_PH_F_TOPIC, roundf(degFtoC(_aqualink_data->ph)));
-  }
-  if (_aqualink_data->orp != TEMP_UNKNOWN && _aqualink_data->orp != _last_mqtt_aqualinkdata.orp) {
-    _last_mqtt_aqualinkdata.orp = _aqualink_data->orp;
-    send_mqtt_numeric_msg(nc, CHEM_ORP_TOPIC, _aqualink_data->orp);
-    send_mqtt_float_msg(nc, CHRM_ORP_F_TOPIC, roundf(degFtoC(_aqualink_data->orp)));
-  }
+    if (aqdata->frz_protect_set_point != TEMP_UNKNOWN) {
+      mqtt_queue_temp(aqdata, MQT_FREEZE_SETPOINT, aqdata->frz_protect_set_point);
+      mqtt_queue(MQT_FREEZE_ENABLED, MQTT_ON);
+    }
+    mqtt_queue(MQT_FREEZE, aqdata->frz_protect_state==ON?MQTT_ON:MQTT_OFF);
 
-  // Salt Water Generator
-  if (_aqualink_data->swg_led_state != LED_S_UNKNOWN) {
+    if (ENABLE_CHILLER && aqdata->chiller_set_point != TEMP_UNKNOWN)
+      mqtt_queue_temp(aqdata, MQT_CHILLER_SETPOINT, aqdata->chiller_set_point);
 
-    //LOG(NET_LOG,LOG_DEBUG, "Sending MQTT SWG MEssages\n");
+    mqtt_queue(MQT_BATTERY, aqdata->battery==OK?MQTT_ON:MQTT_OFF);
 
-    if (_aqualink_data->swg_led_state != _last_mqtt_aqualinkdata.swg_led_state) {
-       send_mqtt_swg_state_msg(nc, SWG_TOPIC, _aqualink_data->swg_led_state);
-       _last_mqtt_aqualinkdata.swg_led_state = _aqualink_data->swg_led_state;
+    if (aqdata->ph != TEMP_UNKNOWN) {
+      mqtt_queue_float(MQT_PH, aqdata->ph);
+      mqtt_queue_float(MQT_PH_F, roundf(degFtoC(aqdata->ph)));
     }
-
-    if (_aqualink_data->swg_percent != TEMP_UNKNOWN && (_aqualink_data->swg_percent != _last_mqtt_aqualinkdata.swg_percent)) {
-      _last_mqtt_aqualinkdata.swg_percent = _aqualink_data->swg_percent;
-      send_mqtt_numeric_msg(nc, SWG_PERCENT_TOPIC, _aqualink_data->swg_percent);
-      send_mqtt_float_msg(nc, SWG_PERCENT_F_TOPIC, roundf(degFtoC(_aqualink_data->swg_percent)));
-      send_mqtt_float_msg(nc, SWG_SETPOINT_TOPIC, roundf(degFtoC(_aqualink_data->swg_percent)));
+    if (aqdata->orp != TEMP_UNKNOWN) {
+      mqtt_queue_int(MQT_ORP, aqdata->orp);
+      mqtt_queue_float(MQT_ORP_F, roundf(degFtoC(aqdata->orp)));
     }
-    if (_aqualink_data->swg_ppm != TEMP_UNKNOWN && (_aqualink_data->swg_ppm != _last_mqtt_aqualinkdata.swg_ppm)) {
-      _last_mqtt_aqualinkdata.swg_ppm = _aqualink_data->swg_ppm;
-      send_mqtt_numeric_msg(nc, SWG_PPM_TOPIC, _aqualink_data->swg_ppm);
-      send_mqtt_float_msg(nc, SWG_PPM_F_TOPIC, roundf(degFtoC(_aqualink_data->swg_ppm)));
+
+    // Salt Water Generator
+    if (aqdata->swg_led_state != LED_S_UNKNOWN) {
+      mqtt_queue_led_state(MQT_SWG, MQT_SWG_ENABLED, aqdata->swg_led_state, MQTT_COOL, MQTT_OFF);
+
+      if (aqdata->swg_percent != TEMP_UNKNOWN) {
+        mqtt_queue_int(MQT_SWG_PERCENT, aqdata->swg_percent);
+        mqtt_queue_float(MQT_SWG_PERCENT_F, roundf(degFtoC(aqdata->swg_percent)));
+        mqtt_queue_float(MQT_SWG_SETPOINT, roundf(degFtoC(aqdata->swg_percent)));
+      }
+      if (aqdata->swg_ppm != TEMP_UNKNOWN) {
+        mqtt_queue_int(MQT_SWG_PPM, aqdata->swg_ppm);
+        mqtt_queue_float(MQT_SWG_PPM_F, roundf(degFtoC(aqdata->swg_ppm)));
+      }
+      mqtt_queue_int(MQT_SWG_BOOST, aqdata->boost);
+      mqtt_queue_int(MQT_SWG_BOOST_DURATION, aqdata->boost_duration);
     }
 
-    if (_aqualink_data->boost != _last_mqtt_aqualinkdata.boost) {
-      send_mqtt_int_msg(nc, SWG_BOOST_TOPIC, _aqualink_data->boost);
-      _last_mqtt_aqualinkdata.boost = _aqualink_data->boost;
+    if (aqdata->ar_swg_device_status != SWG_STATUS_UNKNOWN) {
+      mqtt_queue_int(MQT_SWG_EXTENDED, (int)aqdata->ar_swg_device_status);
+      mqtt_queue(MQT_SWG_STATUS_MSG, get_swg_status_msg(aqdata));
     }
 
-    if ( _aqualink_data->boost_duration != _last_mqtt_aqualinkdata.boost_duration ) {
-      send_mqtt_int_msg(nc, SWG_BOOST_DURATION_TOPIC, _aqualink_data->boost_duration);
-      _last_mqtt_aqualinkdata.boost_duration = _aqualink_data->boost_duration;
+    if (READ_RSDEV_JXI) {
+      mqtt_queue_int(MQT_LXI_ERROR_CODE, (int)aqdata->heater_err_status);
+      if (aqdata->heater_err_status == NUL) {
+        mqtt_queue(MQT_LXI_ERROR_MESSAGE, "");
+      } else {
+        char message[30];
+        getJandyHeaterErrorMQTT(aqdata, message);
+        mqtt_queue(MQT_LXI_ERROR_MESSAGE, message);
+      }
     }
-    
-  } else {
-    //LOG(NET_LOG,LOG_DEBUG, "SWG status unknown\n");
   }
 
-  if (_aqualink_data->ar_swg_device_status != SWG_STATUS_UNKNOWN) {
-    //LOG(NET_LOG,LOG_DEBUG, "Sending MQTT SWG Extended %d\n",_aqualink_data->ar_swg_device_status);
-    if (_aqualink_data->ar_swg_device_status != _last_mqtt_aqualinkdata.ar_swg_device_status) {
-      send_mqtt_int_msg(nc, SWG_EXTENDED_TOPIC, (int)_aqualink_data->ar_swg_device_status);
-      send_mqtt_string_msg(nc, SWG_STATUS_MSG_TOPIC, get_swg_status_msg(_aqualink_data) );
-      _last_mqtt_aqualinkdata.ar_swg_device_status = _aqualink_data->ar_swg_device_status;
-      //LOG(NET_LOG,LOG_DEBUG, "SWG Extended sending cur=%d sent=%d\n",_aqualink_data->ar_swg_device_status,_last_mqtt_aqualinkdata.ar_swg_device_status);
+  // Chiller is only on when in_alt_mode = true and led != off, altlabel_detail isn't tracked so always check.
+  if (ENABLE_CHILLER && aqdata->chiller_button != NULL) {
+    if ( ((altlabel_detail *) aqdata->chiller_button->special_mask_ptr)->in_alt_mode == false ) {
+      // Chiller is off (in heat pump mode)
+      mqtt_queue_led_state(MQT_CHILLER, MQT_CHILLER_ENABLED, OFF, MQTT_COOL, MQTT_OFF);
     } else {
-      //LOG(NET_LOG,LOG_DEBUG, "SWG Extended already sent cur=%d sent=%d\n",_aqualink_data->ar_swg_device_status,_last_mqtt_aqualinkdata.ar_swg_device_status);
+      // post actual LED state, in chiller mode
+      mqtt_queue_led_state(MQT_CHILLER, MQT_CHILLER_ENABLED, aqdata->chiller_button->led->state, MQTT_COOL, MQTT_OFF);
     }
-  } else {
-    //LOG(NET_LOG,LOG_DEBUG, "SWG Extended unknown\n");
   }
 
-  if (READ_RSDEV_JXI && _aqualink_data->heater_err_status != _last_mqtt_aqualinkdata.heater_err_status) {
-    char message[30];
+  // Buttons, anything with a timer running gets checked every time since duration counts down.
+  for (i=0; i < aqdata->total_buttons; i++) {
+    aqkey *button = &aqdata->aqbuttons[i];
+    bool changed = mqtt_group_changed(MQG_BUTTONS + i, v->unknown + v->button[i] + led_version(aqdata, button->led));
 
-    if (_aqualink_data->heater_err_status == NUL) {
-      send_mqtt_int_msg(nc, LXI_ERROR_CODE, (int)_aqualink_data->heater_err_status);
-      send_mqtt_string_msg(nc, LXI_ERROR_MESSAGE, "");
-    } else {
-      //send_mqtt_int_msg(nc, LXI_STATUS, (int)_aqualink_data->heater_err_status);
-      send_mqtt_int_msg(nc, LXI_ERROR_CODE, (int)_aqualink_data->heater_err_status);
-      getJandyHeaterErrorMQTT(_aqualink_data, message);
-      send_mqtt_string_msg(nc, LXI_ERROR_MESSAGE, status);
+    if (changed || button->special_mask != _mqtt_seen_mask[i] || (button->special_mask & TIMER_ACTIVE) == TIMER_ACTIVE) {
+      _mqtt_seen_mask[i] = button->special_mask;
+      mqtt_queue_button(aqdata, i);
     }
-
-    _last_mqtt_aqualinkdata.heater_err_status = _aqualink_data->heater_err_status;
   }
 
-  // LOG(NET_LOG,LOG_INFO, "mqtt_broadcast_aqualinkstate: START LEDs\n");
+  // Pumps, status uses the panel (LED) state as well.
+  for (i=0; i < aqdata->num_pumps; i++) {
+    pump_detail *pump = &aqdata->pumps[i];
+    int pumpStatus;
 
-  // if (time(NULL) % 2) {}   <-- use to determin odd/even second in time to make state flash on enabled.
+    if (pump->button == NULL || !mqtt_group_changed(MQG_PUMPS + i, v->unknown + v->pump[i] + led_version(aqdata, pump->button->led)))
+      continue;
 
-  // Loop over LED's and send any changes.
-  for (i=0; i < _aqualink_data->total_buttons; i++) {
-    if (_last_mqtt_aqualinkdata.aqualinkleds[i].state != _aqualink_data->aqbuttons[i].led->state) {
-      _last_mqtt_aqualinkdata.aqualinkleds[i].state = _aqualink_data->aqbuttons[i].led->state;
-      if (_aqualink_data->aqbuttons[i].code == KEY_POOL_HTR || _aqualink_data->aqbuttons[i].code == KEY_SPA_HTR) {
-        send_mqtt_heater_state_msg(nc, _aqualink_data->aqbuttons[i].name, _aqualink_data->aqbuttons[i].led->state);
-      } else {
-        send_mqtt_state_msg(nc, _aqualink_data->aqbuttons[i].name, _aqualink_data->aqbuttons[i].led->state);
-      }
-
-      send_mqtt_timer_state_msg(nc, _aqualink_data->aqbuttons[i].name, &_aqualink_data->aqbuttons[i]);
-    } else if ((_aqualink_data->aqbuttons[i].special_mask & TIMER_ACTIVE) == TIMER_ACTIVE) {
-      //send_mqtt_timer_duration_msg(nc, _aqualink_data->aqbuttons[i].name, &_aqualink_data->aqbuttons[i]);
-      // send_mqtt_timer_state_msg will call send_mqtt_timer_duration_msg so no need to do it here.
-      // Have to use send_mqtt_timer_state_msg due to a timer being set on a device that's already on, (ir no state change so above code does't get hit)
-      
-      struct timespec current_time;
-      clock_gettime(CLOCK_MONOTONIC, &current_time);
-
-      // Calculate the time difference in nanoseconds
-      long long time_difference_ns = (current_time.tv_sec - last_update_timestamp.tv_sec) * 1000000000LL + (current_time.tv_nsec - last_update_timestamp.tv_nsec);
-
-      // Check if 10 seconds (10 * 10^9 nanoseconds) have passed
-      if (time_difference_ns >= 10000000000LL || last_update_timestamp.tv_sec == 0) {
-        send_mqtt_timer_state_msg(nc, _aqualink_data->aqbuttons[i].name, &_aqualink_data->aqbuttons[i]);
-        last_update_timestamp = current_time;
-      }
-    }
-  }
-
-  // Loop over Pumps
-  for (i=0; i < _aqualink_data->num_pumps; i++) {
-    //_aqualink_data->pumps[i].rpm = TEMP_UNKNOWN;
-    //_aqualink_data->pumps[i].gph = TEMP_UNKNOWN;
-    //_aqualink_data->pumps[i].watts = TEMP_UNKNOWN;
-
-    if (_aqualink_data->pumps[i].rpm != TEMP_UNKNOWN && _aqualink_data->pumps[i].rpm != _last_mqtt_aqualinkdata.pumps[i].rpm) {
-      _last_mqtt_aqualinkdata.pumps[i].rpm = _aqualink_data->pumps[i].rpm;
-      //send_mqtt_aux_msg(nc, PUMP_TOPIC, i+1, PUMP_RPM_TOPIC, _aqualink_data->pumps[i].rpm);
-      send_mqtt_aux_msg(nc, _aqualink_data->pumps[i].button->name, PUMP_RPM_TOPIC, _aqualink_data->pumps[i].rpm);
-      if (_aqualink_data->pumps[i].pumpType == EPUMP || _aqualink_data->pumps[i].pumpType == VSPUMP) {
-        send_mqtt_aux_msg(nc, _aqualink_data->pumps[i].button->name, PUMP_SPEED_TOPIC, getPumpSpeedAsPercent(&_aqualink_data->pumps[i]));
-      }
-    }
-    if (_aqualink_data->pumps[i].gpm != TEMP_UNKNOWN && _aqualink_data->pumps[i].gpm != _last_mqtt_aqualinkdata.pumps[i].gpm) {
-      _last_mqtt_aqualinkdata.pumps[i].gpm = _aqualink_data->pumps[i].gpm;
-      //send_mqtt_aux_msg(nc, PUMP_TOPIC, i+1, PUMP_GPH_TOPIC, _aqualink_data->pumps[i].gph);
-      send_mqtt_aux_msg(nc, _aqualink_data->pumps[i].button->name, PUMP_GPM_TOPIC, _aqualink_data->pumps[i].gpm);
-      if (_aqualink_data->pumps[i].pumpType == VFPUMP) {
-        send_mqtt_aux_msg(nc, _aqualink_data->pumps[i].button->name, PUMP_SPEED_TOPIC, getPumpSpeedAsPercent(&_aqualink_data->pumps[i]));
-      }
-    }
-    if (_aqualink_data->pumps[i].watts != TEMP_UNKNOWN && _aqualink_data->pumps[i].watts != _last_mqtt_aqualinkdata.pumps[i].watts) {
-      _last_mqtt_aqualinkdata.pumps[i].watts = _aqualink_data->pumps[i].watts;
-      //send_mqtt_aux_msg(nc, PUMP_TOPIC, i+1, PUMP_WATTS_TOPIC, _aqualink_data->pumps[i].watts);
-      send_mqtt_aux_msg(nc, _aqualink_data->pumps[i].button->name, PUMP_WATTS_TOPIC, _aqualink_data->pumps[i].watts);
-    }
-    if (_aqualink_data->pumps[i].mode != TEMP_UNKNOWN && _aqualink_data->pumps[i].mode != _last_mqtt_aqualinkdata.pumps[i].mode) {
-      _last_mqtt_aqualinkdata.pumps[i].mode = _aqualink_data->pumps[i].mode;
-      send_mqtt_aux_msg(nc, _aqualink_data->pumps[i].button->name, PUMP_MODE_TOPIC, _aqualink_data->pumps[i].mode);
-    }
-    if (_aqualink_data->pumps[i].pressureCurve != TEMP_UNKNOWN && _aqualink_data->pumps[i].pressureCurve != _last_mqtt_aqualinkdata.pumps[i].pressureCurve) {
-      _last_mqtt_aqualinkdata.pumps[i].pressureCurve = _aqualink_data->pumps[i].pressureCurve;
-      send_mqtt_aux_msg(nc, _aqualink_data->pumps[i].button->name, PUMP_PPC_TOPIC, _aqualink_data->pumps[i].pressureCurve);
+    if (pump->rpm != TEMP_UNKNOWN) {
+      mqtt_queue_int(MQT_PUMP(i, MQT_PUMP_RPM), pump->rpm);
+      if (pump->pumpType == EPUMP || pump->pumpType == VSPUMP)
+        mqtt_queue_int(MQT_PUMP(i, MQT_PUMP_SPEED), getPumpSpeedAsPercent(pump));
     }
-    pumpStatus = getPumpStatus(i, _aqualink_data);
-    if (pumpStatus != TEMP_UNKNOWN && 
-        pumpStatus != _last_mqtt_aqualinkdata.pumps[i].status) {
-      _last_mqtt_aqualinkdata.pumps[i].status = pumpStatus;
-      send_mqtt_aux_msg(nc, _aqualink_data->pumps[i].button->name, PUMP_STATUS_TOPIC, pumpStatus);
+    if (pump->gpm != TEMP_UNKNOWN) {
+      mqtt_queue_int(MQT_PUMP(i, MQT_PUMP_GPM), pump->gpm);
+      if (pump->pumpType == VFPUMP)
+        mqtt_queue_int(MQT_PUMP(i, MQT_PUMP_SPEED), getPumpSpeedAsPercent(pump));
     }
+    if (pump->watts != TEMP_UNKNOWN)
+      mqtt_queue_int(MQT_PUMP(i, MQT_PUMP_WATTS), pump->watts);
+    if (pump->mode != TEMP_UNKNOWN)
+      mqtt_queue_int(MQT_PUMP(i, MQT_PUMP_MODE), pump->mode);
+    if (pump->pressureCurve != TEMP_UNKNOWN)
+      mqtt_queue_int(MQT_PUMP(i, MQT_PUMP_PPC), pump->pressureCurve);
+
+    pumpStatus = getPumpStatus(i, aqdata);
+    if (pumpStatus != TEMP_UNKNOWN)
+      mqtt_queue_int(MQT_PUMP(i, MQT_PUMP_STATUS), pumpStatus);
   }
 
-  // Loop over programmable lights
-  for (i=0; i < _aqualink_data->num_lights; i++) {
-    //LOG(NET_LOG,LOG_NOTICE, "Light %10s | %d | lmode=%.2d cmode=%.2d | name=%s\n",_aqualink_data->lights[i].button->label,_aqualink_data->lights[i].button->led->state,_aqualink_data->lights[i].lastValue,_aqualink_data->lights[i].currentValue,get_currentlight_mode_name(_aqualink_data->lights[i], RSSADAPTER));
-    char topic[50];
-    if ( _aqualink_data->lights[i].currentValue != TEMP_UNKNOWN && _aqualink_data->lights[i].currentValue != _last_mqtt_aqualinkdata.lights[i].currentValue ) {
-      _last_mqtt_aqualinkdata.lights[i].currentValue = _aqualink_data->lights[i].currentValue;
-      send_mqtt_aux_msg(nc, _aqualink_data->lights[i].button->name, LIGHT_PROGRAM_TOPIC, _aqualink_data->lights[i].currentValue);
+  // Programmable lights
+  for (i=0; i < aqdata->num_lights; i++) {
+    if (aqdata->lights[i].currentValue == TEMP_UNKNOWN || !mqtt_group_changed(MQG_LIGHTS + i, v->unknown + v->light[i]))
+      continue;
 
-      sprintf(topic, "%s%s/name", _aqualink_data->lights[i].button->name, LIGHT_PROGRAM_TOPIC);
-      if (_aqualink_data->lights[i].lightType == LC_DIMMER2) {
-        char message[30];
-        sprintf(message, "%d%%", _aqualink_data->lights[i].currentValue);
-        send_mqtt_string_msg(nc, topic, message);
-      } else {
-        //send_mqtt_string_msg(nc, topic, light_mode_name(_aqualink_data->lights[i].lightType, _aqualink_data->lights[i].currentValue, RSSADAPTER));
-        send_mqtt_string_msg(nc, topic, get_currentlight_mode_name(_aqualink_data->lights[i], RSSADAPTER));
-      }
-      /* 
-      if (_aqualink_data->lights[i].lightType == LC_DIMMER) {
-        sprintf(topic, "%s%s", _aqualink_data->lights[i].button->name, LIGHT_DIMMER_VALUE_TOPIC);
-        send_mqtt_int_msg(nc, topic, _aqualink_data->lights[i].currentValue * 25);
-      } else*/ if (_aqualink_data->lights[i].lightType == LC_DIMMER2) {
-        sprintf(topic, "%s%s", _aqualink_data->lights[i].button->name, LIGHT_DIMMER_VALUE_TOPIC);
-        send_mqtt_int_msg(nc, topic, _aqualink_data->lights[i].currentValue);
-      }
+    mqtt_queue_int(MQT_LIGHT(i, MQT_LIGHT_PROGRAM), aqdata->lights[i].currentValue);
+
+    if (aqdata->lights[i].lightType == LC_DIMMER2) {
+      char message[30];
+      sprintf(message, "%d%%", aqdata->lights[i].currentValue);
+      mqtt_queue(MQT_LIGHT(i, MQT_LIGHT_PROGRAM_NAME), message);
+      mqtt_queue_int(MQT_LIGHT(i, MQT_LIGHT_DIMMER), aqdata->lights[i].currentValue);
+    } else {
+      mqtt_queue(MQT_LIGHT(i, MQT_LIGHT_PROGRAM_NAME), get_currentlight_mode_name(aqdata->lights[i], RSSADAPTER));
     }
   }
 
-  // Loop over sensors
-  for (i=0; i < _aqualink_data->num_sensors; i++) {
-    if ( _aqualink_data->sensors[i].value != TEMP_UNKNOWN && _last_mqtt_aqualinkdata.sensors[i].value != _aqualink_data->sensors[i].value) {
-      char topic[50];
-      sprintf(topic, "%s%s", FULL_SENSOR_TOPIC, _aqualink_data->sensors[i].ID);
-      send_mqtt_float_msg(nc, topic, _aqualink_data->sensors[i].value);
-      _last_mqtt_aqualinkdata.sensors[i].value = _aqualink_data->sensors[i].value;
-    }
+  // Sensors
+  for (i=0; i < aqdata->num_sensors; i++) {
+    if ( aqdata->sensors[i].value != TEMP_UNKNOWN && mqtt_group_changed(MQG_SENSORS + i, v->unknown + v->sensor[i]))
+      mqtt_queue_float(MQT_SENSOR(i), aqdata->sensors[i].value);
   }
+
+  _mqtt_seen_all = true;
+
+  mqtt_flush(nc);
 }
 
 
-typedef enum {uActioned, uBad, uDevices, uStatus, uHomebridge, uDynamicconf, uDebugStatus, uDebugDownload, uSimulator, uSchedules, uSetSchedules, uAQmanager, uLogDownload, uNotAvailable, uConfig, uSaveConfig, uConfigDownload} uriAtype;
+typedef enum {uActioned, uBad, uDevices, uStatus, uHomebridge, uDynamicconf, uDebugStatus, uDebugDownload, uSimulator, uSchedules, uSetSchedules, uAQmanager, uLogDownload, uNotAvailable, uConfig, uSaveConfig, uConfigDownload, uAckLatency, uStatusDelta, uProgrammer, uWebCache, uMetrics, uFlightRecorder} uriAtype;
 //typedef enum {NET_MQTT=0, NET_API, NET_WS, DZ_MQTT} netRequest;
-const char actionName[][5] = {"MQTT", "API", "WS", "DZ"};
+const char actionName[][5] = {"MQTT", "API", "WS", "TIMR"};
 
 #define BAD_SETPOINT      "No device for setpoint found"
 #define NO_PLIGHT_DEVICE  "No programable light found"
@@ -958,6 +989,7 @@ const char actionName[][5] = {"MQTT", "API", "WS", "DZ"};
 #define PUMP_NOT_FOUND    "No matching Pump found"
 #define NO_DEVICE         "No matching Device found"
 #define INVALID_VALUE     "Invalid value"
+#define NO_PROGRAMMING_JOB "No matching queued programming job"
 #define NOCHANGE_IGNORING "No change, device is already in that state"
 #define UNKNOWN_REQUEST   "Didn't understand request"
 
@@ -1004,9 +1036,14 @@ uriAtype action_URI(request_source from, const char *URI, int uri_length, float
   uriAtype rtn = uBad;
   bool found = false;
   int i;
+  const char *end = URI + uri_length;
   char *ri1 = (char *)URI;
   char *ri2 = NULL;
   char *ri3 = NULL;
+  int ri1_len;
+  uri_route route;
+  uri_keyword kw2;
+  uri_keyword kw3;
   //bool charvalue=false;
   //char *ri4 = NULL;
 
@@ -1027,27 +1064,59 @@ uriAtype action_URI(request_source from, const char *URI, int uri_length, float
     }
   }
 
+  // Segments are matched whole from the route tables, see uri_routes.c
+  ri1_len = uri_segment_length(ri1, end);
+  route = uri_route_lookup(ri1, ri1_len);
+  kw2 = uri_keyword_lookup(ri2, uri_segment_length(ri2, end));
+  kw3 = uri_keyword_lookup(ri3, uri_segment_length(ri3, end));
+
   //LOG(NET_LOG,LOG_NOTICE, "URI Request: %.*s, %.*s, %.*s | %f\n", uri_length, ri1, uri_length - (ri2 - ri1), ri2, uri_length - (ri3 - ri1), ri3, value);
-  
-  if (strncmp(ri1, "devices", 7) == 0) {
+
+  // Anything only valid from websocket breaks out and gets treated as a device.
+  switch (route) {
+  case URI_DEVICES:
     return uDevices;
-  } else if (strncmp(ri1, "status", 6) == 0) {
+  case URI_STATUSDELTA:
+    if (from == NET_WS) // Only valid from websocket.
+      return uStatusDelta;
+    return uStatus;
+  case URI_STATUS:
     return uStatus;
-  } else if (strncmp(ri1, "homebridge", 10) == 0) {
+  case URI_HOMEBRIDGE:
     return uHomebridge;
-  } else if (strncmp(ri1, "dynamicconfig", 13) == 0) {
+  case URI_DYNAMICCONFIG:
     return uDynamicconf;
-  } else if (strncmp(ri1, "schedules/set", 13) == 0) {
-    return uSetSchedules;
-  } else if (strncmp(ri1, "schedules", 9) == 0) {
+  case URI_SCHEDULES:
+    if (kw2 == UKW_SET)
+      return uSetSchedules;
     return uSchedules;
-  } else if (strncmp(ri1, "config/download", 10) == 0) {
-    return uConfigDownload;
-  } else if (strncmp(ri1, "config/set", 10) == 0) {
-    return uSaveConfig;
-  } else if (strncmp(ri1, "config", 6) == 0) {
+  case URI_CONFIG:
+    if (kw2 == UKW_DOWNLOAD)
+      return uConfigDownload;
+    else if (kw2 == UKW_SET)
+      return uSaveConfig;
     return uConfig;
-  } else if (strncmp(ri1, "simulator", 9) == 0 && from == NET_WS) { // Only valid from websocket.
+  case URI_ACKLATENCY:
+    return uAckLatency;
+  case URI_WEBCACHE:
+    return uWebCache;
+  case URI_METRICS:
+    return uMetrics;
+  case URI_FLIGHTRECORDER:
+    return uFlightRecorder;
+  case URI_PROGRAMMER:
+    // programmer/cancel/<id> or programmer/cancel with value=<id>
+    if (kw2 == UKW_CANCEL) {
+      unsigned int id = (ri3 != NULL)?strtoul(ri3, NULL, 10):(unsigned int)value;
+      if (cancel_aq_programmer_job(id))
+        return uActioned;
+      *rtnmsg = NO_PROGRAMMING_JOB;
+      return uBad;
+    }
+    return uProgrammer;
+  case URI_SIMULATOR:
+    if (from != NET_WS) // Only valid from websocket.
+      break;
     if (ri2 != NULL && strncmp(ri2, "onetouch", 8) == 0) {
       start_simulator(_aqualink_data, ONETOUCH);
     } else if (ri2 != NULL && strncmp(ri2, "allbutton", 9) == 0) {
@@ -1060,16 +1129,24 @@ uriAtype action_URI(request_source from, const char *URI, int uri_length, float
       return uBad;
     }
     return uSimulator;
-  } else if (strncmp(ri1, "simcmd", 10) == 0 && from == NET_WS) { // Only valid from websocket.
+  case URI_SIMCMD:
+    if (from != NET_WS) // Only valid from websocket.
+      break;
     simulator_send_cmd((unsigned char)value);
     return uActioned;
 #ifdef AQ_MANAGER
-  } else if (strncmp(ri1, "aqmanager", 9) == 0 && from == NET_WS) { // Only valid from websocket.
+  case URI_AQMANAGER:
+    if (from != NET_WS) // Only valid from websocket.
+      break;
     return uAQmanager;
-  } else if (strncmp(ri1, "setloglevel", 11) == 0 && from == NET_WS) { // Only valid from websocket.
+  case URI_SETLOGLEVEL:
+    if (from != NET_WS) // Only valid from websocket.
+      break;
     setSystemLogLevel(round(value));
     return uAQmanager; // Want to resent updated status
-  } else if (strncmp(ri1, "addlogmask", 10) == 0 && from == NET_WS) { // Only valid from websocket.
+  case URI_ADDLOGMASK:
+    if (from != NET_WS) // Only valid from websocket.
+      break;
     if ( round(value) == RSSD_LOG ) {
       // Check for filter on RSSD LOG
       if (ri2 != NULL) {
@@ -1088,7 +1165,9 @@ uriAtype action_URI(request_source from, const char *URI, int uri_length, float
     }
     addDebugLogMask(round(value));
     return uAQmanager; // Want to resent updated status
-  } else if (strncmp(ri1, "removelogmask", 13) == 0 && from == NET_WS) { // Only valid from websocket.
+  case URI_REMOVELOGMASK:
+    if (from != NET_WS) // Only valid from websocket.
+      break;
     removeDebugLogMask(round(value));
     if ( round(value) == RSSD_LOG ) {
       for (int i=0; i < MAX_RSSD_LOG_FILTERS; i++) {
@@ -1098,27 +1177,35 @@ uriAtype action_URI(request_source from, const char *URI, int uri_length, float
       //LOG(NET_LOG,LOG_NOTICE, "Removed RSSD LOG filter");
     }
     return uAQmanager; // Want to resent updated status
-  } else if (strncmp(ri1, "logfile", 7) == 0) {
-    if (ri2 != NULL && strncmp(ri2, "download", 8) == 0) {
+  case URI_LOGFILE:
+    if (kw2 == UKW_DOWNLOAD) {
       LOG(NET_LOG,LOG_INFO, "Received download log request!\n");
       return uLogDownload;
-    } 
+    }
     return uAQmanager; // Want to resent updated status
-  } else if (strncmp(ri1, "restart", 7) == 0 && from == NET_WS) { // Only valid from websocket.
+  case URI_RESTART:
+    if (from != NET_WS) // Only valid from websocket.
+      break;
     LOG(NET_LOG,LOG_NOTICE, "Received restart request!\n");
     raise(SIGRESTART);
-    return uActioned; 
-  } else if (strncmp(ri1, "upgrade", 7) == 0 && from == NET_WS) { // Only valid from websocket.
+    return uActioned;
+  case URI_UPGRADE:
+    if (from != NET_WS) // Only valid from websocket.
+      break;
     LOG(NET_LOG,LOG_NOTICE, "Received upgrade request!\n");
     setMASK(_aqualink_data->updatetype, UPDATERELEASE);
     raise(SIGRUPGRADE);
-    return uActioned; 
-  } else if (strncmp(ri1, "installdevrelease", 17) == 0 && from == NET_WS) { // Only valid from websocket.
+    return uActioned;
+  case URI_INSTALLDEVRELEASE:
+    if (from != NET_WS) // Only valid from websocket.
+      break;
     LOG(NET_LOG,LOG_NOTICE, "Received install dev release request!\n");
     setMASK(_aqualink_data->updatetype, INSTALLDEVRELEASE);
     raise(SIGRUPGRADE);
-    return uActioned; 
-  } else if (strncmp(ri1, "seriallogger", 12) == 0 && from == NET_WS) { // Only valid from websocket.
+    return uActioned;
+  case URI_SERIALLOGGER:
+    if (from != NET_WS) // Only valid from websocket.
+      break;
     LOG(NET_LOG,LOG_NOTICE, "Received request to run serial_logger!\n");
     //LOG(NET_LOG,LOG_NOTICE, "Received request ri1=%s, ri2=%s, ri3=%s value=%f\n",ri1,ri2,ri3,value);
     _aqualink_data->slogger_packets = round(value);
@@ -1135,15 +1222,17 @@ uriAtype action_URI(request_source from, const char *URI, int uri_length, float
     }
     //LOG(NET_LOG,LOG_NOTICE, "Received request to run serial_logger (%d,%s,%s)!\n",
     //                        _aqualink_data->slogger_packets,
-    //                        _aqualink_data->slogger_ids[0]!='\0'?_aqualink_data->slogger_ids:" ", 
-    //                        _aqualink_data->slogger_debug?"debug":"" ); 
+    //                        _aqualink_data->slogger_ids[0]!='\0'?_aqualink_data->slogger_ids:" ",
+    //                        _aqualink_data->slogger_debug?"debug":"" );
     _aqualink_data->run_slogger = true;
     return uActioned;
 #else // AQ_MANAGER
-  } else if (strncmp(ri1, "aqmanager", 9) == 0 && from == NET_WS) { // Only valid from websocket.
+  case URI_AQMANAGER:
+    if (from != NET_WS) // Only valid from websocket.
+      break;
     return uNotAvailable;
   // BELOW IS FOR OLD DEBUG.HTML, Need to remove in future release with aqmanager goes live
-  } else if (strncmp(ri1, "debug", 5) == 0) {
+  case URI_DEBUG:
     if (ri2 != NULL && strncmp(ri2, "start", 5) == 0) {
       startInlineDebug();
     } else if (ri2 != NULL && strncmp(ri2, "stop", 4) == 0) {
@@ -1154,17 +1243,17 @@ uriAtype action_URI(request_source from, const char *URI, int uri_length, float
       stopInlineDebug();
     } else if (ri2 != NULL && strncmp(ri2, "clean", 5) == 0) {
       cleanInlineDebug();
-    } else if (ri2 != NULL && strncmp(ri2, "download", 8) == 0) {
+    } else if (kw2 == UKW_DOWNLOAD) {
       return uDebugDownload;
-    } 
+    }
     return uDebugStatus;
 #endif //AQ_MANAGER
-// couple of debug items for testing 
-  } else if (strncmp(ri1, "set_date_time", 13) == 0) {
+// couple of debug items for testing
+  case URI_SET_DATE_TIME:
     //aq_programmer(AQ_SET_TIME, NULL, _aqualink_data);
     panel_device_request(_aqualink_data, DATE_TIME, 0, 0, from);
     return uActioned;
-  } else if (strncmp(ri1, "startup_program", 15) == 0) {
+  case URI_STARTUP_PROGRAM:
     if(isRS_PANEL)
       queueGetProgramData(ALLBUTTON, _aqualink_data);
     if(isRSSA_ENABLED)
@@ -1178,8 +1267,13 @@ uriAtype action_URI(request_source from, const char *URI, int uri_length, float
       queueGetProgramData(AQUAPDA, _aqualink_data);
 #endif
     return uActioned;
+  default:
+    // Device request, dealt with below.
+    break;
+  }
+
 // Action a setpoint message
-  } else if (ri3 != NULL && (strncasecmp(ri2, "setpoint", 8) == 0) && (strncasecmp(ri3, "increment", 9) == 0)) {
+  if (kw2 == UKW_SETPOINT && kw3 == UKW_INCREMENT) {
     if (!isRSSA_ENABLED) {
       LOG(NET_LOG,LOG_WARNING, "%s: ignoring %.*s setpoint increment only valid when RS Serial adapter protocol is enabeled\n", actionName[from], uri_length, URI);
       *rtnmsg = BAD_SETPOINT;
@@ -1188,10 +1282,10 @@ uriAtype action_URI(request_source from, const char *URI, int uri_length, float
 
     int val = round(value);
 
-    if (strncmp(ri1, BTN_POOL_HTR, strlen(BTN_POOL_HTR)) == 0) {
+    if (route == URI_DEV_POOL_HTR) {
       //create_program_request(from, POOL_HTR_INCREMENT, val, 0);
       panel_device_request(_aqualink_data, POOL_HTR_INCREMENT, 0, val, from);
-    } else if (strncmp(ri1, BTN_SPA_HTR, strlen(BTN_SPA_HTR)) == 0) {
+    } else if (route == URI_DEV_SPA_HTR) {
       //create_program_request(from, SPA_HTR_INCREMENT, val, 0);
       panel_device_request(_aqualink_data, SPA_HTR_INCREMENT, 0, val, from);
     } else {
@@ -1200,21 +1294,21 @@ uriAtype action_URI(request_source from, const char *URI, int uri_length, float
       return uBad;
     }
     rtn = uActioned;
-  } else if (ri3 != NULL && (strncasecmp(ri2, "setpoint", 8) == 0) && (strncasecmp(ri3, "set", 3) == 0)) {
+  } else if (kw2 == UKW_SETPOINT && kw3 == UKW_SET) {
     int val =  convertTemp? round(degCtoF(value)) : round(value);
-    if (strncmp(ri1, BTN_POOL_HTR, strlen(BTN_POOL_HTR)) == 0) {
+    if (route == URI_DEV_POOL_HTR) {
      //create_program_request(from, POOL_HTR_SETPOINT, val, 0);
       panel_device_request(_aqualink_data, POOL_HTR_SETPOINT, 0, val, from);
-    } else if (strncmp(ri1, BTN_SPA_HTR, strlen(BTN_SPA_HTR)) == 0) {
+    } else if (route == URI_DEV_SPA_HTR) {
       //create_program_request(from, SPA_HTR_SETPOINT, val, 0);
       panel_device_request(_aqualink_data, SPA_HTR_SETPOINT, 0, val, from);
-    } else if (strncmp(ri1, FREEZE_PROTECT, strlen(FREEZE_PROTECT)) == 0) {
+    } else if (route == URI_DEV_FREEZE) {
       //create_program_request(from, FREEZE_SETPOINT, val, 0);
       panel_device_request(_aqualink_data, FREEZE_SETPOINT, 0, val, from);
-    } else if (strncmp(ri1, CHILLER, strlen(CHILLER)) == 0) {
+    } else if (route == URI_DEV_CHILLER) {
       //create_program_request(from, FREEZE_SETPOINT, val, 0);
       panel_device_request(_aqualink_data, CHILLER_SETPOINT, 0, val, from);
-    } else if (strncmp(ri1, "SWG", 3) == 0) {  // If we get SWG percent as setpoint message it's from homebridge so use the convert
+    } else if (route == URI_DEV_SWG) {  // If we get SWG percent as setpoint message it's from homebridge so use the convert
       //int val = round(degCtoF(value));
       //int val = convertTemp? round(degCtoF(value)) : round(value);
       //create_program_request(from, SWG_SETPOINT, val, 0);
@@ -1233,9 +1327,9 @@ uriAtype action_URI(request_source from, const char *URI, int uri_length, float
       _aqualink_data->unactioned.requested = 0;
       */
   // Action a SWG Percent message
-  } else if ((ri3 != NULL && (strncmp(ri1, "SWG", 3) == 0) && (strncasecmp(ri2, "Percent", 7) == 0) && (strncasecmp(ri3, "set", 3) == 0))) {
+  } else if (route == URI_DEV_SWG && (kw2 == UKW_PERCENT || kw2 == UKW_PERCENT_F) && kw3 == UKW_SET) {
     int val;
-    if ( (strncmp(ri2, "Percent_f", 9) == 0)  ) {
+    if ( kw2 == UKW_PERCENT_F ) {
       val = _aqualink_data->unactioned.value = round(degCtoF(value));
     } else {
       val = _aqualink_data->unactioned.value = round(value);
@@ -1244,7 +1338,7 @@ uriAtype action_URI(request_source from, const char *URI, int uri_length, float
     panel_device_request(_aqualink_data, SWG_SETPOINT, 0, val, from);
     rtn = uActioned;
   // Action a SWG boost message
-  } else if ((ri3 != NULL && (strncmp(ri1, "SWG", 3) == 0) && (strncasecmp(ri2, "Boost", 5) == 0) && (strncasecmp(ri3, "set", 3) == 0))) {
+  } else if (route == URI_DEV_SWG && kw2 == UKW_BOOST && kw3 == UKW_SET) {
     //create_program_request(from, SWG_BOOST, round(value), 0);
     panel_device_request(_aqualink_data, SWG_BOOST, 0, round(value), from);
     if (_aqualink_data->swg_led_state == OFF)
@@ -1252,54 +1346,38 @@ uriAtype action_URI(request_source from, const char *URI, int uri_length, float
     else
       rtn = uActioned;
   // Action Light program.
-  } else if ((ri3 != NULL && ((strncasecmp(ri2, "color", 5) == 0) || (strncasecmp(ri2, "program", 7) == 0)) && (strncasecmp(ri3, "set", 3) == 0))) {
-    found = false;
-    for (i=0; i < _aqualink_data->total_buttons; i++) {
-      if (strncmp(ri1, _aqualink_data->aqbuttons[i].name, strlen(_aqualink_data->aqbuttons[i].name)) == 0 ||
-          strncmp(ri1, _aqualink_data->aqbuttons[i].label, strlen(_aqualink_data->aqbuttons[i].label)) == 0)
-      {
-        //char buf[5];
-        found = true;
-        //sprintf(buf,"%.0f",value);
-        //set_light_mode(buf, i);
-        panel_device_request(_aqualink_data, LIGHT_MODE, i, value, from);
-        break;
-      }
-    }
-    if(!found) {
+  } else if ((kw2 == UKW_COLOR || kw2 == UKW_PROGRAM) && kw3 == UKW_SET) {
+    i = uri_button_lookup(_aqualink_data, ri1, ri1_len, URI_BTN_NAME | URI_BTN_LABEL);
+    if (i < 0) {
       *rtnmsg = NO_PLIGHT_DEVICE;
       LOG(NET_LOG,LOG_WARNING, "%s: Didn't find device that matched URI '%.*s'\n",actionName[from], uri_length, URI);
       rtn = uBad;
     } else {
+      //char buf[5];
+      //sprintf(buf,"%.0f",value);
+      //set_light_mode(buf, i);
+      panel_device_request(_aqualink_data, LIGHT_MODE, i, value, from);
       rtn = uActioned;
     }
-  } else if ((ri3 != NULL && (strncasecmp(ri2, "brightness", 10) == 0) && (strncasecmp(ri3, "set", 3) == 0))) {
-    found = false;
-    for (i=0; i < _aqualink_data->total_buttons; i++) {
-      if (strncmp(ri1, _aqualink_data->aqbuttons[i].name, strlen(_aqualink_data->aqbuttons[i].name)) == 0 ||
-          strncmp(ri1, _aqualink_data->aqbuttons[i].label, strlen(_aqualink_data->aqbuttons[i].label)) == 0)
-      {
-        found = true;
-        panel_device_request(_aqualink_data, LIGHT_BRIGHTNESS, i, value, from);
-        break;
-      }
-    }
-    if(!found) {
+  } else if (kw2 == UKW_BRIGHTNESS && kw3 == UKW_SET) {
+    i = uri_button_lookup(_aqualink_data, ri1, ri1_len, URI_BTN_NAME | URI_BTN_LABEL);
+    if (i < 0) {
       *rtnmsg = NO_PLIGHT_DEVICE;
       LOG(NET_LOG,LOG_WARNING, "%s: Didn't find device that matched URI '%.*s'\n",actionName[from], uri_length, URI);
       rtn = uBad;
     } else {
+      panel_device_request(_aqualink_data, LIGHT_BRIGHTNESS, i, value, from);
       rtn = uActioned;
     }
   // Action a pump RPM/GPM message
-  } else if ((ri3 != NULL && ((strncasecmp(ri2, "RPM", 3) == 0) || (strncasecmp(ri2, "GPM", 3) == 0) || (strncasecmp(ri2, "Speed", 5) == 0) || (strncasecmp(ri2, "VSP", 3) == 0)) && (strncasecmp(ri3, "set", 3) == 0))) {
+  } else if ((kw2 == UKW_RPM || kw2 == UKW_GPM || kw2 == UKW_SPEED || kw2 == UKW_VSP) && kw3 == UKW_SET) {
     found = false;
     // Is it a pump index or pump name
     if (strncmp(ri1, "Pump_", 5) == 0) { // Pump by number
-      int pumpIndex = atoi(ri1+5); // Check for 0   
+      int pumpIndex = atoi(ri1+5); // Check for 0
       for (i=0; i < _aqualink_data->num_pumps; i++) {
         if (_aqualink_data->pumps[i].pumpIndex == pumpIndex) {
-          if ((strncasecmp(ri2, "VSP", 3) == 0)) {
+          if (kw2 == UKW_VSP) {
             if (isIAQT_ENABLED) {
               //LOG(NET_LOG,LOG_NOTICE, "%s: request to change pump %d to program %d\n",actionName[from], pumpIndex+1, round(value));
               //create_program_request(from, PUMP_VSPROGRAM, round(value), pumpIndex);
@@ -1312,12 +1390,12 @@ uriAtype action_URI(request_source from, const char *URI, int uri_length, float
               return uBad;
             }
           } else {
-            if (strncasecmp(ri2, "Speed", 5) == 0) {
+            if (kw2 == UKW_SPEED) {
               int val = convertPumpPercentToSpeed(&_aqualink_data->pumps[i], round(value));
               LOG(NET_LOG,LOG_NOTICE, "%s: request to change pump %d Speed to %d%%, using %s of %d\n",actionName[from],pumpIndex+1, round(value), (_aqualink_data->pumps[i].pumpType==VFPUMP?"GPM":"RPM" ) ,val);
-              panel_device_request(_aqualink_data, PUMP_RPM, pumpIndex, val, from); 
+              panel_device_request(_aqualink_data, PUMP_RPM, pumpIndex, val, from);
             } else {
-              LOG(NET_LOG,LOG_NOTICE, "%s: request to change pump %d %s to %d\n",actionName[from],pumpIndex+1, (strncasecmp(ri2, "GPM", 3) == 0)?"GPM":"RPM", round(value));
+              LOG(NET_LOG,LOG_NOTICE, "%s: request to change pump %d %s to %d\n",actionName[from],pumpIndex+1, (kw2 == UKW_GPM)?"GPM":"RPM", round(value));
             //create_program_request(from, PUMP_RPM, round(value), pumpIndex);
               panel_device_request(_aqualink_data, PUMP_RPM, pumpIndex, round(value), from);
             }
@@ -1329,44 +1407,38 @@ uriAtype action_URI(request_source from, const char *URI, int uri_length, float
           break;
         }
       }
-    } else { // Pump by button name
-      for (i=0; i < _aqualink_data->total_buttons ; i++) {
-        //if (strncmp(ri1, _aqualink_data->aqbuttons[i].name, strlen(_aqualink_data->aqbuttons[i].name)) == 0 ){
-        if ( uri_strcmp(ri1, _aqualink_data->aqbuttons[i].name) || 
-             ( isVBUTTON_ALTLABEL(_aqualink_data->aqbuttons[i].special_mask) && uri_strcmp(ri1, ((altlabel_detail *)_aqualink_data->aqbuttons[i].special_mask_ptr)->altlabel)) ) {
-          int pi;
-          for (pi=0; pi < _aqualink_data->num_pumps; pi++) {
-            if (_aqualink_data->pumps[pi].button == &_aqualink_data->aqbuttons[i]) {
-              if ((strncasecmp(ri2, "VSP", 3) == 0)) {
-                if (isIAQT_ENABLED) {
-                  //LOG(NET_LOG,LOG_NOTICE, "%s: request to change pump %d to program %d\n",actionName[from], pi+1, round(value));
-                  //create_program_request(from, PUMP_VSPROGRAM, round(value), _aqualink_data->pumps[pi].pumpIndex);
-                  LOG(NET_LOG,LOG_ERR, "Setting Pump VSP is not supported yet\n");
-                  *rtnmsg = NO_VSP_SUPPORT;
-                  return uBad;
-                } else {
-                  LOG(NET_LOG,LOG_ERR, "Setting Pump VSP only supported if iAqualinkTouch protocol en enabled\n");
-                  *rtnmsg = NO_VSP_SUPPORT;
-                  return uBad;
-                }
-              } else {
-                if (strncasecmp(ri2, "Speed", 5) == 0) {
-                  int val = convertPumpPercentToSpeed(&_aqualink_data->pumps[pi], round(value));
-                  LOG(NET_LOG,LOG_NOTICE, "%s: request to change pump %d Speed to %d%%, using %s of %d\n",actionName[from],_aqualink_data->pumps[pi].pumpIndex, round(value), (_aqualink_data->pumps[i].pumpType==VFPUMP?"GPM":"RPM" ) ,val);
-                  panel_device_request(_aqualink_data, PUMP_RPM, _aqualink_data->pumps[pi].pumpIndex, val, from); 
-                } else {
-                  LOG(NET_LOG,LOG_NOTICE, "%s: request to change pump %d %s to %d\n",actionName[from], pi+1, (strncasecmp(ri2, "GPM", 3) == 0)?"GPM":"RPM", round(value));
-                //create_program_request(from, PUMP_RPM, round(value), _aqualink_data->pumps[pi].pumpIndex);
-                  panel_device_request(_aqualink_data, PUMP_RPM, _aqualink_data->pumps[pi].pumpIndex, round(value), from);
-                }
-              }
-              //_aqualink_data->unactioned.type = PUMP_RPM;
-              //_aqualink_data->unactioned.value = round(value);
-              //_aqualink_data->unactioned.id = _aqualink_data->pumps[pi].pumpIndex;
-              found=true;
-              break;
+    } else if ( (i = uri_button_lookup(_aqualink_data, ri1, ri1_len, URI_BTN_NAME | URI_BTN_ALTLABEL)) >= 0 ) { // Pump by button name
+      int pi;
+      for (pi=0; pi < _aqualink_data->num_pumps; pi++) {
+        if (_aqualink_data->pumps[pi].button == &_aqualink_data->aqbuttons[i]) {
+          if (kw2 == UKW_VSP) {
+            if (isIAQT_ENABLED) {
+              //LOG(NET_LOG,LOG_NOTICE, "%s: request to change pump %d to program %d\n",actionName[from], pi+1, round(value));
+              //create_program_request(from, PUMP_VSPROGRAM, round(value), _aqualink_data->pumps[pi].pumpIndex);
+              LOG(NET_LOG,LOG_ERR, "Setting Pump VSP is not supported yet\n");
+              *rtnmsg = NO_VSP_SUPPORT;
+              return uBad;
+            } else {
+              LOG(NET_LOG,LOG_ERR, "Setting Pump VSP only supported if iAqualinkTouch protocol en enabled\n");
+              *rtnmsg = NO_VSP_SUPPORT;
+              return uBad;
+            }
+          } else {
+            if (kw2 == UKW_SPEED) {
+              int val = convertPumpPercentToSpeed(&_aqualink_data->pumps[pi], round(value));
+              LOG(NET_LOG,LOG_NOTICE, "%s: request to change pump %d Speed to %d%%, using %s of %d\n",actionName[from],_aqualink_data->pumps[pi].pumpIndex, round(value), (_aqualink_data->pumps[pi].pumpType==VFPUMP?"GPM":"RPM" ) ,val);
+              panel_device_request(_aqualink_data, PUMP_RPM, _aqualink_data->pumps[pi].pumpIndex, val, from);
+            } else {
+              LOG(NET_LOG,LOG_NOTICE, "%s: request to change pump %d %s to %d\n",actionName[from], pi+1, (kw2 == UKW_GPM)?"GPM":"RPM", round(value));
+            //create_program_request(from, PUMP_RPM, round(value), _aqualink_data->pumps[pi].pumpIndex);
+              panel_device_request(_aqualink_data, PUMP_RPM, _aqualink_data->pumps[pi].pumpIndex, round(value), from);
             }
           }
+          //_aqualink_data->unactioned.type = PUMP_RPM;
+          //_aqualink_data->unactioned.value = round(value);
+          //_aqualink_data->unactioned.id = _aqualink_data->pumps[pi].pumpIndex;
+          found=true;
+          break;
         }
       }
     }
@@ -1377,14 +1449,14 @@ uriAtype action_URI(request_source from, const char *URI, int uri_length, float
     } else {
       rtn = uActioned;
     }
-  } else if ((ri3 != NULL && (strncmp(ri1, "CHEM", 4) == 0) && (strncasecmp(ri3, "set", 3) == 0))) {
+  } else if (route == URI_DEV_CHEM && kw3 == UKW_SET) {
   //aqualinkd/CHEM/pH/set
   //aqualinkd/CHEM/ORP/set
-    if ( strncasecmp(ri2, "ORP", 3) == 0 ) {
+    if ( kw2 == UKW_ORP ) {
       SET_IF_CHANGED(_aqualink_data->orp, round(value), _aqualink_data->is_dirty);
       rtn = uActioned;
       LOG(NET_LOG,LOG_NOTICE, "%s: request to set ORP to %d\n",actionName[from],_aqualink_data->orp);
-    } else if ( strncasecmp(ri2, "Ph", 2) == 0 ) {
+    } else if ( kw2 == UKW_PH ) {
       SET_IF_CHANGED(_aqualink_data->ph, value, _aqualink_data->is_dirty);
       rtn = uActioned;
       LOG(NET_LOG,LOG_NOTICE, "%s: request to set Ph to %.2f\n",actionName[from],_aqualink_data->ph);
@@ -1393,43 +1465,31 @@ uriAtype action_URI(request_source from, const char *URI, int uri_length, float
       rtn = uBad;
     }
   // Action a Turn on / off message
-  } else if ( (ri2 != NULL && (strncasecmp(ri2, "set", 3) == 0) && (strncasecmp(ri2, "setpoint", 8) != 0)) ||
-              (ri2 != NULL && ri3 != NULL && (strncasecmp(ri2, "timer", 5) == 0) && (strncasecmp(ri3, "set", 3) == 0)) ) {
+  } else if ( kw2 == UKW_SET || (kw2 == UKW_TIMER && kw3 == UKW_SET) ) {
     // Must be a switch on / off
     rtn = uActioned;
-    found = false;
     //bool istimer = false;
     action_type atype = ON_OFF;
     //int timer=0;
-    if (strncasecmp(ri2, "timer", 5) == 0) {
+    if (kw2 == UKW_TIMER) {
       //istimer = true;
       atype = TIMER;
       //timer = value; // Save off timer
       //value = 1; // Make sure we turn device on if timer.
     } else if ( value > 1 || value < 0) {
-      LOG(NET_LOG,LOG_WARNING, "%s: URI %s has invalid value %.2f\n",actionName[from], URI, value);
+      LOG(NET_LOG,LOG_WARNING, "%s: URI %.*s has invalid value %.2f\n",actionName[from], uri_length, URI, value);
       *rtnmsg = INVALID_VALUE;
       rtn = uBad;
       return rtn;
     }
 
-    for (i=0; i < _aqualink_data->total_buttons && found==false; i++) {
-      // If Label = "Spa", "Spa_Heater" will turn on "Spa", so need to check '/' on label as next character
-      //if (strncmp(ri1, _aqualink_data->aqbuttons[i].name, strlen(_aqualink_data->aqbuttons[i].name)) == 0 ||
-      //   (strncmp(ri1, _aqualink_data->aqbuttons[i].label, strlen(_aqualink_data->aqbuttons[i].label)) == 0 && ri1[strlen(_aqualink_data->aqbuttons[i].label)] == '/'))
-      //if ( uri_strcmp(ri1, _aqualink_data->aqbuttons[i].name) || uri_strcmp(ri1, _aqualink_data->aqbuttons[i].label) )
-
-      if ( uri_strcmp(ri1, _aqualink_data->aqbuttons[i].name) || uri_strcmp(ri1, _aqualink_data->aqbuttons[i].label) || 
-         ( isVBUTTON_ALTLABEL(_aqualink_data->aqbuttons[i].special_mask) && uri_strcmp(ri1, ((altlabel_detail *)_aqualink_data->aqbuttons[i].special_mask_ptr)->altlabel)) )
-      {
-        found = true;
-        //create_panel_request(from, i, value, istimer);
-        LOG(NET_LOG,LOG_INFO, "%d: MATCH %s to topic %.*s\n",from,_aqualink_data->aqbuttons[i].name,uri_length, URI);
-        LOG(NET_LOG,LOG_INFO, "ri1=%s, length=%d char at len=%c\n",ri1,strlen(_aqualink_data->aqbuttons[i].label),ri1[strlen(_aqualink_data->aqbuttons[i].label)] );
-        panel_device_request(_aqualink_data, atype, i, value, from);
-      }
-    }
-    if(!found) {
+    // If Label = "Spa", "Spa_Heater" will turn on "Spa", index only matches the whole segment.
+    i = uri_button_lookup(_aqualink_data, ri1, ri1_len, URI_BTN_ANY);
+    if (i >= 0) {
+      //create_panel_request(from, i, value, istimer);
+      LOG(NET_LOG,LOG_INFO, "%d: MATCH %s to topic %.*s\n",from,_aqualink_data->aqbuttons[i].name,uri_length, URI);
+      panel_device_request(_aqualink_data, atype, i, value, from);
+    } else {
       *rtnmsg = NO_DEVICE;
       LOG(NET_LOG,LOG_WARNING, "%s: Didn't find device that matched URI '%.*s'\n",actionName[from], uri_length, URI);
       rtn = uBad;
@@ -1444,28 +1504,73 @@ uriAtype action_URI(request_source from, const char *URI, int uri_length, float
   return rtn;
 }
 
+// Scheduled action rather than curl'ing the API, URL is as saved ie /api/Filter_Pump/set
+// Net thread only (or nothing else running, ie aqbench), same as any other action_URI().
+bool action_scheduled_URI(const char *URI, float value)
+{
+  char *msg = NULL;
+
+  if (strncmp(URI, "/api/", 5) == 0)
+    URI += 5;
+
+  return (action_URI(NET_TIMER, URI, strlen(URI), value, false, &msg) != uBad);
+}
+
 /*
-  Quicker and more accurate for us than normal strncmp, since we check for the trailing / at right position
-  check Spa against uri /Spa/set /Spa_mode/set / Spa_heater/set
+  The scheduler thread posts here and the net loop runs them, so a schedule changes state on the
+  same thread web & MQTT requests do (as it did when cron curl'd the API) and never races them.
 */
-bool uri_strcmp(const char *uri, const char *string) {
-  int i;
-  int len = strlen(string);
+#define MAX_SCHEDULED_ACTIONS 16
 
-  // Check the trailing / on length first.
-  if (uri[len] != '/') {
-    return false;
+typedef struct scheduled_action {
+  char uri[CV_SIZE * 2]; // aqs_cron.url
+  float value;
+} scheduled_action;
+
+static pthread_mutex_t _scheduled_mutex = PTHREAD_MUTEX_INITIALIZER;
+static scheduled_action _scheduled[MAX_SCHEDULED_ACTIONS];
+static int _num_scheduled = 0;
+
+bool post_scheduled_URI(const char *URI, float value)
+{
+  bool rtn = false;
+
+  pthread_mutex_lock(&_scheduled_mutex);
+  if (_num_scheduled < MAX_SCHEDULED_ACTIONS) {
+    snprintf(_scheduled[_num_scheduled].uri, sizeof(_scheduled[_num_scheduled].uri), "%s", URI);
+    _scheduled[_num_scheduled].value = value;
+    _num_scheduled++;
+    rtn = true;
   }
+  pthread_mutex_unlock(&_scheduled_mutex);
 
-  // Now check all characters
-  for (i=0; i < len; i++) {
-    if ( uri[i] != string[i] ){
-      return false;
-    } 
+  return rtn;
+}
+
+static void run_scheduled_URIs()
+{
+  scheduled_action actions[MAX_SCHEDULED_ACTIONS];
+  int num, i;
+
+  pthread_mutex_lock(&_scheduled_mutex);
+  num = _num_scheduled;
+  memcpy(actions, _scheduled, num * sizeof(scheduled_action));
+  _num_scheduled = 0;
+  pthread_mutex_unlock(&_scheduled_mutex);
+
+  for (i=0; i < num; i++) {
+    if ( ! action_scheduled_URI(actions[i].uri, actions[i].value) )
+      LOG(SCHD_LOG,LOG_ERR, "Schedule %s=%g failed\n", actions[i].uri, actions[i].value);
   }
+}
 
-  return true;
+#ifdef AQ_BENCH
+// aqbench times action_URI() without starting the web / mqtt services.
+void set_net_services_aqdata(struct aqualinkdata *aqdata)
+{
+  _aqualink_data = aqdata;
 }
+#endif
 
 void action_mqtt_message(struct mg_connection *nc, struct mg_mqtt_message *msg) {
   char *rtnmsg;
@@ -1509,18 +1614,20 @@ void action_mqtt_message(struct mg_connection *nc, struct mg_mqtt_message *msg)
     // Check if it was something that can't be changed, if so send back current state.  Homekit thermostat for SWG and Freezeprotect.
     if (  strncmp(&msg->topic.buf[offset], FREEZE_PROTECT, strlen(FREEZE_PROTECT)) == 0) {
       if (_aqualink_data->frz_protect_set_point != TEMP_UNKNOWN ) {
-        send_mqtt_setpoint_msg(nc, FREEZE_PROTECT, _aqualink_data->frz_protect_set_point);
-        send_mqtt_string_msg(nc, FREEZE_PROTECT_ENABELED, MQTT_ON);
+        mqtt_requeue(MQT_FREEZE_SETPOINT);
+        mqtt_requeue(MQT_FREEZE_ENABLED);
       } else {
-        send_mqtt_string_msg(nc, FREEZE_PROTECT_ENABELED, MQTT_OFF);
+        mqtt_queue(MQT_FREEZE_ENABLED, MQTT_OFF);
       }
-      send_mqtt_string_msg(nc, FREEZE_PROTECT, _aqualink_data->frz_protect_state==ON?MQTT_ON:MQTT_OFF);
+      mqtt_requeue(MQT_FREEZE);
     } else if (  strncmp(&msg->topic.buf[offset], SWG_TOPIC, strlen(SWG_TOPIC)) == 0) {
       if (_aqualink_data->swg_led_state != LED_S_UNKNOWN) {
-        send_mqtt_swg_state_msg(nc, SWG_TOPIC, _aqualink_data->swg_led_state);
-        send_mqtt_int_msg(nc, SWG_BOOST_TOPIC, _aqualink_data->boost);
+        mqtt_requeue(MQT_SWG);
+        mqtt_requeue(MQT_SWG_ENABLED);
+        mqtt_requeue(MQT_SWG_BOOST);
       }
     }
+    mqtt_flush(nc);
   }
 
   DEBUG_TIMER_STOP(tid, NET_LOG, "action_mqtt_message() completed, took ");
@@ -1596,7 +1703,9 @@ void action_web_request(struct mg_connection *nc, struct mg_http_message *http_m
   // If we have a get request, pass it
   if (strncmp(http_msg->uri.buf, "/api", 4 ) != 0) {
       DEBUG_TIMER_START(&tid);
-      if ( FAST_SUFFIX_3_CI(http_msg->uri.buf, http_msg->uri.len, ".js") ) {
+      if ( _aqconfig_.web_cache && web_cache_serve(nc, http_msg) ) {
+        // Served from memory
+      } else if ( FAST_SUFFIX_3_CI(http_msg->uri.buf, http_msg->uri.len, ".js") ) {
         mg_http_serve_dir(nc, http_msg, &_http_server_opts_nocache);
       } else {
         mg_http_serve_dir(nc, http_msg, &_http_server_opts);
@@ -1625,27 +1734,32 @@ void action_web_request(struct mg_connection *nc, struct mg_http_message *http_m
         break;
         case uDevices:
         {
-          char message[JSON_BUFFER_SIZE];
+          json_writer w;
+          size_t reply_start;
           DEBUG_TIMER_START(&tid2);
-          build_device_JSON(_aqualink_data, message, JSON_BUFFER_SIZE, false);
+          size_t start = http_json_etag_start(nc, &w, &reply_start);
+          write_device_JSON(&w, get_aqualinkdata_snapshot(), false);
+          http_json_etag_end(nc, http_msg, &w, reply_start, start);
           DEBUG_TIMER_STOP(tid2, NET_LOG, "action_web_request() build_device_JSON took");
-          mg_http_reply(nc, 200, CONTENT_JSON, message);
         }
         break;
         case uHomebridge:
         {
-          char message[JSON_BUFFER_SIZE];
-          build_device_JSON(_aqualink_data, message, JSON_BUFFER_SIZE, true);
-          mg_http_reply(nc, 200, CONTENT_JSON, message);
+          json_writer w;
+          size_t reply_start;
+          size_t start = http_json_etag_start(nc, &w, &reply_start);
+          write_device_JSON(&w, get_aqualinkdata_snapshot(), true);
+          http_json_etag_end(nc, http_msg, &w, reply_start, start);
         }
         break;
         case uStatus:
         {
-          char message[JSON_BUFFER_SIZE];
+          json_writer w;
           DEBUG_TIMER_START(&tid2);
-          build_aqualink_status_JSON(_aqualink_data, message, JSON_BUFFER_SIZE);
+          size_t start = http_json_start(nc, &w);
+          write_aqualink_status_JSON(&w, get_aqualinkdata_snapshot());
+          http_json_end(nc, &w, start);
           DEBUG_TIMER_STOP(tid2, NET_LOG, "action_web_request() build_aqualink_status_JSON took");
-          mg_http_reply(nc, 200, CONTENT_JSON, message);
         }
         break;
         case uDynamicconf:
@@ -1677,13 +1791,57 @@ void action_web_request(struct mg_connection *nc, struct mg_http_message *http_m
         break;
         case uConfig:
         {
-          char message[JSON_BUFFER_SIZE];
+          json_writer w;
           DEBUG_TIMER_START(&tid2);
-          build_aqualink_config_JSON(message, JSON_BUFFER_SIZE, _aqualink_data);
+          size_t start = http_json_start(nc, &w);
+          write_aqualink_config_JSON(&w, _aqualink_data);
+          http_json_end(nc, &w, start);
           DEBUG_TIMER_STOP(tid2, NET_LOG, "action_web_request() build_aqualink_config_JSON took");
+        }
+        break;
+        case uAckLatency:
+        {
+          char message[JSON_BUFFER_SIZE];
+          build_ack_latency_JSON(message, JSON_BUFFER_SIZE);
           mg_http_reply(nc, 200, CONTENT_JSON, message);
         }
         break;
+        case uProgrammer:
+        {
+          json_writer w;
+          size_t start = http_json_start(nc, &w);
+          write_aq_programmer_JSON(&w);
+          http_json_end(nc, &w, start);
+        }
+        break;
+        case uWebCache:
+        {
+          json_writer w;
+          size_t start = http_json_start(nc, &w);
+          write_web_cache_JSON(&w);
+          http_json_end(nc, &w, start);
+        }
+        break;
+        case uMetrics:
+        {
+          net_metrics net;
+          size_t start;
+          get_net_metrics(nc->mgr, &net);
+          mg_printf(nc, "HTTP/1.1 200 OK\r\n%sContent-Length:            \r\n\r\n", CONTENT_METRICS);
+          start = nc->send.len;
+          write_metrics(&nc->send, &net);
+          http_reply_end(nc, start);
+        }
+        break;
+        case uFlightRecorder:
+          if (flight_recorder_dump("api request") >= 0) {
+            struct mg_http_serve_opts opts = _http_server_opts_nocache;
+            opts.mime_types = "cap=application/octet-stream";
+            mg_http_serve_file(nc, http_msg, FLIGHT_RECORDER_FILE, &opts);
+          } else {
+            mg_http_reply(nc, 500, CONTENT_TEXT, "Failed to write flight recorder\n");
+          }
+        break;
 #ifndef AQ_MANAGER
         case uDebugStatus:
         {
@@ -1776,31 +1934,34 @@ void action_websocket_request(struct mg_connection *nc, struct mg_ws_message *wm
     break;
     case uDevices:
     {
+      json_writer w;
       DEBUG_TIMER_START(&tid);
-      char message[JSON_BUFFER_SIZE];
-      build_device_JSON(_aqualink_data, message, JSON_BUFFER_SIZE, false);
+      size_t start = ws_json_start(nc, &w);
+      write_device_JSON(&w, get_aqualinkdata_snapshot(), false);
+      ws_json_end(nc, &w, start);
       DEBUG_TIMER_STOP(tid, NET_LOG, "action_websocket_request() build_device_JSON took");
-      ws_send(nc, message);
     }
     break;
     case uStatus:
     {
+      json_writer w;
       DEBUG_TIMER_START(&tid);
-      char message[JSON_BUFFER_SIZE];
-      build_aqualink_status_JSON(_aqualink_data, message, JSON_BUFFER_SIZE);
+      size_t start = ws_json_start(nc, &w);
+      write_aqualink_status_JSON(&w, get_aqualinkdata_snapshot());
+      ws_json_end(nc, &w, start);
       DEBUG_TIMER_STOP(tid, NET_LOG, "action_websocket_request() build_aqualink_status_JSON took");
-      ws_send(nc, message);
     }
     break;
     case uSimulator:
     {
       LOG(NET_LOG,LOG_DEBUG, "Request to start Simulator\n");
       set_websocket_simulator(nc);
+      json_writer w;
       DEBUG_TIMER_START(&tid);
-      char message[JSON_BUFFER_SIZE];
-      build_aqualink_status_JSON(_aqualink_data, message, JSON_BUFFER_SIZE);
+      size_t start = ws_json_start(nc, &w);
+      write_aqualink_status_JSON(&w, get_aqualinkdata_snapshot());
+      ws_json_end(nc, &w, start);
       DEBUG_TIMER_STOP(tid, NET_LOG, "action_websocket_request() build_aqualink_status_JSON took");
-      ws_send(nc, message);
     }
     break;
     case uAQmanager:
@@ -1840,11 +2001,12 @@ void action_websocket_request(struct mg_connection *nc, struct mg_ws_message *wm
     break;
     case uConfig:
     {
+      json_writer w;
       DEBUG_TIMER_START(&tid);
-      char message[JSON_BUFFER_SIZE];
-      build_aqualink_config_JSON(message, JSON_BUFFER_SIZE, _aqualink_data);
+      size_t start = ws_json_start(nc, &w);
+      write_aqualink_config_JSON(&w, _aqualink_data);
+      ws_json_end(nc, &w, start);
       DEBUG_TIMER_STOP(tid, NET_LOG, "action_websocket_request() build_aqualink_config_JSON took");
-      ws_send(nc, message);
     }
     break;
     case uSaveConfig:
@@ -1856,6 +2018,41 @@ void action_websocket_request(struct mg_connection *nc, struct mg_ws_message *wm
       ws_send(nc, message);
     }
     break;
+    case uAckLatency:
+    {
+      char message[JSON_BUFFER_SIZE];
+      build_ack_latency_JSON(message, JSON_BUFFER_SIZE);
+      ws_send(nc, message);
+    }
+    break;
+    case uProgrammer:
+    {
+      json_writer w;
+      size_t start = ws_json_start(nc, &w);
+      write_aq_programmer_JSON(&w);
+      ws_json_end(nc, &w, start);
+    }
+    break;
+    case uWebCache:
+    {
+      json_writer w;
+      size_t start = ws_json_start(nc, &w);
+      write_web_cache_JSON(&w);
+      ws_json_end(nc, &w, start);
+    }
+    break;
+    case uFlightRecorder:
+      sprintf(buffer, "{\"flightrecorder\":{\"file\":\"%s\",\"frames\":%d}}", FLIGHT_RECORDER_FILE, flight_recorder_dump("api request"));
+      ws_send(nc, buffer);
+    break;
+    case uStatusDelta:
+      // Opt in and ack are the same request, value is the last version the client has (0 for none).
+      // Reply with whatever has changed since then, broadcasts will do the same until it acks again.
+      set_websocket_delta(nc, (value!=NULL?strtoul(value, NULL, 10):0));
+      if (_ws_status_version == 0)
+        update_ws_status(get_aqualinkdata_snapshot());
+      ws_send_status_delta(nc);
+    break;
     case uBad:
     default:
       if (msg == NULL)
@@ -2028,57 +2225,12 @@ static void ev_handler(struct mg_connection *nc, int ev, void *ev_data) {
   }
 }
 
+// (Re)connecting, build the topics and send everything again.
 void reset_last_mqtt_status()
 {
-  int i;
-  memset(&_last_mqtt_aqualinkdata, 0, sizeof(_last_mqtt_aqualinkdata));
-
-  for (i=0; i < _aqualink_data->total_buttons; i++) {
-    _last_mqtt_aqualinkdata.aqualinkleds[i].state = LED_S_UNKNOWN;
-    //if (isVBUTTON_CHILLER(_aqualink_data->aqbuttons[i].special_mask)){
-    //  _chiller_ledindex = i;
-    //}
-  }
-  _last_mqtt_aqualinkdata.ar_swg_device_status = SWG_STATUS_UNKNOWN;
-  _last_mqtt_aqualinkdata.swg_led_state = LED_S_UNKNOWN;
-  _last_mqtt_aqualinkdata.air_temp = TEMP_REFRESH;
-  _last_mqtt_aqualinkdata.pool_temp = TEMP_REFRESH;
-  _last_mqtt_aqualinkdata.spa_temp = TEMP_REFRESH;
-  //_last_mqtt_aqualinkdata.sw .ar_swg_device_status = SWG_STATUS_UNKNOWN;
-  _last_mqtt_aqualinkdata.battery = -1;
-  _last_mqtt_aqualinkdata.frz_protect_state = -1;
-  _last_mqtt_aqualinkdata.service_mode_state = -1;
-  _last_mqtt_aqualinkdata.pool_htr_set_point = TEMP_REFRESH;
-  _last_mqtt_aqualinkdata.spa_htr_set_point = TEMP_REFRESH;
-  _last_mqtt_aqualinkdata.chiller_set_point = TEMP_REFRESH;
-  //_last_mqtt_aqualinkdata.chiller_state = LED_S_UNKNOWN;
-  _last_mqtt_aqualinkdata.ph = -1;
-  _last_mqtt_aqualinkdata.orp = -1;
-  _last_mqtt_aqualinkdata.boost = -1;
-  _last_mqtt_aqualinkdata.swg_percent = -1;
-  _last_mqtt_aqualinkdata.swg_ppm = -1;
-  _last_mqtt_aqualinkdata.heater_err_status = NUL; // 0x00
-
-  for (i=0; i < _aqualink_data->num_pumps; i++) {
-    _last_mqtt_aqualinkdata.pumps[i].gpm = TEMP_UNKNOWN;
-    _last_mqtt_aqualinkdata.pumps[i].rpm = TEMP_UNKNOWN;
-    _last_mqtt_aqualinkdata.pumps[i].watts = TEMP_UNKNOWN;
-    _last_mqtt_aqualinkdata.pumps[i].mode = TEMP_UNKNOWN;
-    _last_mqtt_aqualinkdata.pumps[i].status = TEMP_UNKNOWN;
-    _last_mqtt_aqualinkdata.pumps[i].pressureCurve = TEMP_UNKNOWN;
-    //_last_mqtt_aqualinkdata.pumps[i].driveState = TEMP_UNKNOWN;
-  }
-
-  for (i=0; i < _aqualink_data->num_lights; i++) {
-     _last_mqtt_aqualinkdata.lights[i].currentValue = TEMP_UNKNOWN;
-  }
-
-  for (i=0; i < _aqualink_data->num_sensors; i++) {
-    _last_mqtt_aqualinkdata.sensors[i].value = TEMP_UNKNOWN;
-  }
-
-  _last_mqtt_chiller_led.state = LED_S_UNKNOWN;
-
+  mqtt_init_topics();
+  mqtt_forget_values();
+  _mqtt_seen_all = false;
 }
 
 void start_mqtt(struct mg_mgr *mgr) {
@@ -2179,6 +2331,10 @@ bool _start_net_services(struct mg_mgr *mgr, struct aqualinkdata *aqdata) {
   _http_server_opts_nocache.root_dir = _aqconfig_.web_directory;
   _http_server_opts_nocache.extra_headers = NO_CACHE;
   _http_server_opts_nocache.ssi_pattern = NULL;
+
+  if (_aqconfig_.web_cache)
+    start_web_cache(_aqconfig_.web_directory, _aqconfig_.web_cache_watch);
+
   // Start MQTT
   start_mqtt(mgr);
 
@@ -2201,6 +2357,7 @@ void *net_services_thread( void *ptr )
 {
   struct aqualinkdata *aqdata = (struct aqualinkdata *) ptr;
   int journald_fail = 0;
+  int poll_wait;
 #ifdef DEBUG_SET_IF_CHANGED
   uint noupdate=0;
 #endif
@@ -2216,11 +2373,19 @@ void *net_services_thread( void *ptr )
 
   while (_keepNetServicesRunning == true)
   {
-    mg_mgr_poll(&_mgr, (_aqualink_data->simulator_active != SIM_NONE)?10:100);
+    poll_wait = (_aqualink_data->simulator_active != SIM_NONE)?10:100;
+    // Changes are coalesced into one broadcast every websocket_min_interval
+    if (aqdata->is_dirty == true)
+      poll_wait = AQ_MIN(poll_wait, ws_broadcast_wait());
 
-    if (aqdata->is_dirty == true /*|| _broadcast == true*/) {
-      _broadcast_aqualinkstate(_mgr.conns);
+    mg_mgr_poll(&_mgr, poll_wait);
+    web_cache_poll();
+    run_scheduled_URIs();
+
+    if (aqdata->is_dirty == true && ws_broadcast_wait() == 0 /*|| _broadcast == true*/) {
+      // Clear before taking the snapshot, so anything set while we broadcast is picked up next time round
       CLEAR_DIRTY(aqdata->is_dirty);
+      _broadcast_aqualinkstate(_mgr.conns);
 #ifdef DEBUG_SET_IF_CHANGED
       printf("NO updates for %d loops\n",noupdate), noupdate=0;
     } else {
@@ -2259,6 +2424,7 @@ void *net_services_thread( void *ptr )
 f_end:
   LOG(NET_LOG,LOG_NOTICE, "Stopping network services thread\n");
   mg_mgr_free(&_mgr);
+  stop_web_cache();
 
   pthread_exit(0);
 }
@@ -17,6 +17,10 @@
 #define CONTENT_JSON NO_CACHE"Content-Type: application/json\r\n"
 #define CONTENT_JS   NO_CACHE"Content-Type: text/javascript\r\n"
 #define CONTENT_TEXT NO_CACHE "Content-Type: text/plain\r\n"
+// Can be stored, but must be checked with If-None-Match every time, used with ETags
+#define REVALIDATE "Cache-Control: no-cache\r\n"
+#define CONTENT_JSON_REVALIDATE REVALIDATE"Content-Type: application/json\r\n"
+#define CONTENT_METRICS NO_CACHE "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
 
 
 //void main_server();
@@ -30,6 +34,11 @@ time_t poll_net_services(int timeout_ms);
 void broadcast_aqualinkstate();
 void broadcast_aqualinkstate_error(const char *msg);
 void broadcast_simulator_message();
+bool action_scheduled_URI(const char *URI, float value);
+bool post_scheduled_URI(const char *URI, float value);
+#ifdef AQ_BENCH
+void set_net_services_aqdata(struct aqualinkdata *aqdata);
+#endif
 
 
 
@@ -358,7 +358,7 @@ bool log_freeze_setpoints(struct aqualinkdata *aqdata)
   bool rtn = false;
 
   if (rsm_strcmp(_menu[3], "Temp") == 0)
-    aqdata->frz_protect_set_point = rsm_atoi(&_menu[3][11]);
+    SET_IF_CHANGED(aqdata->frz_protect_set_point, rsm_atoi(&_menu[3][11]), aqdata->is_dirty);
 
   setUnits_ot(_menu[3], aqdata);
 
@@ -411,10 +411,10 @@ bool get_pumpinfo_from_menu_OLD(struct aqualinkdata *aqdata, int menuLineIdx)
       // printf("**** FOUND PUMP %d at index %d *****\n",pump_index,i);
       // aqdata->pumps[i].updated = true;
       pump_update(aqdata, i);
-      aqdata->pumps[i].rpm = rpm;
-      aqdata->pumps[i].watts = watts;
-      aqdata->pumps[i].gpm = gpm;
-      aqdata->pumps[i].pStatus = panelStatus;
+      SET_IF_CHANGED(aqdata->pumps[i].rpm, rpm, aqdata->is_dirty);
+      SET_IF_CHANGED(aqdata->pumps[i].watts, watts, aqdata->is_dirty);
+      SET_IF_CHANGED(aqdata->pumps[i].gpm, gpm, aqdata->is_dirty);
+      SET_IF_CHANGED(aqdata->pumps[i].pStatus, panelStatus, aqdata->is_dirty);
       // LOG(ONET_LOG,LOG_INFO, "Matched OneTouch Pump to Index %d, RPM %d, Watts %d, GPM %d\n",i,rpm,watts,gpm);
       LOG(ONET_LOG, LOG_INFO, "Matched Pump to '%s', Index %d, RPM %d, Watts %d, GPM %d\n", aqdata->pumps[i].button->name, i, rpm, watts, gpm);
       if (aqdata->pumps[i].pumpType == PT_UNKNOWN)
@@ -578,7 +578,7 @@ bool get_aquapureinfo_from_menu(struct aqualinkdata *aqdata, int menuLineIdx)
     int ppm = atoi(&_menu[menuLineIdx+1][6]);
     if (aqdata->swg_ppm != ppm)
     {
-      aqdata->swg_ppm = ppm;
+      SET_IF_CHANGED(aqdata->swg_ppm, ppm, aqdata->is_dirty);
       rtn = true;
     }
     LOG(ONET_LOG, LOG_INFO, "Aquapure SWG %d%, %d PPM\n", swgp, ppm);
@@ -46,28 +46,22 @@ unsigned char pop_ot_cmd(unsigned char receive_type)
   if (receive_type == CMD_STATUS) {
     cmd = _ot_pgm_command;
     _ot_pgm_command = NUL;
+    signal_prog_event(ONETOUCH);
   } 
 
   LOG(ONET_LOG,LOG_DEBUG, "OneTouch Sending '0x%02hhx' to controller\n", cmd);
   return cmd;
 }
 
-void waitfor_ot_queue2empty()
+bool ot_cmd_pending()
 {
-  int i=0;
-
-  while ( (_ot_pgm_command != NUL) && ( i++ < PROGRAMMING_POLL_COUNTER) ) {
-    delay(PROGRAMMING_POLL_DELAY_TIME);
-  }
-
-  if (_ot_pgm_command != NUL) {
-      // Wait for longer interval
-      while ( (_ot_pgm_command != NUL) && ( i++ < PROGRAMMING_POLL_COUNTER * 2) ) {
-        delay(PROGRAMMING_POLL_COUNTER * 2);
-      }
-  }
+  return (_ot_pgm_command != NUL);
+}
 
-  if (_ot_pgm_command != NUL) {
+void waitfor_ot_queue2empty()
+{
+  // Same overall limit as the old poll loops, short wait then a much longer one.
+  if ( ! wait_for_prog_cmd_sent(ONETOUCH, &_ot_pgm_command, PROGRAMMING_POLL_COUNTER * (PROGRAMMING_POLL_DELAY_TIME + PROGRAMMING_POLL_COUNTER * 2)) ) {
     LOG(ONET_LOG,LOG_WARNING, "OneTouch Send command Queue did not empty, timeout\n");
   }
 }
@@ -96,7 +90,7 @@ bool waitForOT_MessageTypes(struct aqualinkdata *aqdata, unsigned char mtype1, u
 
     if (*last_onetouch_packet() == mtype1 || *last_onetouch_packet() == mtype2) break;
 
-    pthread_cond_wait(&aqdata->active_thread.thread_cond, &aqdata->active_thread.thread_mutex);
+    wait_for_prog_kick(aqdata);
   }
 
   pthread_mutex_unlock(&aqdata->active_thread.thread_mutex);
@@ -126,7 +120,7 @@ bool waitForNextOT_Menu(struct aqualinkdata *aqdata) {
 
     //if(thread_kick_type() == KICKT_MENU) break;
 
-    pthread_cond_wait(&aqdata->active_thread.thread_cond, &aqdata->active_thread.thread_mutex);
+    wait_for_prog_kick(aqdata);
     if(thread_kick_type() == KICKT_MENU) break;
   }
 
@@ -496,7 +490,7 @@ void *set_aqualink_onetouch_pump_rpm( void *ptr )
           RPM = rsm_atoi(&onetouch_menu_hlight()[7]);
           intPress(digitDiff(RPM, pumpRPM, 10));
           // Get the new RPM.
-          aqdata->pumps[structIndex].rpm = rsm_atoi(&onetouch_menu_hlight()[7]);
+          SET_IF_CHANGED(aqdata->pumps[structIndex].rpm, rsm_atoi(&onetouch_menu_hlight()[7]), aqdata->is_dirty);
           send_ot_cmd(KEY_ONET_SELECT);
           waitfor_ot_queue2empty();
           waitForOT_MessageTypes(aqdata,CMD_MSG_LONG,CMD_PDA_HIGHLIGHTCHARS,5);
@@ -511,7 +505,7 @@ void *set_aqualink_onetouch_pump_rpm( void *ptr )
             } else if (GPM < pumpRPM) {
               send_ot_cmd(KEY_ONET_UP);
             } else {
-              aqdata->pumps[structIndex].gpm = rsm_atoi(&onetouch_menu_hlight()[8]);
+              SET_IF_CHANGED(aqdata->pumps[structIndex].gpm, rsm_atoi(&onetouch_menu_hlight()[8]), aqdata->is_dirty);
               send_ot_cmd(KEY_ONET_SELECT);
               waitfor_ot_queue2empty();
               break;
@@ -549,7 +543,7 @@ void *set_aqualink_onetouch_pump_rpm( void *ptr )
 
   cleanAndTerminateThread(threadCtrl);
 
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -594,7 +588,7 @@ void *set_aqualink_onetouch_macro( void *ptr )
 
   cleanAndTerminateThread(threadCtrl);
 
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -622,7 +616,7 @@ void *get_aqualink_onetouch_freezeprotect( void *ptr )
 
   cleanAndTerminateThread(threadCtrl);
 
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 /*
@@ -652,7 +646,7 @@ void *get_aqualink_onetouch_setpoints( void *ptr )
 
   cleanAndTerminateThread(threadCtrl);
 
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -757,7 +751,7 @@ void *set_aqualink_onetouch_pool_heater_temp( void *ptr )
 
   cleanAndTerminateThread(threadCtrl);
 
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -782,7 +776,7 @@ void *set_aqualink_onetouch_spa_heater_temp( void *ptr )
 
   cleanAndTerminateThread(threadCtrl);
 
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -836,7 +830,7 @@ void *set_aqualink_onetouch_boost( void *ptr )
 
   cleanAndTerminateThread(threadCtrl);
 
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -941,7 +935,7 @@ void *set_aqualink_onetouch_swg_percent( void *ptr )
 
   cleanAndTerminateThread(threadCtrl);
 
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -1080,7 +1074,7 @@ void *set_aqualink_onetouch_time( void *ptr )
 
   cleanAndTerminateThread(threadCtrl);
 
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -4,6 +4,7 @@
 
 unsigned char pop_ot_cmd(unsigned char receive_type);
 bool ot_queue_cmd(unsigned char cmd);
+bool ot_cmd_pending();
 
 //bool in_ot_programming_mode(struct aqualinkdata *aq_data);
 
@@ -0,0 +1,437 @@
+/*
+ * Copyright (c) 2017 Shaun Feakes - All rights reserved
+ *
+ * You may use redistribute and/or modify this code under the terms of
+ * the GNU General Public License version 2 as published by the
+ * Free Software Foundation. For the terms of this license,
+ * see <http://www.gnu.org/licenses/>.
+ *
+ * You are free to use this software under the terms of the GNU General
+ * Public License, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ *  https://github.com/sfeakes/aqualinkd
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "packetCapture.h"
+#include "packetLogger.h"
+#include "aq_serial.h"
+#include "utils.h"
+
+/*
+  Only one writer at a time (serial thread reads, but writes & device threads can log too),
+  so a mutex around the ring.  A reader on a live file copies it first, it may see a record
+  that's half overwritten at the tail, that's checked for and stops the read.
+*/
+
+static pthread_mutex_t _cap_mutex = PTHREAD_MUTEX_INITIALIZER;
+static packet_capture_header *_cap = NULL;
+static unsigned char *_cap_data = NULL;
+static size_t _cap_mapsize = 0;
+
+#define REC_SIZE sizeof(packet_capture_record)
+
+static uint64_t timespec_ns(clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void init_header(packet_capture_header *hdr, uint64_t data_size)
+{
+  memset(hdr, 0, sizeof(packet_capture_header));
+  memcpy(hdr->magic, CAP_MAGIC, sizeof(CAP_MAGIC));
+  hdr->version = CAP_VERSION;
+  hdr->header_size = sizeof(packet_capture_header);
+  hdr->data_size = data_size;
+  hdr->start_realtime_ns = timespec_ns(CLOCK_REALTIME);
+  hdr->start_monotonic_ns = timespec_ns(CLOCK_MONOTONIC);
+}
+
+static uint8_t record_protocol(uint8_t type, const unsigned char *data)
+{
+  return (type == CAP_RAW)?P_UNKNOWN:getProtocolType(data);
+}
+
+static bool map_capture(const char *path, size_t size)
+{
+  size_t mapsize = sizeof(packet_capture_header) + size;
+  void *map;
+  int fd;
+
+  if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+    return false;
+
+  if (ftruncate(fd, mapsize) != 0) {
+    close(fd);
+    return false;
+  }
+
+  map = mmap(NULL, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (map == MAP_FAILED)
+    return false;
+
+  _cap = (packet_capture_header *)map;
+  _cap_data = (unsigned char *)map + sizeof(packet_capture_header);
+  _cap_mapsize = mapsize;
+
+  init_header(_cap, size);
+
+  return true;
+}
+
+bool startPacketCapture(const char *path, size_t size)
+{
+  bool rtn = true;
+
+  pthread_mutex_lock(&_cap_mutex);
+
+  if (_cap == NULL) {
+    if (path != NULL) {
+      rtn = map_capture(path, size);
+    } else if ( (rtn = map_capture(RS485CAPFILE, size)) == false ) {
+      rtn = map_capture(RS485CAPFILE_ALT, size);
+    }
+    if (!rtn)
+      LOG(RSSD_LOG, LOG_ERR, "Unable to create RS485 capture file (%d): %s\n", errno, strerror(errno));
+  }
+
+  pthread_mutex_unlock(&_cap_mutex);
+
+  return rtn;
+}
+
+void stopPacketCapture()
+{
+  pthread_mutex_lock(&_cap_mutex);
+
+  if (_cap != NULL) {
+    msync(_cap, _cap_mapsize, MS_ASYNC);
+    munmap(_cap, _cap_mapsize);
+    _cap = NULL;
+    _cap_data = NULL;
+  }
+
+  pthread_mutex_unlock(&_cap_mutex);
+}
+
+bool isPacketCaptureRunning()
+{
+  return _cap != NULL;
+}
+
+// Offset of the record after the one at pos, wrapping as the writer does.
+static uint64_t next_record(const unsigned char *data, uint64_t data_size, uint64_t pos)
+{
+  packet_capture_record rec;
+
+  memcpy(&rec, data + pos, REC_SIZE);
+  pos += REC_SIZE + rec.length;
+
+  if (pos + REC_SIZE > data_size)
+    return 0;
+
+  memcpy(&rec, data + pos, REC_SIZE);
+  if (rec.type == CAP_PAD)
+    return 0;
+
+  return pos;
+}
+
+// Move tail past any old records in [from, to), only called before anything is written there.
+static void evict(uint64_t from, uint64_t to)
+{
+  while (_cap->wrapped && _cap->tail >= from && _cap->tail < to) {
+    _cap->tail = next_record(_cap_data, _cap->data_size, _cap->tail);
+    if (_cap->tail == 0)
+      break;
+  }
+}
+
+void capturePacket(uint8_t type, const unsigned char *data, int length)
+{
+  packet_capture_record rec;
+  uint64_t need = REC_SIZE + length;
+
+  if (_cap == NULL || length <= 0 || length > 0xFFFF)
+    return;
+
+  rec.time_ns = timespec_ns(CLOCK_MONOTONIC);
+  rec.length = length;
+  rec.type = type;
+  rec.protocol = record_protocol(type, data);
+
+  pthread_mutex_lock(&_cap_mutex);
+
+  if (_cap == NULL || need > _cap->data_size) {
+    pthread_mutex_unlock(&_cap_mutex);
+    return;
+  }
+
+  if (_cap->head + need > _cap->data_size) {
+    // Doesn't fit before the end, pad out & wrap.
+    evict(_cap->head, _cap->data_size);
+    if (_cap->data_size - _cap->head >= REC_SIZE) {
+      packet_capture_record pad = {0};
+      pad.type = CAP_PAD;
+      pad.length = 0;
+      memcpy(_cap_data + _cap->head, &pad, REC_SIZE);
+    }
+    if (!_cap->wrapped) {
+      _cap->wrapped = 1;
+      _cap->tail = 0;
+    }
+    _cap->head = 0;
+  }
+
+  evict(_cap->head, _cap->head + need);
+
+  memcpy(_cap_data + _cap->head, &rec, REC_SIZE);
+  memcpy(_cap_data + _cap->head + REC_SIZE, data, length);
+
+  __atomic_store_n(&_cap->head, _cap->head + need, __ATOMIC_RELEASE);
+  _cap->records++;
+
+  pthread_mutex_unlock(&_cap_mutex);
+}
+
+FILE *createPacketCaptureFile(const char *path, uint64_t data_size)
+{
+  packet_capture_header hdr;
+  FILE *fp;
+
+  if ((fp = fopen(path, "wb")) == NULL)
+    return NULL;
+
+  init_header(&hdr, data_size);
+  hdr.head = data_size;
+  fwrite(&hdr, sizeof(hdr), 1, fp);
+
+  return fp;
+}
+
+void writePacketCaptureRecord(FILE *fp, uint8_t type, uint64_t time_ns, const unsigned char *data, int length)
+{
+  packet_capture_record rec;
+
+  rec.time_ns = time_ns;
+  rec.length = length;
+  rec.type = type;
+  rec.protocol = record_protocol(type, data);
+
+  fwrite(&rec, REC_SIZE, 1, fp);
+  fwrite(data, 1, length, fp);
+}
+
+/*
+ * Offline reading
+ */
+
+static unsigned char *load_capture(const char *path, packet_capture_header *hdr)
+{
+  unsigned char *data;
+  FILE *fp;
+
+  if ((fp = fopen(path, "rb")) == NULL)
+    return NULL;
+
+  if (fread(hdr, sizeof(packet_capture_header), 1, fp) != 1 ||
+      strncmp(hdr->magic, CAP_MAGIC, sizeof(hdr->magic)) != 0 ||
+      hdr->version != CAP_VERSION ||
+      hdr->header_size != sizeof(packet_capture_header) ||
+      hdr->data_size < REC_SIZE ||
+      hdr->head > hdr->data_size || hdr->tail > hdr->data_size) {
+    fclose(fp);
+    return NULL;
+  }
+
+  if ((data = malloc(hdr->data_size)) != NULL) {
+    if (fread(data, 1, hdr->data_size, fp) != hdr->data_size) {
+      free(data);
+      data = NULL;
+    }
+  }
+
+  fclose(fp);
+  return data;
+}
+
+bool isPacketCaptureFile(const char *path)
+{
+  packet_capture_header hdr;
+  FILE *fp;
+  bool rtn;
+
+  if ((fp = fopen(path, "rb")) == NULL)
+    return false;
+
+  rtn = (fread(&hdr, sizeof(hdr), 1, fp) == 1 && strncmp(hdr.magic, CAP_MAGIC, sizeof(hdr.magic)) == 0);
+
+  fclose(fp);
+  return rtn;
+}
+
+int readPacketCapture(const char *path, capture_record_cb callback, void *ctx)
+{
+  packet_capture_header hdr;
+  packet_capture_record rec;
+  unsigned char *data;
+  uint64_t pos;
+  int count = 0;
+  int wraps = 0;
+
+  if ((data = load_capture(path, &hdr)) == NULL)
+    return -1;
+
+  pos = hdr.wrapped?hdr.tail:0;
+
+  // When wrapped, tail can equal head (ring exactly full), so always take the first record.
+  while (hdr.head > 0 && (pos != hdr.head || (hdr.wrapped && count == 0))) {
+    if (pos + REC_SIZE <= hdr.data_size)
+      memcpy(&rec, data + pos, REC_SIZE);
+    if (pos + REC_SIZE > hdr.data_size || rec.type == CAP_PAD) {
+      if (wraps++ > 0)
+        break; // Can only wrap once, file is corrupt
+      pos = 0;
+      continue;
+    }
+    if (rec.type > CAP_RAW || pos + REC_SIZE + rec.length > hdr.data_size)
+      break; // Torn record from a live file
+
+    callback(&hdr, &rec, data + pos + REC_SIZE, ctx);
+    count++;
+    pos += REC_SIZE + rec.length;
+  }
+
+  free(data);
+  return count;
+}
+
+typedef struct capture_text_ctx {
+  FILE *packets;
+  FILE *bytes;
+  const char *packetfile;
+  const char *bytefile;
+} capture_text_ctx;
+
+static void capture_to_text(const packet_capture_header *hdr, const packet_capture_record *rec, const unsigned char *data, void *ctx)
+{
+  capture_text_ctx *t = (capture_text_ctx *)ctx;
+  char buff[LARGELOGBUFFER];
+  int i;
+
+  if (rec->type == CAP_RAW) {
+    if (t->bytes == NULL && (t->bytes = fopen(t->bytefile, "w")) == NULL)
+      return;
+    for (i=0; i < rec->length; i++)
+      fprintf(t->bytes, "0x%02hhx|", data[i]);
+  } else {
+    if (t->packets == NULL && (t->packets = fopen(t->packetfile, "w")) == NULL)
+      return;
+    if (rec->type == CAP_ERROR)
+      beautifyBadPacket(buff, LARGELOGBUFFER, data, rec->length);
+    else
+      beautifyPacket(buff, LARGELOGBUFFER, data, rec->length, rec->type == CAP_READ);
+    fputs(buff, t->packets);
+  }
+}
+
+// Same text files the packet logger used to write.
+int packetCaptureToText(const char *path, const char *packetfile, const char *bytefile)
+{
+  capture_text_ctx ctx = {NULL, NULL, packetfile, bytefile};
+  int rtn = readPacketCapture(path, capture_to_text, &ctx);
+
+  if (ctx.packets != NULL)
+    fclose(ctx.packets);
+  if (ctx.bytes != NULL)
+    fclose(ctx.bytes);
+
+  return rtn;
+}
+
+typedef struct capture_bin_ctx {
+  FILE *fp;
+  bool raw; // Capture has raw bytes, so ignore frames.
+} capture_bin_ctx;
+
+static void has_raw(const packet_capture_header *hdr, const packet_capture_record *rec, const unsigned char *data, void *ctx)
+{
+  if (rec->type == CAP_RAW)
+    ((capture_bin_ctx *)ctx)->raw = true;
+}
+
+static void capture_to_binary(const packet_capture_header *hdr, const packet_capture_record *rec, const unsigned char *data, void *ctx)
+{
+  capture_bin_ctx *b = (capture_bin_ctx *)ctx;
+
+  if ( (b->raw && rec->type == CAP_RAW) || (!b->raw && (rec->type == CAP_READ || rec->type == CAP_ERROR)) )
+    fwrite(data, 1, rec->length, b->fp);
+}
+
+/*
+ * Byte stream get_packet() can read back, like the text log playback.  Raw records are exactly
+ * what was on the bus, without them we only have frames read (not escaped, same as the text log).
+ */
+int packetCaptureToBinary(const char *path, const char *binfile)
+{
+  capture_bin_ctx ctx = {NULL, false};
+  int rtn;
+
+  if (readPacketCapture(path, has_raw, &ctx) < 0)
+    return -1;
+
+  if ((ctx.fp = fopen(binfile, "wb")) == NULL)
+    return -1;
+
+  rtn = readPacketCapture(path, capture_to_binary, &ctx);
+
+  fclose(ctx.fp);
+  return rtn;
+}
+
+/*
+ * Text log line back to bytes, "... | HEX: 0x10|0x02|0x0a|...|" or a line that's just hex.
+ * Returns number of bytes, 0 if the line doesn't hold a packet.
+ */
+int parseHexPacketLine(const char *line, unsigned char *buffer, int size)
+{
+  const char *p = strstr(line, "HEX:");
+  char *end;
+  int length = 0;
+
+  if (p != NULL)
+    p += 4;
+  else
+    p = line;
+
+  while (*p == ' ' || *p == '\t')
+    p++;
+
+  while (length < size && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+    long value = strtol(p, &end, 16);
+    if (end <= p + 2)
+      break; // "0x" and nothing after it
+    buffer[length++] = (unsigned char)value;
+    p = end;
+    if (*p == '|')
+      p++;
+  }
+
+  return length;
+}
@@ -0,0 +1,76 @@
+#ifndef PACKETCAPTURE_H_
+#define PACKETCAPTURE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+  Binary RS485 capture, replaces the text RS485.log / RS485raw.log files.
+
+  The file is a fixed size ring mmap'd from /dev/shm so it never grows and never touches
+  the SD card, the oldest records are overwritten once it's full.  serial_logger -ctext
+  turns it back into the old text logs, serial_logger -f and dummy_reader will play it.
+
+  File layout is a packet_capture_header then data_size bytes of ring.  Each record is a
+  packet_capture_record followed by length bytes, records are never split across the end
+  of the ring (a CAP_PAD record or < sizeof(record) spare bytes means wrap to 0).
+*/
+
+#define RS485CAPFILE     "/dev/shm/RS485.cap"
+#define RS485CAPFILE_ALT "/tmp/RS485.cap" // If there is no /dev/shm
+#define RS485CAP_SIZE    (2 * 1024 * 1024)
+
+#define CAP_MAGIC   "AQRSCAP"
+#define CAP_VERSION 1
+
+// Record direction / type
+#define CAP_PAD   0
+#define CAP_READ  1 // Good frame read
+#define CAP_WRITE 2 // Frame we sent
+#define CAP_ERROR 3 // Bad frame read
+#define CAP_RAW   4 // Bytes exactly as read() returned them
+
+typedef struct packet_capture_header {
+  char     magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint64_t data_size;
+  uint64_t head;        // Offset in ring of next record
+  uint64_t tail;        // Offset in ring of oldest record, only valid once wrapped
+  uint32_t wrapped;
+  uint32_t reserved;
+  uint64_t records;     // Total ever written
+  uint64_t start_realtime_ns; // Clocks at start so record times can be turned into wall time
+  uint64_t start_monotonic_ns;
+} packet_capture_header;
+
+typedef struct __attribute__((packed)) packet_capture_record {
+  uint64_t time_ns;  // CLOCK_MONOTONIC
+  uint16_t length;
+  uint8_t  type;     // CAP_READ etc
+  uint8_t  protocol; // protocolType
+} packet_capture_record;
+
+bool startPacketCapture(const char *path, size_t size);
+void stopPacketCapture();
+bool isPacketCaptureRunning();
+void capturePacket(uint8_t type, const unsigned char *data, int length);
+
+// Whole capture written in one go (not a ring), data_size must be the total of all records.
+FILE *createPacketCaptureFile(const char *path, uint64_t data_size);
+void writePacketCaptureRecord(FILE *fp, uint8_t type, uint64_t time_ns, const unsigned char *data, int length);
+
+// Offline reading
+typedef void (*capture_record_cb)(const packet_capture_header *hdr, const packet_capture_record *rec, const unsigned char *data, void *ctx);
+
+bool isPacketCaptureFile(const char *path);
+int readPacketCapture(const char *path, capture_record_cb callback, void *ctx); // returns records read or -1
+int packetCaptureToText(const char *path, const char *packetfile, const char *bytefile);
+int packetCaptureToBinary(const char *path, const char *binfile);
+
+// One line of the old text RS485.log back to a packet, returns bytes or 0.
+int parseHexPacketLine(const char *line, unsigned char *buffer, int size);
+
+#endif //PACKETCAPTURE_H_
@@ -4,12 +4,11 @@
 #include <ctype.h>
 
 #include "packetLogger.h"
+#include "packetCapture.h"
 #include "aq_serial.h"
 #include "utils.h"
 #include "config.h"
 
-static FILE *_packetLogFile  = NULL;
-static FILE *_byteLogFile    = NULL;
 static bool _logfile_raw     = false;
 static bool _logfile_packets = false;
 //static bool _includePentair = false;
@@ -18,58 +17,49 @@ static bool _logfile_packets = false;
 void _logPacket(logmask_t from, const unsigned char *packet_buffer, int packet_length, bool error, bool force, bool is_read);
 int _beautifyPacket(char *buff, int buff_size, const unsigned char *packet_buffer, int packet_length, bool error, bool is_read);
 
+/*
+  Packets & raw bytes go to the binary capture ring (packetCapture.c) rather than text files,
+  use serial_logger -ctext to get RS485LOGFILE / RS485BYTELOGFILE back.
+*/
+static void startCapture()
+{
+  if (_logfile_raw || _logfile_packets) {
+    if (!startPacketCapture(NULL, RS485CAP_SIZE)) {
+      _logfile_raw = false;
+      _logfile_packets = false;
+    }
+  }
+}
+
 //void startPacketLogger(bool debug_RSProtocol_packets) {
 void startPacketLogger() {
   // Make local copy of variables so we can turn on/off as needed.
   _logfile_raw = _aqconfig_.log_raw_bytes;
   _logfile_packets = _aqconfig_.log_protocol_packets;
+  startCapture();
 }
 
 void startPacketLogging(bool log_protocol_packets, bool log_raw_bytes)
 {
   _logfile_raw = log_raw_bytes;
   _logfile_packets = log_protocol_packets;
+  startCapture();
 }
 
 void stopPacketLogger() {
-  if (_packetLogFile != NULL)
-    fclose(_packetLogFile);
-
-  if (_byteLogFile != NULL)
-    fclose(_byteLogFile);
-
   _logfile_raw = false;
   _logfile_packets = false;
-}
-
-// Log passed packets
-void writePacketLog(char *buffer) {
-  if (!_logfile_packets)
-    return;
-
-  if (_packetLogFile == NULL)
-    _packetLogFile = fopen(RS485LOGFILE, "w");
 
-  if (_packetLogFile != NULL) {
-    fputs(buffer, _packetLogFile);
-  } 
+  stopPacketCapture();
 }
 
-// Log Raw Bytes
-void logPacketByte(const unsigned char *byte)
+// Log Raw Bytes, whatever one read() returned
+void logPacketBytes(const unsigned char *bytes, int length)
 {
   if (!_logfile_raw)
     return;
 
-  char buff[10];
-  if (_byteLogFile == NULL)
-    _byteLogFile = fopen(RS485BYTELOGFILE, "w");
-
-  if (_byteLogFile != NULL) {
-    sprintf(buff, "0x%02hhx|",*byte);
-    fputs( buff, _byteLogFile);
-  } 
-  //}
+  capturePacket(CAP_RAW, bytes, length);
 }
 
 /*
@@ -141,14 +131,18 @@ void _logPacket(logmask_t from, const unsigned char *packet_buffer, int packet_l
   else
     LOG(from,LOG_DEBUG_SERIAL, "Serial write %d bytes\n",packet_length);
 #endif
+  if (_logfile_packets)
+    capturePacket(error?CAP_ERROR:(is_read?CAP_READ:CAP_WRITE), packet_buffer, packet_length);
+
+  // Only needed the capture
+  if ( force == false && error == false && getLogLevel(from) < LOG_DEBUG_SERIAL )
+    return;
+
   //char buff[1000];
   char buff[LARGELOGBUFFER];
 
   int len = _beautifyPacket(buff, LARGELOGBUFFER, packet_buffer, packet_length, error, is_read);
 
-  if (_logfile_packets)
-    writePacketLog(buff);
-
   if (error == true)
     LOG_LARGEMSG(from,LOG_WARNING, buff, len);
   else {
@@ -168,6 +162,10 @@ int beautifyPacket(char *buff, int buff_size, const unsigned char *packet_buffer
 {
   return _beautifyPacket(buff, buff_size, packet_buffer, packet_length, false, is_read);
 }
+int beautifyBadPacket(char *buff, int buff_size, const unsigned char *packet_buffer, int packet_length)
+{
+  return _beautifyPacket(buff, buff_size, packet_buffer, packet_length, true, true);
+}
 int _beautifyPacket(char *buff, int buff_size, const unsigned char *packet_buffer, int packet_length, bool error, bool is_read)
 {
   //int i = 0;
@@ -6,6 +6,7 @@
 
 #include "utils.h"
 
+// Text logs, now only written by serial_logger -ctext from the capture (packetCapture.h)
 #define RS485LOGFILE "/tmp/RS485.log"
 #define RS485BYTELOGFILE "/tmp/RS485raw.log"
 
@@ -19,9 +20,10 @@ void stopPacketLogger();
 void logPacketRead(const unsigned char *packet_buffer, int packet_length);
 void logPacketWrite(const unsigned char *packet_buffer, int packet_length);
 void logPacketError(const unsigned char *packet_buffer, int packet_length);
-void logPacketByte(const unsigned char *byte);
+void logPacketBytes(const unsigned char *bytes, int length);
 void logPacket(logmask_t from, int level, const unsigned char *packet_buffer, int packet_length, bool is_read) ;
 int beautifyPacket(char *buff, int buff_size, const unsigned char *packet_buffer, int packet_length, bool is_read);
+int beautifyBadPacket(char *buff, int buff_size, const unsigned char *packet_buffer, int packet_length);
 
 int sprintFrame(char *buff, int buff_size, const unsigned char *packet_buffer, int packet_length);
 
@@ -0,0 +1,1275 @@
+/*
+*
+*  Program to act as the control panel (RS485 master) on a pseudo terminal, so AqualinkD can be
+*  run and timed with no hardware.  Not in release code / binary for AqualinkD
+*
+*  panelemulator -p RS-8 -l /tmp/ttyAQ -t 60
+*  then run aqualinkd with serial_port=/tmp/ttyAQ and the same device_id / extended_device_id.
+*
+*  Polls the keypad ID (and extended ID) with the probe / status / message cadence of the panel,
+*  checks every reply is a good ACK of the right type inside the window, and reports ACK latency,
+*  late & missed slots.  Keys AqualinkD presses on an RS panel toggle the matching LED, so on/off
+*  requests complete.  The RS keypad menus AqualinkD uses for heater setpoints (SET TEMP and REVIEW)
+*  are emulated and each trip through them is timed from the MENU key to the panel confirming, the
+*  rest of the menus are there to be scrolled past, other programming will time out.
+*  On a PDA panel the screens AqualinkD walks for init (firmware, set temp, freeze protect) and heater
+*  setpoints are emulated along with the equipment on/off page.  A setpoint is timed from its first
+*  key until AqualinkD has brought the PDA back to the home page, on/off from its first key to the
+*  SELECT that toggles the device.
+*
+*/
+
+#define _GNU_SOURCE 1 // for posix_openpt & ptsname
+
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <errno.h>
+#include <poll.h>
+#include <termios.h>
+
+#include <fcntl.h>
+#include <time.h>
+
+#include "aq_serial.h"
+#include "utils.h"
+#include "packetLogger.h"
+#include "rs_msg_utils.h"
+#include "pda_menu.h"
+
+#define CONFIG_C // Make us look like config.c when we load config.h so we get globals.
+#include "config.h"
+
+#define PE_WINDOW_MS        10    // Reply has to be complete inside this
+#define PE_LATE_MULTIPLE    4     // Replies up to window * this are late, after that the slot is missed
+#define PE_OFFLINE_MISSES   10    // Missed slots in a row before we go back to probing, like the panel does
+#define PE_NS_PER_BYTE      1041667ULL // 10 bits at 9600 baud
+#define PE_INTERFRAME_NS    1000000ULL
+#define PE_MAX_SAMPLES      (1024 * 1024)
+#define PE_RX_BUFFER        4096
+
+typedef enum pe_panel_type {
+  PE_RS,
+  PE_PDA
+} pe_panel_type;
+
+typedef enum pe_result {
+  PE_OK,
+  PE_LATE,
+  PE_MISSED,
+  PE_BAD
+} pe_result;
+
+typedef struct pe_target {
+  const char *name;
+  unsigned char id;
+  unsigned char ack_type;
+  bool connected;
+  int missed_in_row;
+  uint64_t connected_ns;  // First ACK
+  unsigned long sent;
+  unsigned long ok;
+  unsigned long late;
+  unsigned long missed;
+  unsigned long bad;
+  unsigned long drops;    // Went back to probing
+  unsigned long keys;
+  uint32_t buckets[ACK_LATENCY_BUCKETS];
+  long max_us;
+  uint64_t total_us;
+  long *samples;
+  unsigned long num_samples;
+} pe_target;
+
+typedef struct pe_rx {
+  unsigned char buffer[PE_RX_BUFFER];
+  int length;
+} pe_rx;
+
+bool _keepRunning = true;
+
+static int _master_fd = -1;
+static int _slave_fd = -1;
+static pe_rx _rx;
+static bool _fast = false;
+static uint64_t _window_ns = PE_WINDOW_MS * 1000000ULL;
+static uint64_t _start_ns;
+static unsigned long _load_frames = 0;
+static unsigned long _unexpected = 0;
+
+// Our fake equipment state, LED bytes exactly as they go in the RS status frame.
+static unsigned char _leds[AQ_PSTLEN] = {0x00, 0x00, 0x00, 0x00, 0x00};
+static int _num_aux = 7;
+
+static int _pool_sp = 82;
+static int _spa_sp = 100;
+static int _frz_sp = 38;
+
+// RS keypad key to LED (1 based), same layout AqualinkD uses for RS panels.
+static const struct { unsigned char key; int led; int aux; } _rs_keys[] = {
+  {KEY_PUMP, 7, 0}, {KEY_SPA, 6, 0},
+  {KEY_AUX1, 5, 1}, {KEY_AUX2, 4, 2}, {KEY_AUX3, 3, 3}, {KEY_AUX4, 9, 4},
+  {KEY_AUX5, 8, 5}, {KEY_AUX6, 12, 6}, {KEY_AUX7, 1, 7}
+};
+
+/*
+ * RS keypad menu.  RIGHT / LEFT scroll the items at a level, ENTER selects, CANCEL leaves.
+ * Selecting an item with an action either edits a setpoint (RIGHT / LEFT change it, ENTER sets it)
+ * or shows what it's set to, then the panel goes back to the normal display.
+ */
+typedef enum pe_menu_action {
+  PE_ACT_NONE,
+  PE_ACT_EDIT_POOL,
+  PE_ACT_EDIT_SPA,
+  PE_ACT_SHOW_TEMPS,
+  PE_ACT_SHOW_FRZ,
+  PE_ACT_PDA_ON_OFF
+} pe_menu_action;
+
+typedef struct pe_menu_item {
+  const char *name;
+  pe_menu_action action;
+  const struct pe_menu_item *sub;
+  int num_sub;
+} pe_menu_item;
+
+static const pe_menu_item _set_temp_menu[] = {
+  {"SET POOL TEMP", PE_ACT_EDIT_POOL}, {"SET SPA TEMP", PE_ACT_EDIT_SPA}
+};
+static const pe_menu_item _review_menu[] = {
+  {"TEMP SET", PE_ACT_SHOW_TEMPS}, {"FRZ PROTECT", PE_ACT_SHOW_FRZ}
+};
+static const pe_menu_item _top_menu[] = {
+  {"HELP"}, {"PROGRAM"},
+  {"SET TEMP", PE_ACT_NONE, _set_temp_menu, 2},
+  {"SET TIME"},
+  {"REVIEW", PE_ACT_NONE, _review_menu, 2},
+  {"SYSTEM SETUP"}
+};
+
+#define PE_MENU_MAX_SHOW 3
+
+static struct {
+  bool active;
+  const pe_menu_item *items;   // Level we are scrolling, NULL when editing or showing
+  int num_items;
+  int item;                    // -1 is the 'PRESS ENTER* TO SELECT' title
+  pe_menu_action editing;
+  int value;
+  const char *show[PE_MENU_MAX_SHOW]; // Messages left to show before going back to the normal display
+  int num_show;
+  char display[AQ_MSGLEN * 4];
+  const char *flow;            // Action we are timing
+  uint64_t started_ns;         // MENU key
+  unsigned long keys;
+} _menu;
+
+// Completed trips through the menus, by action.
+static struct {
+  unsigned long count;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  unsigned long keys;
+} _flows[PE_ACT_PDA_ON_OFF + 1];
+
+static const char *_flow_names[] = {"", "SET POOL TEMP", "SET SPA TEMP", "REVIEW TEMP SET", "REVIEW FRZ PROTECT", "PDA ON/OFF"};
+
+/*
+ * PDA screens.  UP / DOWN move the highlight (wrapping over first to last), SELECT goes to the
+ * screen for that line, BACK to the one before.  Set temp & freeze protect values are edited in
+ * place, highlighted characters, UP / DOWN change it and SELECT sets it.
+ */
+typedef enum pe_pda_screen {
+  PE_PDA_NONE,
+  PE_PDA_FW,
+  PE_PDA_HOME,
+  PE_PDA_MAIN,
+  PE_PDA_SET_TEMP,
+  PE_PDA_SYSTEM_SETUP,
+  PE_PDA_FREEZE,
+  PE_PDA_FREEZE_DEVICES,
+  PE_PDA_EQUIPMENT
+} pe_pda_screen;
+
+typedef struct pe_pda_page {
+  const char *lines[PDA_LINES];     // NULL are filled in by pda_line()
+  pe_pda_screen select[PDA_LINES];
+  int first, last;                  // Lines the highlight moves over, -1 for none
+  pe_pda_screen back;
+} pe_pda_page;
+
+static const pe_pda_page _pda_pages[] = {
+  [PE_PDA_FW] = {
+    .lines = {[1] = " PDA-PS8 Combo  ", [3] = "Firmware Version", [5] = "   PDA: 7.1.0   "},
+    .first = -1, .last = -1, .back = PE_PDA_HOME },
+  [PE_PDA_HOME] = {
+    .lines = {[1] = "AIR         POOL", [4] = "POOL MODE    OFF", [5] = "POOL HEATER  OFF",
+              [6] = "SPA MODE     OFF", [7] = "SPA HEATER   OFF", [8] = "MENU", [9] = "EQUIPMENT ON/OFF"},
+    .select = {[8] = PE_PDA_MAIN, [9] = PE_PDA_EQUIPMENT},
+    .first = 4, .last = 9, .back = PE_PDA_HOME },
+  [PE_PDA_MAIN] = {
+    .lines = {[0] = "   MAIN MENU    ", [2] = "HELP           >", [3] = "PROGRAM        >", [4] = "SET TEMP       >",
+              [5] = "SET TIME       >", [6] = "PDA OPTIONS    >", [7] = "SYSTEM SETUP   >"},
+    .select = {[4] = PE_PDA_SET_TEMP, [7] = PE_PDA_SYSTEM_SETUP},
+    .first = 2, .last = 7, .back = PE_PDA_HOME },
+  [PE_PDA_SET_TEMP] = {
+    .lines = {[0] = "    SET TEMP    "},
+    .first = 2, .last = 3, .back = PE_PDA_MAIN },
+  [PE_PDA_SYSTEM_SETUP] = {
+    .lines = {[0] = "  SYSTEM SETUP  ", [1] = "LABEL AUX      >", [2] = "FREEZE PROTECT >", [3] = "AIR TEMP       >",
+              [4] = "DEGREES C/F    >", [5] = "TEMP CALIBRATE >", [6] = "SOLAR PRIORITY >", [7] = "PUMP LOCKOUT   >"},
+    .select = {[2] = PE_PDA_FREEZE},
+    .first = 1, .last = 7, .back = PE_PDA_MAIN },
+  [PE_PDA_FREEZE] = {
+    .lines = {[0] = " FREEZE PROTECT ", [6] = "Use ARROW KEYS  ", [7] = "TO SET VALUE.   ",
+              [8] = "Press SELECT    ", [9] = "TO CONTINUE.    "},
+    .first = -1, .last = -1, .back = PE_PDA_SYSTEM_SETUP },
+  [PE_PDA_FREEZE_DEVICES] = {
+    .lines = {[0] = " FREEZE PROTECT ", [1] = "    DEVICES     ", [2] = "FILTER PUMP    X"},
+    .first = 2, .last = 2, .back = PE_PDA_SYSTEM_SETUP },
+  [PE_PDA_EQUIPMENT] = {
+    .lines = {[0] = "   EQUIPMENT    ", [9] = "ALL OFF"},
+    .first = 1, .last = 9, .back = PE_PDA_HOME }
+};
+
+// Lines 1 to 8 of the equipment page, SELECT toggles them.
+static struct {
+  const char *label;
+  bool on;
+} _pda_equipment[] = {
+  {"FILTER PUMP", false}, {"SPA", false}, {"POOL HEAT", false}, {"SPA HEAT", false},
+  {"AUX1", false}, {"AUX2", false}, {"AUX3", false}, {"AUX4", false}
+};
+
+#define PE_PDA_QUEUE 32
+
+static struct {
+  pe_pda_screen screen;
+  int hlight;
+  int editing;                 // Line whose value is being changed, -1 for none
+  int value;
+  struct {
+    unsigned char data[3 + AQ_MSGLEN];
+    int length;
+  } out[PE_PDA_QUEUE];         // Screen updates to send before the next status
+  int num_out;
+  bool flow;                   // Timing a trip from the home page
+  pe_menu_action flow_action;  // What got set on the way, PE_ACT_NONE if nothing
+  uint64_t started_ns;
+  unsigned long keys;
+} _pda;
+
+void intHandler(int dummy)
+{
+  _keepRunning = false;
+  LOG(SLOG_LOG, LOG_NOTICE, "Stopping!\n");
+}
+
+bool isAqualinkDStopping() {
+  return !_keepRunning;
+}
+
+static uint64_t now_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t when)
+{
+  struct timespec deadline;
+  deadline.tv_sec = when / 1000000000ULL;
+  deadline.tv_nsec = when % 1000000000ULL;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR && _keepRunning) {}
+}
+
+static bool open_pty(const char *link)
+{
+  struct termios tty;
+  char *slave;
+
+  if ((_master_fd = posix_openpt(O_RDWR | O_NOCTTY)) < 0 ||
+      grantpt(_master_fd) != 0 || unlockpt(_master_fd) != 0 ||
+      (slave = ptsname(_master_fd)) == NULL) {
+    LOG(SLOG_LOG, LOG_ERR, "Unable to create pseudo terminal: %s\n", strerror(errno));
+    return false;
+  }
+
+  // Hold the slave open so it's raw before AqualinkD gets there (no echo of our frames back to us),
+  // and so AqualinkD closing & re-opening the port doesn't give us EIO.
+  if ((_slave_fd = open(slave, O_RDWR | O_NOCTTY)) < 0 || tcgetattr(_slave_fd, &tty) != 0) {
+    LOG(SLOG_LOG, LOG_ERR, "Unable to open %s: %s\n", slave, strerror(errno));
+    return false;
+  }
+  cfmakeraw(&tty);
+  cfsetispeed(&tty, B9600);
+  cfsetospeed(&tty, B9600);
+  tcsetattr(_slave_fd, TCSANOW, &tty);
+
+  fcntl(_master_fd, F_SETFL, fcntl(_master_fd, F_GETFL) | O_NONBLOCK);
+
+  if (link != NULL) {
+    unlink(link);
+    if (symlink(slave, link) != 0) {
+      LOG(SLOG_LOG, LOG_ERR, "Unable to link %s to %s: %s\n", link, slave, strerror(errno));
+      return false;
+    }
+    LOG(SLOG_LOG, LOG_NOTICE, "Control panel on %s (%s)\n", link, slave);
+  } else {
+    LOG(SLOG_LOG, LOG_NOTICE, "Control panel on %s\n", slave);
+  }
+
+  return true;
+}
+
+/*
+ * DLE STX data checksum DLE ETX, any DLE in data or checksum is followed by a NUL.
+ * data starts with the destination ID.
+ */
+static void send_frame(const unsigned char *data, int length)
+{
+  unsigned char packet[AQ_MAXPKTLEN];
+  unsigned char frame[AQ_MAXPKTLEN * 2];
+  int i, n = 0;
+
+  packet[0] = DLE;
+  packet[1] = STX;
+  memcpy(&packet[2], data, length);
+  packet[length+3] = DLE;
+  packet[length+4] = ETX;
+  packet[length+2] = generate_checksum(packet, length+5);
+
+  frame[n++] = DLE;
+  frame[n++] = STX;
+  for (i=2; i < length+3; i++) {
+    frame[n++] = packet[i];
+    if (packet[i] == DLE)
+      frame[n++] = NUL;
+  }
+  frame[n++] = DLE;
+  frame[n++] = ETX;
+
+  if (write(_master_fd, frame, n) != n)
+    LOG(SLOG_LOG, LOG_ERR, "Write to pseudo terminal failed\n");
+
+  if (getLogLevel(SLOG_LOG) >= LOG_DEBUG)
+    logPacketWrite(packet, length+5);
+}
+
+// Pull the next whole Jandy frame (unescaped) out of the rx buffer, 0 if there isn't one yet.
+static int take_frame(pe_rx *rx, unsigned char *frame)
+{
+  int start, i, n = 0;
+
+  for (start=0; start < rx->length-1; start++) {
+    if (rx->buffer[start] == DLE && rx->buffer[start+1] == STX)
+      break;
+  }
+  if (start >= rx->length-1) {
+    // Keep a trailing DLE, could be the start of the next frame.
+    if (rx->length > 0 && rx->buffer[rx->length-1] == DLE) {
+      rx->buffer[0] = DLE;
+      rx->length = 1;
+    } else {
+      rx->length = 0;
+    }
+    return 0;
+  }
+
+  frame[n++] = DLE;
+  frame[n++] = STX;
+  for (i=start+2; i < rx->length-1; i++) {
+    if (rx->buffer[i] == DLE && rx->buffer[i+1] == ETX) {
+      frame[n++] = DLE;
+      frame[n++] = ETX;
+      i += 2;
+      memmove(rx->buffer, &rx->buffer[i], rx->length - i);
+      rx->length -= i;
+      return n;
+    }
+    if (n >= AQ_MAXPKTLEN-2)
+      break; // Garbage, drop it
+    frame[n++] = rx->buffer[i];
+    if (rx->buffer[i] == DLE && rx->buffer[i+1] == NUL)
+      i++;
+  }
+
+  if (n >= AQ_MAXPKTLEN-2) {
+    rx->length = 0;
+    return 0;
+  }
+
+  // Not complete, keep it from the start.
+  memmove(rx->buffer, &rx->buffer[start], rx->length - start);
+  rx->length -= start;
+  return 0;
+}
+
+// Wait up to deadline for a frame, returns length or 0.
+static int read_frame(unsigned char *frame, uint64_t deadline)
+{
+  struct pollfd pfd = {.fd = _master_fd, .events = POLLIN};
+  uint64_t now;
+  int length, n;
+
+  while (_keepRunning) {
+    if ((length = take_frame(&_rx, frame)) > 0)
+      return length;
+
+    if ((now = now_ns()) >= deadline)
+      return 0;
+
+    if (poll(&pfd, 1, (int)((deadline - now + 999999) / 1000000)) <= 0)
+      continue;
+
+    if ((n = read(_master_fd, &_rx.buffer[_rx.length], PE_RX_BUFFER - _rx.length)) > 0)
+      _rx.length += n;
+    if (_rx.length >= PE_RX_BUFFER)
+      _rx.length = 0; // Nothing sane fills that.
+  }
+  return 0;
+}
+
+// Anything AqualinkD sent when nobody asked (or too late to count for the slot it was for).
+static void drain_stray()
+{
+  unsigned char frame[AQ_MAXPKTLEN];
+  int n;
+
+  // Master is non blocking, so this only takes what's already there.
+  while (_rx.length < PE_RX_BUFFER && (n = read(_master_fd, &_rx.buffer[_rx.length], PE_RX_BUFFER - _rx.length)) > 0)
+    _rx.length += n;
+
+  while (take_frame(&_rx, frame) > 0)
+    _unexpected++;
+}
+
+static void record_latency(pe_target *t, long us)
+{
+  int b;
+
+  for (b=0; b < ACK_LATENCY_BUCKETS-1; b++) {
+    if (us <= get_ack_latency_bucket_us(b))
+      break;
+  }
+  t->buckets[b]++;
+  t->total_us += us;
+  if (us > t->max_us)
+    t->max_us = us;
+  if (t->samples != NULL && t->num_samples < PE_MAX_SAMPLES)
+    t->samples[t->num_samples++] = us;
+}
+
+static void toggle_led(int led)
+{
+  int i = led - 1;
+  _leds[i / 4] ^= (1 << ((i % 4) * 2));
+}
+
+static void menu_set_display()
+{
+  if (_menu.num_show > 0)
+    snprintf(_menu.display, sizeof(_menu.display), "%s", _menu.show[0]);
+  else if (_menu.editing == PE_ACT_EDIT_POOL)
+    snprintf(_menu.display, sizeof(_menu.display), "POOL %d`F", _menu.value);
+  else if (_menu.editing == PE_ACT_EDIT_SPA)
+    snprintf(_menu.display, sizeof(_menu.display), "SPA %d`F", _menu.value);
+  else if (_menu.item < 0)
+    snprintf(_menu.display, sizeof(_menu.display), "PRESS ENTER* TO SELECT");
+  else
+    snprintf(_menu.display, sizeof(_menu.display), "%s", _menu.items[_menu.item].name);
+}
+
+static void flow_done(pe_menu_action action, uint64_t started_ns, unsigned long keys)
+{
+  uint64_t took = now_ns() - started_ns;
+
+  _flows[action].count++;
+  _flows[action].total_ns += took;
+  _flows[action].keys += keys;
+  if (took > _flows[action].max_ns)
+    _flows[action].max_ns = took;
+
+  LOG(SLOG_LOG, LOG_NOTICE, "%s took %.3f sec, %lu keys\n", _flow_names[action], took / 1e9, keys);
+}
+
+static void menu_flow_done(pe_menu_action action)
+{
+  flow_done(action, _menu.started_ns, _menu.keys);
+}
+
+static void menu_select(const pe_menu_item *item)
+{
+  static char pool[AQ_MSGLEN * 2], spa[AQ_MSGLEN * 2], frz[AQ_MSGLEN * 3];
+
+  switch (item->action) {
+    case PE_ACT_EDIT_POOL:
+      _menu.items = NULL;
+      _menu.editing = item->action;
+      _menu.value = _pool_sp;
+      break;
+    case PE_ACT_EDIT_SPA:
+      _menu.items = NULL;
+      _menu.editing = item->action;
+      _menu.value = _spa_sp;
+      break;
+    case PE_ACT_SHOW_TEMPS:
+      snprintf(pool, sizeof(pool), "POOL TEMP IS SET TO %d`F", _pool_sp);
+      snprintf(spa, sizeof(spa), "SPA TEMP IS SET TO %d`F", _spa_sp);
+      _menu.show[0] = pool;
+      _menu.show[1] = spa;
+      _menu.show[2] = "MAINTAIN TEMP IS OFF";
+      _menu.num_show = 3;
+      menu_flow_done(item->action);
+      break;
+    case PE_ACT_PDA_ON_OFF:
+      break;
+    case PE_ACT_SHOW_FRZ:
+      snprintf(frz, sizeof(frz), "FREEZE PROTECTION IS SET TO %d`F", _frz_sp);
+      _menu.show[0] = frz;
+      _menu.num_show = 1;
+      menu_flow_done(item->action);
+      break;
+    case PE_ACT_NONE:
+      if (item->sub != NULL) {
+        _menu.items = item->sub;
+        _menu.num_items = item->num_sub;
+        _menu.item = 0;
+      }
+      break;
+  }
+}
+
+static void menu_key(pe_target *t, unsigned char key)
+{
+  static char set[AQ_MSGLEN * 3];
+
+  if (!_menu.active) {
+    if (key != KEY_MENU) {
+      LOG(SLOG_LOG, LOG_INFO, "%s key 0x%02hhx (not emulated)\n", t->name, key);
+      return;
+    }
+    memset(&_menu, 0, sizeof(_menu));
+    _menu.active = true;
+    _menu.items = _top_menu;
+    _menu.num_items = sizeof(_top_menu) / sizeof(_top_menu[0]);
+    _menu.item = -1;
+    _menu.started_ns = now_ns();
+  }
+  _menu.keys++;
+
+  if (key == KEY_CANCEL) {
+    LOG(SLOG_LOG, LOG_INFO, "%s left menu\n", t->name);
+    _menu.active = false;
+    return;
+  }
+
+  if (_menu.num_show > 0) {
+    // Showing a result, panel ignores keys till it's done.
+  } else if (_menu.editing != PE_ACT_NONE) {
+    if (key == KEY_RIGHT) {
+      _menu.value++;
+    } else if (key == KEY_LEFT) {
+      _menu.value--;
+    } else if (key == KEY_ENTER) {
+      if (_menu.editing == PE_ACT_EDIT_POOL) {
+        _pool_sp = _menu.value;
+        snprintf(set, sizeof(set), "POOL TEMP IS SET TO %d`F", _pool_sp);
+      } else {
+        _spa_sp = _menu.value;
+        snprintf(set, sizeof(set), "SPA TEMP IS SET TO %d`F", _spa_sp);
+      }
+      _menu.show[0] = set;
+      _menu.num_show = 1;
+      menu_flow_done(_menu.editing);
+      _menu.editing = PE_ACT_NONE;
+    }
+  } else if (key == KEY_RIGHT) {
+    _menu.item = (_menu.item + 1) % _menu.num_items;
+  } else if (key == KEY_LEFT) {
+    _menu.item = (_menu.item <= 0) ? _menu.num_items - 1 : _menu.item - 1;
+  } else if (key == KEY_ENTER && _menu.item >= 0) {
+    menu_select(&_menu.items[_menu.item]);
+  }
+
+  menu_set_display();
+  LOG(SLOG_LOG, LOG_INFO, "%s key 0x%02hhx, menu shows '%s'\n", t->name, key, _menu.display);
+}
+
+static void rs_key(pe_target *t, unsigned char key)
+{
+  int i;
+
+  for (i=0; i < sizeof(_rs_keys) / sizeof(_rs_keys[0]); i++) {
+    if (_rs_keys[i].key == key && _rs_keys[i].aux <= _num_aux) {
+      toggle_led(_rs_keys[i].led);
+      LOG(SLOG_LOG, LOG_INFO, "%s key 0x%02hhx, LED %d now %s\n", t->name, key, _rs_keys[i].led,
+          (_leds[(_rs_keys[i].led-1) / 4] >> (((_rs_keys[i].led-1) % 4) * 2)) & 1 ? "on" : "off");
+      return;
+    }
+  }
+  menu_key(t, key);
+}
+
+/*
+ * One slot, send to t and wait for its ACK.  Before the target has answered a probe nothing is
+ * held against it.  Returns what happened, *key is the command in the ACK.
+ */
+static pe_result exchange(pe_target *t, const unsigned char *data, int length, unsigned char *key)
+{
+  unsigned char frame[AQ_MAXPKTLEN];
+  uint64_t start, end, wire;
+  int rlength;
+  pe_result rtn;
+
+  drain_stray();
+
+  *key = NUL;
+  send_frame(data, length);
+  start = now_ns();
+
+  rlength = read_frame(frame, start + _window_ns * PE_LATE_MULTIPLE);
+  end = now_ns();
+
+  if (rlength == 0) {
+    rtn = PE_MISSED;
+  } else if (frame[PKT_DEST] != DEV_MASTER || frame[PKT_CMD] != CMD_ACK || rlength < 9 ||
+             !check_jandy_checksum(frame, rlength) ||
+             (frame[PKT_DATA] != t->ack_type && !(t->ack_type == ACK_NORMAL && frame[PKT_DATA] == ACK_SCREEN_BUSY_SCROLL))) {
+    char buf[512];
+    beautifyPacket(buf, sizeof(buf), frame, rlength, true);
+    LOG(SLOG_LOG, LOG_WARNING, "%s bad reply %s\n", t->name, buf);
+    rtn = PE_BAD;
+  } else {
+    rtn = (end - start <= _window_ns) ? PE_OK : PE_LATE;
+    *key = frame[PKT_DATA+1];
+  }
+
+  if (!t->connected) {
+    if (rtn == PE_OK || rtn == PE_LATE) {
+      t->connected = true;
+      t->missed_in_row = 0;
+      if (t->connected_ns == 0) {
+        t->connected_ns = end;
+        LOG(SLOG_LOG, LOG_NOTICE, "%s 0x%02hhx answered probe after %.3f sec\n", t->name, t->id, (end - _start_ns) / 1e9);
+      } else {
+        LOG(SLOG_LOG, LOG_NOTICE, "%s 0x%02hhx back online\n", t->name, t->id);
+      }
+    }
+  } else {
+    t->sent++;
+    switch (rtn) {
+      case PE_OK:     t->ok++;     break;
+      case PE_LATE:   t->late++;   break;
+      case PE_MISSED: t->missed++; break;
+      case PE_BAD:    t->bad++;    break;
+    }
+    if (rtn == PE_MISSED) {
+      if (++t->missed_in_row >= PE_OFFLINE_MISSES) {
+        LOG(SLOG_LOG, LOG_WARNING, "%s 0x%02hhx missed %d slots, probing again\n", t->name, t->id, t->missed_in_row);
+        t->connected = false;
+        t->drops++;
+      }
+    } else {
+      t->missed_in_row = 0;
+    }
+    if (*key != NUL)
+      t->keys++;
+  }
+
+  if (rtn == PE_OK || rtn == PE_LATE)
+    record_latency(t, (long)((end - start) / 1000));
+
+  // Hold the bus for as long as both frames would have taken at 9600
+  if (!_fast) {
+    wire = (length + 5 + (rlength > 0 ? rlength : 0)) * PE_NS_PER_BYTE + PE_INTERFRAME_NS;
+    if (rtn == PE_MISSED)
+      wire += _window_ns;
+    sleep_until_ns(start + wire);
+  }
+
+  return rtn;
+}
+
+static void probe(pe_target *t)
+{
+  unsigned char data[] = {t->id, CMD_PROBE};
+  unsigned char key;
+
+  exchange(t, data, sizeof(data), &key);
+}
+
+static pe_result send_message(pe_target *t, unsigned char cmd, unsigned char index, const char *msg, unsigned char *key)
+{
+  unsigned char data[3 + AQ_MSGLEN];
+
+  data[0] = t->id;
+  data[1] = cmd;
+  data[2] = index;
+  memset(&data[3], ' ', AQ_MSGLEN);
+  memcpy(&data[3], msg, strnlen(msg, AQ_MSGLEN));
+
+  return exchange(t, data, sizeof(data), key);
+}
+
+// Anything longer than a line goes as the 5 part long message.
+static void send_display(pe_target *t, const char *msg, unsigned char *key)
+{
+  char part[AQ_MSGLEN + 1];
+  unsigned char k;
+  int i, len = strlen(msg);
+
+  if (len <= AQ_MSGLEN) {
+    send_message(t, CMD_MSG, 0x00, msg, key);
+    return;
+  }
+
+  *key = NUL;
+  for (i=1; i <= 5; i++) {
+    snprintf(part, sizeof(part), "%s", (i-1) * AQ_MSGLEN < len ? msg + (i-1) * AQ_MSGLEN : "");
+    send_message(t, CMD_MSG_LONG, i, part, &k);
+    if (k != NUL)
+      *key = k;
+  }
+}
+
+// One message a cycle while in the menu, what it shows now.
+static void poll_rs_menu(pe_target *t, unsigned char *key)
+{
+  send_display(t, _menu.display, key);
+
+  if (_menu.num_show > 0) {
+    memmove(&_menu.show[0], &_menu.show[1], sizeof(_menu.show[0]) * (PE_MENU_MAX_SHOW - 1));
+    if (--_menu.num_show == 0)
+      _menu.active = false; // Back to the normal display
+    else
+      menu_set_display();
+  }
+}
+
+static void local_time(char *buf, int size, bool pda)
+{
+  time_t now = time(NULL);
+  struct tm tm;
+  char day[4];
+  int hour, i;
+
+  localtime_r(&now, &tm);
+  hour = tm.tm_hour % 12 == 0 ? 12 : tm.tm_hour % 12;
+
+  if (pda) {
+    // "     SAT 8:46AM " / "     SAT 10:29AM"
+    strftime(day, sizeof(day), "%a", &tm);
+    for (i=0; day[i] != '\0'; i++)
+      day[i] = toupper(day[i]);
+    snprintf(buf, size, "     %.3s %d:%02d%s", day, hour, tm.tm_min, tm.tm_hour < 12 ? "AM" : "PM");
+  } else {
+    snprintf(buf, size, "%d:%02d %s", hour, tm.tm_min, tm.tm_hour < 12 ? "AM" : "PM");
+  }
+}
+
+// RS keypad, status every cycle and one line of the message loop.
+static void poll_rs_keypad(pe_target *t, unsigned long cycle, bool *sent_rev)
+{
+  unsigned char status[2 + AQ_PSTLEN];
+  unsigned char loop[] = {t->id, CMD_MSG_LOOP_ST};
+  unsigned char key;
+  char msg[AQ_MSGLEN * 2];
+
+  if (!t->connected) {
+    probe(t);
+    *sent_rev = false;
+    return;
+  }
+
+  status[0] = t->id;
+  status[1] = CMD_STATUS;
+  memcpy(&status[2], _leds, AQ_PSTLEN);
+  if (exchange(t, status, sizeof(status), &key) <= PE_LATE && key != NUL)
+    rs_key(t, key);
+
+  if (_menu.active) {
+    poll_rs_menu(t, &key);
+    if (key != NUL)
+      rs_key(t, key);
+    return;
+  }
+
+  if (!*sent_rev) {
+    send_message(t, CMD_MSG, 0x00, "8157 REV T.2", &key);
+    *sent_rev = true;
+    return;
+  }
+
+  switch (cycle % 4) {
+    case 0:
+      exchange(t, loop, sizeof(loop), &key);
+      break;
+    case 1:
+      send_message(t, CMD_MSG, 0x00, "AIR TEMP 75`F", &key);
+      break;
+    case 2:
+      send_message(t, CMD_MSG, 0x00, "POOL TEMP 80`F", &key);
+      break;
+    case 3:
+      local_time(msg, sizeof(msg), false);
+      send_message(t, CMD_MSG, 0x00, msg, &key);
+      break;
+  }
+  if (key != NUL)
+    rs_key(t, key);
+}
+
+static void pda_queue(const unsigned char *data, int length)
+{
+  if (_pda.num_out >= PE_PDA_QUEUE) {
+    LOG(SLOG_LOG, LOG_WARNING, "PDA screen update queue full\n");
+    return;
+  }
+  memcpy(_pda.out[_pda.num_out].data, data, length);
+  _pda.out[_pda.num_out].length = length;
+  _pda.num_out++;
+}
+
+static void pda_line(int line, char *buf, int size)
+{
+  const char *text = _pda_pages[_pda.screen].lines[line];
+
+  if (text != NULL) {
+    snprintf(buf, size, "%s", text);
+  } else if (_pda.screen == PE_PDA_HOME && line == 0) {
+    local_time(buf, size, true);
+  } else if (_pda.screen == PE_PDA_HOME && line == 2) {
+    snprintf(buf, size, " 75`     80`    ");
+  } else if (_pda.screen == PE_PDA_SET_TEMP && line == 2) {
+    snprintf(buf, size, "%-9s%5d`F", "POOL HEAT", _pda.editing == line ? _pda.value : _pool_sp);
+  } else if (_pda.screen == PE_PDA_SET_TEMP && line == 3) {
+    snprintf(buf, size, "%-9s%5d`F", "SPA HEAT", _pda.editing == line ? _pda.value : _spa_sp);
+  } else if (_pda.screen == PE_PDA_FREEZE && line == 2) {
+    snprintf(buf, size, "%-10s%4d`F", "TEMP", _pda.editing == line ? _pda.value : _frz_sp);
+  } else if (_pda.screen == PE_PDA_EQUIPMENT && line >= 1 && line <= 8) {
+    snprintf(buf, size, "%-13s%3s", _pda_equipment[line-1].label, _pda_equipment[line-1].on ? "ON" : "OFF");
+  } else {
+    buf[0] = '\0';
+  }
+}
+
+static void pda_queue_line(unsigned char id, int line)
+{
+  unsigned char data[3 + AQ_MSGLEN];
+  char text[AQ_MSGLEN * 2];
+
+  pda_line(line, text, sizeof(text));
+
+  data[0] = id;
+  data[1] = CMD_MSG_LONG;
+  data[2] = line;
+  // Time & temps on the home page always use these.
+  if (_pda.screen == PE_PDA_HOME && line == 0)
+    data[2] = 0x40;
+  else if (_pda.screen == PE_PDA_HOME && line == 2)
+    data[2] = 0x82;
+  memset(&data[3], ' ', AQ_MSGLEN);
+  memcpy(&data[3], text, strnlen(text, AQ_MSGLEN));
+
+  pda_queue(data, sizeof(data));
+}
+
+// Highlight the line, or just the number on it when editing.
+static void pda_queue_hlight(unsigned char id)
+{
+  unsigned char hlight[] = {id, CMD_PDA_HIGHLIGHT, _pda.hlight, 0x00, 0x00};
+  unsigned char chars[] = {id, CMD_PDA_HIGHLIGHTCHARS, _pda.editing, 0x00, 0x00, 0x01};
+  char text[AQ_MSGLEN * 2];
+  int i;
+
+  if (_pda.editing < 0) {
+    if (_pda.hlight >= 0)
+      pda_queue(hlight, sizeof(hlight));
+    return;
+  }
+
+  pda_line(_pda.editing, text, sizeof(text));
+  for (i=0; text[i] != '\0' && !isdigit((unsigned char)text[i]); i++) {}
+  chars[3] = i;
+  for (; isdigit((unsigned char)text[i]); i++) {}
+  chars[4] = i;
+  pda_queue(chars, sizeof(chars));
+}
+
+static void pda_show(unsigned char id, pe_pda_screen screen)
+{
+  unsigned char clear[] = {id, CMD_PDA_CLEAR};
+  int i;
+
+  _pda.screen = screen;
+  _pda.hlight = _pda_pages[screen].first;
+  _pda.editing = -1;
+  if (screen == PE_PDA_FREEZE) {
+    _pda.editing = _pda.hlight = 2;
+    _pda.value = _frz_sp;
+  }
+
+  pda_queue(clear, sizeof(clear));
+  for (i=0; i < PDA_LINES; i++) {
+    if (_pda_pages[screen].lines[i] != NULL || (i >= 2 && i <= 3 && screen == PE_PDA_SET_TEMP) ||
+        (i <= 2 && screen == PE_PDA_HOME) || (i >= 1 && i <= 8 && screen == PE_PDA_EQUIPMENT))
+      pda_queue_line(id, i);
+  }
+  // AqualinkD only knows it's the freeze protect page from line 6, so the value comes after it.
+  if (screen == PE_PDA_FREEZE)
+    pda_queue_line(id, 2);
+  pda_queue_hlight(id);
+
+  if (screen == PE_PDA_HOME && _pda.flow) {
+    if (_pda.flow_action != PE_ACT_NONE)
+      flow_done(_pda.flow_action, _pda.started_ns, _pda.keys);
+    _pda.flow = false;
+  }
+}
+
+static void pda_key(pe_target *t, unsigned char key)
+{
+  const pe_pda_page *page = &_pda_pages[_pda.screen];
+
+  if (!_pda.flow) {
+    _pda.flow = true;
+    _pda.flow_action = PE_ACT_NONE;
+    _pda.started_ns = now_ns();
+    _pda.keys = 0;
+  }
+  _pda.keys++;
+
+  switch (key) {
+    case KEY_PDA_UP:
+    case KEY_PDA_DOWN:
+      if (_pda.editing >= 0) {
+        _pda.value += (key == KEY_PDA_UP) ? 1 : -1;
+        pda_queue_line(t->id, _pda.editing);
+        pda_queue_hlight(t->id);
+      } else if (page->first >= 0) {
+        if (key == KEY_PDA_UP)
+          _pda.hlight = (_pda.hlight <= page->first) ? page->last : _pda.hlight - 1;
+        else
+          _pda.hlight = (_pda.hlight >= page->last) ? page->first : _pda.hlight + 1;
+        pda_queue_hlight(t->id);
+      }
+      break;
+    case KEY_PDA_SELECT:
+      if (_pda.editing >= 0 && _pda.screen == PE_PDA_FREEZE) {
+        _frz_sp = _pda.value;
+        pda_show(t->id, PE_PDA_FREEZE_DEVICES);
+      } else if (_pda.editing >= 0) {
+        if (_pda.editing == 2) {
+          _pool_sp = _pda.value;
+          _pda.flow_action = PE_ACT_EDIT_POOL;
+        } else {
+          _spa_sp = _pda.value;
+          _pda.flow_action = PE_ACT_EDIT_SPA;
+        }
+        _pda.editing = -1;
+        pda_queue_line(t->id, _pda.hlight);
+        pda_queue_hlight(t->id);
+      } else if (_pda.screen == PE_PDA_SET_TEMP) {
+        _pda.editing = _pda.hlight;
+        _pda.value = (_pda.hlight == 2) ? _pool_sp : _spa_sp;
+        pda_queue_hlight(t->id);
+      } else if (_pda.screen == PE_PDA_EQUIPMENT && _pda.hlight >= 1 && _pda.hlight <= 8) {
+        // AqualinkD stays on this page, so the trip ends here rather than on the home page.
+        _pda_equipment[_pda.hlight-1].on = !_pda_equipment[_pda.hlight-1].on;
+        pda_queue_line(t->id, _pda.hlight);
+        pda_queue_hlight(t->id);
+        flow_done(PE_ACT_PDA_ON_OFF, _pda.started_ns, _pda.keys);
+        _pda.flow = false;
+      } else if (_pda.hlight >= 0 && page->select[_pda.hlight] != PE_PDA_NONE) {
+        pda_show(t->id, page->select[_pda.hlight]);
+      } else {
+        LOG(SLOG_LOG, LOG_INFO, "%s select line %d (not emulated)\n", t->name, _pda.hlight);
+      }
+      break;
+    case KEY_PDA_BACK:
+      if (_pda.editing >= 0 && _pda.screen == PE_PDA_SET_TEMP) {
+        _pda.editing = -1;
+        pda_queue_line(t->id, _pda.hlight);
+        pda_queue_hlight(t->id);
+      } else {
+        pda_show(t->id, page->back);
+      }
+      break;
+    default:
+      LOG(SLOG_LOG, LOG_INFO, "%s key 0x%02hhx (not emulated)\n", t->name, key);
+      return;
+  }
+  LOG(SLOG_LOG, LOG_INFO, "%s key 0x%02hhx, screen %d line %d%s\n", t->name, key, _pda.screen, _pda.hlight, _pda.editing >= 0 ? " editing" : "");
+}
+
+// PDA, what changed on the screen then status, keys are only taken on the status.
+static void poll_pda(pe_target *t, unsigned long cycle)
+{
+  unsigned char status[2 + AQ_PSTLEN] = {t->id, CMD_STATUS, 0x00, 0x00, 0x00, 0x00, 0x00};
+  unsigned char key;
+
+  if (!t->connected) {
+    probe(t);
+    _pda.screen = PE_PDA_NONE;
+    _pda.num_out = 0;
+    return;
+  }
+
+  // Starts on the firmware screen, AqualinkD runs its init from there.
+  if (_pda.screen == PE_PDA_NONE)
+    pda_show(t->id, PE_PDA_FW);
+
+  if (_pda.num_out > 0) {
+    exchange(t, _pda.out[0].data, _pda.out[0].length, &key);
+    memmove(&_pda.out[0], &_pda.out[1], sizeof(_pda.out[0]) * --_pda.num_out);
+  } else if (_pda.screen == PE_PDA_HOME && cycle % 8 == 0) {
+    pda_queue_line(t->id, 0);
+    return;
+  } else {
+    exchange(t, status, sizeof(status), &key);
+  }
+
+  if (key != NUL)
+    pda_key(t, key);
+}
+
+static void poll_iaqtouch(pe_target *t)
+{
+  unsigned char poll[] = {t->id, CMD_IAQ_POLL};
+  unsigned char key;
+
+  if (!t->connected) {
+    probe(t);
+    return;
+  }
+
+  exchange(t, poll, sizeof(poll), &key);
+  if (key != NUL)
+    LOG(SLOG_LOG, LOG_INFO, "%s key 0x%02hhx (pages not emulated)\n", t->name, key);
+}
+
+/*
+ * Other traffic on the bus AqualinkD has to read past, a probe to an ID nobody has and an SWG
+ * that answers (we play both ends).  AqualinkD should never reply to either, anything it does
+ * send is counted as unexpected by the next slot.
+ */
+static void synthetic_load(int frames, unsigned char our_id)
+{
+  unsigned char empty[] = {our_id == 0x09 ? 0x0b : 0x09, CMD_PROBE};
+  unsigned char swg[] = {0x50, CMD_PERCENT, 50};
+  unsigned char swg_reply[] = {DEV_MASTER, CMD_PPM, 0x1f, 0x00, 0x00, 0x00};
+  uint64_t start;
+  int i;
+
+  for (i=0; i < frames && _keepRunning; i++) {
+    start = now_ns();
+    if (i % 2 == 0) {
+      send_frame(empty, sizeof(empty));
+      _load_frames++;
+    } else {
+      send_frame(swg, sizeof(swg));
+      send_frame(swg_reply, sizeof(swg_reply));
+      _load_frames += 2;
+    }
+    if (!_fast)
+      sleep_until_ns(start + 20 * PE_NS_PER_BYTE + PE_INTERFRAME_NS);
+  }
+}
+
+static int compare_long(const void *a, const void *b)
+{
+  long x = *(const long *)a;
+  long y = *(const long *)b;
+  return (x > y) - (x < y);
+}
+
+static void report(pe_target *t, double seconds)
+{
+  unsigned long answered = t->ok + t->late;
+  char line[512];
+  int b, n = 0;
+
+  if (t->id == NUL)
+    return;
+
+  if (t->connected_ns == 0) {
+    LOG(SLOG_LOG, LOG_NOTICE, "%s 0x%02hhx never answered a probe\n", t->name, t->id);
+    return;
+  }
+
+  LOG(SLOG_LOG, LOG_NOTICE, "%s 0x%02hhx, first ACK after %.3f sec, %lu slots in %.1f sec\n",
+      t->name, t->id, (t->connected_ns - _start_ns) / 1e9, t->sent, seconds);
+  LOG(SLOG_LOG, LOG_NOTICE, "  ok %lu, late %lu, missed %lu (%.3f%%), bad %lu, dropped %lu, keys %lu\n",
+      t->ok, t->late, t->missed, t->sent > 0 ? 100.0 * t->missed / t->sent : 0.0, t->bad, t->drops, t->keys);
+
+  if (t->num_samples > 0) {
+    qsort(t->samples, t->num_samples, sizeof(long), compare_long);
+    LOG(SLOG_LOG, LOG_NOTICE, "  ACK latency us: avg %.0f, p50 %ld, p90 %ld, p99 %ld, max %ld\n",
+        answered > 0 ? (double)t->total_us / answered : 0.0,
+        t->samples[t->num_samples / 2], t->samples[t->num_samples * 9 / 10],
+        t->samples[t->num_samples * 99 / 100], t->max_us);
+  }
+
+  for (b=0; b < ACK_LATENCY_BUCKETS; b++) {
+    if (get_ack_latency_bucket_us(b) > 0)
+      n += snprintf(line + n, sizeof(line) - n, " <=%ldus:%u", get_ack_latency_bucket_us(b), t->buckets[b]);
+    else
+      n += snprintf(line + n, sizeof(line) - n, " more:%u", t->buckets[b]);
+  }
+  LOG(SLOG_LOG, LOG_NOTICE, " %s\n", line);
+}
+
+static void init_target(pe_target *t, const char *name, unsigned char id, unsigned char ack_type)
+{
+  memset(t, 0, sizeof(pe_target));
+  t->name = name;
+  t->id = id;
+  t->ack_type = ack_type;
+  if (id != NUL)
+    t->samples = malloc(sizeof(long) * PE_MAX_SAMPLES);
+}
+
+void printHelp(const char *name)
+{
+  printf("%s\n", name);
+  printf("\t-h             (this message)\n");
+  printf("\t-p <panel>     (RS-4 RS-6 RS-8 RS-10 RS-12 RS-14 RS-16 or PDA, default RS-8)\n");
+  printf("\t-id <id>       (Keypad ID AqualinkD uses, default 0x0a, 0x60 for PDA)\n");
+  printf("\t-e <id>        (iAqualinkTouch extended ID AqualinkD uses, 0x30-0x33)\n");
+  printf("\t-l <file>      (Link to the pseudo terminal, use it as serial_port)\n");
+  printf("\t-t <sec>       (Run time, default 60)\n");
+  printf("\t-w <ms>        (ACK window, default %d)\n", PE_WINDOW_MS);
+  printf("\t-load <n>      (Extra frames to other devices each cycle)\n");
+  printf("\t-fast          (Don't pace to 9600 baud)\n");
+  printf("\t-v / -vv       (Debug / log every frame)\n");
+}
+
+int main(int argc, char *argv[])
+{
+  int logLevel = LOG_NOTICE;
+  pe_panel_type panel = PE_RS;
+  const char *panel_name = "RS-8";
+  const char *link = NULL;
+  int keypad_id = -1;
+  int extended_id = NUL;
+  int duration = 60;
+  int load = 0;
+  pe_target keypad;
+  pe_target extended;
+  unsigned long cycle = 0;
+  bool sent_rev = false;
+  uint64_t end_ns;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0) {
+      printHelp(basename(argv[0]));
+      return 0;
+    } else if (strcmp(argv[i], "-p") == 0 && i+1 < argc) {
+      panel_name = argv[++i];
+      if (strcasecmp(panel_name, "PDA") == 0) {
+        panel = PE_PDA;
+      } else if (strncasecmp(panel_name, "RS-", 3) == 0 && atoi(panel_name+3) >= 4 && atoi(panel_name+3) <= 16) {
+        panel = PE_RS;
+        _num_aux = atoi(panel_name+3) - 1;
+        if (_num_aux > 7)
+          _num_aux = 7; // Rest are on the aux B keys / other protocols
+      } else {
+        fprintf(stderr, "ERROR, unknown panel '%s'\n", panel_name);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "-id") == 0 && i+1 < argc) {
+      keypad_id = strtoul(argv[++i], NULL, 16);
+    } else if (strcmp(argv[i], "-e") == 0 && i+1 < argc) {
+      extended_id = strtoul(argv[++i], NULL, 16);
+    } else if (strcmp(argv[i], "-l") == 0 && i+1 < argc) {
+      link = argv[++i];
+    } else if (strcmp(argv[i], "-t") == 0 && i+1 < argc) {
+      duration = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-w") == 0 && i+1 < argc) {
+      _window_ns = strtoul(argv[++i], NULL, 10) * 1000000ULL;
+    } else if (strcmp(argv[i], "-load") == 0 && i+1 < argc) {
+      load = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-fast") == 0) {
+      _fast = true;
+    } else if (strcmp(argv[i], "-v") == 0) {
+      logLevel = LOG_INFO;
+    } else if (strcmp(argv[i], "-vv") == 0) {
+      logLevel = LOG_DEBUG;
+    }
+  }
+
+  if (keypad_id < 0)
+    keypad_id = (panel == PE_PDA ? 0x60 : 0x0a);
+
+  if ( (panel == PE_RS && (keypad_id < 0x08 || keypad_id > 0x0b)) || (panel == PE_PDA && (keypad_id < 0x60 || keypad_id > 0x63)) ) {
+    fprintf(stderr, "ERROR, ID 0x%02x isn't a %s keypad ID\n", keypad_id, panel_name);
+    return 1;
+  }
+  if (extended_id != NUL && (panel == PE_PDA || extended_id < 0x30 || extended_id > 0x33)) {
+    fprintf(stderr, "ERROR, extended ID 0x%02x isn't an iAqualinkTouch ID on an RS panel\n", extended_id);
+    return 1;
+  }
+
+#ifdef AQ_MANAGER
+  setLoggingPrms(logLevel, false, NULL);
+#else
+  setLoggingPrms(logLevel, false, NULL, NULL);
+#endif
+
+  LOG(SLOG_LOG, LOG_NOTICE, "Starting %s as %s panel\n", basename(argv[0]), panel_name);
+
+  if (!open_pty(link))
+    return 1;
+
+  signal(SIGINT, intHandler);
+  signal(SIGTERM, intHandler);
+
+  init_target(&keypad, panel == PE_PDA ? "PDA" : "AllButton", keypad_id, panel == PE_PDA ? ACK_PDA : ACK_NORMAL);
+  init_target(&extended, "iAqualinkTouch", extended_id, ACK_IAQ_TOUCH);
+
+  _start_ns = now_ns();
+  end_ns = _start_ns + (uint64_t)duration * 1000000000ULL;
+
+  while (_keepRunning && now_ns() < end_ns) {
+    if (panel == PE_PDA)
+      poll_pda(&keypad, cycle);
+    else
+      poll_rs_keypad(&keypad, cycle, &sent_rev);
+
+    if (extended.id != NUL)
+      poll_iaqtouch(&extended);
+
+    if (load > 0)
+      synthetic_load(load, keypad.id);
+
+    cycle++;
+  }
+
+  LOG(SLOG_LOG, LOG_NOTICE, "%s panel, %lu cycles, %lu load frames, %lu unexpected replies\n",
+      panel_name, cycle, _load_frames, _unexpected);
+  report(&keypad, (now_ns() - _start_ns) / 1e9);
+  report(&extended, (now_ns() - _start_ns) / 1e9);
+  for (i=PE_ACT_EDIT_POOL; i <= PE_ACT_PDA_ON_OFF; i++) {
+    if (_flows[i].count > 0)
+      LOG(SLOG_LOG, LOG_NOTICE, "%s x%lu, avg %.3f sec, max %.3f sec, avg %.1f keys\n", _flow_names[i], _flows[i].count,
+          _flows[i].total_ns / 1e9 / _flows[i].count, _flows[i].max_ns / 1e9, (double)_flows[i].keys / _flows[i].count);
+  }
+
+  if (link != NULL)
+    unlink(link);
+  close(_slave_fd);
+  close(_master_fd);
+  free(keypad.samples);
+  free(extended.samples);
+
+  return keypad.connected_ns == 0 ? 1 : 0;
+}
@@ -31,6 +31,7 @@
 #include "packetLogger.h"
 #include "devices_jandy.h"
 #include "rs_msg_utils.h"
+#include "uri_routes.h"
 
 // Used in equiptment_update_cycle() for additional items on EQUIPMENT STATUS
 // TOTAL_BUTTONS is at most 20 so bits 21-31 should be available
@@ -158,27 +159,31 @@ unsigned char get_last_pda_packet_type()
 void set_pda_led(struct aqualinkled *led, char state)
 {
   aqledstate old_state = led->state;
+  aqledstate new_state;
+  bool changed = false;
+
   if (state == 'N')
   {
-    led->state = ON;
+    new_state = ON;
   }
   else if (state == 'A')
   {
-    led->state = ENABLE;
+    new_state = ENABLE;
   }
   else if (state == '*')
   {
-    led->state = FLASH;
+    new_state = FLASH;
   }
   else if (state == '%')
   {
-    led->state = ON;
+    new_state = ON;
   }
   else
   {
-    led->state = OFF;
+    new_state = OFF;
   }
-  if (old_state != led->state)
+  SET_IF_CHANGED(led->state, new_state, changed);
+  if (changed)
   {
     LOG(PDA_LOG,LOG_DEBUG, "set_pda_led from %d to %d\n", old_state, led->state);
   }
@@ -861,6 +866,7 @@ void process_pda_packet_msg_long_level_aux_device(const char *msg)
       label = (char*)malloc(strlen(str)+1);
       strcpy ( label, str );
       _aqualink_data->aqbuttons[li-1].label = label;
+      invalidate_uri_button_index();
     } else {
       LOG(PDA_LOG,LOG_ERR, "PDA couldn't get AUX? number\n", pda_m_line(0));
     }
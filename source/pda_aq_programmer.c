@@ -65,6 +65,7 @@ void waitfor_queue2empty();
 void send_cmd(unsigned char cmd);
 unsigned char pop_allb_cmd(struct aqualinkdata *aqdata);
 int get_allb_queue_length();
+bool allb_cmd_pending();
 
 void waitfor_pda_queue2empty() {
   waitfor_queue2empty();
@@ -73,11 +74,16 @@ void send_pda_cmd(unsigned char cmd) {
   send_cmd(cmd);
 }
 unsigned char pop_pda_cmd(struct aqualinkdata *aqdata){
-  return pop_allb_cmd(aqdata);
+  unsigned char cmd = pop_allb_cmd(aqdata);
+  signal_prog_event(AQUAPDA);
+  return cmd;
 }
 int get_pda_queue_length(){
   return get_allb_queue_length();
 }
+bool pda_cmd_pending(){
+  return allb_cmd_pending();
+}
 
 #else
 
@@ -95,6 +101,10 @@ int get_pda_queue_length(){
   return _pda_cmdstack_place;
 }
 
+bool pda_cmd_pending(){
+  return (_pda_command != NUL);
+}
+
 bool push_pda_cmd(unsigned char cmd) {
   _pda_command = cmd;
   /*
@@ -121,6 +131,7 @@ unsigned char pop_pda_cmd(struct aqualinkdata *aqdata)
   if (_pda_command != NUL && aqdata->last_packet_type == CMD_STATUS) {
     cmd = _pda_command;
     _pda_command = NUL;
+    signal_prog_event(AQUAPDA);
   }
 /*
   // Only send commands on status messages 
@@ -142,9 +153,8 @@ bool waitfor_pda_queue2empty() {
     LOG(PDA_LOG, LOG_DEBUG, "Waiting for queue to empty\n");
   }
 
-  while ( (_pda_command != NUL) && ( i++ < PROGRAMMING_POLL_COUNTER) ) {
-    delay(100);
-  }
+  if ( ! wait_for_prog_cmd_sent(AQUAPDA, &_pda_command, PROGRAMMING_POLL_COUNTER * 100) )
+    i = PROGRAMMING_POLL_COUNTER;
 /*
   if (get_pda_queue_length() > 0) {
     LOG(PDA_LOG, LOG_DEBUG, "Waiting for queue to empty\n");
@@ -662,14 +672,14 @@ void *set_aqualink_PDA_device_on_off( void *ptr )
       LOG(PDA_LOG,LOG_INFO, "PDA Device On/Off, found device '%s', changing state\n",button->label);
       force_queue_delete(); // NSF This is a bad thing to do.  Need to fix this
       send_pda_cmd(KEY_PDA_SELECT);
-      while (get_pda_queue_length() > 0) { delay(500); }
+      waitfor_pda_queue2empty();
       // If you are turning on a heater there will be a sub menu to set temp
       if ((state == ON) && ((device == aqdata->pool_heater_index) || (device == aqdata->spa_heater_index))) {
         if (! waitForPDAnextMenu(aqdata)) {
           LOG(PDA_LOG,LOG_ERR, "PDA Device On/Off: %s on - waitForPDAnextMenu\n", button->label);
         } else {
           send_pda_cmd(KEY_PDA_SELECT);
-	        while (get_pda_queue_length() > 0) { delay(500); }
+	        waitfor_pda_queue2empty();
           if (!waitForPDAMessageType(aqdata,CMD_PDA_HIGHLIGHT,20)) {
             LOG(PDA_LOG,LOG_ERR, "PDA Device On/Off: %s on - wait for CMD_PDA_HIGHLIGHT\n",button->label);
           }
@@ -703,7 +713,7 @@ void *set_aqualink_PDA_device_on_off( void *ptr )
 
   cleanAndTerminateThread(threadCtrl);
   
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 
 }
@@ -756,14 +766,14 @@ void *set_aqualink_PDA_device_on_off( void *ptr )
       LOG(PDA_LOG,LOG_INFO, "PDA Device On/Off, found device '%s', changing state\n",aqdata->aqbuttons[device].label);
       force_queue_delete(); // NSF This is a bad thing to do.  Need to fix this
       send_pda_cmd(KEY_PDA_SELECT);
-      while (get_pda_queue_length() > 0) { delay(500); }
+      waitfor_pda_queue2empty();
       // If you are turning on a heater there will be a sub menu to set temp
       if ((state == ON) && ((device == aqdata->pool_heater_index) || (device == aqdata->spa_heater_index))) {
         if (! waitForPDAnextMenu(aqdata)) {
           LOG(PDA_LOG,LOG_ERR, "PDA Device On/Off: %s on - waitForPDAnextMenu\n", aqdata->aqbuttons[device].label);
         } else {
           send_pda_cmd(KEY_PDA_SELECT);
-	        while (get_pda_queue_length() > 0) { delay(500); }
+	        waitfor_pda_queue2empty();
           if (!waitForPDAMessageType(aqdata,CMD_PDA_HIGHLIGHT,20)) {
             LOG(PDA_LOG,LOG_ERR, "PDA Device On/Off: %s on - wait for CMD_PDA_HIGHLIGHT\n",aqdata->aqbuttons[device].label);
           }
@@ -798,7 +808,7 @@ void *set_aqualink_PDA_device_on_off( void *ptr )
 
   cleanAndTerminateThread(threadCtrl);
   
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 
 }
@@ -902,7 +912,7 @@ void *set_aqualink_PDA_light_mode( void *ptr )
 
   cleanAndTerminateThread(threadCtrl);
   
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -924,7 +934,7 @@ void *get_aqualink_PDA_device_status( void *ptr )
  
   cleanAndTerminateThread(threadCtrl);
   
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -1003,7 +1013,7 @@ void *set_aqualink_PDA_init( void *ptr )
 
   cleanAndTerminateThread(threadCtrl);
 
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -1028,7 +1038,7 @@ void *set_aqualink_PDA_wakeinit( void *ptr )
 
   cleanAndTerminateThread(threadCtrl);
   
-  // just stop compiler error, ptr is not valid as it's just been freed
+  // just stop compiler error
   return ptr;
 }
 
@@ -1102,7 +1112,7 @@ bool waitForPDAMessageHighlight(struct aqualinkdata *aqdata, int highlighIndex,
 
     if (aqdata->last_packet_type == CMD_PDA_HIGHLIGHT && pda_m_hlightindex() == highlighIndex) break;
 
-    pthread_cond_wait(&aqdata->active_thread.thread_cond, &aqdata->active_thread.thread_mutex);
+    wait_for_prog_kick(aqdata);
   }
 
   pthread_mutex_unlock(&aqdata->active_thread.thread_mutex);
@@ -1126,7 +1136,7 @@ bool _waitForPDAMessageType(struct aqualinkdata *aqdata, unsigned char mtype, in
   pthread_mutex_lock(&aqdata->active_thread.thread_mutex);
 
   if (forceNext) { // Ignore current message type, and wait for next
-    pthread_cond_wait(&aqdata->active_thread.thread_cond, &aqdata->active_thread.thread_mutex);
+    wait_for_prog_kick(aqdata);
   } 
 
   while( ++i <= numMessageReceived)
@@ -1135,7 +1145,7 @@ bool _waitForPDAMessageType(struct aqualinkdata *aqdata, unsigned char mtype, in
     
     if (aqdata->last_packet_type == mtype) break;
     
-    pthread_cond_wait(&aqdata->active_thread.thread_cond, &aqdata->active_thread.thread_mutex);
+    wait_for_prog_kick(aqdata);
   }
 
   pthread_mutex_unlock(&aqdata->active_thread.thread_mutex);
@@ -1182,7 +1192,7 @@ bool waitForPDAMessageTypesOrMenu(struct aqualinkdata *aqdata, unsigned char mty
 
     if (aqdata->last_packet_type == mtype1 || aqdata->last_packet_type == mtype2) break;
 
-    pthread_cond_wait(&aqdata->active_thread.thread_cond, &aqdata->active_thread.thread_mutex);
+    wait_for_prog_kick(aqdata);
   }
 
   pthread_mutex_unlock(&aqdata->active_thread.thread_mutex);
@@ -1634,7 +1644,7 @@ bool waitForPDAMessage(struct aqualinkdata *aqdata, int numMessageReceived, unsi
     
     //LOG(PDA_LOG,LOG_DEBUG, "Programming mode: looking for '%s' received message '%s'\n",message,aqdata->last_message);
     pthread_cond_init(&aqdata->active_thread.thread_cond, NULL);
-    pthread_cond_wait(&aqdata->active_thread.thread_cond, &aqdata->active_thread.thread_mutex);
+    wait_for_prog_kick(aqdata);
     //LOG(PDA_LOG,LOG_DEBUG, "Programming mode: loop %d of %d looking for '%s' received message '%s'\n",i,numMessageReceived,message,aqdata->last_message);
   }
   
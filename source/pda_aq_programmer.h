@@ -15,6 +15,7 @@ typedef enum pda_type {
 
 
 unsigned char pop_pda_cmd(struct aqualinkdata *aq_data);
+bool pda_cmd_pending();
 
 
 void *get_aqualink_PDA_device_status( void *ptr );
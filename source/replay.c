@@ -0,0 +1,405 @@
+/*
+ * Copyright (c) 2017 Shaun Feakes - All rights reserved
+ *
+ * You may use redistribute and/or modify this code under the terms of
+ * the GNU General Public License version 2 as published by the
+ * Free Software Foundation. For the terms of this license,
+ * see <http://www.gnu.org/licenses/>.
+ *
+ * You are free to use this software under the terms of the GNU General
+ * Public License, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ *  https://github.com/sfeakes/aqualinkd
+ */
+
+/*
+  The whole trace is loaded before the clock starts, so file IO & parsing aren't in the numbers.
+  Trace (virtual) time comes from the capture record times, a text log doesn't have any so each
+  frame is given the time it would take on the wire.  Packets are replayed back to back, the
+  virtual clock says how much bus time we got through, and is what handlers get from aq_time()
+  (wall time of the capture, or the replay start for a text log), so their timestamps & time
+  checks see time pass the way it did live.  Anything the main loop or other threads would
+  have done in that time (delayed requests, timers, programmers) still doesn't happen.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "aqualink.h"
+#include "aq_serial.h"
+#include "utils.h"
+#include "config.h"
+#include "rs_dispatch.h"
+#include "aq_snapshot.h"
+#include "devices_jandy.h"
+#include "devices_pentair.h"
+#include "packetCapture.h"
+#include "json_messages.h"
+#include "json_writer.h"
+#include "timespec_subtract.h"
+#include "replay.h"
+
+#define REPLAY_NS_PER_BYTE  1041667ULL // 10 bits at 9600 baud
+#define REPLAY_MAX_HANDLERS 32
+
+typedef struct replay_frame {
+  uint64_t time_ns; // Virtual
+  size_t offset;    // Into replay_trace.bytes
+  int length;
+} replay_frame;
+
+typedef struct replay_trace {
+  replay_frame *frames;
+  size_t count;
+  size_t alloc;
+  unsigned char *bytes;
+  size_t used;
+  size_t size;
+  unsigned long skipped; // Writes & bad frames, we only replay what was read
+  int64_t realtime_ns;   // Add to a frame time_ns for wall time
+  bool failed;
+} replay_trace;
+
+typedef struct replay_handler {
+  const char *name;
+  unsigned long packets;
+  uint64_t cpu_ns;
+} replay_handler;
+
+typedef struct replay_result {
+  double wall_sec;
+  double trace_sec;
+  uint64_t handler_ns;
+  uint64_t process_ns;
+} replay_result;
+
+// Handlers are matched by name pointer, so these have to be the only copy.
+static const char _name_jandy[] = "Jandy";
+static const char _name_pentair[] = "Pentair";
+static const char _name_ignored[] = "Not processed";
+
+static replay_handler _handlers[REPLAY_MAX_HANDLERS];
+static int _num_handlers = 0;
+
+static time_t _replay_now = 0;
+
+// aq_time() source while replaying, the wall time of the frame being handled.
+static time_t replay_time(time_t *tloc)
+{
+  if (tloc != NULL)
+    *tloc = _replay_now;
+  return _replay_now;
+}
+
+static bool add_frame(replay_trace *t, uint64_t time_ns, const unsigned char *data, int length)
+{
+  if (length <= 0 || length > AQ_MAXPKTLEN) {
+    t->skipped++;
+    return true;
+  }
+
+  if (t->count == t->alloc) {
+    size_t alloc = t->alloc ? t->alloc * 2 : 4096;
+    replay_frame *frames = realloc(t->frames, alloc * sizeof(replay_frame));
+    if (frames == NULL)
+      return false;
+    t->frames = frames;
+    t->alloc = alloc;
+  }
+
+  if (t->used + length > t->size) {
+    size_t size = t->size ? t->size * 2 : 256 * 1024;
+    unsigned char *bytes = realloc(t->bytes, size);
+    if (bytes == NULL)
+      return false;
+    t->bytes = bytes;
+    t->size = size;
+  }
+
+  memcpy(t->bytes + t->used, data, length);
+  t->frames[t->count].time_ns = time_ns;
+  t->frames[t->count].offset = t->used;
+  t->frames[t->count].length = length;
+  t->count++;
+  t->used += length;
+
+  return true;
+}
+
+static void load_capture_record(const packet_capture_header *hdr, const packet_capture_record *rec, const unsigned char *data, void *ctx)
+{
+  replay_trace *t = (replay_trace *)ctx;
+
+  if (t->failed)
+    return;
+
+  t->realtime_ns = (int64_t)hdr->start_realtime_ns - (int64_t)hdr->start_monotonic_ns;
+
+  if (rec->type == CAP_READ) {
+    if (!add_frame(t, rec->time_ns, data, rec->length))
+      t->failed = true;
+  } else if (rec->type == CAP_WRITE || rec->type == CAP_ERROR) {
+    t->skipped++;
+  }
+}
+
+static bool load_text_log(const char *file, replay_trace *t)
+{
+  FILE *fp;
+  char line[4000];
+  unsigned char packet[AQ_MAXPKTLEN+1];
+  uint64_t time_ns = 0;
+  char *hex;
+  int length;
+
+  if ((fp = fopen(file, "r")) == NULL)
+    return false;
+
+  t->realtime_ns = (int64_t)time(NULL) * 1000000000LL;
+
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    if ((length = parseHexPacketLine(line, packet, sizeof(packet))) <= 0)
+      continue;
+
+    // Only replay what we read, not what we sent or what failed checksum.
+    if ((hex = strstr(line, "HEX:")) != NULL) {
+      *hex = '\0';
+      if (strstr(line, "Write") != NULL || strstr(line, "BAD PACKET") != NULL) {
+        t->skipped++;
+        continue;
+      }
+    }
+
+    if (!add_frame(t, time_ns, packet, length)) {
+      fclose(fp);
+      return false;
+    }
+    time_ns += length * REPLAY_NS_PER_BYTE;
+  }
+
+  fclose(fp);
+  return true;
+}
+
+static replay_handler *get_handler(const char *name)
+{
+  int i;
+
+  for (i=0; i < _num_handlers; i++) {
+    if (_handlers[i].name == name)
+      return &_handlers[i];
+  }
+
+  if (_num_handlers == REPLAY_MAX_HANDLERS)
+    return &_handlers[REPLAY_MAX_HANDLERS-1];
+
+  _handlers[_num_handlers].name = name;
+  return &_handlers[_num_handlers++];
+}
+
+static uint64_t cpu_ns(clockid_t clock)
+{
+  struct timespec now;
+
+  clock_gettime(clock, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void run_handler(const char *name, rs_packet_handler handler, unsigned char *packet, int length, struct aqualinkdata *aqdata)
+{
+  replay_handler *h = get_handler(name);
+  uint64_t start = cpu_ns(CLOCK_THREAD_CPUTIME_ID);
+
+  aqdata_write_lock();
+  handler(packet, length, aqdata);
+  aqdata_write_unlock();
+
+  h->cpu_ns += cpu_ns(CLOCK_THREAD_CPUTIME_ID) - start;
+  h->packets++;
+}
+
+// Same decisions as main_loop() and the RS device queue make, without the ACK.
+static void replay_packet(unsigned char *packet, int length, struct aqualinkdata *aqdata)
+{
+  static unsigned char last_to = NUL;
+  const rs_dispatch_entry *dispatch;
+  protocolType protocol = getProtocolType(packet);
+
+  if (protocol == JANDY) {
+    // Replies to the master are charged to whoever the last packet went to.
+    if (packet[PKT_DEST] != DEV_MASTER)
+      last_to = packet[PKT_DEST];
+
+    if ((dispatch = get_rs_dispatch_entry(packet[PKT_DEST]))->emulation != SIM_NONE) {
+      run_handler(getJandyDeviceName(dispatch->emulation), dispatch->process_emulation, packet, length, aqdata);
+    } else if (_aqconfig_.read_RS485_devmask > 0) {
+      dispatch = get_rs_dispatch_entry(last_to);
+      run_handler(dispatch->device_name != NULL ? dispatch->device_name : _name_jandy, processJandyPacket, packet, length, aqdata);
+    } else {
+      get_handler(_name_ignored)->packets++;
+    }
+  } else if (protocol == PENTAIR && READ_RSDEV_vsfPUMP) {
+    run_handler(_name_pentair, processPentairPacket, packet, length, aqdata);
+  } else {
+    get_handler(_name_ignored)->packets++;
+  }
+}
+
+// Numbers keep their own format, jw_int() is a long and cpu_ns can be bigger than that on 32 bit.
+static void write_number(json_writer *w, const char *key, const char *format, ...)
+{
+  char buf[64];
+  va_list args;
+
+  va_start(args, format);
+  vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+
+  jw_raw(w, key, buf);
+}
+
+static bool write_state(const char *statefile, const char *file, const replay_trace *t, const replay_result *r, struct aqualinkdata *aqdata)
+{
+  // The file name can be anything, escaped worst case is 6 bytes a char (\u00XX).
+  size_t size = JSON_STATUS_SIZE + JSON_BUFFER_SIZE + 1024 + REPLAY_MAX_HANDLERS * 128 + strlen(file) * 6;
+  char *status = malloc(JSON_STATUS_SIZE);
+  char *devices = malloc(JSON_BUFFER_SIZE);
+  char *buffer = malloc(size);
+  FILE *fp = NULL;
+  json_writer w;
+  int i;
+
+  if (status == NULL || devices == NULL || buffer == NULL) {
+    free(status);
+    free(devices);
+    free(buffer);
+    return false;
+  }
+
+  if (build_aqualink_status_JSON(aqdata, status, JSON_STATUS_SIZE) <= 0)
+    strcpy(status, "null");
+  if (build_device_JSON(aqdata, devices, JSON_BUFFER_SIZE, false) <= 0)
+    strcpy(devices, "null");
+
+  jw_init(&w, buffer, size);
+  jw_object_start(&w, NULL);
+  jw_object_start(&w, "replay");
+  jw_string(&w, "file", file);
+  write_number(&w, "frames", "%zu", t->count);
+  write_number(&w, "skipped", "%lu", t->skipped);
+  write_number(&w, "wall_sec", "%.6f", r->wall_sec);
+  write_number(&w, "trace_sec", "%.6f", r->trace_sec);
+  write_number(&w, "packets_per_sec", "%.0f", r->wall_sec > 0 ? t->count / r->wall_sec : 0);
+  jw_object_start(&w, "handlers");
+  for (i=0; i < _num_handlers; i++) {
+    jw_object_start(&w, _handlers[i].name);
+    write_number(&w, "packets", "%lu", _handlers[i].packets);
+    write_number(&w, "cpu_ns", "%llu", (unsigned long long)_handlers[i].cpu_ns);
+    jw_object_end(&w);
+  }
+  jw_object_end(&w);
+  jw_object_end(&w);
+  jw_raw(&w, "status", status);
+  jw_raw(&w, "devices", devices);
+  jw_object_end(&w);
+  jw_finish(&w);
+
+  free(status);
+  free(devices);
+
+  if (w.overflow || (fp = fopen(statefile, "w")) == NULL) {
+    free(buffer);
+    return false;
+  }
+
+  fprintf(fp, "%s\n", buffer);
+  fclose(fp);
+  free(buffer);
+
+  return true;
+}
+
+int replay_rs485_trace(const char *file, const char *statefile, struct aqualinkdata *aqdata)
+{
+  replay_trace trace;
+  replay_result result;
+  unsigned char packet[AQ_MAXPKTLEN+1];
+  struct timespec start, end, elapsed;
+  uint64_t process_start;
+  size_t i;
+  int rtn = EXIT_SUCCESS;
+
+  memset(&trace, 0, sizeof(trace));
+  memset(&result, 0, sizeof(result));
+
+  if (isPacketCaptureFile(file)) {
+    if (readPacketCapture(file, load_capture_record, &trace) < 0)
+      trace.failed = true;
+  } else if (!load_text_log(file, &trace)) {
+    trace.failed = true;
+  }
+
+  if (trace.failed) {
+    LOG(AQUA_LOG,LOG_ERR, "Replay, error reading %s\n", file);
+    rtn = EXIT_FAILURE;
+    goto done;
+  } else if (trace.count == 0) {
+    LOG(AQUA_LOG,LOG_ERR, "Replay, no frames read from %s (raw byte captures can't be replayed)\n", file);
+    rtn = EXIT_FAILURE;
+    goto done;
+  }
+
+  LOG(AQUA_LOG,LOG_NOTICE, "Replaying %zu frames from %s\n", trace.count, file);
+
+  set_aq_time_source(replay_time);
+  process_start = cpu_ns(CLOCK_PROCESS_CPUTIME_ID);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (i=0; i < trace.count; i++) {
+    _replay_now = (time_t)(((int64_t)trace.frames[i].time_ns + trace.realtime_ns) / 1000000000LL);
+    // Handlers get the same zero filled buffer get_packet() would give them.
+    memset(packet, 0, sizeof(packet));
+    memcpy(packet, trace.bytes + trace.frames[i].offset, trace.frames[i].length);
+    replay_packet(packet, trace.frames[i].length, aqdata);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  result.process_ns = cpu_ns(CLOCK_PROCESS_CPUTIME_ID) - process_start;
+  set_aq_time_source(NULL);
+
+  timespec_subtract(&elapsed, &end, &start);
+  result.wall_sec = elapsed.tv_sec + elapsed.tv_nsec / 1e9;
+  result.trace_sec = (trace.frames[trace.count-1].time_ns - trace.frames[0].time_ns +
+                      trace.frames[trace.count-1].length * REPLAY_NS_PER_BYTE) / 1e9;
+  for (i=0; i < _num_handlers; i++)
+    result.handler_ns += _handlers[i].cpu_ns;
+
+  LOG(AQUA_LOG,LOG_NOTICE, "Replayed %zu frames (%lu skipped) in %.3f sec, %.0f packets/sec\n",
+      trace.count, trace.skipped, result.wall_sec, result.wall_sec > 0 ? trace.count / result.wall_sec : 0);
+  LOG(AQUA_LOG,LOG_NOTICE, "Trace covers %.3f sec of RS485, replayed at %.0fx real time\n",
+      result.trace_sec, result.wall_sec > 0 ? result.trace_sec / result.wall_sec : 0);
+  LOG(AQUA_LOG,LOG_NOTICE, "CPU %.3f ms in handlers, %.3f ms process total\n",
+      result.handler_ns / 1e6, result.process_ns / 1e6);
+  for (i=0; i < _num_handlers; i++) {
+    LOG(AQUA_LOG,LOG_NOTICE, "  %-16s %8lu packets %10.3f ms cpu %8.2f us/packet\n", _handlers[i].name, _handlers[i].packets,
+        _handlers[i].cpu_ns / 1e6, _handlers[i].packets > 0 ? _handlers[i].cpu_ns / 1e3 / _handlers[i].packets : 0);
+  }
+
+  if (write_state(statefile, file, &trace, &result, aqdata)) {
+    LOG(AQUA_LOG,LOG_NOTICE, "Final state written to %s\n", statefile);
+  } else {
+    LOG(AQUA_LOG,LOG_ERR, "Replay, unable to write %s\n", statefile);
+    rtn = EXIT_FAILURE;
+  }
+
+done:
+  free(trace.frames);
+  free(trace.bytes);
+
+  return rtn;
+}
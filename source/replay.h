@@ -0,0 +1,18 @@
+#ifndef REPLAY_H_
+#define REPLAY_H_
+
+#include "aqualink.h"
+
+/*
+  aqualinkd -replay <file>
+  Feed a recorded trace (capture file or text RS485.log) through the same packet handlers the
+  main loop uses, as fast as they'll go, then report packets/sec & CPU per handler and write
+  the final state.  Nothing is sent, so no ACK's and no programming.
+*/
+
+#define REPLAY_STATE_FILE "/tmp/aqualinkd-replay.json"
+
+// Dispatch table must be built before calling.  Returns EXIT_SUCCESS or EXIT_FAILURE
+int replay_rs485_trace(const char *file, const char *statefile, struct aqualinkdata *aqdata);
+
+#endif // REPLAY_H_
@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2017 Shaun Feakes - All rights reserved
+ *
+ * You may use redistribute and/or modify this code under the terms of
+ * the GNU General Public License version 2 as published by the
+ * Free Software Foundation. For the terms of this license,
+ * see <http://www.gnu.org/licenses/>.
+ *
+ * You are free to use this software under the terms of the GNU General
+ * Public License, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ *  https://github.com/sfeakes/aqualinkd
+ */
+
+/*
+  Lookup table of what to do with a Jandy packet, keyed by destination ID.
+  Saves running though the list of ID's we emulate and every READ_RSDEV_ check on each packet.
+
+  Built once config & auto configure have settled the ID's, then rebuilt if any of those ID's change
+  (panel doesn't support a protocol, iAqualink gets enabled etc).
+
+  Built from the RS485 thread and also read from the readonly device thread (processJandyPacket), so a
+  rebuild fills the table that isn't in use and then publishes it with an atomic pointer swap. Readers
+  never see a half built table, only the old one or the new one.  Rebuilds are seconds apart (startup /
+  panel probe) so a reader is long done with an entry before that buffer gets reused.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "rs_dispatch.h"
+#include "rs_devices.h"
+#include "config.h"
+#include "utils.h"
+#include "devices_jandy.h"
+#include "allbutton.h"
+#include "onetouch.h"
+#include "iaqtouch.h"
+#include "iaqualink.h"
+#include "serialadapter.h"
+#include "pda.h"
+
+static rs_dispatch_entry _rs_dispatch_tables[2][256];
+_Atomic(const rs_dispatch_entry *) _rs_dispatch = _rs_dispatch_tables[0];
+
+// Only stops two builders racing for the spare buffer, readers never take it.
+static pthread_mutex_t _rs_dispatch_build_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef AQ_PDA
+// PDA doesn't take aqdata, it has it's own copy from init_pda()
+static bool process_pda_emulation_packet(unsigned char *packet, int length, struct aqualinkdata *aqdata)
+{
+  return process_pda_packet(packet, length);
+}
+#endif
+
+static rs_packet_handler emulation_handler(emulation_type etype)
+{
+  switch (etype) {
+    case ALLBUTTON:
+      return process_allbutton_packet;
+    case RSSADAPTER:
+      return process_rssadapter_packet;
+    case IAQTOUCH:
+      return process_iaqtouch_packet;
+    case ONETOUCH:
+      return process_onetouch_packet;
+#ifdef AQ_PDA
+    case AQUAPDA:
+      return process_pda_emulation_packet;
+#endif
+    case IAQUALNK:
+      return process_iaqualink_packet;
+    default:
+      return NULL;
+  }
+}
+
+static void set_emulation(rs_dispatch_entry *entry, unsigned char id)
+{
+  if (id == 0x00)
+    return;
+
+  entry->emulation = getJandyDeviceType(id);
+  entry->process_emulation = emulation_handler(entry->emulation);
+
+  if (entry->process_emulation == NULL)
+    entry->emulation = SIM_NONE;
+}
+
+static void set_readonly(rs_dispatch_entry *entry, rsDeviceType device, const char *name, rs_packet_handler to, rs_reply_handler from)
+{
+  entry->device = device;
+  entry->device_name = name;
+  entry->process_to = to;
+  entry->process_from = from;
+}
+
+void build_rs_dispatch_table()
+{
+  int i;
+  int emulated = 0;
+  int readonly = 0;
+  rs_dispatch_entry *table;
+
+  pthread_mutex_lock(&_rs_dispatch_build_mutex);
+
+  table = (atomic_load(&_rs_dispatch) == _rs_dispatch_tables[0])?_rs_dispatch_tables[1]:_rs_dispatch_tables[0];
+
+  for (i=0; i <= 0xFF; i++) {
+    unsigned char id = (unsigned char)i;
+    rs_dispatch_entry entry = {.emulation = SIM_NONE, .device = DRS_NONE};
+
+    if (id != 0x00 && (id == _aqconfig_.device_id ||
+                       id == _aqconfig_.rssa_device_id ||
+                       id == _aqconfig_.extended_device_id ||
+                       id == _aqconfig_.extended_device_id2)) {
+      set_emulation(&entry, id);
+    }
+
+    // Same order as the old READ_RSDEV_ checks, first match wins.
+    if (READ_RSDEV_SWG && is_swg_id(id))
+      set_readonly(&entry, DRS_SWG, "SWG", processPacketToSWG, processPacketFromSWG);
+    else if (READ_RSDEV_ePUMP && is_jandy_pump_id(id))
+      set_readonly(&entry, DRS_EPUMP, "EPump", processPacketToJandyPump, processPacketFromJandyPump);
+    else if (READ_RSDEV_JXI && is_jxi_heater_id(id))
+      set_readonly(&entry, DRS_JXI, "JXi", processPacketToJandyJXiHeater, processPacketFromJandyJXiHeater);
+    else if (READ_RSDEV_LX && is_lx_heater_id(id))
+      set_readonly(&entry, DRS_LX, "LX", processPacketToJandyLXHeater, processPacketFromJandyLXHeater);
+    else if (READ_RSDEV_CHEM_FEDR && is_chem_feeder_id(id))
+      set_readonly(&entry, DRS_CHEM_FEED, "ChemL", processPacketToJandyChemFeeder, processPacketFromJandyChemFeeder);
+    else if (READ_RSDEV_CHEM_ANLZ && is_chem_anlzer_id(id))
+      set_readonly(&entry, DRS_CHEM_ANLZ, "CemSnr", processPacketToJandyChemAnalyzer, processPacketFromJandyChemAnalyzer);
+    else if (READ_RSDEV_iAQLNK && is_aqualink_touch_id(id) // should we add is_iaqualink_id() as well????
+             && id != _aqconfig_.extended_device_id) // We would have already read extended_device_id frame
+      set_readonly(&entry, DRS_NONE, "iAqLnk", process_iAqualinkStatusPacket, NULL);
+    else if (READ_RSDEV_HPUMP && is_heat_pump_id(id))
+      set_readonly(&entry, DRS_HEATPUMP, "HPump", processPacketToHeatPump, processPacketFromHeatPump);
+    else if (READ_RSDEV_JLIGHT && is_jandy_light_id(id))
+      set_readonly(&entry, DRS_JLIGHT, "JLight", processPacketToJandyLight, processPacketFromJandyLight);
+
+    if (entry.emulation != SIM_NONE)
+      emulated++;
+    if (entry.process_to != NULL)
+      readonly++;
+
+    table[i] = entry;
+  }
+
+  atomic_store_explicit(&_rs_dispatch, table, memory_order_release);
+
+  pthread_mutex_unlock(&_rs_dispatch_build_mutex);
+
+  LOG(AQUA_LOG,LOG_DEBUG, "RS dispatch table built, emulating %d ID's, reading %d ID's\n", emulated, readonly);
+}
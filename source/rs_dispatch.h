@@ -0,0 +1,38 @@
+#ifndef RS_DISPATCH_H_
+#define RS_DISPATCH_H_
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "aqualink.h"
+#include "aq_serial.h"
+#include "aq_programmer.h"
+
+typedef bool (*rs_packet_handler)(unsigned char *packet, int length, struct aqualinkdata *aqdata);
+typedef bool (*rs_reply_handler)(unsigned char *packet, int length, struct aqualinkdata *aqdata, const unsigned char previous_packet_to);
+
+/*
+  One entry per RS485 ID, indexed by packet[PKT_DEST].
+  emulation != SIM_NONE means we are acting as that ID, process_emulation() decodes it and
+  emulation is also what caculate_ack_packet() uses to build the reply.
+  process_to != NULL means it's a device we only read, device is what to expect the next ACK
+  from (DRS_NONE if we don't care about the reply), process_from() decodes that ACK.
+*/
+typedef struct rs_dispatch_entry {
+  emulation_type    emulation;
+  rs_packet_handler process_emulation;
+
+  rsDeviceType      device;
+  const char        *device_name;
+  rs_packet_handler process_to;
+  rs_reply_handler  process_from;
+} rs_dispatch_entry;
+
+// Points at whichever of the two tables was built last, see rs_dispatch.c
+extern _Atomic(const rs_dispatch_entry *) _rs_dispatch;
+
+void build_rs_dispatch_table();
+
+static inline const rs_dispatch_entry *get_rs_dispatch_entry(unsigned char id) { return &atomic_load_explicit(&_rs_dispatch, memory_order_acquire)[id]; }
+
+#endif // RS_DISPATCH_H_
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2017 Shaun Feakes - All rights reserved
+ *
+ * You may use redistribute and/or modify this code under the terms of
+ * the GNU General Public License version 2 as published by the 
+ * Free Software Foundation. For the terms of this license, 
+ * see <http://www.gnu.org/licenses/>.
+ *
+ * You are free to use this software under the terms of the GNU General
+ * Public License, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ *  https://github.com/sfeakes/aqualinkd
+ */
+
+/*
+  Packets to devices we only read (SWG, ePump, JXi, Pentair VSP etc) are pushed here by
+  the RS485 thread and decoded on a seperate thread, so slow decoding or logging never
+  delays reading the next frame or ACK'ing a frame that's addressed to us.
+
+  Single producer (RS485 thread), single consumer (worker below), so head & tail are
+  only ever written by one side each.  The semaphore is only to wake the consumer.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+#include "aqualink.h"
+#include "aq_serial.h"
+#include "utils.h"
+#include "config.h"
+#include "devices_jandy.h"
+#include "devices_pentair.h"
+#include "timespec_subtract.h"
+#include "aq_snapshot.h"
+#include "rs_packet_queue.h"
+
+#define RS_PACKET_QUEUE_MASK (RS_PACKET_QUEUE_SIZE - 1)
+
+static struct {
+  rs_queued_packet slots[RS_PACKET_QUEUE_SIZE];
+  _Atomic uint32_t head; // Written by consumer
+  _Atomic uint32_t tail; // Written by producer
+  _Atomic uint32_t max_depth;
+  _Atomic uint64_t queued;
+  _Atomic uint64_t overflows;
+  sem_t ready;
+  pthread_t thread_id;
+  volatile bool running;
+  struct aqualinkdata *aqdata;
+} _rsq;
+
+void *rs_packet_queue_worker(void *ptr);
+
+void start_rs_packet_queue(struct aqualinkdata *aqdata)
+{
+  atomic_store(&_rsq.head, 0);
+  atomic_store(&_rsq.tail, 0);
+  _rsq.aqdata = aqdata;
+  _rsq.running = true;
+
+  sem_init(&_rsq.ready, 0, 0);
+
+  if( pthread_create( &_rsq.thread_id , NULL ,  rs_packet_queue_worker, NULL) < 0) {
+    LOG(AQUA_LOG, LOG_ERR, "could not create RS device thread\n");
+    _rsq.running = false;
+    return;
+  }
+}
+
+void stop_rs_packet_queue()
+{
+  if (!_rsq.running)
+    return;
+
+  LOG(AQUA_LOG, LOG_INFO, "Stopping RS device thread\n");
+  _rsq.running = false;
+  sem_post(&_rsq.ready);
+  pthread_join(_rsq.thread_id, NULL);
+  sem_destroy(&_rsq.ready);
+
+  if (atomic_load(&_rsq.overflows) > 0) {
+    LOG(AQUA_LOG, LOG_WARNING, "RS device queue dropped %llu of %llu packets, max depth %u\n",
+        (unsigned long long)atomic_load(&_rsq.overflows), (unsigned long long)atomic_load(&_rsq.queued), atomic_load(&_rsq.max_depth));
+  }
+}
+
+/*
+ * Only called from RS485 thread.  Never blocks, if the consumer has fallen behind the packet
+ * is dropped and counted.
+ */
+bool push_rs_packet_queue(const unsigned char *packet, int length, const struct timespec *received)
+{
+  uint32_t tail = atomic_load_explicit(&_rsq.tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&_rsq.head, memory_order_acquire);
+  uint32_t depth = tail - head;
+
+  if (!_rsq.running || length <= 0 || length > AQ_MAXPKTLEN)
+    return false;
+
+  if (depth >= RS_PACKET_QUEUE_SIZE) {
+    uint64_t overflows = atomic_fetch_add(&_rsq.overflows, 1) + 1;
+    // Don't flood the log, first one and then every 100
+    if (overflows == 1 || overflows % 100 == 0)
+      LOG(AQUA_LOG, LOG_WARNING, "RS device queue full, dropped %llu packets so far\n", (unsigned long long)overflows);
+    return false;
+  }
+
+  rs_queued_packet *slot = &_rsq.slots[tail & RS_PACKET_QUEUE_MASK];
+  memcpy(slot->packet, packet, length);
+  slot->length = length;
+  slot->received = *received;
+
+  atomic_store_explicit(&_rsq.tail, tail + 1, memory_order_release);
+  atomic_fetch_add_explicit(&_rsq.queued, 1, memory_order_relaxed);
+
+  if (depth + 1 > atomic_load_explicit(&_rsq.max_depth, memory_order_relaxed))
+    atomic_store_explicit(&_rsq.max_depth, depth + 1, memory_order_relaxed);
+
+  sem_post(&_rsq.ready);
+
+  return true;
+}
+
+void get_rs_packet_queue_stats(rs_packet_queue_stats *stats)
+{
+  stats->depth = atomic_load(&_rsq.tail) - atomic_load(&_rsq.head);
+  stats->max_depth = atomic_load(&_rsq.max_depth);
+  stats->queued = atomic_load(&_rsq.queued);
+  stats->overflows = atomic_load(&_rsq.overflows);
+}
+
+void process_queued_packet(rs_queued_packet *qp)
+{
+  if (getLogLevel(RSTM_LOG) >= LOG_DEBUG) {
+    struct timespec now;
+    struct timespec elapsed;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    timespec_subtract(&elapsed, &now, &qp->received);
+    LOG(RSTM_LOG, LOG_DEBUG, "RS device packet waited %.3f sec in queue\n", roundf3(timespec2float(&elapsed)));
+  }
+
+  aqdata_write_lock();
+  if (getProtocolType(qp->packet) == JANDY) {
+    processJandyPacket(qp->packet, qp->length, _rsq.aqdata);
+  }
+  // Process Pentair Device Packed (pentair have to & from in message, so no need to)
+  else if (getProtocolType(qp->packet) == PENTAIR && READ_RSDEV_vsfPUMP) {
+    processPentairPacket(qp->packet, qp->length, _rsq.aqdata);
+    // In the future probably add code to catch device offline (ie missing reply message)
+  }
+  aqdata_write_unlock();
+}
+
+void *rs_packet_queue_worker(void *ptr)
+{
+  LOG(AQUA_LOG, LOG_NOTICE, "Started RS device thread\n");
+
+  while (_rsq.running) {
+    if (sem_wait(&_rsq.ready) != 0) {
+      if (errno == EINTR)
+        continue;
+      LOG(AQUA_LOG, LOG_ERR, "RS device thread sem_wait failed %d %s\n", errno, strerror(errno));
+      break;
+    }
+
+    uint32_t head = atomic_load_explicit(&_rsq.head, memory_order_relaxed);
+    // Drain everything that's there, we may have been posted more than once.
+    while (head != atomic_load_explicit(&_rsq.tail, memory_order_acquire)) {
+      process_queued_packet(&_rsq.slots[head & RS_PACKET_QUEUE_MASK]);
+      atomic_store_explicit(&_rsq.head, ++head, memory_order_release);
+    }
+  }
+
+  LOG(AQUA_LOG, LOG_DEBUG, "End RS device thread\n");
+
+  pthread_exit(0);
+}
@@ -0,0 +1,31 @@
+#ifndef RS_PACKET_QUEUE_H_
+#define RS_PACKET_QUEUE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "aqualink.h"
+
+// Must be a power of 2
+#define RS_PACKET_QUEUE_SIZE 64
+
+typedef struct rs_queued_packet {
+  struct timespec received; // CLOCK_MONOTONIC
+  int length;
+  unsigned char packet[AQ_MAXPKTLEN+1];
+} rs_queued_packet;
+
+typedef struct rs_packet_queue_stats {
+  uint32_t depth;      // Packets waiting right now
+  uint32_t max_depth;  // High water mark
+  uint64_t queued;     // Total packets queued
+  uint64_t overflows;  // Packets dropped because queue was full
+} rs_packet_queue_stats;
+
+void start_rs_packet_queue(struct aqualinkdata *aqdata);
+void stop_rs_packet_queue();
+bool push_rs_packet_queue(const unsigned char *packet, int length, const struct timespec *received);
+void get_rs_packet_queue_stats(rs_packet_queue_stats *stats);
+
+#endif // RS_PACKET_QUEUE_H_
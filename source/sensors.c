@@ -8,9 +8,11 @@
 #include <regex.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <math.h>
 
 #include "aqualink.h"
 //#include "utils.h"
+#include "config.h"
 #include "sensors.h"
 
 
@@ -30,152 +32,266 @@ regex would be something like .*t=([0-9|\.]*)
 
 
 /*
- read sensor value from ie /sys/class/thermal/thermal_zone0/temp
+  Each sensor has it's own poll interval (sensor_NN_poll_time or sensor_poll_time), a couple of
+  worker threads pick whichever sensor is due next, so a slow 1-wire read (~750ms) only holds up
+  one worker rather than every other sensor.
+  Files are opened once and re-read with pread() from offset 0 (sysfs regenerates the value on
+  each read at 0), regex is compiled once when the sensor is set up.
+*/
 
- return true if current reading is different to last value stored
- */
+#define SENSOR_WORKERS 2
+#define SENSOR_HYSTERESIS 0.05  // Default, change has to be at least this before we report it
+#define READ_BUFFER_SIZE 256
 
-struct sensorthread {
-  pthread_t thread_id;
-  pthread_mutex_t thread_mutex;
-  pthread_cond_t thread_cond;
-  struct aqualinkdata *aqdata;
-  struct timespec timeout;
+struct sensor_state {
+  external_sensor *sensor;
+  int fd;
+  bool has_regex;
+  regex_t preg;
+  struct timespec due; // CLOCK_MONOTONIC
+  bool busy;
 };
 
-struct sensorthread *_sthread = NULL;
+static struct {
+  struct sensor_state sensors[MAX_SENSORS];
+  int num_sensors;
+  pthread_t workers[SENSOR_WORKERS];
+  int num_workers;
+  bool running;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  struct aqualinkdata *aqdata;
+} _sensors = {.mutex = PTHREAD_MUTEX_INITIALIZER};
 
 void *sensors_worker( void *ptr );
+static bool read_sensor(struct sensor_state *state);
+static void free_sensor_state(struct sensor_state *state);
 
+// Waits for the workers to finish, so a start straight after (config reload) gets a clean slate.
 void stop_sensors_thread() {
+  pthread_t workers[SENSOR_WORKERS];
+  int num, i;
+
   LOG(AQUA_LOG, LOG_INFO, "Stopping sensor thread\n");
 
-  if (_sthread != NULL)
-    pthread_cond_broadcast(&_sthread->thread_cond);
+  pthread_mutex_lock(&_sensors.mutex);
+  if (_sensors.running) {
+    _sensors.running = false;
+    pthread_cond_broadcast(&_sensors.cond);
+  }
+  num = _sensors.num_workers;
+  memcpy(workers, _sensors.workers, sizeof(workers));
+  pthread_mutex_unlock(&_sensors.mutex);
+
+  for (i=0; i < num; i++)
+    pthread_join(workers[i], NULL);
 
+  if (num == 0)
+    return;
+
+  pthread_mutex_lock(&_sensors.mutex);
+  for (i=0; i < _sensors.num_sensors; i++)
+    free_sensor_state(&_sensors.sensors[i]);
+  _sensors.num_workers = 0;
+  pthread_mutex_unlock(&_sensors.mutex);
 }
 
-void start_sensors_thread(struct aqualinkdata *aqdata) {
+static void init_sensor_state(struct sensor_state *state, external_sensor *sensor)
+{
+  int status;
+  char errbuf[128];
 
-  _sthread = calloc(1, sizeof(struct sensorthread));
+  memset(state, 0, sizeof(struct sensor_state));
+  state->sensor = sensor;
+  state->fd = -1;
+  clock_gettime(CLOCK_MONOTONIC, &state->due);
 
-  _sthread->aqdata = aqdata;
-  _sthread->thread_id = 0;
+  if (sensor->regex != NULL) {
+    if ( (status = regcomp(&state->preg, sensor->regex, REG_EXTENDED)) == 0 ) {
+      state->has_regex = true;
+    } else {
+      regerror(status, &state->preg, errbuf, sizeof(errbuf));
+      LOG(AQUA_LOG,LOG_ERR, "Compiling sensor regex '%s' for %s, %s. Using raw value\n",sensor->regex, sensor->label, errbuf);
+    }
+  }
+}
+
+static void free_sensor_state(struct sensor_state *state)
+{
+  if (state->fd >= 0)
+    close(state->fd);
+  if (state->has_regex)
+    regfree(&state->preg);
+  state->fd = -1;
+  state->has_regex = false;
+}
 
-  if( pthread_create( &_sthread->thread_id , NULL ,  sensors_worker, (void*)_sthread) < 0) {
-    LOG(AQUA_LOG, LOG_ERR, "could not create sensors thread\n");
-    free(_sthread);
+void start_sensors_thread(struct aqualinkdata *aqdata) {
+  pthread_condattr_t attr;
+  int i;
+
+  pthread_mutex_lock(&_sensors.mutex);
+  if (_sensors.running || _sensors.num_workers > 0) {
+    pthread_mutex_unlock(&_sensors.mutex);
+    LOG(AQUA_LOG, LOG_WARNING, "Sensor thread already running\n");
     return;
   }
 
-  if ( _sthread->thread_id != 0 ) {
-    pthread_detach(_sthread->thread_id);
+  _sensors.aqdata = aqdata;
+  _sensors.num_sensors = aqdata->num_sensors;
+  for (i=0; i < _sensors.num_sensors; i++)
+    init_sensor_state(&_sensors.sensors[i], &aqdata->sensors[i]);
+
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&_sensors.cond, &attr);
+  pthread_condattr_destroy(&attr);
+
+  _sensors.running = true;
+  for (i=0; i < SENSOR_WORKERS && i < _sensors.num_sensors; i++) {
+    if( pthread_create( &_sensors.workers[i] , NULL ,  sensors_worker, NULL) != 0) {
+      LOG(AQUA_LOG, LOG_ERR, "could not create sensors thread\n");
+      break;
+    }
+    _sensors.num_workers++;
+  }
+
+  if (_sensors.num_workers == 0) {
+    _sensors.running = false;
+    for (i=0; i < _sensors.num_sensors; i++)
+      free_sensor_state(&_sensors.sensors[i]);
   }
+  pthread_mutex_unlock(&_sensors.mutex);
+}
+
+static int sensor_poll_time(external_sensor *sensor)
+{
+  int poll_time = (sensor->poll_time > 0) ? sensor->poll_time : _aqconfig_.sensor_poll_time;
+  return (poll_time > 0) ? poll_time : 1;
+}
+
+static bool due_before(const struct timespec *a, const struct timespec *b)
+{
+  return (a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec <= b->tv_nsec));
 }
 
 void *sensors_worker( void *ptr )
 {
-  struct sensorthread *sthread;
-  sthread = (struct sensorthread *) ptr;
-  int retval = 0;
+  struct sensor_state *next;
+  struct timespec now;
+  int i;
 
   LOG(AQUA_LOG, LOG_NOTICE, "Started sensor thread\n");
 
-  pthread_mutex_lock(&sthread->thread_mutex);
+  pthread_mutex_lock(&_sensors.mutex);
 
-  do {
-    if (retval != 0 && retval != ETIMEDOUT) {
-       LOG(AQUA_LOG, LOG_ERR, "Sensor thread pthread_cond_timedwait failed for error %d %s\n",retval,strerror(retval));
-      break;
+  while (_sensors.running) {
+    // Next sensor due that another worker isn't already reading
+    next = NULL;
+    for (i=0; i < _sensors.num_sensors; i++) {
+      if (!_sensors.sensors[i].busy && (next == NULL || due_before(&_sensors.sensors[i].due, &next->due)))
+        next = &_sensors.sensors[i];
     }
 
-    for (int i=0; i < sthread->aqdata->num_sensors; i++) {
-      //LOG(AQUA_LOG, LOG_DEBUG, "Sensor thread reading %s\n",sthread->aqdata->sensors[i].label);
-      if (read_sensor(&sthread->aqdata->sensors[i]) ) {
-        SET_DIRTY(sthread->aqdata->is_dirty);
-      }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (next == NULL) {
+      pthread_cond_wait(&_sensors.cond, &_sensors.mutex);
+      continue;
+    } else if (!due_before(&next->due, &now)) {
+      pthread_cond_timedwait(&_sensors.cond, &_sensors.mutex, &next->due);
+      continue;
     }
 
-    clock_gettime(CLOCK_REALTIME, &sthread->timeout);
-    sthread->timeout.tv_sec += _aqconfig_.sensor_poll_time;
-    //sthread->started_at = time(0);
-    //LOG(AQUA_LOG, LOG_DEBUG, "Sensor thread will sleep for %d seconds\n",_aqconfig_.sensor_poll_time);
-  } while ((retval = pthread_cond_timedwait(&sthread->thread_cond, &sthread->thread_mutex, &sthread->timeout)) == ETIMEDOUT);
+    next->busy = true;
+    pthread_mutex_unlock(&_sensors.mutex);
+
+    //LOG(AQUA_LOG, LOG_DEBUG, "Sensor thread reading %s\n",next->sensor->label);
+    if (read_sensor(next)) {
+      _sensors.aqdata->is_dirty = true; // read_sensor() already counted the change
+    }
+
+    pthread_mutex_lock(&_sensors.mutex);
+    clock_gettime(CLOCK_MONOTONIC, &next->due);
+    next->due.tv_sec += sensor_poll_time(next->sensor);
+    next->busy = false;
+    // Someone may be waiting on a sensor that is due before that.
+    pthread_cond_signal(&_sensors.cond);
+  }
 
-  pthread_mutex_unlock(&sthread->thread_mutex);
+  // stop_sensors_thread() joins us & cleans up
+  pthread_mutex_unlock(&_sensors.mutex);
 
   LOG(AQUA_LOG, LOG_DEBUG, "End sensor thread\n");
 
-  free(sthread);
   pthread_exit(0);
 }
 
-#define READ_BUFFER_SIZE 256
+/*
+ read sensor value from ie /sys/class/thermal/thermal_zone0/temp
 
-bool read_sensor(external_sensor *sensor) {
-  int fp;
+ return true if current reading is different enough from last value stored
+ */
+static bool read_sensor(struct sensor_state *state) {
+  external_sensor *sensor = state->sensor;
   float value = 0.0;
+  float hysteresis;
+  bool changed = false;
   char buffer[READ_BUFFER_SIZE];
   char *startptr = &buffer[0];
   char *endptr;
-
-  fp = open(sensor->path, O_RDONLY, 0);
-  if (fp < 0) {
-    LOGSystemError(errno, AQUA_LOG, sensor->path);
-    LOG(AQUA_LOG,LOG_ERR, "Reading sensor %s %s\n",sensor->label, sensor->path);
-    return FALSE;
+  ssize_t len;
+  regmatch_t pmatch[2];
+  int status;
+
+  if (state->fd < 0) {
+    state->fd = open(sensor->path, O_RDONLY, 0);
+    if (state->fd < 0) {
+      LOGSystemError(errno, AQUA_LOG, sensor->path);
+      LOG(AQUA_LOG,LOG_ERR, "Reading sensor %s %s\n",sensor->label, sensor->path);
+      return FALSE;
+    }
   }
 
   // Read the sensor
-  if ( read(fp, buffer, READ_BUFFER_SIZE) <= 0 ) {
+  if ( (len = pread(state->fd, buffer, READ_BUFFER_SIZE - 1, 0)) <= 0 ) {
     LOG(AQUA_LOG,LOG_ERR, "Reading value from sensor %s %s\n",sensor->label, sensor->path);
-    close(fp);
+    // Device may have gone away (1-wire re-enumerated), open it again next time
+    close(state->fd);
+    state->fd = -1;
     return FALSE;
   }
-  close(fp);
+  buffer[len] = '\0';
 
   // If regex pass that
-  if (sensor->regex != NULL) {
-    regex_t preg;
-    regmatch_t pmatch[2];
-    //const char *pattern = ".*t=([0-9|\\.]*)";
-    //const char *pattern = ".*([0-9]+).*";
-    int status;
-     // Compile the regular expression
-    status = regcomp(&preg, sensor->regex, REG_EXTENDED);
-    if (status != 0) {
-      LOG(AQUA_LOG,LOG_ERR, "Compiling sensor regex %s\n",sensor->regex);
-      return 1;
-    }
-
+  if (state->has_regex) {
     // Run regex
-    if ( (status = regexec(&preg, buffer, 2, pmatch, 0)) == 0) {
+    if ( (status = regexec(&state->preg, buffer, 2, pmatch, 0)) == 0) {
         startptr = buffer + pmatch[1].rm_so;
     } else if (status == REG_NOMATCH) {
         //LOG(AQUA_LOG,LOG_DEBUG, "No sensor regex match '%s' on line '%s'\n",sensor->regex,line_buffer);
     } else {
         LOG(AQUA_LOG,LOG_ERR, "regex match error %d using '%s' on line '%s'\n",status,sensor->regex,buffer);
     }
-    // Free the compiled regular expression
-    regfree(&preg);
   }
 
   // Convert value to float
   value = strtof(startptr, &endptr);
-  if (endptr == buffer) {
+  if (endptr == startptr) {
     LOG(AQUA_LOG,LOG_ERR, "Reading sensor value from %s\n", sensor->path);
+    return FALSE;
   }
 
   value = value * sensor->factor;
 
   LOG(AQUA_LOG,LOG_DEBUG, "Read sensor %s value=%.2f\n",sensor->label, value);
 
-  if (sensor->value != value) {
-    sensor->value = value;
-    return TRUE;
+  // Ignore jitter, only report once it's moved far enough from what we last reported
+  hysteresis = (sensor->hysteresis >= 0) ? sensor->hysteresis : SENSOR_HYSTERESIS;
+  if (sensor->value == TEMP_UNKNOWN || fabsf(value - sensor->value) >= hysteresis) {
+    SET_IF_CHANGED(sensor->value, value, changed);
   }
 
-  return FALSE;
+  return changed;
 }
 
 
@@ -186,6 +302,7 @@ bool read_sensor_buffered(external_sensor *sensor) {
 
   FILE *fp;
   float value;
+  bool changed = false;
 
   fp = fopen(sensor->path, "r");
   if (fp == NULL) {
@@ -229,12 +346,9 @@ bool read_sensor_buffered(external_sensor *sensor) {
   //printf("Converted value %f\n",value);
   LOG(AQUA_LOG,LOG_DEBUG, "Read sensor %s value=%.2f\n",sensor->label, value);
 
-  if (sensor->value != value) {
-    sensor->value = value;
-    return TRUE;
-  }
+  SET_IF_CHANGED(sensor->value, value, changed);
 
-  return FALSE;
+  return changed;
 }
 #endif
 
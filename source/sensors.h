@@ -13,9 +13,12 @@ typedef struct external_sensor{
   char ID[7];
   char *regex;
   char *uom;
+  int poll_time;     // Seconds, 0 use sensor_poll_time
+  float hysteresis;  // Minimum change to report, SENSOR_HYSTERESIS_UNSET use default, 0 report any change
 } external_sensor;
 
-bool read_sensor(external_sensor *sensor);
+#define SENSOR_HYSTERESIS_UNSET -1
+
 void stop_sensors_thread();
 void start_sensors_thread(struct aqualinkdata *aq_data);
 
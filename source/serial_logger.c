@@ -31,6 +31,7 @@
 #include "aq_serial.h"
 #include "utils.h"
 #include "packetLogger.h"
+#include "packetCapture.h"
 #include "rs_msg_utils.h"
 
 #ifdef SERIAL_LOGGER
@@ -626,6 +627,8 @@ int main(int argc, char *argv[]) {
   bool errorMonitor = false;
   bool printAllIDs = false;
   bool timePackets = false;
+  bool captureToText = false;
+  char *port = argv[1];
 
   // aq_serial.c uses the following
   _aqconfig_.log_protocol_packets = false;
@@ -651,8 +654,10 @@ int main(int argc, char *argv[]) {
     fprintf(stderr, "\t-pi <ID> (just log specific Pantair ID, can use multiple -pi. will also force -d switch)\n");
     fprintf(stderr, "\t-r (raw)\n");
     fprintf(stderr, "\t-s (Serial Speed Test / OS caching issues)\n");
-    fprintf(stderr, "\t-lpack (log RS packets to %s)\n",RS485LOGFILE);
-    fprintf(stderr, "\t-lrawb (log raw RS bytes to %s)\n",RS485BYTELOGFILE);
+    fprintf(stderr, "\t-lpack (capture RS packets to %s)\n",RS485CAPFILE);
+    fprintf(stderr, "\t-lrawb (capture raw RS bytes to %s)\n",RS485CAPFILE);
+    fprintf(stderr, "\t-f (first param is a file to play back, raw bytes or a capture)\n");
+    fprintf(stderr, "\t-ctext (first param is a capture, convert it to %s & %s)\n",RS485LOGFILE,RS485BYTELOGFILE);
     fprintf(stderr, "\t-e (monitor errors)\n");
     fprintf(stderr, "\t-a (Print all ID's the panel queried)\n");
     fprintf(stderr, "\t-t (time each packet, will also force -s switch)\n");
@@ -702,9 +707,21 @@ int main(int argc, char *argv[]) {
     } else if (strcmp(argv[i], "-t") == 0) {
       timePackets = true;
       logLevel = LOG_DEBUG;
+    } else if (strcmp(argv[i], "-ctext") == 0) {
+      captureToText = true;
     }
   }
 
+  if (captureToText) {
+    int records = packetCaptureToText(argv[1], RS485LOGFILE, RS485BYTELOGFILE);
+    if (records < 0) {
+      fprintf(stderr, "ERROR, %s is not a valid capture file\n", argv[1]);
+      return 1;
+    }
+    printf("Converted %d records from %s\n", records, argv[1]);
+    return 0;
+  }
+
 #ifdef AQ_MANAGER
   setLoggingPrms(logLevel, false, NULL);
 #else
@@ -712,10 +729,18 @@ int main(int argc, char *argv[]) {
 #endif
 
   if (_playback_file) {
-    rs_fd = open(argv[1], O_RDONLY | O_NOCTTY | O_NONBLOCK | O_NDELAY);
+    // Capture files get played back as the byte stream they recorded.
+    if (isPacketCaptureFile(argv[1])) {
+      port = "/tmp/RS485cap.bin";
+      if (packetCaptureToBinary(argv[1], port) < 0) {
+        LOG(SLOG_LOG, LOG_ERR, "Unable to read capture file: %s\n", argv[1]);
+        return -1;
+      }
+    }
+    rs_fd = open(port, O_RDONLY | O_NOCTTY | O_NONBLOCK | O_NDELAY);
     if (rs_fd < 0)  {
-      LOG(SLOG_LOG, LOG_ERR, "Unable to open file: %s\n", argv[1]);
-      displayLastSystemError(argv[1]);
+      LOG(SLOG_LOG, LOG_ERR, "Unable to open file: %s\n", port);
+      displayLastSystemError(port);
       return -1;
     }
   } else {
@@ -736,9 +761,9 @@ int main(int argc, char *argv[]) {
     LOG(SLOG_LOG, LOG_NOTICE, "Logging serial errors!\n");
   }
   if (_aqconfig_.log_protocol_packets)
-     LOG(SLOG_LOG, LOG_NOTICE, "Logging packets to %s!\n",RS485LOGFILE);
+     LOG(SLOG_LOG, LOG_NOTICE, "Capturing packets to %s!\n",RS485CAPFILE);
   if (_aqconfig_.log_raw_bytes)
-     LOG(SLOG_LOG, LOG_NOTICE, "Logging raw bytes to %s!\n",RS485BYTELOGFILE);
+     LOG(SLOG_LOG, LOG_NOTICE, "Capturing raw bytes to %s!\n",RS485CAPFILE);
 
   if (logLevel < LOG_DEBUG && errorMonitor==false )
     printf("Please wait.");
@@ -10,11 +10,17 @@
 #include "packetLogger.h"
 #include "color_lights.h"
 #include "allbutton.h"
+#include "cmd_queue.h"
 
 #define RSSA_QLEN 40
 
-unsigned char _rssa_queue[RSSA_QLEN][4];
-int _rssa_q_length = 0;
+// Coalescing keys, a newer request for the same thing replaces the one waiting.
+#define RSSA_KEY_SETPOINT 1
+#define RSSA_KEY_DEVICE   2
+#define RSSA_KEY_GET      3
+
+static cmd_queue _rssa_queue = CMD_QUEUE_INIT("rssadapter", RSSA_LOG, RSSA_QLEN);
+static unsigned char _rssa_cmd[CMDQ_MAX_CMD];
 bool _rssa_last_was_queue = false;
 //int _rssa_position = 0;
 
@@ -42,18 +48,25 @@ void processRSSALEDstate(struct aqualinkdata *aqdata, unsigned char *packet)
 }
 
 
+static bool queue_rssa_cmd(cmdq_priority prio, uint32_t key, unsigned char *cmd);
+
 bool push_rssa_cmd(unsigned char *cmd) {
-  if (_rssa_q_length >= RSSA_QLEN ) {
-    LOG(RSSA_LOG,LOG_ERR, "Queue overflow, last command ignored!\n");
-    return false;
-  }
+  return queue_rssa_cmd(CMDQ_USER, 0, cmd);
+}
 
-  memcpy(_rssa_queue[_rssa_q_length++], cmd, 4);
+static bool queue_rssa_cmd(cmdq_priority prio, uint32_t key, unsigned char *cmd) {
+  if ( ! cmdq_push(&_rssa_queue, prio, key, cmd, 4) )
+    return false;
 
-  LOG(RSSA_LOG,LOG_DEBUG, "Added to message queue, position %d 0x%02hhx|0x%02hhx|0x%02hhx|0x%02hhx\n",_rssa_q_length-1,_rssa_queue[_rssa_q_length-1][0],_rssa_queue[_rssa_q_length-1][1],_rssa_queue[_rssa_q_length-1][2],_rssa_queue[_rssa_q_length-1][3]);
+  LOG(RSSA_LOG,LOG_DEBUG, "Added to message queue, length %d 0x%02hhx|0x%02hhx|0x%02hhx|0x%02hhx\n",cmdq_length(&_rssa_queue),cmd[0],cmd[1],cmd[2],cmd[3]);
   return true;
 }
 
+// Status request, if we are already waiting on the same one don't ask again.
+static bool poll_rssa_cmd(unsigned char *cmd) {
+  return queue_rssa_cmd(CMDQ_POLL, CMDQ_KEY(RSSA_KEY_GET, cmd[2] << 8 | cmd[3]), cmd);
+}
+
 unsigned char *get_rssa_cmd(unsigned char source_message_type) {
 
   _rssa_last_was_queue = false;
@@ -71,10 +84,10 @@ unsigned char *get_rssa_cmd(unsigned char source_message_type) {
   else if (source_message_type != CMD_STATUS && source_message_type != 0x07) // 0x07 is second part of set message
     return rssa_null; // Only send command on status messages.
   else  {
-    if (_rssa_q_length > 0) {
-      LOG(RSSA_LOG,LOG_DEBUG, "Pull from message queue, length %d 0x%02hhx|0x%02hhx|0x%02hhx|0x%02hhx\n",_rssa_q_length,_rssa_queue[0][0],_rssa_queue[0][1],_rssa_queue[0][2],_rssa_queue[0][3]);
+    if (cmdq_peek(&_rssa_queue, _rssa_cmd) > 0) {
+      LOG(RSSA_LOG,LOG_DEBUG, "Pull from message queue, 0x%02hhx|0x%02hhx|0x%02hhx|0x%02hhx\n",_rssa_cmd[0],_rssa_cmd[1],_rssa_cmd[2],_rssa_cmd[3]);
       _rssa_last_was_queue = true;
-      return _rssa_queue[0];
+      return _rssa_cmd;
     }   
   }
 
@@ -85,10 +98,9 @@ void remove_rssa_cmd() {
 
 //stopInlineDebug();
 
-  if (_rssa_q_length > 0 && _rssa_last_was_queue == true) {
-    LOG(RSSA_LOG,LOG_DEBUG, "Remove from message queue, length %d\n",_rssa_q_length-1);
-    memmove(&_rssa_queue[0], &_rssa_queue[1], (sizeof(unsigned char) * 4) * _rssa_q_length);
-    _rssa_q_length--;
+  if (_rssa_last_was_queue == true) {
+    cmdq_remove(&_rssa_queue);
+    LOG(RSSA_LOG,LOG_DEBUG, "Remove from message queue, length %d\n",cmdq_length(&_rssa_queue));
   }
 }
 
@@ -96,8 +108,18 @@ void queue_aqualink_rssadapter_setpoint(unsigned char typeID, int val) {
   unsigned char readySP[] = {0x00,0x01,typeID,0x35};
   unsigned char setSP[] = {0x00,0x01,0x00,(unsigned char)val};
 
-  push_rssa_cmd(readySP);
-  push_rssa_cmd(setSP);
+  // Ready & set have to go together, a newer value for the same setpoint just replaces the waiting one.
+  cmdq_push_pair(&_rssa_queue, CMDQ_USER, CMDQ_KEY(RSSA_KEY_SETPOINT, typeID), readySP, 4, setSP, 4);
+}
+
+// Setpoint we have queued but not sent yet, so repeated +1's add up.
+static int rssadapter_pending_setpoint(unsigned char typeID, int current) {
+  unsigned char setSP[CMDQ_MAX_CMD];
+
+  if (cmdq_pending(&_rssa_queue, CMDQ_KEY(RSSA_KEY_SETPOINT, typeID), 1, setSP) > 0)
+    return setSP[3];
+
+  return current;
 }
 
 /* NSF Need to delete this and use aqbuttonp[].rssd_code */
@@ -124,7 +146,8 @@ unsigned char RSSAdevID(int bIndex) {
 
 void rssadapter_device_state(const unsigned char devID, const unsigned char state) {
   unsigned char setDev[] = {0x00,0x01,state,devID};
-  push_rssa_cmd(setDev);
+  // 0x00 is get state, keep that seperate from set so set then get doesn't collapse
+  queue_rssa_cmd(CMDQ_USER, CMDQ_KEY(RSSA_KEY_DEVICE, (state==0x00?0x100:0) | devID), setDev);
 }
 /*
 void rssadapter_device_off(unsigned char devID) {
@@ -162,9 +185,11 @@ void set_aqualink_rssadapter_aux_state(int buttonIndex, bool turnOn)
 */
 void increase_aqualink_rssadapter_pool_setpoint(int val, struct aqualinkdata *aqdata) {
 
-  val = setpoint_check(POOL_HTR_SETPOINT, aqdata->pool_htr_set_point + val, aqdata);
+  int current = rssadapter_pending_setpoint(RS_SA_POOLSP, aqdata->pool_htr_set_point);
+
+  val = setpoint_check(POOL_HTR_SETPOINT, current + val, aqdata);
 
-  LOG(RSSA_LOG,LOG_DEBUG, "Increasing pool heater from %d to %d\n",aqdata->pool_htr_set_point,val);
+  LOG(RSSA_LOG,LOG_DEBUG, "Increasing pool heater from %d to %d\n",current,val);
 
   queue_aqualink_rssadapter_setpoint(RS_SA_POOLSP, val);
 }
@@ -172,9 +197,11 @@ void increase_aqualink_rssadapter_pool_setpoint(int val, struct aqualinkdata *aq
 void increase_aqualink_rssadapter_spa_setpoint(int val, struct aqualinkdata *aqdata) {
 
 
-  val = setpoint_check(SPA_HTR_SETPOINT, aqdata->spa_htr_set_point + val, aqdata);
+  int current = rssadapter_pending_setpoint((isSINGLE_DEV_PANEL?RS_SA_POOLSP2:RS_SA_SPASP), aqdata->spa_htr_set_point);
 
-  LOG(RSSA_LOG,LOG_DEBUG, "Increasing spa heater from %d to %d\n",aqdata->spa_htr_set_point,val);
+  val = setpoint_check(SPA_HTR_SETPOINT, current + val, aqdata);
+
+  LOG(RSSA_LOG,LOG_DEBUG, "Increasing spa heater from %d to %d\n",current,val);
 
   queue_aqualink_rssadapter_setpoint( (isSINGLE_DEV_PANEL?RS_SA_POOLSP2:RS_SA_SPASP), val);
 }
@@ -229,7 +256,8 @@ void get_aqualink_rssadapter_colorlight_statuses(struct aqualinkdata *aqdata)
   for (int i=0; i < aqdata->num_lights; i++) {
     if (aqdata->lights[i].lightType != LC_PROGRAMABLE ) {
       // LC_PROGRAMABLE is aqualinkd to set, so works as normal button
-      rssadapter_device_state(aqdata->lights[i].button->rssd_code, 0x00); // 0x00 meand Get curent state
+      unsigned char getDev[] = {0x00,0x01,0x00,aqdata->lights[i].button->rssd_code}; // 0x00 meand Get curent state
+      poll_rssa_cmd(getDev);
     }
   }
 }
@@ -237,33 +265,29 @@ void get_aqualink_rssadapter_colorlight_statuses(struct aqualinkdata *aqdata)
 
 void get_aqualink_rssadapter_setpoints() {
   //push_rssa_cmd(getModel);
-  push_rssa_cmd(getUnits);
-  push_rssa_cmd(getPoolSP);
+  poll_rssa_cmd(getUnits);
+  poll_rssa_cmd(getPoolSP);
   if (!isSINGLE_DEV_PANEL)
-    push_rssa_cmd(getSpaSP);
+    poll_rssa_cmd(getSpaSP);
   else
-    push_rssa_cmd(getPoolSP2);
+    poll_rssa_cmd(getPoolSP2);
 }
 
 // Return true if we change the state.
 bool setLEDstate( aqled *led, unsigned char state, struct aqualinkdata *aqdata)
 {
+  bool changed = false;
+
   if (state == 0x00) {
-    if (led->state != OFF) {
-      led->state = OFF;
-      return true;
-    }
+    SET_IF_CHANGED(led->state, OFF, changed);
   } else if (state == 0x01) {
-    if (led->state != ON) {
-      led->state = ON;
-      return true;
-    }
+    SET_IF_CHANGED(led->state, ON, changed);
   }
   // Should also add FLASH and ENABLE.
 
   //_aqualink_data.aqbuttons[13].led->state = OFF;
   //
-  return false;
+  return changed;
 }
 
 bool process_rssadapter_packet(unsigned char *packet, int length, struct aqualinkdata *aqdata) {
@@ -288,18 +312,18 @@ bool process_rssadapter_packet(unsigned char *packet, int length, struct aqualin
       // But do it here as it's the first init, cnt=0 will only happen once  
       queueGetProgramData(RSSADAPTER, aqdata);
     } else {
-      push_rssa_cmd(getPoolSP);
+      poll_rssa_cmd(getPoolSP);
     
       if (!isSINGLE_DEV_PANEL)
-        push_rssa_cmd(getSpaSP);
+        poll_rssa_cmd(getSpaSP);
       else
-        push_rssa_cmd(getPoolSP2);
+        poll_rssa_cmd(getPoolSP2);
  // No status LED's for these, so get them on a poll cycle
       if ( PANEL_SIZE() >= 16 ) {
-        push_rssa_cmd(getAux12);
-        push_rssa_cmd(getAux13);
-        push_rssa_cmd(getAux14);
-        push_rssa_cmd(getAux15);
+        poll_rssa_cmd(getAux12);
+        poll_rssa_cmd(getAux13);
+        poll_rssa_cmd(getAux14);
+        poll_rssa_cmd(getAux15);
       }
 
     }
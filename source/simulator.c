@@ -6,16 +6,15 @@
 #include "aqualink.h"
 #include "net_services.h"
 #include "packetLogger.h"
+#include "cmd_queue.h"
 
-#define MAX_STACK 20
-int _sim_stack_place = 0;
-unsigned char _sim_commands[MAX_STACK];
+static cmd_queue _sim_queue = CMD_QUEUE_INIT("simulator", SIM_LOG, 20);
 
 bool push_simulator_cmd(unsigned char cmd);
 
 int simulator_cmd_length()
 {
-  return _sim_stack_place;
+  return cmdq_length(&_sim_queue);
 }
 
 // External command
@@ -26,25 +25,15 @@ void simulator_send_cmd(unsigned char cmd)
 
 bool push_simulator_cmd(unsigned char cmd)
 {
-  if (_sim_stack_place < MAX_STACK) {
-    _sim_commands[_sim_stack_place] = cmd;
-    _sim_stack_place++;
-  } else {
-    LOG(SIM_LOG, LOG_ERR, "Command queue overflow, too many unsent commands to RS control panel\n");
-    return false;
-  }
-
-  return true;
+  return cmdq_push(&_sim_queue, CMDQ_USER, 0, &cmd, 1);
 }
 
 unsigned char pop_simulator_cmd(unsigned char receive_type)
 {
   unsigned char cmd = NUL;
 
-  if (_sim_stack_place > 0 && receive_type == CMD_STATUS ) {
-    cmd = _sim_commands[0];
-    _sim_stack_place--;
-    memmove(&_sim_commands[0], &_sim_commands[1], sizeof(unsigned char) * _sim_stack_place ) ;
+  if (receive_type == CMD_STATUS) {
+    cmd = cmdq_pop_byte(&_sim_queue);
   }
 
   LOG(SIM_LOG,LOG_DEBUG, "Sending '0x%02hhx' to controller\n", cmd);
@@ -0,0 +1,486 @@
+/*
+ * Copyright (c) 2017 Shaun Feakes - All rights reserved
+ *
+ * You may use redistribute and/or modify this code under the terms of
+ * the GNU General Public License version 2 as published by the
+ * Free Software Foundation. For the terms of this license,
+ * see <http://www.gnu.org/licenses/>.
+ *
+ * You are free to use this software under the terms of the GNU General
+ * Public License, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ *  https://github.com/sfeakes/aqualinkd
+ */
+
+/*
+  Compare the old action_URI() strncmp chain & button scans against the uri_routes tables.
+  Only the routing is timed, nothing is actioned.
+
+  ./release/uribench                 // built in request mix
+  ./release/uribench <file> [loops]  // one URI per line, or aqualinkd debug log
+                                     // (takes the '...' from "URI Request '...'" lines)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "aqualink.h"
+#include "aq_panel.h"
+#include "aq_mqtt.h"
+#include "uri_routes.h"
+
+#define DEFAULT_LOOPS 200000
+#define MAX_REQUESTS  4096
+
+// What the request would have done, so both implementations can be checked against each other.
+typedef enum {
+  B_BAD = 0, B_DEVICES, B_STATUS, B_HOMEBRIDGE, B_DYNCONF, B_SCHEDULES, B_SETSCHEDULES,
+  B_CONFIG, B_SAVECONFIG, B_CONFIGDL, B_ACKLATENCY, B_WEBCACHE, B_PROGRAMMER,
+  B_SETPOINT, B_SETPOINT_INC, B_SWG_PERCENT, B_SWG_BOOST, B_LIGHT, B_BRIGHTNESS,
+  B_PUMP, B_CHEM, B_ONOFF, B_TIMER
+} bench_action;
+
+typedef struct bench_result {
+  bench_action action;
+  int button; // aqbuttons index, pump index or setpoint device
+} bench_result;
+
+static struct aqualinkdata _aqdata;
+
+// Request mix from a web UI, homebridge and an MQTT broker on an RS-8 combo.
+static const char *_defaultMix[] = {
+  "status", "status", "status", "status", "status", "status", "status", "status",
+  "devices", "devices", "devices", "homebridge", "homebridge",
+  "dynamicconfig", "schedules", "webcache", "acklatency",
+  "Filter_Pump/set", "Spa/set", "Aux_1/set", "Aux_3/set", "Aux_V1/set",
+  "Pool Light/set", "Waterfall/set", "Spa Mode/set",
+  "Solar_Heater/set", "Pool_Heater/set", "Spa_Heater/set",
+  "Pool_Heater/setpoint/set", "Spa_Heater/setpoint/set", "Freeze_Protect/setpoint/set",
+  "SWG/Percent/set", "SWG/Percent_f/set", "SWG/Boost/set", "SWG/setpoint/set",
+  "Aux_4/program/set", "Pool Light/color/set", "Aux_4/brightness/set",
+  "Pump_1/RPM/set", "Pump_2/GPM/set", "Filter_Pump/RPM/set", "Filter_Pump/Speed/set",
+  "CHEM/pH/set", "CHEM/ORP/set",
+  "Aux_2/timer/set", "Filter_Pump/timer/set",
+  "Nothing/set", "notaroute",
+};
+
+static void add_button(int i, const char *name, const char *label)
+{
+  _aqdata.aqbuttons[i].name = (char *)name;
+  _aqdata.aqbuttons[i].label = (char *)label;
+}
+
+static void setup_panel()
+{
+  static altlabel_detail alt = {.altlabel = "Cleaner Boost", .in_alt_mode = false};
+  static pump_detail p1, p2;
+
+  add_button(0,  BTN_PUMP,      "Filter Pump");
+  add_button(1,  BTN_SPA,       "Spa");
+  add_button(2,  BTN_AUX1,      "Cleaner");
+  add_button(3,  BTN_AUX2,      "Waterfall");
+  add_button(4,  BTN_AUX3,      "Air Blower");
+  add_button(5,  BTN_AUX4,      "Pool Light");
+  add_button(6,  BTN_AUX5,      "Spa Light");
+  add_button(7,  BTN_AUX6,      "Aux 6");
+  add_button(8,  BTN_AUX7,      "Aux 7");
+  add_button(9,  BTN_POOL_HTR,  "Heater");
+  add_button(10, BTN_SPA_HTR,   "Heater");
+  add_button(11, "Solar_Heater", "Solar Heater");
+  add_button(12, "Aux_V1",      "Spa Mode");
+  add_button(13, "Aux_V2",      "Clean Mode");
+  add_button(14, "Aux_V3",      "All Off");
+  add_button(15, "Aux_V4",      "Day Party");
+  _aqdata.aqbuttons[13].special_mask = VIRTUAL_BUTTON | VIRTUAL_BUTTON_ALT_LABEL;
+  _aqdata.aqbuttons[13].special_mask_ptr = &alt;
+  _aqdata.total_buttons = 16;
+  _aqdata.virtual_button_start = 12;
+
+  p1.pumpIndex = 1;
+  p1.button = &_aqdata.aqbuttons[0];
+  p2.pumpIndex = 2;
+  p2.button = &_aqdata.aqbuttons[2];
+  _aqdata.pumps[0] = p1;
+  _aqdata.pumps[1] = p2;
+  _aqdata.num_pumps = 2;
+}
+
+/*
+  The old chain, as it was in action_URI() with the actions taken out.
+*/
+static bool old_uri_strcmp(const char *uri, const char *string)
+{
+  int len = strlen(string);
+
+  if (uri[len] != '/')
+    return false;
+
+  return strncmp(uri, string, len) == 0;
+}
+
+static bench_result old_route(const char *URI, int uri_length)
+{
+  bench_result r = {B_BAD, -1};
+  char *ri1 = (char *)URI;
+  char *ri2 = NULL;
+  char *ri3 = NULL;
+  int i;
+
+  for (i=1; i < uri_length; i++) {
+    if ( URI[i] == '/' ) {
+      if (ri2 == NULL) {
+        ri2 = (char *)&URI[++i];
+      } else if (ri3 == NULL) {
+        ri3 = (char *)&URI[++i];
+        break;
+      }
+    }
+  }
+
+  if (strncmp(ri1, "devices", 7) == 0) {
+    r.action = B_DEVICES;
+  } else if (strncmp(ri1, "status", 6) == 0) {
+    r.action = B_STATUS;
+  } else if (strncmp(ri1, "homebridge", 10) == 0) {
+    r.action = B_HOMEBRIDGE;
+  } else if (strncmp(ri1, "dynamicconfig", 13) == 0) {
+    r.action = B_DYNCONF;
+  } else if (strncmp(ri1, "schedules/set", 13) == 0) {
+    r.action = B_SETSCHEDULES;
+  } else if (strncmp(ri1, "schedules", 9) == 0) {
+    r.action = B_SCHEDULES;
+  } else if (strncmp(ri1, "config/download", 10) == 0) {
+    r.action = B_CONFIGDL;
+  } else if (strncmp(ri1, "config/set", 10) == 0) {
+    r.action = B_SAVECONFIG;
+  } else if (strncmp(ri1, "config", 6) == 0) {
+    r.action = B_CONFIG;
+  } else if (strncmp(ri1, "acklatency", 10) == 0) {
+    r.action = B_ACKLATENCY;
+  } else if (strncmp(ri1, "webcache", 8) == 0) {
+    r.action = B_WEBCACHE;
+  } else if (strncmp(ri1, "programmer", 10) == 0) {
+    r.action = B_PROGRAMMER;
+  } else if (strncmp(ri1, "aqmanager", 9) == 0 || strncmp(ri1, "logfile", 7) == 0 ||
+             strncmp(ri1, "set_date_time", 13) == 0 || strncmp(ri1, "startup_program", 15) == 0) {
+    r.action = B_BAD; // Not part of the mix
+  } else if (ri3 != NULL && (strncasecmp(ri2, "setpoint", 8) == 0) && (strncasecmp(ri3, "increment", 9) == 0)) {
+    r.action = B_SETPOINT_INC;
+    if (strncmp(ri1, BTN_POOL_HTR, strlen(BTN_POOL_HTR)) == 0)
+      r.button = 0;
+    else if (strncmp(ri1, BTN_SPA_HTR, strlen(BTN_SPA_HTR)) == 0)
+      r.button = 1;
+    else
+      r.action = B_BAD;
+  } else if (ri3 != NULL && (strncasecmp(ri2, "setpoint", 8) == 0) && (strncasecmp(ri3, "set", 3) == 0)) {
+    r.action = B_SETPOINT;
+    if (strncmp(ri1, BTN_POOL_HTR, strlen(BTN_POOL_HTR)) == 0)
+      r.button = 0;
+    else if (strncmp(ri1, BTN_SPA_HTR, strlen(BTN_SPA_HTR)) == 0)
+      r.button = 1;
+    else if (strncmp(ri1, FREEZE_PROTECT, strlen(FREEZE_PROTECT)) == 0)
+      r.button = 2;
+    else if (strncmp(ri1, CHILLER, strlen(CHILLER)) == 0)
+      r.button = 3;
+    else if (strncmp(ri1, "SWG", 3) == 0)
+      r.button = 4;
+    else
+      r.action = B_BAD;
+  } else if ((ri3 != NULL && (strncmp(ri1, "SWG", 3) == 0) && (strncasecmp(ri2, "Percent", 7) == 0) && (strncasecmp(ri3, "set", 3) == 0))) {
+    r.action = B_SWG_PERCENT;
+    r.button = (strncmp(ri2, "Percent_f", 9) == 0);
+  } else if ((ri3 != NULL && (strncmp(ri1, "SWG", 3) == 0) && (strncasecmp(ri2, "Boost", 5) == 0) && (strncasecmp(ri3, "set", 3) == 0))) {
+    r.action = B_SWG_BOOST;
+  } else if ((ri3 != NULL && ((strncasecmp(ri2, "color", 5) == 0) || (strncasecmp(ri2, "program", 7) == 0)) && (strncasecmp(ri3, "set", 3) == 0))) {
+    for (i=0; i < _aqdata.total_buttons; i++) {
+      if (strncmp(ri1, _aqdata.aqbuttons[i].name, strlen(_aqdata.aqbuttons[i].name)) == 0 ||
+          strncmp(ri1, _aqdata.aqbuttons[i].label, strlen(_aqdata.aqbuttons[i].label)) == 0) {
+        r.action = B_LIGHT;
+        r.button = i;
+        break;
+      }
+    }
+  } else if ((ri3 != NULL && (strncasecmp(ri2, "brightness", 10) == 0) && (strncasecmp(ri3, "set", 3) == 0))) {
+    for (i=0; i < _aqdata.total_buttons; i++) {
+      if (strncmp(ri1, _aqdata.aqbuttons[i].name, strlen(_aqdata.aqbuttons[i].name)) == 0 ||
+          strncmp(ri1, _aqdata.aqbuttons[i].label, strlen(_aqdata.aqbuttons[i].label)) == 0) {
+        r.action = B_BRIGHTNESS;
+        r.button = i;
+        break;
+      }
+    }
+  } else if ((ri3 != NULL && ((strncasecmp(ri2, "RPM", 3) == 0) || (strncasecmp(ri2, "GPM", 3) == 0) || (strncasecmp(ri2, "Speed", 5) == 0) || (strncasecmp(ri2, "VSP", 3) == 0)) && (strncasecmp(ri3, "set", 3) == 0))) {
+    if (strncmp(ri1, "Pump_", 5) == 0) {
+      int pumpIndex = atoi(ri1+5);
+      for (i=0; i < _aqdata.num_pumps; i++) {
+        if (_aqdata.pumps[i].pumpIndex == pumpIndex) {
+          r.action = B_PUMP;
+          r.button = pumpIndex;
+          break;
+        }
+      }
+    } else {
+      for (i=0; i < _aqdata.total_buttons && r.action == B_BAD; i++) {
+        if ( old_uri_strcmp(ri1, _aqdata.aqbuttons[i].name) ||
+             ( isVBUTTON_ALTLABEL(_aqdata.aqbuttons[i].special_mask) && old_uri_strcmp(ri1, ((altlabel_detail *)_aqdata.aqbuttons[i].special_mask_ptr)->altlabel)) ) {
+          for (int pi=0; pi < _aqdata.num_pumps; pi++) {
+            if (_aqdata.pumps[pi].button == &_aqdata.aqbuttons[i]) {
+              r.action = B_PUMP;
+              r.button = _aqdata.pumps[pi].pumpIndex;
+              break;
+            }
+          }
+        }
+      }
+    }
+  } else if ((ri3 != NULL && (strncmp(ri1, "CHEM", 4) == 0) && (strncasecmp(ri3, "set", 3) == 0))) {
+    if ( strncasecmp(ri2, "ORP", 3) == 0 ) {
+      r.action = B_CHEM;
+      r.button = 0;
+    } else if ( strncasecmp(ri2, "Ph", 2) == 0 ) {
+      r.action = B_CHEM;
+      r.button = 1;
+    }
+  } else if ( (ri2 != NULL && (strncasecmp(ri2, "set", 3) == 0) && (strncasecmp(ri2, "setpoint", 8) != 0)) ||
+              (ri2 != NULL && ri3 != NULL && (strncasecmp(ri2, "timer", 5) == 0) && (strncasecmp(ri3, "set", 3) == 0)) ) {
+    for (i=0; i < _aqdata.total_buttons; i++) {
+      if ( old_uri_strcmp(ri1, _aqdata.aqbuttons[i].name) || old_uri_strcmp(ri1, _aqdata.aqbuttons[i].label) ||
+         ( isVBUTTON_ALTLABEL(_aqdata.aqbuttons[i].special_mask) && old_uri_strcmp(ri1, ((altlabel_detail *)_aqdata.aqbuttons[i].special_mask_ptr)->altlabel)) ) {
+        r.action = (strncasecmp(ri2, "timer", 5) == 0)?B_TIMER:B_ONOFF;
+        r.button = i;
+        break;
+      }
+    }
+  }
+
+  return r;
+}
+
+/*
+  Same decisions through the route tables, in the order action_URI() now makes them.
+*/
+static bench_result new_route(const char *URI, int uri_length)
+{
+  bench_result r = {B_BAD, -1};
+  const char *end = URI + uri_length;
+  char *ri1 = (char *)URI;
+  char *ri2 = NULL;
+  char *ri3 = NULL;
+  int ri1_len;
+  uri_route route;
+  uri_keyword kw2;
+  uri_keyword kw3;
+  int i;
+
+  for (i=1; i < uri_length; i++) {
+    if ( URI[i] == '/' ) {
+      if (ri2 == NULL) {
+        ri2 = (char *)&URI[++i];
+      } else if (ri3 == NULL) {
+        ri3 = (char *)&URI[++i];
+        break;
+      }
+    }
+  }
+
+  ri1_len = uri_segment_length(ri1, end);
+  route = uri_route_lookup(ri1, ri1_len);
+  kw2 = uri_keyword_lookup(ri2, uri_segment_length(ri2, end));
+  kw3 = uri_keyword_lookup(ri3, uri_segment_length(ri3, end));
+
+  switch (route) {
+  case URI_DEVICES:       r.action = B_DEVICES;       return r;
+  case URI_STATUSDELTA:
+  case URI_STATUS:        r.action = B_STATUS;        return r;
+  case URI_HOMEBRIDGE:    r.action = B_HOMEBRIDGE;    return r;
+  case URI_DYNAMICCONFIG: r.action = B_DYNCONF;       return r;
+  case URI_SCHEDULES:     r.action = (kw2 == UKW_SET)?B_SETSCHEDULES:B_SCHEDULES; return r;
+  case URI_CONFIG:        r.action = (kw2 == UKW_DOWNLOAD)?B_CONFIGDL:(kw2 == UKW_SET)?B_SAVECONFIG:B_CONFIG; return r;
+  case URI_ACKLATENCY:    r.action = B_ACKLATENCY;    return r;
+  case URI_WEBCACHE:      r.action = B_WEBCACHE;      return r;
+  case URI_PROGRAMMER:    r.action = B_PROGRAMMER;    return r;
+  case URI_AQMANAGER:
+  case URI_LOGFILE:
+  case URI_SET_DATE_TIME:
+  case URI_STARTUP_PROGRAM:
+    return r; // Not part of the mix
+  default:
+    break;
+  }
+
+  if (kw2 == UKW_SETPOINT && kw3 == UKW_INCREMENT) {
+    r.action = B_SETPOINT_INC;
+    if (route == URI_DEV_POOL_HTR)
+      r.button = 0;
+    else if (route == URI_DEV_SPA_HTR)
+      r.button = 1;
+    else
+      r.action = B_BAD;
+  } else if (kw2 == UKW_SETPOINT && kw3 == UKW_SET) {
+    r.action = B_SETPOINT;
+    switch (route) {
+      case URI_DEV_POOL_HTR: r.button = 0; break;
+      case URI_DEV_SPA_HTR:  r.button = 1; break;
+      case URI_DEV_FREEZE:   r.button = 2; break;
+      case URI_DEV_CHILLER:  r.button = 3; break;
+      case URI_DEV_SWG:      r.button = 4; break;
+      default:               r.action = B_BAD; break;
+    }
+  } else if (route == URI_DEV_SWG && (kw2 == UKW_PERCENT || kw2 == UKW_PERCENT_F) && kw3 == UKW_SET) {
+    r.action = B_SWG_PERCENT;
+    r.button = (kw2 == UKW_PERCENT_F);
+  } else if (route == URI_DEV_SWG && kw2 == UKW_BOOST && kw3 == UKW_SET) {
+    r.action = B_SWG_BOOST;
+  } else if ((kw2 == UKW_COLOR || kw2 == UKW_PROGRAM) && kw3 == UKW_SET) {
+    if ((r.button = uri_button_lookup(&_aqdata, ri1, ri1_len, URI_BTN_NAME | URI_BTN_LABEL)) >= 0)
+      r.action = B_LIGHT;
+  } else if (kw2 == UKW_BRIGHTNESS && kw3 == UKW_SET) {
+    if ((r.button = uri_button_lookup(&_aqdata, ri1, ri1_len, URI_BTN_NAME | URI_BTN_LABEL)) >= 0)
+      r.action = B_BRIGHTNESS;
+  } else if ((kw2 == UKW_RPM || kw2 == UKW_GPM || kw2 == UKW_SPEED || kw2 == UKW_VSP) && kw3 == UKW_SET) {
+    if (strncmp(ri1, "Pump_", 5) == 0) {
+      int pumpIndex = atoi(ri1+5);
+      for (i=0; i < _aqdata.num_pumps; i++) {
+        if (_aqdata.pumps[i].pumpIndex == pumpIndex) {
+          r.action = B_PUMP;
+          r.button = pumpIndex;
+          break;
+        }
+      }
+    } else if ( (i = uri_button_lookup(&_aqdata, ri1, ri1_len, URI_BTN_NAME | URI_BTN_ALTLABEL)) >= 0 ) {
+      for (int pi=0; pi < _aqdata.num_pumps; pi++) {
+        if (_aqdata.pumps[pi].button == &_aqdata.aqbuttons[i]) {
+          r.action = B_PUMP;
+          r.button = _aqdata.pumps[pi].pumpIndex;
+          break;
+        }
+      }
+    }
+  } else if (route == URI_DEV_CHEM && kw3 == UKW_SET) {
+    if (kw2 == UKW_ORP) {
+      r.action = B_CHEM;
+      r.button = 0;
+    } else if (kw2 == UKW_PH) {
+      r.action = B_CHEM;
+      r.button = 1;
+    }
+  } else if ( kw2 == UKW_SET || (kw2 == UKW_TIMER && kw3 == UKW_SET) ) {
+    if ((r.button = uri_button_lookup(&_aqdata, ri1, ri1_len, URI_BTN_ANY)) >= 0)
+      r.action = (kw2 == UKW_TIMER)?B_TIMER:B_ONOFF;
+  }
+
+  if (r.action == B_BAD)
+    r.button = -1;
+
+  return r;
+}
+
+static int load_requests(const char *file, char **requests)
+{
+  char line[1024];
+  char *start;
+  char *end;
+  int num = 0;
+  FILE *fp = fopen(file, "r");
+
+  if (fp == NULL) {
+    perror(file);
+    return -1;
+  }
+
+  while (num < MAX_REQUESTS && fgets(line, sizeof(line), fp) != NULL) {
+    if ( (start = strstr(line, "URI Request '")) != NULL ) {
+      start += 13;
+      if ( (end = strchr(start, '\'')) == NULL )
+        continue;
+    } else {
+      start = line;
+      end = start + strcspn(start, "\r\n");
+    }
+    if (strncmp(start, "/api/", 5) == 0)
+      start += 5;
+    if (end <= start)
+      continue;
+    requests[num++] = strndup(start, end - start);
+  }
+
+  fclose(fp);
+  return num;
+}
+
+static double elapsed_ns(struct timespec *start, struct timespec *end)
+{
+  return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+int main(int argc, char *argv[])
+{
+  char *requests[MAX_REQUESTS];
+  int lengths[MAX_REQUESTS];
+  int num;
+  long loops = DEFAULT_LOOPS;
+  int mismatch = 0;
+  volatile int sink = 0;
+  struct timespec start, end;
+  double old_ns, new_ns;
+  bench_result o, n;
+
+  if (argc > 1 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)) {
+    printf("Usage: %s [request file] [loops]\n", argv[0]);
+    return EXIT_SUCCESS;
+  }
+
+  if (argc > 1) {
+    if ( (num = load_requests(argv[1], requests)) <= 0 ) {
+      fprintf(stderr, "No requests loaded from %s\n", argv[1]);
+      return EXIT_FAILURE;
+    }
+  } else {
+    num = sizeof(_defaultMix) / sizeof(_defaultMix[0]);
+    for (int i=0; i < num; i++)
+      requests[i] = (char *)_defaultMix[i];
+  }
+
+  if (argc > 2)
+    loops = atol(argv[2]);
+
+  setup_panel();
+
+  for (int i=0; i < num; i++) {
+    lengths[i] = strlen(requests[i]);
+    o = old_route(requests[i], lengths[i]);
+    n = new_route(requests[i], lengths[i]);
+    if (o.action != n.action || o.button != n.button) {
+      printf("Mismatch '%s' old=%d/%d new=%d/%d\n", requests[i], o.action, o.button, n.action, n.button);
+      mismatch++;
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (long l=0; l < loops; l++) {
+    for (int i=0; i < num; i++)
+      sink += old_route(requests[i], lengths[i]).button;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  old_ns = elapsed_ns(&start, &end) / ((double)loops * num);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (long l=0; l < loops; l++) {
+    for (int i=0; i < num; i++)
+      sink += new_route(requests[i], lengths[i]).button;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  new_ns = elapsed_ns(&start, &end) / ((double)loops * num);
+
+  printf("%d requests x %ld loops, %d buttons\n", num, loops, _aqdata.total_buttons);
+  printf("  strncmp chain  %8.1f ns/request\n", old_ns);
+  printf("  route tables   %8.1f ns/request  (%.2fx)\n", new_ns, old_ns / new_ns);
+  printf("  %d mismatch%s\n", mismatch, mismatch==1?"":"es");
+
+  return mismatch == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
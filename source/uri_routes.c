@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2017 Shaun Feakes - All rights reserved
+ *
+ * You may use redistribute and/or modify this code under the terms of
+ * the GNU General Public License version 2 as published by the
+ * Free Software Foundation. For the terms of this license,
+ * see <http://www.gnu.org/licenses/>.
+ *
+ * You are free to use this software under the terms of the GNU General
+ * Public License, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ *  https://github.com/sfeakes/aqualinkd
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "aqualink.h"
+#include "aq_panel.h"
+#include "aq_mqtt.h"
+#include "uri_routes.h"
+
+/*
+  All three tables are open addressing on an FNV-1a hash, slots hold index+1 so 0 is empty.
+  The route & keyword tables are fixed so get built on first use.  The button table is
+  only rebuilt after invalidate_uri_button_index() or when total_buttons changes, so
+  anything that changes a button name, label or altlabel must call it.  Every hit is
+  still checked against the current button strings so a stale slot can't return the
+  wrong button, and a miss is just a miss (no rebuild, junk URIs stay cheap).
+*/
+
+typedef struct uri_name {
+  const char *name;
+  int id;
+} uri_name;
+
+static const uri_name _routes[] = {
+  {"devices",           URI_DEVICES},
+  {"statusdelta",       URI_STATUSDELTA},
+  {"status",            URI_STATUS},
+  {"homebridge",        URI_HOMEBRIDGE},
+  {"dynamicconfig",     URI_DYNAMICCONFIG},
+  {"schedules",         URI_SCHEDULES},
+  {"config",            URI_CONFIG},
+  {"acklatency",        URI_ACKLATENCY},
+  {"webcache",          URI_WEBCACHE},
+  {"metrics",           URI_METRICS},
+  {"flightrecorder",    URI_FLIGHTRECORDER},
+  {"programmer",        URI_PROGRAMMER},
+  {"simulator",         URI_SIMULATOR},
+  {"simcmd",            URI_SIMCMD},
+  {"aqmanager",         URI_AQMANAGER},
+  {"setloglevel",       URI_SETLOGLEVEL},
+  {"addlogmask",        URI_ADDLOGMASK},
+  {"removelogmask",     URI_REMOVELOGMASK},
+  {"logfile",           URI_LOGFILE},
+  {"restart",           URI_RESTART},
+  {"upgrade",           URI_UPGRADE},
+  {"installdevrelease", URI_INSTALLDEVRELEASE},
+  {"seriallogger",      URI_SERIALLOGGER},
+  {"debug",             URI_DEBUG},
+  {"set_date_time",     URI_SET_DATE_TIME},
+  {"startup_program",   URI_STARTUP_PROGRAM},
+  {BTN_POOL_HTR,        URI_DEV_POOL_HTR},
+  {BTN_SPA_HTR,         URI_DEV_SPA_HTR},
+  {FREEZE_PROTECT,      URI_DEV_FREEZE},
+  {CHILLER,             URI_DEV_CHILLER},
+  {SWG_TOPIC,           URI_DEV_SWG},
+  {CHEM_TOPIC,          URI_DEV_CHEM},
+};
+
+static const uri_name _keywords[] = {
+  {"set",        UKW_SET},
+  {"setpoint",   UKW_SETPOINT},
+  {"increment",  UKW_INCREMENT},
+  {"Percent",    UKW_PERCENT},
+  {"Percent_f",  UKW_PERCENT_F},
+  {"Boost",      UKW_BOOST},
+  {"color",      UKW_COLOR},
+  {"program",    UKW_PROGRAM},
+  {"brightness", UKW_BRIGHTNESS},
+  {"RPM",        UKW_RPM},
+  {"GPM",        UKW_GPM},
+  {"Speed",      UKW_SPEED},
+  {"VSP",        UKW_VSP},
+  {"timer",      UKW_TIMER},
+  {"ORP",        UKW_ORP},
+  {"ORP_f",      UKW_ORP},  // Old prefix compare took these as ORP & pH
+  {"pH",         UKW_PH},
+  {"pH_f",       UKW_PH},
+  {"download",   UKW_DOWNLOAD},
+  {"cancel",     UKW_CANCEL},
+};
+
+#define NUM_ROUTES   (sizeof(_routes) / sizeof(_routes[0]))
+#define NUM_KEYWORDS (sizeof(_keywords) / sizeof(_keywords[0]))
+
+#define NAME_INDEX_SIZE   128 // Power of 2, keep well over the size of the tables above
+#define BUTTON_INDEX_SIZE 256 // Power of 2, keep well over TOTAL_BUTTONS * 3
+
+static uint8_t _routeIndex[NAME_INDEX_SIZE];
+static uint8_t _keywordIndex[NAME_INDEX_SIZE];
+static pthread_once_t _nameIndexOnce = PTHREAD_ONCE_INIT;
+
+typedef struct uri_button_slot {
+  uint8_t button; // aqbuttons index + 1, 0 = empty
+  uint8_t match;  // URI_BTN_NAME / LABEL / ALTLABEL
+} uri_button_slot;
+
+static uri_button_slot _buttonIndex[BUTTON_INDEX_SIZE];
+static pthread_mutex_t _buttonIndexMutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int _buttonIndexVersion = 1;
+static unsigned int _buttonIndexBuilt = 0;
+static int _buttonIndexTotal = -1;
+
+
+static uint32_t uri_hash(const char *seg, int len, bool nocase)
+{
+  uint32_t hash = 2166136261u; // FNV-1a
+
+  for (int i=0; i < len; i++) {
+    hash ^= nocase ? (unsigned char)tolower((unsigned char)seg[i]) : (unsigned char)seg[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static void add_name_index(uint8_t *index, const uri_name *names, int num, bool nocase)
+{
+  uint32_t slot;
+
+  for (int i=0; i < num; i++) {
+    slot = uri_hash(names[i].name, strlen(names[i].name), nocase) & (NAME_INDEX_SIZE - 1);
+    while (index[slot] != 0)
+      slot = (slot + 1) & (NAME_INDEX_SIZE - 1);
+    index[slot] = i + 1;
+  }
+}
+
+static void build_name_indexes()
+{
+  add_name_index(_routeIndex, _routes, NUM_ROUTES, false);
+  add_name_index(_keywordIndex, _keywords, NUM_KEYWORDS, true);
+}
+
+static int find_name(const uint8_t *index, const uri_name *names, const char *seg, int len, bool nocase)
+{
+  uint32_t slot;
+  const char *name;
+
+  if (seg == NULL || len <= 0)
+    return 0;
+
+  pthread_once(&_nameIndexOnce, build_name_indexes);
+
+  slot = uri_hash(seg, len, nocase) & (NAME_INDEX_SIZE - 1);
+  while (index[slot] != 0) {
+    name = names[index[slot] - 1].name;
+    if (name[len] == '\0' && (nocase ? strncasecmp(seg, name, len) : strncmp(seg, name, len)) == 0)
+      return names[index[slot] - 1].id;
+    slot = (slot + 1) & (NAME_INDEX_SIZE - 1);
+  }
+
+  return 0;
+}
+
+// Length of segment up to the next '/' or end of the URI.
+int uri_segment_length(const char *seg, const char *end)
+{
+  const char *p = seg;
+
+  if (seg == NULL)
+    return 0;
+
+  while (p < end && *p != '/')
+    p++;
+
+  return p - seg;
+}
+
+uri_route uri_route_lookup(const char *seg, int len)
+{
+  return find_name(_routeIndex, _routes, seg, len, false);
+}
+
+uri_keyword uri_keyword_lookup(const char *seg, int len)
+{
+  return find_name(_keywordIndex, _keywords, seg, len, true);
+}
+
+
+static const char *button_string(aqkey *button, int match)
+{
+  switch (match) {
+    case URI_BTN_NAME:
+      return button->name;
+    case URI_BTN_LABEL:
+      return button->label;
+    case URI_BTN_ALTLABEL:
+      if (isVBUTTON_ALTLABEL(button->special_mask) && button->special_mask_ptr != NULL)
+        return ((altlabel_detail *)button->special_mask_ptr)->altlabel;
+    break;
+  }
+  return NULL;
+}
+
+static void add_button_index(int button, int match, const char *str)
+{
+  uint32_t slot;
+
+  if (str == NULL || *str == '\0')
+    return;
+
+  slot = uri_hash(str, strlen(str), false) & (BUTTON_INDEX_SIZE - 1);
+  while (_buttonIndex[slot].button != 0)
+    slot = (slot + 1) & (BUTTON_INDEX_SIZE - 1);
+
+  _buttonIndex[slot].button = button + 1;
+  _buttonIndex[slot].match = match;
+}
+
+static void build_button_index(struct aqualinkdata *aqdata)
+{
+  memset(_buttonIndex, 0, sizeof(_buttonIndex));
+
+  for (int i=0; i < aqdata->total_buttons; i++) {
+    add_button_index(i, URI_BTN_NAME, aqdata->aqbuttons[i].name);
+    add_button_index(i, URI_BTN_LABEL, aqdata->aqbuttons[i].label);
+    add_button_index(i, URI_BTN_ALTLABEL, button_string(&aqdata->aqbuttons[i], URI_BTN_ALTLABEL));
+  }
+
+  _buttonIndexBuilt = _buttonIndexVersion;
+  _buttonIndexTotal = aqdata->total_buttons;
+}
+
+static int find_button(struct aqualinkdata *aqdata, const char *seg, int len, int match)
+{
+  uint32_t slot = uri_hash(seg, len, false) & (BUTTON_INDEX_SIZE - 1);
+  const char *str;
+  int found = -1;
+  int i;
+
+  // Same string can be in here more than once (name on one button, label on another),
+  // so run the whole probe chain and keep the lowest index like the old loop did.
+  while (_buttonIndex[slot].button != 0) {
+    i = _buttonIndex[slot].button - 1;
+    if ( (_buttonIndex[slot].match & match) && (found < 0 || i < found) && i < aqdata->total_buttons ) {
+      str = button_string(&aqdata->aqbuttons[i], _buttonIndex[slot].match);
+      if (str != NULL && strncmp(seg, str, len) == 0 && str[len] == '\0')
+        found = i;
+    }
+    slot = (slot + 1) & (BUTTON_INDEX_SIZE - 1);
+  }
+
+  return found;
+}
+
+int uri_button_lookup(struct aqualinkdata *aqdata, const char *seg, int len, int match)
+{
+  int rtn;
+
+  if (seg == NULL || len <= 0)
+    return -1;
+
+  pthread_mutex_lock(&_buttonIndexMutex);
+
+  if (_buttonIndexBuilt != _buttonIndexVersion || _buttonIndexTotal != aqdata->total_buttons)
+    build_button_index(aqdata);
+
+  rtn = find_button(aqdata, seg, len, match);
+
+  pthread_mutex_unlock(&_buttonIndexMutex);
+
+  return rtn;
+}
+
+void invalidate_uri_button_index()
+{
+  pthread_mutex_lock(&_buttonIndexMutex);
+  _buttonIndexVersion++;
+  pthread_mutex_unlock(&_buttonIndexMutex);
+}
@@ -0,0 +1,91 @@
+
+#ifndef URI_ROUTES_H_
+#define URI_ROUTES_H_
+
+#include <stdbool.h>
+
+#include "aqualink.h"
+
+/*
+  Lookup tables for action_URI(), built once so a request doesn't walk a strncmp chain
+  and then every button for every MQTT / API / WS message.
+  Segments are the pieces of the URI between '/', they are not NUL terminated.
+*/
+
+// First segment.  Case sensitive, same as the old strncmp() chain.
+typedef enum uri_route {
+  URI_NONE = 0,
+  URI_DEVICES,
+  URI_STATUSDELTA,
+  URI_STATUS,
+  URI_HOMEBRIDGE,
+  URI_DYNAMICCONFIG,
+  URI_SCHEDULES,
+  URI_CONFIG,
+  URI_ACKLATENCY,
+  URI_WEBCACHE,
+  URI_METRICS,
+  URI_FLIGHTRECORDER,
+  URI_PROGRAMMER,
+  URI_SIMULATOR,
+  URI_SIMCMD,
+  URI_AQMANAGER,
+  URI_SETLOGLEVEL,
+  URI_ADDLOGMASK,
+  URI_REMOVELOGMASK,
+  URI_LOGFILE,
+  URI_RESTART,
+  URI_UPGRADE,
+  URI_INSTALLDEVRELEASE,
+  URI_SERIALLOGGER,
+  URI_DEBUG,
+  URI_SET_DATE_TIME,
+  URI_STARTUP_PROGRAM,
+  // Devices that have their own actions, anything else is looked up as a button.
+  URI_DEV_POOL_HTR,
+  URI_DEV_SPA_HTR,
+  URI_DEV_FREEZE,
+  URI_DEV_CHILLER,
+  URI_DEV_SWG,
+  URI_DEV_CHEM
+} uri_route;
+
+// Second & third segment.  Case insensitive, same as the old strncasecmp() checks.
+typedef enum uri_keyword {
+  UKW_NONE = 0,
+  UKW_SET,
+  UKW_SETPOINT,
+  UKW_INCREMENT,
+  UKW_PERCENT,
+  UKW_PERCENT_F,
+  UKW_BOOST,
+  UKW_COLOR,
+  UKW_PROGRAM,
+  UKW_BRIGHTNESS,
+  UKW_RPM,
+  UKW_GPM,
+  UKW_SPEED,
+  UKW_VSP,
+  UKW_TIMER,
+  UKW_ORP,
+  UKW_PH,
+  UKW_DOWNLOAD,
+  UKW_CANCEL
+} uri_keyword;
+
+// Which button strings a lookup should match.
+#define URI_BTN_NAME     (1 << 0)
+#define URI_BTN_LABEL    (1 << 1)
+#define URI_BTN_ALTLABEL (1 << 2)
+#define URI_BTN_ANY      (URI_BTN_NAME | URI_BTN_LABEL | URI_BTN_ALTLABEL)
+
+int uri_segment_length(const char *seg, const char *end);
+uri_route uri_route_lookup(const char *seg, int len);
+uri_keyword uri_keyword_lookup(const char *seg, int len);
+
+// Returns index into aqbuttons[] or -1.  Lowest index wins when names / labels clash.
+int uri_button_lookup(struct aqualinkdata *aqdata, const char *seg, int len, int match);
+// Call when buttons are added or a name / label / altlabel changes.
+void invalidate_uri_button_index();
+
+#endif // URI_ROUTES_H_
@@ -28,6 +28,9 @@
 #include <sys/stat.h>
 //#include <time.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
 #include <fcntl.h>
 
 #ifdef AD_DEBUG
@@ -370,14 +373,17 @@ const char *logmask2name(logmask_t from)
   }
 }
 
-void timestamp(char* time_string)
+static void format_timestamp(char* time_string, time_t when)
 {
-    time_t now;
-    struct tm *tmptr;
+    struct tm tmbuf;
+
+    localtime_r(&when, &tmbuf);
+    strftime(time_string, TIMESTAMP_LENGTH, "%b-%d-%y %H:%M:%S %p ", &tmbuf);
+}
 
-    time(&now);
-    tmptr = localtime(&now);
-    strftime(time_string, TIMESTAMP_LENGTH, "%b-%d-%y %H:%M:%S %p ", tmptr);
+void timestamp(char* time_string)
+{
+    format_timestamp(time_string, time(NULL));
 }
 
 //Move existing pointer
@@ -618,7 +624,10 @@ void LOG(const logmask_t from, const int msg_level, const char * format, ...)
 }
 
 
-void _LOG(logmask_t from, int msg_level, char *message, int message_buffer_size)
+static void log_to_file(const char *message, const struct timespec *when);
+
+// Does the actual output, from the log writer thread or the caller if that's not running.
+static void log_to_sinks(logmask_t from, int msg_level, char *message, int message_buffer_size, const struct timespec *when)
 {
   /*
    message should have the first LOG_OFFSET (20) characters as spaces, this allows us to add Type & From to message.
@@ -678,7 +687,7 @@ void _LOG(logmask_t from, int msg_level, char *message, int message_buffer_size)
       syslog (LOG_DEBUG, "%s", &message[9]);
     else
       syslog (msg_level, "%s", &message[9]);
-    closelog ();
+    //closelog (); // Keep the connection, we are the only thing writing to it.
     //return;
   }
   #endif //AQ_MANAGER
@@ -708,29 +717,7 @@ void _LOG(logmask_t from, int msg_level, char *message, int message_buffer_size)
     //printf ("*** Adding ERROR to buffer '%s' **** \n",_loq_display_message);
   }
 
-#ifndef AQ_MANAGER
-  if (_log2file == TRUE && _log_filename != NULL) {   
-    char time[TIMESTAMP_LENGTH];
-    int fp = open(_log_filename, O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
-    if (fp != -1) {
-      timestamp(time);
-      if ( write(fp, time, strlen(time) ) == -1 ||
-           write(fp, message, strlen(message) ) == -1 ) 
-      {
-        syslog(LOG_ERR, "Can't write to log file %s\n %s", _log_filename, message);
-        fprintf (stderr, "Can't write to log file %s\n %s", _log_filename, message);
-      }
-      //write(fp, time, strlen(time) );
-      //write(fp, message, strlen(message) );
-      close(fp);
-    } else {
-      if (_daemonise == TRUE)
-        syslog(LOG_ERR, "Can't open log file %s\n %s", _log_filename, message);
-      else
-        fprintf (stderr, "Can't open debug log %s\n %s", _log_filename, message);
-    }
-  }
-#endif //AQ_MANAGER
+  log_to_file(message, when);
 
   if (_daemonise == FALSE) {
     if (msg_level == LOG_ERR) {
@@ -750,6 +737,294 @@ void _LOG(logmask_t from, int msg_level, char *message, int message_buffer_size)
   }
 }
 
+#ifndef AQ_MANAGER
+// Log file is kept open rather than open / write / close on every message.
+static pthread_mutex_t _log_file_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int _log_fd = -1;
+static const char *_log_fd_name = NULL;
+
+static void log_to_file(const char *message, const struct timespec *when)
+{
+  char timestamp[TIMESTAMP_LENGTH];
+
+  pthread_mutex_lock(&_log_file_mutex);
+
+  if (_log2file == TRUE && _log_filename != NULL) {
+    if (_log_fd != -1 && _log_fd_name != _log_filename) {
+      close(_log_fd);
+      _log_fd = -1;
+    }
+    if (_log_fd == -1) {
+      _log_fd = open(_log_filename, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+      _log_fd_name = _log_filename;
+    }
+    if (_log_fd != -1) {
+      format_timestamp(timestamp, (when != NULL)?when->tv_sec:time(NULL));
+      if ( write(_log_fd, timestamp, strlen(timestamp) ) == -1 ||
+           write(_log_fd, message, strlen(message) ) == -1 ) 
+      {
+        syslog(LOG_ERR, "Can't write to log file %s\n %s", _log_filename, message);
+        fprintf (stderr, "Can't write to log file %s\n %s", _log_filename, message);
+      }
+    } else {
+      if (_daemonise == TRUE)
+        syslog(LOG_ERR, "Can't open log file %s\n %s", _log_filename, message);
+      else
+        fprintf (stderr, "Can't open debug log %s\n %s", _log_filename, message);
+    }
+  } else if (_log_fd != -1) {
+    // Inline debug stopped
+    close(_log_fd);
+    _log_fd = -1;
+  }
+
+  pthread_mutex_unlock(&_log_file_mutex);
+}
+#else
+static void log_to_file(const char *message, const struct timespec *when) {}
+#endif //AQ_MANAGER
+
+/*
+ * Async logging.
+ * LOG() is called from the RS485 thread, so it shouldn't be sitting in syslog / journal / file io while
+ * the panel waits for an ACK.  Once start_log_writer() is called messages go into a lock free multi
+ * producer ring (sequence number per slot) and the log writer thread does all the output.
+ * A producer never blocks and never takes a lock, worst case it's LOG_PUSH_TRIES goes at claiming slots,
+ * a memcpy, and a sem_post if the writer is asleep.  If the ring is full the message is dropped & counted.
+ * Until the writer starts (and in serial_logger etc that never start it) logging is synchronous.
+ */
+#define LOG_RING_SIZE 512   // Must be a power of 2
+#define LOG_SLOT_TEXT 256   // Longer messages (packet dumps) use consecutive slots
+#define LOG_PUSH_TRIES 16
+
+typedef struct log_slot {
+  atomic_uint seq;
+  logmask_t from;       // from, level, time, length & parts are only set in the first slot of a message
+  int level;
+  int length;
+  int parts;
+  struct timespec time;
+  char text[LOG_SLOT_TEXT];
+} log_slot;
+
+static log_slot _log_ring[LOG_RING_SIZE];
+static atomic_uint _log_ring_head = 0;   // Next position a producer claims
+static unsigned int _log_ring_tail = 0;  // Next position the writer reads, only the writer uses it
+static atomic_bool _log_writer_running = false;
+static atomic_bool _log_writer_sleeping = false;
+static atomic_ulong _log_queued = 0;
+static atomic_ulong _log_dropped = 0;
+static atomic_ulong _log_levels[LOG_DEBUG_SERIAL+1]; // Messages that passed the level check, LOG_ERR & above counted as LOG_ERR
+static volatile bool _log_writer_stop = false;
+static sem_t _log_writer_wake;
+static pthread_t _log_writer_thread;
+
+#define LOG_SLOT(pos) (&_log_ring[(pos) & (LOG_RING_SIZE - 1)])
+
+// Returns false if the writer isn't running and the caller should log itself.
+static bool log_ring_push(logmask_t from, int msg_level, const char *text)
+{
+  unsigned int pos;
+  int length, parts, i, tries;
+  struct timespec now;
+
+  if (!atomic_load_explicit(&_log_writer_running, memory_order_acquire))
+    return false;
+
+  length = strlen(text);
+  parts = AQ_MAX(1, (length + LOG_SLOT_TEXT - 1) / LOG_SLOT_TEXT);
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  pos = atomic_load_explicit(&_log_ring_head, memory_order_relaxed);
+  for (tries = 0; ; tries++) {
+    // Writer frees slots in order, so if the last one we need is free so are the others.
+    unsigned int seq = atomic_load_explicit(&LOG_SLOT(pos + parts - 1)->seq, memory_order_acquire);
+    int diff = (int)(seq - (pos + parts - 1));
+
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&_log_ring_head, &pos, pos + parts, memory_order_relaxed, memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      atomic_fetch_add_explicit(&_log_dropped, 1, memory_order_relaxed); // Full
+      return true;
+    } else {
+      pos = atomic_load_explicit(&_log_ring_head, memory_order_relaxed);
+    }
+
+    if (tries >= LOG_PUSH_TRIES) {
+      atomic_fetch_add_explicit(&_log_dropped, 1, memory_order_relaxed);
+      return true;
+    }
+  }
+
+  // Publish the first slot last, once the writer sees it all the parts are there.
+  for (i = parts - 1; i >= 0; i--) {
+    log_slot *slot = LOG_SLOT(pos + i);
+    int offset = i * LOG_SLOT_TEXT;
+
+    memcpy(slot->text, text + offset, AQ_MIN(LOG_SLOT_TEXT, length - offset));
+    if (i == 0) {
+      slot->from = from;
+      slot->level = msg_level;
+      slot->length = length;
+      slot->parts = parts;
+      slot->time = now;
+    }
+    atomic_store_explicit(&slot->seq, pos + i + 1, memory_order_release);
+  }
+
+  atomic_fetch_add_explicit(&_log_queued, 1, memory_order_relaxed);
+
+  if (atomic_exchange(&_log_writer_sleeping, false))
+    sem_post(&_log_writer_wake);
+
+  return true;
+}
+
+static bool log_ring_ready()
+{
+  return (atomic_load(&LOG_SLOT(_log_ring_tail)->seq) == _log_ring_tail + 1);
+}
+
+// Writer side, output the next message if there is one.
+static bool log_ring_pop()
+{
+  char message[LARGELOGBUFFER + LOG_OFFSET + 2];
+  log_slot *first = LOG_SLOT(_log_ring_tail);
+  int i, length, parts;
+
+  if (atomic_load_explicit(&first->seq, memory_order_acquire) != _log_ring_tail + 1)
+    return false;
+
+  parts = first->parts;
+  length = AQ_MIN(first->length, LARGELOGBUFFER);
+
+  memset(message, ' ', LOG_OFFSET);
+  for (i = 0; i < parts; i++) {
+    int offset = i * LOG_SLOT_TEXT;
+    if (offset < length)
+      memcpy(&message[LOG_OFFSET + offset], LOG_SLOT(_log_ring_tail + i)->text, AQ_MIN(LOG_SLOT_TEXT, length - offset));
+  }
+  message[LOG_OFFSET + length] = '\0';
+
+  log_to_sinks(first->from, first->level, message, sizeof(message), &first->time);
+
+  for (i = 0; i < parts; i++)
+    atomic_store_explicit(&LOG_SLOT(_log_ring_tail + i)->seq, _log_ring_tail + i + LOG_RING_SIZE, memory_order_release);
+  _log_ring_tail += parts;
+
+  return true;
+}
+
+static void log_report_dropped()
+{
+  static unsigned long reported = 0;
+  unsigned long dropped = atomic_load_explicit(&_log_dropped, memory_order_relaxed);
+  char message[LOGBUFFER];
+
+  if (dropped == reported)
+    return;
+
+  memset(message, ' ', LOG_OFFSET);
+  snprintf(&message[LOG_OFFSET], LOGBUFFER - LOG_OFFSET - 4, "Logging too fast, dropped %lu messages (%lu total)\n", dropped - reported, dropped);
+  log_to_sinks(AQUA_LOG, LOG_WARNING, message, LOGBUFFER, NULL);
+  reported = dropped;
+}
+
+void *log_writer(void *ptr)
+{
+  struct timespec timeout;
+
+  while (true) {
+    while (log_ring_pop()) {}
+
+    log_report_dropped();
+
+    if (_log_writer_stop)
+      break;
+
+    atomic_store(&_log_writer_sleeping, true);
+    if (log_ring_ready()) // Something arrived between the last pop & setting the flag.
+      continue;
+
+    // Timeout is just a safety net.
+    clock_gettime(CLOCK_REALTIME, &timeout);
+    timeout.tv_sec += 1;
+    sem_timedwait(&_log_writer_wake, &timeout);
+  }
+
+  return NULL;
+}
+
+void stop_log_writer()
+{
+  if (!atomic_exchange(&_log_writer_running, false))
+    return;
+
+  // Anything logged from here is synchronous, writer empties the ring before it exits.
+  _log_writer_stop = true;
+  sem_post(&_log_writer_wake);
+  pthread_join(_log_writer_thread, NULL);
+
+  // Anyone who was half way through a push when we stopped.
+  while (log_ring_pop()) {}
+}
+
+// Only call once daemonise() has forked.
+bool start_log_writer()
+{
+  static bool registered = false;
+  unsigned int i;
+
+  if (atomic_load(&_log_writer_running))
+    return true;
+
+  for (i = 0; i < LOG_RING_SIZE; i++)
+    atomic_store(&_log_ring[i].seq, i);
+  atomic_store(&_log_ring_head, 0);
+  _log_ring_tail = 0;
+  _log_writer_stop = false;
+
+  if (sem_init(&_log_writer_wake, 0, 0) != 0 ||
+      pthread_create(&_log_writer_thread, NULL, log_writer, NULL) != 0) {
+    LOG(AQUA_LOG, LOG_ERR, "Failed to start log writer thread, logging synchronously\n");
+    return false;
+  }
+  atomic_store(&_log_writer_running, true);
+
+  // Make sure whatever is queued gets written if we exit() from anywhere.
+  if (!registered) {
+    atexit(stop_log_writer);
+    registered = true;
+  }
+
+  return true;
+}
+
+void get_log_stats(unsigned long *queued, unsigned long *dropped)
+{
+  *queued = atomic_load_explicit(&_log_queued, memory_order_relaxed);
+  *dropped = atomic_load_explicit(&_log_dropped, memory_order_relaxed);
+}
+
+unsigned long get_log_level_count(int level)
+{
+  if (level < LOG_ERR || level > LOG_DEBUG_SERIAL)
+    return 0;
+
+  return atomic_load_explicit(&_log_levels[level], memory_order_relaxed);
+}
+
+void _LOG(logmask_t from, int msg_level, char *message, int message_buffer_size)
+{
+  atomic_fetch_add_explicit(&_log_levels[AQ_MAX(LOG_ERR, AQ_MIN(msg_level, LOG_DEBUG_SERIAL))], 1, memory_order_relaxed);
+
+  if (log_ring_push(from, msg_level, &message[LOG_OFFSET]))
+    return;
+
+  log_to_sinks(from, msg_level, message, message_buffer_size, NULL);
+}
+
 void daemonise (char *pidFile, void (*main_function) (void))
 {
   FILE *fp = NULL;
@@ -890,6 +1165,22 @@ void delay (unsigned int howLong) // Microseconds (1000000 = 1 second) milisecon
 
   nanosleep (&sleeper, &dummy) ;
 }
+
+/*
+ * time() for anything that runs from RS485 packets.  -replay sets its own source so those
+ * handlers see the trace's clock rather than how long the replay has been running.
+ */
+static time_t (*_aq_time_source)(time_t *) = time;
+
+time_t aq_time(time_t *tloc)
+{
+  return _aq_time_source(tloc);
+}
+
+void set_aq_time_source(time_t (*source)(time_t *))
+{
+  _aq_time_source = (source != NULL)?source:time;
+}
 /*
 // Same as above but can pass 0.5
 void ndelay (float howLong) // Microseconds (1000000 = 1 second) 
@@ -115,6 +115,12 @@ void LOG_LARGEMSG(const logmask_t from, const int msg_level, const char * buffer
 void LOGSystemError (int errnum, logmask_t from, const char *on_what);
 void displayLastSystemError (const char *on_what);
 
+// Move log output (journal / syslog / file) to a background thread, LOG() just queues.
+bool start_log_writer();
+void stop_log_writer();
+void get_log_stats(unsigned long *queued, unsigned long *dropped);
+unsigned long get_log_level_count(int level); // LOG_ERR to LOG_DEBUG_SERIAL
+
 int count_characters(const char *str, char character);
 //void readCfg (char *cfgFile);
 int text2elevel(char* level);
@@ -129,6 +135,8 @@ bool text2bool(char *str);
 bool request2bool(char *str);
 char *bool2text(bool val);
 void delay (unsigned int howLong);
+time_t aq_time(time_t *tloc);
+void set_aq_time_source(time_t (*source)(time_t *));
 //void ndelay (float howLong) 
 float degFtoC(float degF);
 float degCtoF(float degC);
@@ -0,0 +1,445 @@
+/*
+ * Copyright (c) 2017 Shaun Feakes - All rights reserved
+ *
+ * You may use redistribute and/or modify this code under the terms of
+ * the GNU General Public License version 2 as published by the
+ * Free Software Foundation. For the terms of this license,
+ * see <http://www.gnu.org/licenses/>.
+ *
+ * You are free to use this software under the terms of the GNU General
+ * Public License, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ *  https://github.com/sfeakes/aqualinkd
+ */
+
+/*
+  Files are kept in one array sorted by URI, so a lookup is a bsearch.  Reloading builds
+  a new array and swaps it in, both happen on the net thread so nothing is serving from
+  the old one while it's freed.
+
+  With watch enabled, inotify watches every directory we loaded.  web_cache_poll() is
+  called from the net loop, reads any events without blocking and reloads once things
+  have been quiet for WEB_CACHE_REBUILD_DELAY (editors and rsync make lots of events).
+*/
+
+#define _GNU_SOURCE 1 // for memmem
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#ifdef AQ_WEB_GZIP
+#include <zlib.h>
+#endif
+
+#include "aqualink.h"
+#include "net_services.h"
+#include "web_cache.h"
+
+typedef struct web_asset {
+  char *uri;             // ie /controller.html
+  const char *mime;
+  char *data;
+  size_t len;
+  char *gzdata;          // NULL if no gzip copy
+  size_t gzlen;
+  char etag[24];         // "0123456789abcdef"
+  char gzetag[24];       // "0123456789abcdef-gz", each encoding needs it's own strong ETag
+  bool revalidate;
+} web_asset;
+
+typedef struct web_assets {
+  web_asset *assets;
+  int num;
+  int size;
+  size_t bytes;
+} web_assets;
+
+static web_assets _cache = {NULL, 0, 0, 0};
+static web_cache_stats _stats;
+static char *_root_dir = NULL;
+static bool _watch = false;
+static int _inotify_fd = -1;
+static time_t _rebuild_at = 0;
+
+static const struct {
+  const char *ext;
+  const char *mime;
+  bool compress;
+} _mime_types[] = {
+  {"html", "text/html; charset=utf-8", true},
+  {"htm",  "text/html; charset=utf-8", true},
+  {"js",   "text/javascript; charset=utf-8", true},
+  {"css",  "text/css; charset=utf-8", true},
+  {"json", "application/json", true},
+  {"txt",  "text/plain; charset=utf-8", true},
+  {"svg",  "image/svg+xml", true},
+  {"webmanifest", "application/manifest+json", true},
+  {"png",  "image/png", false},
+  {"jpg",  "image/jpeg", false},
+  {"jpeg", "image/jpeg", false},
+  {"gif",  "image/gif", false},
+  {"ico",  "image/x-icon", false},
+  {"woff", "font/woff", false},
+  {"woff2","font/woff2", false},
+};
+
+static int mime_index(const char *path)
+{
+  const char *ext = strrchr(path, '.');
+  int i;
+
+  if (ext != NULL) {
+    for (i=0; i < sizeof(_mime_types)/sizeof(_mime_types[0]); i++) {
+      if (strcasecmp(ext + 1, _mime_types[i].ext) == 0)
+        return i;
+    }
+  }
+  return -1;
+}
+
+static bool has_suffix(const char *str, const char *suffix)
+{
+  size_t len = strlen(str);
+  size_t slen = strlen(suffix);
+
+  return (len >= slen && strcasecmp(str + len - slen, suffix) == 0);
+}
+
+static void make_etag(char *etag, size_t size, const char *data, size_t len, const char *suffix)
+{
+  uint64_t hash = 14695981039346656037ULL; // FNV-1a
+  size_t i;
+
+  for (i=0; i < len; i++) {
+    hash ^= (unsigned char)data[i];
+    hash *= 1099511628211ULL;
+  }
+  snprintf(etag, size, "\"%016llx%s\"", (unsigned long long)hash, suffix);
+}
+
+static char *read_file(const char *path, size_t len)
+{
+  FILE *fp;
+  char *data;
+
+  if ( (fp = fopen(path, "rb")) == NULL)
+    return NULL;
+
+  if ( (data = malloc(len > 0 ? len : 1)) != NULL && fread(data, 1, len, fp) != len) {
+    free(data);
+    data = NULL;
+  }
+  fclose(fp);
+
+  return data;
+}
+
+#ifdef AQ_WEB_GZIP
+static char *gzip_data(const char *data, size_t len, size_t *gzlen)
+{
+  z_stream zs;
+  char *out;
+  uLong size;
+
+  memset(&zs, 0, sizeof(zs));
+  // 15+16 is a gzip wrapper rather than zlib, which is what browsers want.
+  if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return NULL;
+
+  size = deflateBound(&zs, len) + 18;
+  if ( (out = malloc(size)) == NULL) {
+    deflateEnd(&zs);
+    return NULL;
+  }
+
+  zs.next_in = (Bytef *)data;
+  zs.avail_in = len;
+  zs.next_out = (Bytef *)out;
+  zs.avail_out = size;
+  if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+    deflateEnd(&zs);
+    free(out);
+    return NULL;
+  }
+  *gzlen = zs.total_out;
+  deflateEnd(&zs);
+
+  return out;
+}
+#endif
+
+// Use file.gz if it's there and not older than file (config.js gets edited by hand).
+static void load_gzip(web_asset *asset, const char *path, const struct stat *st, bool compress)
+{
+  char gzpath[PATH_MAX];
+  struct stat gzst;
+
+  snprintf(gzpath, sizeof(gzpath), "%s.gz", path);
+  if (stat(gzpath, &gzst) == 0 && S_ISREG(gzst.st_mode) && gzst.st_mtime >= st->st_mtime && gzst.st_size <= WEB_CACHE_MAX_FILE) {
+    if ( (asset->gzdata = read_file(gzpath, gzst.st_size)) != NULL)
+      asset->gzlen = gzst.st_size;
+  }
+
+#ifdef AQ_WEB_GZIP
+  // Not worth it unless it saves a good chunk.
+  if (asset->gzdata == NULL && compress && asset->len > 256) {
+    if ( (asset->gzdata = gzip_data(asset->data, asset->len, &asset->gzlen)) != NULL && asset->gzlen > asset->len * 9 / 10) {
+      free(asset->gzdata);
+      asset->gzdata = NULL;
+    }
+  }
+#endif
+
+  if (asset->gzdata != NULL)
+    make_etag(asset->gzetag, sizeof(asset->gzetag), asset->gzdata, asset->gzlen, "-gz");
+  else
+    asset->gzlen = 0;
+}
+
+static bool add_asset(web_assets *cache, const char *path, const char *uri, const struct stat *st)
+{
+  web_asset *asset;
+  web_asset *grow;
+  int mime = mime_index(path);
+
+  if (st->st_size > WEB_CACHE_MAX_FILE || cache->bytes + st->st_size > WEB_CACHE_MAX_TOTAL) {
+    LOG(NET_LOG,LOG_DEBUG, "Web cache not caching %s, %ld bytes is too big\n", uri, (long)st->st_size);
+    return false;
+  }
+
+  if (cache->num >= cache->size) {
+    if ( (grow = realloc(cache->assets, (cache->size + 32) * sizeof(web_asset))) == NULL)
+      return false;
+    cache->assets = grow;
+    cache->size += 32;
+  }
+
+  asset = &cache->assets[cache->num];
+  memset(asset, 0, sizeof(web_asset));
+  if ( (asset->data = read_file(path, st->st_size)) == NULL) {
+    LOG(NET_LOG,LOG_WARNING, "Web cache couldn't read %s\n", path);
+    return false;
+  }
+  asset->len = st->st_size;
+  asset->uri = strdup(uri);
+  asset->mime = (mime >= 0) ? _mime_types[mime].mime : "text/plain; charset=utf-8";
+  // Scripts change between versions, so make the browser check them each time (a 304 is cheap).
+  asset->revalidate = has_suffix(path, ".js");
+  make_etag(asset->etag, sizeof(asset->etag), asset->data, asset->len, "");
+  load_gzip(asset, path, st, (mime >= 0 && _mime_types[mime].compress));
+
+  cache->bytes += asset->len + asset->gzlen;
+  cache->num++;
+
+  return true;
+}
+
+static void load_dir(web_assets *cache, const char *dir, const char *uri)
+{
+  DIR *dp;
+  struct dirent *entry;
+  struct stat st;
+  char path[PATH_MAX];
+  char euri[PATH_MAX];
+
+  if ( (dp = opendir(dir)) == NULL) {
+    LOG(NET_LOG,LOG_WARNING, "Web cache couldn't open %s\n", dir);
+    return;
+  }
+
+  if (_inotify_fd >= 0 && inotify_add_watch(_inotify_fd, dir, IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO) < 0)
+    LOG(NET_LOG,LOG_WARNING, "Web cache couldn't watch %s for changes\n", dir);
+
+  while ( (entry = readdir(dp)) != NULL) {
+    if (entry->d_name[0] == '.')
+      continue;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+    snprintf(euri, sizeof(euri), "%s/%s", uri, entry->d_name);
+    if (stat(path, &st) != 0)
+      continue;
+
+    if (S_ISDIR(st.st_mode)) {
+      load_dir(cache, path, euri);
+    } else if (S_ISREG(st.st_mode) && !has_suffix(entry->d_name, ".gz")) {
+      add_asset(cache, path, euri, &st);
+    }
+  }
+
+  closedir(dp);
+}
+
+static int asset_cmp(const void *a, const void *b)
+{
+  return strcmp(((const web_asset *)a)->uri, ((const web_asset *)b)->uri);
+}
+
+static void free_assets(web_assets *cache)
+{
+  int i;
+
+  for (i=0; i < cache->num; i++) {
+    free(cache->assets[i].uri);
+    free(cache->assets[i].data);
+    free(cache->assets[i].gzdata);
+  }
+  free(cache->assets);
+  memset(cache, 0, sizeof(web_assets));
+}
+
+static void load_web_cache()
+{
+  web_assets cache = {NULL, 0, 0, 0};
+  char root[PATH_MAX];
+  size_t len;
+  int i, gz = 0;
+
+  if (_inotify_fd >= 0)
+    close(_inotify_fd);
+  _inotify_fd = _watch ? inotify_init1(IN_NONBLOCK | IN_CLOEXEC) : -1;
+  if (_watch && _inotify_fd < 0)
+    LOG(NET_LOG,LOG_WARNING, "Web cache couldn't start inotify, changes to %s will need a restart\n", _root_dir);
+
+  // web_directory usually has a trailing /
+  snprintf(root, sizeof(root), "%s", _root_dir);
+  for (len = strlen(root); len > 1 && root[len-1] == '/'; len--)
+    root[len-1] = '\0';
+
+  load_dir(&cache, root, "");
+  qsort(cache.assets, cache.num, sizeof(web_asset), asset_cmp);
+
+  free_assets(&_cache);
+  _cache = cache;
+
+  for (i=0; i < _cache.num; i++) {
+    if (_cache.assets[i].gzdata != NULL)
+      gz++;
+  }
+  _stats.files = _cache.num;
+  _stats.bytes = _cache.bytes;
+
+  LOG(NET_LOG,LOG_NOTICE, "Web cache loaded %d files (%d with gzip) from %s, %lu bytes\n", _cache.num, gz, root, (unsigned long)_cache.bytes);
+}
+
+bool start_web_cache(const char *root_dir, bool watch)
+{
+  if (root_dir == NULL)
+    return false;
+
+  free(_root_dir);
+  _root_dir = strdup(root_dir);
+  _watch = watch;
+  _rebuild_at = 0;
+  load_web_cache();
+
+  return true;
+}
+
+void stop_web_cache()
+{
+  if (_inotify_fd >= 0)
+    close(_inotify_fd);
+  _inotify_fd = -1;
+  free_assets(&_cache);
+  free(_root_dir);
+  _root_dir = NULL;
+}
+
+void web_cache_poll()
+{
+  char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  time_t now;
+  bool changed = false;
+
+  if (_inotify_fd < 0)
+    return;
+
+  // Don't care what changed, just that something did.
+  while (read(_inotify_fd, buf, sizeof(buf)) > 0)
+    changed = true;
+
+  now = time(NULL);
+  if (changed) {
+    _rebuild_at = now + WEB_CACHE_REBUILD_DELAY;
+  } else if (_rebuild_at != 0 && now >= _rebuild_at) {
+    _rebuild_at = 0;
+    _stats.rebuilds++;
+    LOG(NET_LOG,LOG_INFO, "Web directory changed, reloading web cache\n");
+    load_web_cache();
+  }
+}
+
+static bool header_has(struct mg_str *header, const char *value)
+{
+  return (header != NULL && memmem(header->buf, header->len, value, strlen(value)) != NULL);
+}
+
+bool web_cache_serve(struct mg_connection *nc, struct mg_http_message *http_msg)
+{
+  char uri[PATH_MAX];
+  web_asset key;
+  web_asset *asset;
+  const char *etag;
+  const char *data;
+  size_t len;
+  int ulen;
+  bool gzip;
+  bool head = (mg_strcmp(http_msg->method, mg_str("HEAD")) == 0);
+
+  if (_cache.num == 0 || (!head && mg_strcmp(http_msg->method, mg_str("GET")) != 0))
+    return false;
+
+  if ( (ulen = mg_url_decode(http_msg->uri.buf, http_msg->uri.len, uri, sizeof(uri) - 11, 0)) <= 0 || strstr(uri, "..") != NULL)
+    return false;
+
+  // Same as serving the directory, / is index.html
+  if (uri[ulen-1] == '/')
+    strcpy(&uri[ulen], "index.html");
+
+  key.uri = uri;
+  if ( (asset = bsearch(&key, _cache.assets, _cache.num, sizeof(web_asset), asset_cmp)) == NULL) {
+    _stats.misses++;
+    return false;
+  }
+  _stats.hits++;
+
+  gzip = (asset->gzdata != NULL && header_has(mg_http_get_header(http_msg, "Accept-Encoding"), "gzip"));
+  etag = gzip ? asset->gzetag : asset->etag;
+
+  if (header_has(mg_http_get_header(http_msg, "If-None-Match"), etag)) {
+    _stats.not_modified++;
+    mg_printf(nc, "HTTP/1.1 304 Not Modified\r\n%sETag: %s\r\n%sContent-Length: 0\r\n\r\n",
+                  (asset->revalidate?REVALIDATE:CACHE), etag, (asset->gzdata != NULL?"Vary: Accept-Encoding\r\n":""));
+    return true;
+  }
+
+  data = gzip ? asset->gzdata : asset->data;
+  len = gzip ? asset->gzlen : asset->len;
+  if (gzip)
+    _stats.gzip++;
+
+  mg_printf(nc, "HTTP/1.1 200 OK\r\nContent-Type: %s\r\n%sETag: %s\r\n%s%sContent-Length: %lu\r\n\r\n",
+                asset->mime, (asset->revalidate?REVALIDATE:CACHE), etag,
+                (asset->gzdata != NULL?"Vary: Accept-Encoding\r\n":""),
+                (gzip?"Content-Encoding: gzip\r\n":""),
+                (unsigned long)len);
+  if (!head)
+    mg_send(nc, data, len);
+
+  return true;
+}
+
+void get_web_cache_stats(web_cache_stats *stats)
+{
+  *stats = _stats;
+}
@@ -0,0 +1,36 @@
+#ifndef WEB_CACHE_H_
+#define WEB_CACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mongoose.h"
+
+/*
+  web_directory loaded into memory at startup so the UI isn't read off the SD card for
+  every request.  Each file keeps a gzip'd copy (file.gz next to it, or compressed here
+  when built with AQ_WEB_GZIP) and a strong ETag.  Everything is used from the net thread
+  only, so no locking.  Anything not in the cache is a miss and gets served from disk.
+*/
+
+#define WEB_CACHE_MAX_FILE   (2 * 1024 * 1024)
+#define WEB_CACHE_MAX_TOTAL  (16 * 1024 * 1024)
+#define WEB_CACHE_REBUILD_DELAY 2 // seconds after the last change before we reload
+
+typedef struct web_cache_stats {
+  uint32_t files;
+  uint64_t bytes;          // Plain + gzip copies
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t not_modified;   // 304 replies
+  uint64_t gzip;           // Replies sent compressed
+  uint32_t rebuilds;
+} web_cache_stats;
+
+bool start_web_cache(const char *root_dir, bool watch);
+void stop_web_cache();
+bool web_cache_serve(struct mg_connection *nc, struct mg_http_message *http_msg);
+void web_cache_poll();
+void get_web_cache_stats(web_cache_stats *stats);
+
+#endif // WEB_CACHE_H_